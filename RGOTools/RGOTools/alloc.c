@@ -0,0 +1,432 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  alloc.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "thread.h"
+#include "alloc.h"
+
+#define ALLOCATION_NUM_BUCKETS 4096
+#define TRACKED_IMAGE_NUM_BUCKETS 1024
+
+typedef struct TrackedImage
+{
+	struct TrackedImage* next;
+	char* name;
+	MemoryUsage usage;
+} TrackedImage;
+
+typedef struct TrackedAllocation
+{
+	struct TrackedAllocation* next;
+	void* data;
+	size_t size;
+	MemoryStage stage;
+	TrackedImage* image; /* NULL if the thread that made it wasn't working on an image */
+} TrackedAllocation;
+
+/* The image a thread is working on. The session tells whether it's from an earlier run that's since been freed. */
+typedef struct
+{
+	u32 session;
+	TrackedImage* image;
+} TrackingThreadState;
+
+static const char* memoryStageNames[NUM_MEMORY_STAGES] =
+{
+	"load",
+	"decompress",
+	"untile",
+	"expand",
+	"encode"
+};
+
+static OnceFlag trackingOnce = ONCE_FLAG_STATIC_INIT;
+static bool32 trackingInitialized = FALSE;
+static ThreadLocal trackingThreadKey;
+static Mutex trackingMutex;
+static volatile bool32 tracking = FALSE;
+static u32 trackingSession = 0;
+static TrackedAllocation* allocationBuckets[ALLOCATION_NUM_BUCKETS] = { 0 };
+static TrackedImage* imageBuckets[TRACKED_IMAGE_NUM_BUCKETS] = { 0 };
+static u32 nTrackedImages = 0;
+static MemoryUsage totalUsage = { 0 };
+static MemoryUsage stageUsage[NUM_MEMORY_STAGES] = { { 0 } };
+
+static void InitMemoryTracking(void);
+static void THREAD_EXIT_CALLBACK FreeTrackingThreadState(void* value);
+static TrackedImage* FindTrackedImage(const char* name);
+static TrackedImage* GetThreadTrackedImage(void);
+static void AddAllocation(void* data, size_t size, MemoryStage stage, TrackedImage* image);
+static TrackedAllocation* RemoveAllocation(size_t address);
+static void AddUsage(MemoryUsage* usage, size_t size);
+static void PrintMemoryReport(u32 nWorstImages);
+static int CompareTrackedImagePeaks(const void* a, const void* b);
+
+static void InitMemoryTracking(void)
+{
+	InitMutex(&trackingMutex);
+	trackingInitialized = CreateThreadLocal(&trackingThreadKey, FreeTrackingThreadState);
+}
+
+static void THREAD_EXIT_CALLBACK FreeTrackingThreadState(void* value)
+{
+	free(value);
+}
+
+/* Must be called before starting the threads whose allocations are to be tracked */
+bool32 StartMemoryTracking(void)
+{
+	RunOnce(&trackingOnce, InitMemoryTracking);
+	if (!trackingInitialized || tracking)
+	{
+		return FALSE;
+	}
+	LockMutex(&trackingMutex);
+	++trackingSession;
+	memset(&totalUsage, 0, sizeof(totalUsage));
+	memset(stageUsage, 0, sizeof(stageUsage));
+	tracking = TRUE;
+	UnlockMutex(&trackingMutex);
+	return TRUE;
+}
+
+/* Counts whatever this thread allocates from now on towards the image with this name.
+ * Any thread can free the buffers, and they still come off the right image. NULL stops
+ * counting this thread's allocations towards any image. */
+void SetTrackedImage(const char* name)
+{
+	TrackingThreadState* state = NULL;
+
+	if (!tracking)
+	{
+		return;
+	}
+	state = GetThreadLocal(trackingThreadKey);
+	if (!state)
+	{
+		state = calloc(1, sizeof(TrackingThreadState));
+		if (!state)
+		{
+			return;
+		}
+		SetThreadLocal(trackingThreadKey, state);
+	}
+	LockMutex(&trackingMutex);
+	state->session = trackingSession;
+	state->image = name ? FindTrackedImage(name) : NULL;
+	UnlockMutex(&trackingMutex);
+}
+
+/* Adds the image if it isn't there yet. Must be called with the mutex locked. */
+static TrackedImage* FindTrackedImage(const char* name)
+{
+	TrackedImage* image = NULL;
+	const char* c = NULL;
+	u32 hash = 0;
+
+	for (c = name; *c; ++c)
+	{
+		hash = hash * 31 + (u8)*c;
+	}
+	hash %= TRACKED_IMAGE_NUM_BUCKETS;
+	for (image = imageBuckets[hash]; image; image = image->next)
+	{
+		if (strcmp(image->name, name) == 0)
+		{
+			return image;
+		}
+	}
+	image = calloc(1, sizeof(TrackedImage));
+	if (!image)
+	{
+		return NULL;
+	}
+	image->name = malloc(strlen(name) + 1);
+	if (!image->name)
+	{
+		free(image);
+		return NULL;
+	}
+	strcpy(image->name, name);
+	image->next = imageBuckets[hash];
+	imageBuckets[hash] = image;
+	++nTrackedImages;
+	return image;
+}
+
+/* Must be called with the mutex locked */
+static TrackedImage* GetThreadTrackedImage(void)
+{
+	TrackingThreadState* state = NULL;
+
+	state = GetThreadLocal(trackingThreadKey);
+	if (!state || state->session != trackingSession)
+	{
+		return NULL;
+	}
+	return state->image;
+}
+
+void* TrackedMalloc(size_t size, MemoryStage stage)
+{
+	void* data = NULL;
+
+	data = malloc(size);
+	if (data && tracking)
+	{
+		TrackAllocation(data, size, stage);
+	}
+	return data;
+}
+
+/* The buffer keeps counting towards the image it was first allocated for */
+void* TrackedRealloc(void* data, size_t size, MemoryStage stage)
+{
+	TrackedAllocation* allocation = NULL;
+	TrackedImage* image = NULL;
+	void* newData = NULL;
+
+	if (!tracking)
+	{
+		return realloc(data, size);
+	}
+	/* Once realloc frees the old buffer, another thread can get the same address and track it,
+	 * so the old entry has to be gone before then */
+	LockMutex(&trackingMutex);
+	allocation = data ? RemoveAllocation((size_t)data) : NULL;
+	UnlockMutex(&trackingMutex);
+	newData = realloc(data, size);
+	LockMutex(&trackingMutex);
+	if (!newData)
+	{
+		if (allocation)
+		{
+			AddAllocation(data, allocation->size, allocation->stage, allocation->image);
+		}
+	}
+	else
+	{
+		image = allocation ? allocation->image : GetThreadTrackedImage();
+		AddAllocation(newData, size, stage, image);
+	}
+	UnlockMutex(&trackingMutex);
+	free(allocation);
+	return newData;
+}
+
+/* Starts counting a buffer that was allocated some other way, like by LoadFile */
+void TrackAllocation(void* data, size_t size, MemoryStage stage)
+{
+	if (!data || !tracking)
+	{
+		return;
+	}
+	LockMutex(&trackingMutex);
+	AddAllocation(data, size, stage, GetThreadTrackedImage());
+	UnlockMutex(&trackingMutex);
+}
+
+void TrackedFree(void* data)
+{
+	if (data && tracking)
+	{
+		LockMutex(&trackingMutex);
+		free(RemoveAllocation((size_t)data));
+		UnlockMutex(&trackingMutex);
+	}
+	free(data);
+}
+
+/* If there's no memory to remember the allocation, it just isn't counted */
+static void AddAllocation(void* data, size_t size, MemoryStage stage, TrackedImage* image)
+{
+	TrackedAllocation* allocation = NULL;
+	u32 bucket = 0;
+
+	allocation = malloc(sizeof(TrackedAllocation));
+	if (!allocation)
+	{
+		return;
+	}
+	bucket = (u32)(((size_t)data >> 4) % ALLOCATION_NUM_BUCKETS);
+	allocation->data = data;
+	allocation->size = size;
+	allocation->stage = stage;
+	allocation->image = image;
+	allocation->next = allocationBuckets[bucket];
+	allocationBuckets[bucket] = allocation;
+
+	AddUsage(&totalUsage, size);
+	AddUsage(&stageUsage[stage], size);
+	if (image)
+	{
+		AddUsage(&image->usage, size);
+	}
+}
+
+/* Takes the allocation out of the counts and returns it to be freed, or NULL if it wasn't tracked */
+static TrackedAllocation* RemoveAllocation(size_t address)
+{
+	TrackedAllocation** link = NULL;
+	TrackedAllocation* allocation = NULL;
+
+	link = &allocationBuckets[(address >> 4) % ALLOCATION_NUM_BUCKETS];
+	for (; *link && (size_t)(*link)->data != address; link = &(*link)->next);
+	allocation = *link;
+	if (!allocation)
+	{
+		return NULL;
+	}
+	*link = allocation->next;
+	totalUsage.liveBytes -= allocation->size;
+	stageUsage[allocation->stage].liveBytes -= allocation->size;
+	if (allocation->image)
+	{
+		allocation->image->usage.liveBytes -= allocation->size;
+	}
+	return allocation;
+}
+
+static void AddUsage(MemoryUsage* usage, size_t size)
+{
+	usage->liveBytes += size;
+	if (usage->liveBytes > usage->peakBytes)
+	{
+		usage->peakBytes = usage->liveBytes;
+	}
+	++usage->nAllocations;
+}
+
+MemoryUsage GetTrackedMemoryUsage(void)
+{
+	MemoryUsage ret = { 0 };
+
+	if (!trackingInitialized)
+	{
+		return ret;
+	}
+	LockMutex(&trackingMutex);
+	ret = totalUsage;
+	UnlockMutex(&trackingMutex);
+	return ret;
+}
+
+/* Prints the peaks for the whole run, each stage and the nWorstImages images with the highest peaks,
+ * then forgets everything. Every tracked thread must have finished its work. */
+MemoryUsage StopMemoryTracking(u32 nWorstImages)
+{
+	MemoryUsage ret = { 0 };
+	TrackedAllocation* allocation = NULL;
+	TrackedAllocation* nextAllocation = NULL;
+	TrackedImage* image = NULL;
+	TrackedImage* nextImage = NULL;
+	u32 i = 0;
+
+	if (!tracking)
+	{
+		return ret;
+	}
+	tracking = FALSE;
+	LockMutex(&trackingMutex);
+	ret = totalUsage;
+	PrintMemoryReport(nWorstImages);
+	for (i = 0; i < ALLOCATION_NUM_BUCKETS; ++i)
+	{
+		for (allocation = allocationBuckets[i]; allocation; allocation = nextAllocation)
+		{
+			nextAllocation = allocation->next;
+			free(allocation);
+		}
+		allocationBuckets[i] = NULL;
+	}
+	for (i = 0; i < TRACKED_IMAGE_NUM_BUCKETS; ++i)
+	{
+		for (image = imageBuckets[i]; image; image = nextImage)
+		{
+			nextImage = image->next;
+			free(image->name);
+			free(image);
+		}
+		imageBuckets[i] = NULL;
+	}
+	nTrackedImages = 0;
+	UnlockMutex(&trackingMutex);
+	return ret;
+}
+
+/* Must be called with the mutex locked */
+static void PrintMemoryReport(u32 nWorstImages)
+{
+	TrackedImage** images = NULL;
+	TrackedImage* image = NULL;
+	u32 nImages = 0;
+	u32 i = 0;
+
+	printf("Peak tracked memory: %.2f MB over %llu allocations\n", totalUsage.peakBytes / (1024.0 * 1024.0), totalUsage.nAllocations);
+	for (i = 0; i < NUM_MEMORY_STAGES; ++i)
+	{
+		printf("  %-10s peak %.2f MB over %llu allocations\n", memoryStageNames[i],
+			stageUsage[i].peakBytes / (1024.0 * 1024.0), stageUsage[i].nAllocations);
+	}
+	if (totalUsage.liveBytes > 0)
+	{
+		printf("  %.2f MB was never freed through TrackedFree\n", totalUsage.liveBytes / (1024.0 * 1024.0));
+	}
+
+	if (nWorstImages == 0 || nTrackedImages == 0)
+	{
+		return;
+	}
+	images = malloc(sizeof(TrackedImage*) * nTrackedImages);
+	if (!images)
+	{
+		return;
+	}
+	for (i = 0; i < TRACKED_IMAGE_NUM_BUCKETS; ++i)
+	{
+		for (image = imageBuckets[i]; image; image = image->next)
+		{
+			images[nImages++] = image;
+		}
+	}
+	qsort(images, nImages, sizeof(TrackedImage*), CompareTrackedImagePeaks);
+	printf("Highest peaks:\n");
+	for (i = 0; i < nImages && i < nWorstImages; ++i)
+	{
+		printf("  %.2f MB %s\n", images[i]->usage.peakBytes / (1024.0 * 1024.0), images[i]->name);
+	}
+	free(images);
+}
+
+static int CompareTrackedImagePeaks(const void* a, const void* b)
+{
+	const TrackedImage* imageA = NULL;
+	const TrackedImage* imageB = NULL;
+
+	imageA = *(const TrackedImage* const*)a;
+	imageB = *(const TrackedImage* const*)b;
+	if (imageA->usage.peakBytes != imageB->usage.peakBytes)
+	{
+		return imageA->usage.peakBytes > imageB->usage.peakBytes ? -1 : 1;
+	}
+	return strcmp(imageA->name, imageB->name);
+}
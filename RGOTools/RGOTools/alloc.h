@@ -0,0 +1,58 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  alloc.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include "util.h"
+
+/* Keeps count of how many bytes the big per-image buffers take up, both in total and for
+ * each stage and image, along with the most that was ever live at once. Buffers are
+ * allocated and freed through the Tracked functions, which are plain malloc and free
+ * while tracking is stopped. A buffer allocated while tracking has to be freed with
+ * TrackedFree, or it's counted as live for the rest of the run. */
+
+typedef enum
+{
+	MEMORY_STAGE_LOAD,       /* The whole container file */
+	MEMORY_STAGE_DECOMPRESS, /* Decompressed subfiles, and decoded pixels cut out of them */
+	MEMORY_STAGE_UNTILE,     /* PSP pixels in linear order */
+	MEMORY_STAGE_EXPAND,     /* Pixels expanded to RGBA for encoding */
+	MEMORY_STAGE_ENCODE,     /* Encoded PNGs */
+	NUM_MEMORY_STAGES
+} MemoryStage;
+
+typedef struct
+{
+	u64 liveBytes;
+	u64 peakBytes;
+	u64 nAllocations;
+} MemoryUsage;
+
+bool32 StartMemoryTracking(void);
+void SetTrackedImage(const char* name);
+void* TrackedMalloc(size_t size, MemoryStage stage);
+void* TrackedRealloc(void* data, size_t size, MemoryStage stage);
+void TrackAllocation(void* data, size_t size, MemoryStage stage);
+void TrackedFree(void* data);
+MemoryUsage GetTrackedMemoryUsage(void);
+MemoryUsage StopMemoryTracking(u32 nWorstImages);
+
+#endif
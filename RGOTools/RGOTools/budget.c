@@ -0,0 +1,149 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  budget.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "util.h"
+#include "image.h"
+#include "thread.h"
+#include "budget.h"
+
+struct MemoryBudget
+{
+	Mutex mutex;
+	Condition released;
+	u64 reservedBytes;
+	MemoryBudgetStats stats;
+};
+
+MemoryBudget* CreateMemoryBudget(u64 budgetBytes)
+{
+	MemoryBudget* budget = NULL;
+
+	budget = calloc(1, sizeof(MemoryBudget));
+	if (!budget)
+	{
+		return NULL;
+	}
+	budget->stats.budgetBytes = budgetBytes;
+	InitMutex(&budget->mutex);
+	InitCondition(&budget->released);
+	return budget;
+}
+
+/* An upper bound on the memory extracting an image takes at any one time, worked out from the
+ * header alone so that it's known before anything is decoded. Decoding a PSP image has the tiled
+ * and untiled pixels around at once. Encoding a PNG has the pixels, their RGBA expansion and the
+ * encoded PNG, which can't come out much bigger than the RGBA, and the maximum profile keeps the
+ * smallest PNG so far alongside the one being encoded. The loaded file isn't counted, since it's
+ * shared by every image in it and only one file is loaded at a time. */
+u64 EstimateImagePeakMemory(const u8* header, Platform platform, Palette palette, OutputSettings output)
+{
+	u64 pixelsSize = 0;
+	u64 rgbaSize = 0;
+	u64 decodePeak = 0;
+	u64 writePeak = 0;
+
+	pixelsSize = GetDecompressedImageSize(header);
+	rgbaSize = palette.nColors != 256 ? pixelsSize * 8 : pixelsSize * 4;
+	decodePeak = platform == PLATFORM_PSP ? pixelsSize * 2 : pixelsSize;
+
+	switch (output.format)
+	{
+	case OUTPUT_FORMAT_RAW:
+		writePeak = pixelsSize;
+		break;
+	case OUTPUT_FORMAT_THUMBNAIL:
+		/* The thumbnail is built a row at a time, so only its own RGBA and PNG add up to much */
+		writePeak = pixelsSize + (u64)output.thumbnailSize * output.thumbnailSize * 4 * 2;
+		break;
+	default:
+		writePeak = pixelsSize + rgbaSize * (output.encodeProfile == PNG_ENCODE_PROFILE_MAXIMUM ? 3 : 2);
+		break;
+	}
+	return decodePeak > writePeak ? decodePeak : writePeak;
+}
+
+/* Waits until bytes fit under the budget alongside everything already reserved. bytesHeldByCaller
+ * is how much of what's already reserved the caller is holding on to while it waits. If nothing
+ * else is reserved, the reservation goes ahead even over budget, since waiting would never end.
+ * Does nothing if budget is NULL. */
+void ReserveMemory(MemoryBudget* budget, u64 bytes, u64 bytesHeldByCaller)
+{
+	double waitStart = 0.0;
+
+	if (!budget)
+	{
+		return;
+	}
+	LockMutex(&budget->mutex);
+	if (budget->reservedBytes > bytesHeldByCaller && budget->reservedBytes + bytes > budget->stats.budgetBytes)
+	{
+		++budget->stats.nWaits;
+		waitStart = GetTimeInSeconds();
+		while (budget->reservedBytes > bytesHeldByCaller && budget->reservedBytes + bytes > budget->stats.budgetBytes)
+		{
+			WaitCondition(&budget->released, &budget->mutex);
+		}
+		budget->stats.waitSeconds += GetTimeInSeconds() - waitStart;
+	}
+	if (budget->reservedBytes + bytes > budget->stats.budgetBytes)
+	{
+		++budget->stats.nOverBudget;
+	}
+	budget->reservedBytes += bytes;
+	++budget->stats.nReservations;
+	if (budget->reservedBytes > budget->stats.peakReservedBytes)
+	{
+		budget->stats.peakReservedBytes = budget->reservedBytes;
+	}
+	UnlockMutex(&budget->mutex);
+}
+
+/* Does nothing if budget is NULL */
+void ReleaseMemory(MemoryBudget* budget, u64 bytes)
+{
+	if (!budget || bytes == 0)
+	{
+		return;
+	}
+	LockMutex(&budget->mutex);
+	budget->reservedBytes -= bytes;
+	BroadcastCondition(&budget->released);
+	UnlockMutex(&budget->mutex);
+}
+
+/* Everything reserved should have been released by now */
+MemoryBudgetStats DestroyMemoryBudget(MemoryBudget* budget)
+{
+	MemoryBudgetStats ret = { 0 };
+
+	ret = budget->stats;
+	ret.reservedBytes = budget->reservedBytes;
+	DestroyCondition(&budget->released);
+	DestroyMutex(&budget->mutex);
+	free(budget);
+	return ret;
+}
+
+void PrintMemoryBudgetStats(MemoryBudgetStats stats)
+{
+	printf("Memory budget: %.1f MiB. Peak reserved: %.1f MiB\n", stats.budgetBytes / (1024.0 * 1024.0), stats.peakReservedBytes / (1024.0 * 1024.0));
+	printf("Reservations: %u. Waited: %u (%.3fs). Over budget: %u\n", stats.nReservations, stats.nWaits, stats.waitSeconds, stats.nOverBudget);
+}
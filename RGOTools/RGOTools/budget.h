@@ -0,0 +1,50 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  budget.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "util.h"
+#include "image.h"
+
+/* Limits how much memory the images being extracted at once can take. Before an image is
+ * decoded, its peak memory is estimated from its header and reserved, and the reservation
+ * waits until everything in flight fits under the budget together with it. The reservation
+ * is released once the image has been written out. Safe to use from multiple threads. */
+typedef struct MemoryBudget MemoryBudget;
+
+typedef struct
+{
+	u64 budgetBytes;
+	u64 peakReservedBytes;
+	u32 nReservations;
+	u32 nWaits;         /* Reservations that had to wait for others to be released */
+	u32 nOverBudget;    /* Reservations that went over the budget because nothing else was in flight */
+	double waitSeconds; /* Time spent waiting for reservations */
+	u64 reservedBytes;  /* Still reserved when the budget was destroyed. Should be 0 */
+} MemoryBudgetStats;
+
+MemoryBudget* CreateMemoryBudget(u64 budgetBytes);
+u64 EstimateImagePeakMemory(const u8* header, Platform platform, Palette palette, OutputSettings output);
+void ReserveMemory(MemoryBudget* budget, u64 bytes, u64 bytesHeldByCaller);
+void ReleaseMemory(MemoryBudget* budget, u64 bytes);
+MemoryBudgetStats DestroyMemoryBudget(MemoryBudget* budget);
+void PrintMemoryBudgetStats(MemoryBudgetStats stats);
+
+#endif
@@ -0,0 +1,391 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  dedup.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "OutsideCode/zlib/zlib.h"
+#include "util.h"
+#include "image.h"
+#include "thread.h"
+#include "dedup.h"
+
+#define DEDUP_INDEX_NUM_BUCKETS 4096
+
+/* Mixed into each fingerprint so that data and decoded fingerprints can never be mistaken for each other */
+typedef enum
+{
+	FINGERPRINT_IMAGE_DATA,
+	FINGERPRINT_DECODED_IMAGE
+} FingerprintType;
+
+/* Entries also keep what their fingerprint was made from, so that a match can be confirmed byte for byte:
+ * the compressed data, palette and width for data fingerprints, and the pixels, palette and dimensions
+ * for decoded ones. */
+typedef struct DedupEntry
+{
+	struct DedupEntry* next;
+	Fingerprint fingerprint;
+	char* outputPath;
+	Memory data; /* Compressed data or decoded pixels */
+	u32 paletteData[256];
+	u32 nColors;
+	u32 width;
+	u32 height;
+} DedupEntry;
+
+typedef struct
+{
+	char* duplicatePath;
+	char* originalPath;
+} DedupLink;
+
+struct DedupIndex
+{
+	Mutex mutex;
+	DedupEntry* buckets[DEDUP_INDEX_NUM_BUCKETS];
+	DedupLink* links;
+	u32 nLinks;
+	u32 linksCapacity;
+	DedupStats stats;
+};
+
+static Fingerprint StartFingerprint(FingerprintType type);
+static void AddToFingerprint(Fingerprint* fingerprint, const void* data, u32 size);
+static Fingerprint GetDecodedImageFingerprint(DecodedImage decodedImage);
+static DedupEntry* FindDataEntry(DedupIndex* index, const ImageDataKey* dataKey);
+static DedupEntry* FindDecodedEntry(DedupIndex* index, DecodedImage decodedImage, Fingerprint fingerprint);
+static DedupEntry* AddEntry(DedupIndex* index, Fingerprint fingerprint, const char* outputPath);
+static void AddDataEntry(DedupIndex* index, const ImageDataKey* dataKey, const char* outputPath);
+static void AddDecodedEntry(DedupIndex* index, DecodedImage decodedImage, Fingerprint fingerprint, const char* outputPath);
+static void AddLink(DedupIndex* index, const char* duplicatePath, const char* originalPath);
+
+DedupIndex* CreateDedupIndex(void)
+{
+	DedupIndex* index = NULL;
+
+	index = calloc(1, sizeof(DedupIndex));
+	if (!index)
+	{
+		return NULL;
+	}
+	InitMutex(&index->mutex);
+	return index;
+}
+
+ImageDataKey GetImageDataKey(const u8* header, Palette palette, u32 width)
+{
+	ImageDataKey ret = { 0 };
+
+	ret.header = header;
+	ret.palette = palette;
+	ret.width = width;
+	ret.fingerprint = StartFingerprint(FINGERPRINT_IMAGE_DATA);
+	AddToFingerprint(&ret.fingerprint, header, GetImageDataSize(header));
+	AddToFingerprint(&ret.fingerprint, palette.data, palette.nColors * 4);
+	AddToFingerprint(&ret.fingerprint, &width, sizeof(width));
+	return ret;
+}
+
+/* Everything that ends up in the output */
+static Fingerprint GetDecodedImageFingerprint(DecodedImage decodedImage)
+{
+	Fingerprint ret = { 0 };
+
+	ret = StartFingerprint(FINGERPRINT_DECODED_IMAGE);
+	AddToFingerprint(&ret, decodedImage.pixels.data, decodedImage.pixels.size);
+	AddToFingerprint(&ret, decodedImage.palette.data, decodedImage.palette.nColors * 4);
+	AddToFingerprint(&ret, &decodedImage.width, sizeof(decodedImage.width));
+	AddToFingerprint(&ret, &decodedImage.height, sizeof(decodedImage.height));
+	return ret;
+}
+
+static Fingerprint StartFingerprint(FingerprintType type)
+{
+	Fingerprint ret = { 0 };
+	u32 typeValue = 0;
+
+	typeValue = (u32)type;
+	ret.crc = crc32(0, NULL, 0);
+	ret.adler = adler32(0, NULL, 0);
+	AddToFingerprint(&ret, &typeValue, sizeof(typeValue));
+	return ret;
+}
+
+static void AddToFingerprint(Fingerprint* fingerprint, const void* data, u32 size)
+{
+	fingerprint->crc = crc32(fingerprint->crc, data, size);
+	fingerprint->adler = adler32(fingerprint->adler, data, size);
+}
+
+/* Returns TRUE and records outputPath as a duplicate if an earlier image with exactly the same data,
+ * palette and width was extracted. Data is only remembered once the image has been checked after
+ * decoding, so it always leads to an image that was actually written. */
+bool32 FindDuplicateImageData(DedupIndex* index, const ImageDataKey* dataKey, const char* outputPath)
+{
+	DedupEntry* entry = NULL;
+
+	LockMutex(&index->mutex);
+	entry = FindDataEntry(index, dataKey);
+	if (!entry || strcmp(entry->outputPath, outputPath) == 0)
+	{
+		UnlockMutex(&index->mutex);
+		return FALSE;
+	}
+	AddLink(index, outputPath, entry->outputPath);
+	++index->stats.nDataDuplicates;
+	UnlockMutex(&index->mutex);
+	return TRUE;
+}
+
+/* Returns TRUE and records outputPath as a duplicate if an earlier image decoded to exactly the same thing.
+ * Otherwise, outputPath is remembered as the original for both fingerprints and this returns FALSE. */
+bool32 FindDuplicateDecodedImage(DedupIndex* index, const ImageDataKey* dataKey, DecodedImage decodedImage, const char* outputPath)
+{
+	DedupEntry* entry = NULL;
+	Fingerprint decodedFingerprint = { 0 };
+
+	decodedFingerprint = GetDecodedImageFingerprint(decodedImage);
+	LockMutex(&index->mutex);
+	entry = FindDecodedEntry(index, decodedImage, decodedFingerprint);
+	if (entry && strcmp(entry->outputPath, outputPath) != 0)
+	{
+		AddLink(index, outputPath, entry->outputPath);
+		if (!FindDataEntry(index, dataKey))
+		{
+			AddDataEntry(index, dataKey, entry->outputPath);
+		}
+		++index->stats.nPixelDuplicates;
+		UnlockMutex(&index->mutex);
+		return TRUE;
+	}
+	if (!entry)
+	{
+		AddDecodedEntry(index, decodedImage, decodedFingerprint, outputPath);
+		AddDataEntry(index, dataKey, outputPath);
+	}
+	++index->stats.nUnique;
+	UnlockMutex(&index->mutex);
+	return FALSE;
+}
+
+/* An image is only a duplicate after decoding if its pixels, palette and dimensions match, not just their fingerprint */
+static DedupEntry* FindDecodedEntry(DedupIndex* index, DecodedImage decodedImage, Fingerprint fingerprint)
+{
+	DedupEntry* entry = NULL;
+
+	for (entry = index->buckets[fingerprint.crc % DEDUP_INDEX_NUM_BUCKETS]; entry; entry = entry->next)
+	{
+		if (entry->fingerprint.crc == fingerprint.crc && entry->fingerprint.adler == fingerprint.adler &&
+			entry->data.data && entry->data.size == decodedImage.pixels.size &&
+			entry->width == decodedImage.width && entry->height == decodedImage.height &&
+			entry->nColors == decodedImage.palette.nColors &&
+			memcmp(entry->data.data, decodedImage.pixels.data, decodedImage.pixels.size) == 0 &&
+			memcmp(entry->paletteData, decodedImage.palette.data, decodedImage.palette.nColors * 4) == 0)
+		{
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* A matching fingerprint isn't enough to skip decoding an image, so the data itself has to match too */
+static DedupEntry* FindDataEntry(DedupIndex* index, const ImageDataKey* dataKey)
+{
+	DedupEntry* entry = NULL;
+	u32 dataSize = 0;
+
+	dataSize = GetImageDataSize(dataKey->header);
+	for (entry = index->buckets[dataKey->fingerprint.crc % DEDUP_INDEX_NUM_BUCKETS]; entry; entry = entry->next)
+	{
+		if (entry->fingerprint.crc == dataKey->fingerprint.crc && entry->fingerprint.adler == dataKey->fingerprint.adler &&
+			entry->data.data && entry->data.size == dataSize && entry->width == dataKey->width &&
+			entry->nColors == dataKey->palette.nColors &&
+			memcmp(entry->data.data, dataKey->header, dataSize) == 0 &&
+			memcmp(entry->paletteData, dataKey->palette.data, dataKey->palette.nColors * 4) == 0)
+		{
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* If there's no memory to remember an image, it's just treated as unique next time */
+static DedupEntry* AddEntry(DedupIndex* index, Fingerprint fingerprint, const char* outputPath)
+{
+	DedupEntry* entry = NULL;
+	u32 bucket = 0;
+
+	entry = calloc(1, sizeof(DedupEntry));
+	if (!entry)
+	{
+		return NULL;
+	}
+	entry->outputPath = CopyString(outputPath);
+	if (!entry->outputPath)
+	{
+		free(entry);
+		return NULL;
+	}
+	bucket = fingerprint.crc % DEDUP_INDEX_NUM_BUCKETS;
+	entry->fingerprint = fingerprint;
+	entry->next = index->buckets[bucket];
+	index->buckets[bucket] = entry;
+	return entry;
+}
+
+/* Without a copy of the data, the entry can never be matched, which is no worse than not having it */
+static void AddDataEntry(DedupIndex* index, const ImageDataKey* dataKey, const char* outputPath)
+{
+	DedupEntry* entry = NULL;
+
+	entry = AddEntry(index, dataKey->fingerprint, outputPath);
+	if (!entry)
+	{
+		return;
+	}
+	entry->data.size = GetImageDataSize(dataKey->header);
+	entry->data.data = malloc(entry->data.size);
+	if (!entry->data.data)
+	{
+		return;
+	}
+	memcpy(entry->data.data, dataKey->header, entry->data.size);
+	memcpy(entry->paletteData, dataKey->palette.data, dataKey->palette.nColors * 4);
+	entry->nColors = dataKey->palette.nColors;
+	entry->width = dataKey->width;
+}
+
+/* Like AddDataEntry, for the pixels and palette an image decoded to */
+static void AddDecodedEntry(DedupIndex* index, DecodedImage decodedImage, Fingerprint fingerprint, const char* outputPath)
+{
+	DedupEntry* entry = NULL;
+
+	entry = AddEntry(index, fingerprint, outputPath);
+	if (!entry)
+	{
+		return;
+	}
+	entry->data.size = decodedImage.pixels.size;
+	entry->data.data = malloc(entry->data.size);
+	if (!entry->data.data)
+	{
+		return;
+	}
+	memcpy(entry->data.data, decodedImage.pixels.data, entry->data.size);
+	memcpy(entry->paletteData, decodedImage.palette.data, decodedImage.palette.nColors * 4);
+	entry->nColors = decodedImage.palette.nColors;
+	entry->width = decodedImage.width;
+	entry->height = decodedImage.height;
+}
+
+static void AddLink(DedupIndex* index, const char* duplicatePath, const char* originalPath)
+{
+	DedupLink* links = NULL;
+	u32 newCapacity = 0;
+
+	if (index->nLinks == index->linksCapacity)
+	{
+		newCapacity = index->linksCapacity ? index->linksCapacity * 2 : 256;
+		links = realloc(index->links, sizeof(DedupLink) * newCapacity);
+		if (!links)
+		{
+			return;
+		}
+		index->links = links;
+		index->linksCapacity = newCapacity;
+	}
+	index->links[index->nLinks].duplicatePath = CopyString(duplicatePath);
+	index->links[index->nLinks].originalPath = CopyString(originalPath);
+	if (!index->links[index->nLinks].duplicatePath || !index->links[index->nLinks].originalPath)
+	{
+		free(index->links[index->nLinks].duplicatePath);
+		free(index->links[index->nLinks].originalPath);
+		return;
+	}
+	++index->nLinks;
+}
+
+/* Writes one line per duplicate: its path, a tab, then the path of the image it duplicates. */
+bool32 WriteDedupManifest(DedupIndex* index, const char* manifestPath)
+{
+	FILE* manifestFile = NULL;
+	u32 i = 0;
+
+	manifestFile = fopen(manifestPath, "wb");
+	if (!manifestFile)
+	{
+		FOPEN_FAIL_MESSAGE(manifestPath);
+		return FALSE;
+	}
+	LockMutex(&index->mutex);
+	for (i = 0; i < index->nLinks; ++i)
+	{
+		fprintf(manifestFile, "%s\t%s\n", index->links[i].duplicatePath, index->links[i].originalPath);
+	}
+	UnlockMutex(&index->mutex);
+	fclose(manifestFile);
+	return TRUE;
+}
+
+DedupStats GetDedupStats(DedupIndex* index)
+{
+	DedupStats ret = { 0 };
+
+	LockMutex(&index->mutex);
+	ret = index->stats;
+	UnlockMutex(&index->mutex);
+	return ret;
+}
+
+void PrintDedupStats(DedupStats stats)
+{
+	printf("Unique images: %u. Duplicates found before decoding: %u. After decoding: %u\n",
+		stats.nUnique, stats.nDataDuplicates, stats.nPixelDuplicates);
+}
+
+void DestroyDedupIndex(DedupIndex* index)
+{
+	DedupEntry* entry = NULL;
+	DedupEntry* next = NULL;
+	u32 i = 0;
+
+	if (!index)
+	{
+		return;
+	}
+	for (i = 0; i < DEDUP_INDEX_NUM_BUCKETS; ++i)
+	{
+		for (entry = index->buckets[i]; entry; entry = next)
+		{
+			next = entry->next;
+			free(entry->outputPath);
+			free(entry->data.data);
+			free(entry);
+		}
+	}
+	for (i = 0; i < index->nLinks; ++i)
+	{
+		free(index->links[i].duplicatePath);
+		free(index->links[i].originalPath);
+	}
+	free(index->links);
+	DestroyMutex(&index->mutex);
+	free(index);
+}
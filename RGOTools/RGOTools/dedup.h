@@ -0,0 +1,68 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  dedup.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "util.h"
+#include "image.h"
+
+/* Remembers every image extracted so far by fingerprint, so that an image that would come out the
+ * same as an earlier one is recorded as a duplicate of it instead of being written again. Images are
+ * checked by their compressed data, palette and width before they're decoded, and again by their decoded
+ * pixels and palette afterwards, which also catches the same image compressed differently. Skipping an
+ * image takes a byte for byte match either way, so the index keeps a copy of the compressed data, the
+ * decoded pixels and the palettes of every image it has written. */
+typedef struct DedupIndex DedupIndex;
+
+/* crc32 and adler32 of the same bytes side by side. The two are independent enough that
+ * telling apart the few thousand images in the game is no problem. */
+typedef struct
+{
+	u32 crc;
+	u32 adler;
+} Fingerprint;
+
+/* Everything that decides what an image looks like before it's decoded. header points into the
+ * loaded file, so a key is only good until the file is freed. */
+typedef struct
+{
+	const u8* header;
+	Palette palette; /* As it is in the file */
+	u32 width; /* The width the image is decoded at, from GetImageWidth */
+	Fingerprint fingerprint;
+} ImageDataKey;
+
+typedef struct
+{
+	u32 nUnique;
+	u32 nDataDuplicates;  /* Found before decoding */
+	u32 nPixelDuplicates; /* Found after decoding */
+} DedupStats;
+
+DedupIndex* CreateDedupIndex(void);
+ImageDataKey GetImageDataKey(const u8* header, Palette palette, u32 width);
+bool32 FindDuplicateImageData(DedupIndex* index, const ImageDataKey* dataKey, const char* outputPath);
+bool32 FindDuplicateDecodedImage(DedupIndex* index, const ImageDataKey* dataKey, DecodedImage decodedImage, const char* outputPath);
+bool32 WriteDedupManifest(DedupIndex* index, const char* manifestPath);
+DedupStats GetDedupStats(DedupIndex* index);
+void PrintDedupStats(DedupStats stats);
+void DestroyDedupIndex(DedupIndex* index);
+
+#endif
@@ -24,6 +24,18 @@
 #include "OutsideCode/libpng/png.h"
 #include "util.h"
 #include "image.h"
+#include "writer.h"
+#include "sink.h"
+#include "raw.h"
+#include "thumbnail.h"
+#include "width.h"
+#include "map.h"
+#include "dedup.h"
+#include "palette.h"
+#include "stats.h"
+#include "trace.h"
+#include "alloc.h"
+#include "budget.h"
 
 #define DEFAULT_PALETTE_NUM_BYTES 1024
 #define DEFAULT_PALETTE_NUM_COLORS (DEFAULT_PALETTE_NUM_BYTES / 4)
@@ -36,11 +48,86 @@
 #define PS2_IMAGE_DEFAULT_WIDTH 640
 #define TILES_PER_ROW (PSP_IMAGE_DEFAULT_WIDTH / TILE_WIDTH)
 #define TILE_ROW_SIZE (PSP_IMAGE_DEFAULT_WIDTH * TILE_HEIGHT)
+#define NO_SIZE_LIMIT 0xFFFFFFFF /* For GetNumBytesToNextHeader on containers that have already been validated */
 
-static u32 GetNumBytesToNextHeader(const u8* currentHeader, u32 nSubfiles);
+/* Used in place of a parameter to leave libpng's own default alone */
+#define PNG_ENCODE_LIBPNG_DEFAULT -1
+
+/* One attempt at encoding a PNG. Profiles that list several attempts keep whichever is smallest. */
+typedef struct
+{
+	int compressionLevel;
+	int filters;
+	int strategy;
+} PNGEncodeParameters;
+
+static const PNGEncodeParameters fastParameters[] =
+{
+	{ 1, PNG_FILTER_NONE, Z_DEFAULT_STRATEGY }
+};
+static const PNGEncodeParameters defaultParameters[] =
+{
+	{ PNG_ENCODE_LIBPNG_DEFAULT, PNG_ENCODE_LIBPNG_DEFAULT, PNG_ENCODE_LIBPNG_DEFAULT }
+};
+static const PNGEncodeParameters maximumParameters[] =
+{
+	{ 9, PNG_ALL_FILTERS, Z_FILTERED },
+	{ 9, PNG_ALL_FILTERS, Z_DEFAULT_STRATEGY },
+	{ 9, PNG_FILTER_NONE, Z_FILTERED },
+	{ 9, PNG_FILTER_NONE, Z_DEFAULT_STRATEGY },
+	{ 9, PNG_FILTER_SUB, Z_FILTERED },
+	{ 9, PNG_FILTER_SUB, Z_DEFAULT_STRATEGY },
+	{ 9, PNG_FILTER_UP, Z_FILTERED },
+	{ 9, PNG_FILTER_UP, Z_DEFAULT_STRATEGY },
+	{ 9, PNG_FILTER_AVG, Z_FILTERED },
+	{ 9, PNG_FILTER_AVG, Z_DEFAULT_STRATEGY },
+	{ 9, PNG_FILTER_PAETH, Z_FILTERED },
+	{ 9, PNG_FILTER_PAETH, Z_DEFAULT_STRATEGY }
+};
+
+/* libpng writes the encoded PNG here piece by piece */
+typedef struct
+{
+	Memory memory;
+	u32 capacity;
+} PNGOutputBuffer;
+
+/* Turns an image's palette indices, as they come out of decompression, into RGBA colors */
+typedef void (*RGBAConverter)(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+
+static bool32 ReadImageInfo(Memory imageData, ImageInfo* imageInfo);
+static bool32 ValidateImageHeader(const u8* header, u32 nBytesLeft, u32 imageIndex);
+static bool32 ValidatePS2Subimage(const u8* src, u32 srcSize, u32 numBytesToDecompress);
+static u32 GetNumBytesToNextHeader(const u8* currentHeader, u32 nSubfiles, u32 nBytesLeft, u32* nPaddingKilobytes);
 static bool32 DecompressPSPSubimage(u8* src, u32 srcSize, u8* dst, u32 dstSize);
+static void DecompressPS2SubimageCounted(u8* src, u8* dst, u32 numBytesToDecompress, SubfileStats* stats);
+static void PNGWriteToMemory(png_structp pngWritePtr, png_bytep data, png_size_t length);
+static void PNGFlushMemory(png_structp pngWritePtr);
+static bool32 EncodeRGBAPNG(u8** rowPointers, u32 width, u32 height, const PNGEncodeParameters* parameters, Memory* encodedImage);
+static bool32 ExtractDecodedImage(DecodedImage decodedImage, const char* imageOutputPath, const ExtractSettings* settings, u64 reservedBytes);
+static void FindImagesWithSharedData(u8** headers, u32 nImages, u32* sharedWith);
+static const char* GetImageOutputPath(const char* outputPath, char* outputPathMultipleFiles, u32 appendLocation, u32 imageIndex);
+static void UntileTileRow(const u8* tiledRow, u8* linearRow);
+static void TileLinearRow(const u8* linearRow, u8* tiledRow);
+static void ConvertLinearIndices4ToRGBA(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+static void ConvertLinearIndices8ToRGBA(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+static void ConvertTiledIndices4ToRGBA(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+static void ConvertTiledIndices8ToRGBA(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+static RGBAConverter GetRGBAConverter(bool32 isTiled, u32 bitsPerPixel);
+static bool32 CanKeepPixelsTiled(const u8* header, Platform platform, const ExtractSettings* settings);
+static Memory DecodeExtractedPixels(u8* header, Platform platform, bool32 keepTiled, ImageCodecStats* stats);
 
 ImageInfo GetImageInfo(Memory imageData)
+{
+	ImageInfo ret = { 0 };
+	ReadImageInfo(imageData, &ret);
+	return ret;
+}
+
+/* Does the work of GetImageInfo. Every palette is checked against the size of the file, which only costs
+ * a comparison per palette. Returns FALSE if the palettes run past the end of the file or there are more
+ * than MAX_IMAGES_PER_FILE of them, in which case imageInfo only holds what was found up to there. */
+static bool32 ReadImageInfo(Memory imageData, ImageInfo* imageInfo)
 {
 	/* The easiest way to determine the number of images is to determine the
 	 * number of palettes, as each image gets its own palette. */
@@ -54,6 +141,11 @@ ImageInfo GetImageInfo(Memory imageData)
 	u32 imageOffset = 0x400;
 	u32 color = 0;
 
+	if (imageData.size < imageOffset + 8)
+	{
+		*imageInfo = ret;
+		return FALSE;
+	}
 	ret.firstHeader = &imageData.data[DEFAULT_HEADER_OFFSET];
 	ret.palettes[0].nColors = 256; /* The first image always has a 256 color palette. */
 	ret.palettes[0].data = &imageData.data[0];
@@ -70,7 +162,8 @@ ImageInfo GetImageInfo(Memory imageData)
 		if (color == 0)
 		{
 			/* Definitely padding. There's only 1 palette */
-			return ret;
+			*imageInfo = ret;
+			return TRUE;
 		}
 		/* Not padding. First color was just transparent. */
 	}
@@ -78,14 +171,16 @@ ImageInfo GetImageInfo(Memory imageData)
 	{
 		/* MAP data. There's only 1 palette */
 		ret.hasMAPData = TRUE;
-		return ret;
+		*imageInfo = ret;
+		return TRUE;
 	}
 	else if (color > 0 && color < 256)
 	{
 		/* Image header. In practice only one file has the image header
 		 * immediately follow when there's only one palette (PSP image 2536). */
 		ret.firstHeader = &imageData.data[0x400];
-		return ret;
+		*imageInfo = ret;
+		return TRUE;
 	}
 
 	/* More than one palette. The palette data will end when the first image header
@@ -93,10 +188,21 @@ ImageInfo GetImageInfo(Memory imageData)
 	 * after the final palette with no padding. */
 	while (1)
 	{
+		if (ret.nImages == MAX_IMAGES_PER_FILE)
+		{
+			*imageInfo = ret;
+			return FALSE;
+		}
 		++ret.nImages;
 
 		/* Check if it's a 16 color palette by getting what would be the 17th color. */
 		imageOffset += 16 * 4;
+		if (imageOffset + 8 > imageData.size)
+		{
+			--ret.nImages;
+			*imageInfo = ret;
+			return FALSE;
+		}
 		color = LittleEndianRead32(&imageData.data[imageOffset]);
 
 		if (color == 0)
@@ -125,12 +231,19 @@ ImageInfo GetImageInfo(Memory imageData)
 
 			/* Image header. The final palette is a 16 color palette. */
 			ret.firstHeader = &imageData.data[imageOffset];
-			return ret;
+			*imageInfo = ret;
+			return TRUE;
 		}
 		else
 		{
 			/* More than 16 colors. It's a 256 color palette.
 			 * Get the 4 bytes after the end of the palette. */
+			if (imageOffset + (256 - 16) * 4 + 8 > imageData.size)
+			{
+				--ret.nImages;
+				*imageInfo = ret;
+				return FALSE;
+			}
 			ret.palettes[ret.nImages - 1].nColors = 256;
 			ret.palettes[ret.nImages - 1].data = &imageData.data[imageOffset - (16 * 4)];
 			imageOffset += (256 - 16) * 4;
@@ -140,12 +253,121 @@ ImageInfo GetImageInfo(Memory imageData)
 			{
 				/* Image header. The final palette is a 256 color palette. */
 				ret.firstHeader = &imageData.data[imageOffset];
-				return ret;
+				*imageInfo = ret;
+				return TRUE;
 			}
 		}
 	}
 }
 
+/* Checks every offset and size in a container against the size of the buffer once, so that everything
+ * else can trust them without checking: the palettes, the MAP data, each image header and its subfile
+ * offsets, and the padding between images. PS2 subfiles are also walked section by section, without
+ * decompressing them, to make sure they decompress to exactly their size without reading past their data.
+ * On success, imageInfo is filled in as by GetImageInfo. On failure, what's wrong is printed. A MAP width of 0 is
+ * left to InitDecodedImage, since it only matters to PS2 images without a custom width. */
+bool32 ValidateContainer(Memory imageData, ImageInfo* imageInfo)
+{
+	ImageInfo info = { 0 };
+	u8* header = NULL;
+	u32 nBytesLeft = 0;
+	u32 nBytesToNextHeader = 0;
+	u32 nPaddingKilobytes = 0;
+	u32 i = 0;
+
+	if (!ReadImageInfo(imageData, &info))
+	{
+		printf("The palettes run past the end of the file, or there are more than %u of them\n", MAX_IMAGES_PER_FILE);
+		return FALSE;
+	}
+	if ((u32)(info.firstHeader - imageData.data) >= imageData.size)
+	{
+		printf("The first image header is past the end of the file\n");
+		return FALSE;
+	}
+
+	header = info.firstHeader;
+	for (i = 0; i < info.nImages; ++i)
+	{
+		nBytesLeft = imageData.size - (u32)(header - imageData.data);
+		if (!ValidateImageHeader(header, nBytesLeft, i))
+		{
+			return FALSE;
+		}
+		if (i + 1 < info.nImages)
+		{
+			nBytesToNextHeader = GetNumBytesToNextHeader(header, LittleEndianRead32(header), nBytesLeft, &nPaddingKilobytes);
+			if (nBytesToNextHeader == 0 || nBytesToNextHeader >= nBytesLeft)
+			{
+				printf("Image %u is followed by padding that runs past the end of the file\n", i);
+				return FALSE;
+			}
+			header += nBytesToNextHeader;
+		}
+	}
+	*imageInfo = info;
+	return TRUE;
+}
+
+/* Checks one image's header and subfiles. nBytesLeft is the number of bytes from the header to the end of the file. */
+static bool32 ValidateImageHeader(const u8* header, u32 nBytesLeft, u32 imageIndex)
+{
+	Platform platform = 0;
+	u32 nSubfiles = 0;
+	u32 imageDataSize = 0;
+	u32 subfileOffset = 0;
+	u32 nextSubfileOffset = 0;
+	u32 subfileHeaderSize = 0;
+	u64 decompressedSize = 0;
+	u32 i = 0;
+
+	if (nBytesLeft < 8)
+	{
+		printf("Image %u's header runs past the end of the file\n", imageIndex);
+		return FALSE;
+	}
+	nSubfiles = LittleEndianRead32(header);
+	if ((u64)(nSubfiles + 2ULL) * 4 > nBytesLeft)
+	{
+		printf("Image %u's header claims %u subfiles, more than fit in the file\n", imageIndex, nSubfiles);
+		return FALSE;
+	}
+	imageDataSize = LittleEndianRead32(&header[(nSubfiles + 1) * 4]);
+	subfileOffset = LittleEndianRead32(&header[4]);
+	if (imageDataSize > nBytesLeft || (u64)subfileOffset + 8 > nBytesLeft)
+	{
+		printf("Image %u's data runs past the end of the file\n", imageIndex);
+		return FALSE;
+	}
+
+	/* The platform is known from the first subfile, now that it's in the file */
+	platform = GetImagePlatform(header);
+	subfileHeaderSize = platform == PLATFORM_PS2 ? 4 : 16;
+	for (i = 0; i < nSubfiles; ++i)
+	{
+		subfileOffset = LittleEndianRead32(&header[(i + 1) * 4]);
+		nextSubfileOffset = LittleEndianRead32(&header[(i + 2) * 4]);
+		if (subfileOffset < (nSubfiles + 2) * 4 || nextSubfileOffset > imageDataSize ||
+			nextSubfileOffset < subfileOffset || nextSubfileOffset - subfileOffset < subfileHeaderSize)
+		{
+			printf("Image %u's subfile %u has bad offsets\n", imageIndex, i);
+			return FALSE;
+		}
+		decompressedSize += LittleEndianRead32(&header[subfileOffset]);
+		if (decompressedSize > 0xFFFFFFFF)
+		{
+			printf("Image %u decompresses to more than 4 GB\n", imageIndex);
+			return FALSE;
+		}
+		if (platform == PLATFORM_PS2 && !ValidatePS2Subimage(&header[subfileOffset + 4], nextSubfileOffset - subfileOffset - 4, LittleEndianRead32(&header[subfileOffset])))
+		{
+			printf("Image %u's subfile %u doesn't decompress to its size within its data\n", imageIndex, i);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
 u8* GetImageHeader(Memory imageData, ImageInfo imageInfo, u32 index)
 {
 	u8* ret = NULL;
@@ -168,17 +390,31 @@ u8* GetImageHeader(Memory imageData, ImageInfo imageInfo, u32 index)
 u8* GetNextImageHeader(u8* currentHeader)
 {
 	u32 nSubfiles = 0;
+	u32 nPaddingKilobytes = 0;
 	nSubfiles = LittleEndianRead32(currentHeader);
-	return &currentHeader[GetNumBytesToNextHeader(currentHeader, nSubfiles)];
+	return &currentHeader[GetNumBytesToNextHeader(currentHeader, nSubfiles, NO_SIZE_LIMIT, &nPaddingKilobytes)];
+}
+
+/* The number of whole kilobytes of padding between an image and the next one.
+ * Like GetNextImageHeader, this can't be used on the last image in a file. */
+u32 GetImagePaddingKilobytes(const u8* header)
+{
+	u32 nPaddingKilobytes = 0;
+	GetNumBytesToNextHeader(header, LittleEndianRead32(header), NO_SIZE_LIMIT, &nPaddingKilobytes);
+	return nPaddingKilobytes;
 }
 
-static u32 GetNumBytesToNextHeader(const u8* currentHeader, u32 nSubfiles)
+/* Returns 0 if the next header would be less than 4 bytes from nBytesLeft, which only
+ * ValidateContainer needs. Everything else has a validated container and no limit. */
+static u32 GetNumBytesToNextHeader(const u8* currentHeader, u32 nSubfiles, u32 nBytesLeft, u32* nPaddingKilobytes)
 {
 	u32 imageDataSize = 0;
 	u32 checkPadding = 0;
 	u32 checkForChecksum[4] = { 0 };
 	u32 i = 0;
 
+	*nPaddingKilobytes = 0;
+
 	/* Calculate how many bytes are in the image.
 	 * The last 4 bytes in the header give the size of the image data, but there
 	 * is also a 16-byte checksum which must be 16-byte-aligned that isn't counted in that value. */
@@ -192,6 +428,10 @@ static u32 GetNumBytesToNextHeader(const u8* currentHeader, u32 nSubfiles)
 	}
 
 	/* There may still be some number of kilobytes of additional padding before the next header. */
+	if ((u64)imageDataSize + 4 > nBytesLeft)
+	{
+		return 0;
+	}
 	memcpy(&checkPadding, &currentHeader[imageDataSize], 4);
 	while (checkPadding == 0)
 	{
@@ -212,6 +452,11 @@ static u32 GetNumBytesToNextHeader(const u8* currentHeader, u32 nSubfiles)
 		}
 		/* Actually padding. Move to the next kilobyte. */
 		imageDataSize += 1024;
+		++*nPaddingKilobytes;
+		if ((u64)imageDataSize + 4 > nBytesLeft)
+		{
+			return 0;
+		}
 		memcpy(&checkPadding, &currentHeader[imageDataSize], 4);
 	}
 	return imageDataSize;
@@ -236,7 +481,32 @@ Platform GetImagePlatform(const u8* header)
 	}
 }
 
+/* The size of the image once all of its subfiles are decompressed. */
+u32 GetDecompressedImageSize(const u8* header)
+{
+	u32 nSubfiles = 0;
+	u32 subfileOffset = 0;
+	u32 decompressedSize = 0;
+	u32 i = 0;
+
+	nSubfiles = LittleEndianRead32(header);
+	for (i = 0; i < nSubfiles; ++i)
+	{
+		subfileOffset = LittleEndianRead32(&header[(i + 1) * 4]);
+		decompressedSize += LittleEndianRead32(&header[subfileOffset]);
+	}
+	return decompressedSize;
+}
+
 Memory DecompressImage(u8* header, Platform platform)
+{
+	return DecompressImageSubfiles(header, platform, 0, LittleEndianRead32(header), NULL);
+}
+
+/* Decompresses a run of consecutive subfiles. Each subfile decompresses to a contiguous
+ * part of the image, so the result is the part of the image those subfiles cover.
+ * If stats isn't NULL, the counters for each subfile decompressed are filled in. See stats.h. */
+Memory DecompressImageSubfiles(u8* header, Platform platform, u32 firstSubfile, u32 nSubfilesToDecompress, ImageCodecStats* stats)
 {
 	Memory ret = { 0 };
 	u32 nSubfiles = 0;
@@ -247,24 +517,25 @@ Memory DecompressImage(u8* header, Platform platform)
 	u32 nextHeaderSubfileOffset = 0;
 	u8* compressedDataInPtr = NULL;
 	u8* decompressedDataOutPtr = NULL;
+	SubfileStats* subfileStats = NULL;
 
 	u32 i = 0;
 
 	nSubfiles = LittleEndianRead32(header);
 
 	/* Handle exception case where image has zero subfiles (PSP image 2530) */
-	if (nSubfiles == 0)
+	if (nSubfiles == 0 || nSubfilesToDecompress == 0 || firstSubfile + nSubfilesToDecompress > nSubfiles)
 	{
 		return ret;
 	}
 
-	/* Allocate memory to hold the uncompressed image */
-	for (i = 0; i < nSubfiles; ++i)
+	/* Allocate memory to hold the uncompressed subfiles */
+	for (i = firstSubfile; i < firstSubfile + nSubfilesToDecompress; ++i)
 	{
 		currentHeaderSubfileOffset = LittleEndianRead32(&header[(i + 1) * 4]);
 		decompressedSize += LittleEndianRead32(&header[currentHeaderSubfileOffset]);
 	}
-	ret.data = malloc(decompressedSize);
+	ret.data = TrackedMalloc(decompressedSize, MEMORY_STAGE_DECOMPRESS);
 	if (!ret.data)
 	{
 		return ret;
@@ -273,32 +544,45 @@ Memory DecompressImage(u8* header, Platform platform)
 
 	/* Decompress the subfiles and put them contiguously in the allocated memory */
 	decompressedBytesRemaining = ret.size;
-	currentHeaderSubfileOffset = LittleEndianRead32(&header[4]);
-	for (i = 0; i < nSubfiles; ++i)
+	currentHeaderSubfileOffset = LittleEndianRead32(&header[(firstSubfile + 1) * 4]);
+	for (i = firstSubfile; i < firstSubfile + nSubfilesToDecompress; ++i)
 	{
 		nextHeaderSubfileOffset = LittleEndianRead32(&header[(i + 2) * 4]);
 		decompressedSize = LittleEndianRead32(&header[currentHeaderSubfileOffset]);
 		compressedSize = nextHeaderSubfileOffset - currentHeaderSubfileOffset;
 		decompressedDataOutPtr = &ret.data[ret.size - decompressedBytesRemaining];
+		if (stats)
+		{
+			subfileStats = &stats->subfiles[i];
+			subfileStats->compressedSize = compressedSize;
+			subfileStats->decompressedSize = decompressedSize;
+		}
 
 		/* The compressed data is offset differently from the
 		 * start of a subfile between the PS2 and PSP, and the PSP uses gzip for compression, while
 		 * the PS2 version uses a custom algorithm */
+		BeginTraceEvent(TRACE_STAGE_DECOMPRESS, NULL, i);
 		if (platform == PLATFORM_PS2)
 		{
 			compressedDataInPtr = &header[currentHeaderSubfileOffset + 4];
-			DecompressPS2Subimage(compressedDataInPtr, decompressedDataOutPtr, decompressedSize);
+			DecompressPS2SubimageCounted(compressedDataInPtr, decompressedDataOutPtr, decompressedSize, subfileStats);
 		}
 		else
 		{
 			compressedDataInPtr = &header[currentHeaderSubfileOffset + 16];
-			if (!DecompressPSPSubimage(compressedDataInPtr, compressedSize, decompressedDataOutPtr, decompressedSize))
+			if (stats)
+			{
+				++stats->nInflateCalls;
+			}
+			if (!DecompressPSPSubimage(compressedDataInPtr, compressedSize - 16, decompressedDataOutPtr, decompressedSize))
 			{
-				free(ret.data);
+				EndTraceEvent(TRACE_STAGE_DECOMPRESS);
+				TrackedFree(ret.data);
 				ret.data = NULL;
 				return ret;
 			}
 		}
+		EndTraceEvent(TRACE_STAGE_DECOMPRESS);
 		decompressedBytesRemaining -= decompressedSize;
 		currentHeaderSubfileOffset = nextHeaderSubfileOffset;
 	}
@@ -321,6 +605,7 @@ static bool32 DecompressPSPSubimage(u8* src, u32 srcSize, u8* dst, u32 dstSize)
 	}
 	if (inflate(&zStream, Z_FINISH) != Z_STREAM_END)
 	{
+		inflateEnd(&zStream);
 		return FALSE;
 	}
 	if (inflateEnd(&zStream) != Z_OK)
@@ -331,7 +616,62 @@ static bool32 DecompressPSPSubimage(u8* src, u32 srcSize, u8* dst, u32 dstSize)
 	return TRUE;
 }
 
+/* Walks the sections of a PS2 subfile the same way DecompressPS2Subimage does, without writing anything,
+ * to check that they add up to exactly numBytesToDecompress and never read past srcSize. With that checked
+ * once, the decompressor's inner loop doesn't need to check either. */
+static bool32 ValidatePS2Subimage(const u8* src, u32 srcSize, u32 numBytesToDecompress)
+{
+	u32 srcPos = 0;
+	u32 backReferenceLength = 0;
+	u32 encodingTypeBitField = 0;
+
+	while (numBytesToDecompress != 0)
+	{
+		encodingTypeBitField >>= 1;
+		if (!(encodingTypeBitField & 0x100))
+		{
+			if (srcPos == srcSize)
+			{
+				return FALSE;
+			}
+			encodingTypeBitField = src[srcPos] | 0xFF00;
+			++srcPos;
+		}
+		if (encodingTypeBitField & 0x1)
+		{
+			if (srcPos == srcSize)
+			{
+				return FALSE;
+			}
+			++srcPos;
+			--numBytesToDecompress;
+		}
+		else
+		{
+			if (srcSize - srcPos < 2)
+			{
+				return FALSE;
+			}
+			backReferenceLength = (src[srcPos + 1] & 0xF) + 3;
+			if (backReferenceLength > numBytesToDecompress)
+			{
+				return FALSE;
+			}
+			srcPos += 2;
+			numBytesToDecompress -= backReferenceLength;
+		}
+	}
+	return TRUE;
+}
+
 void DecompressPS2Subimage(u8* src, u8* dst, u32 numBytesToDecompress)
+{
+	DecompressPS2SubimageCounted(src, dst, numBytesToDecompress, NULL);
+}
+
+/* Counting the two kinds of section is only a couple of increments, so it's done either way
+ * and the counts are only stored if stats isn't NULL. */
+static void DecompressPS2SubimageCounted(u8* src, u8* dst, u32 numBytesToDecompress, SubfileStats* stats)
 {
 	u8 circularBuf[0x1000] = { 0 };
 	u32 bufPos = 0xFEE;
@@ -339,6 +679,9 @@ void DecompressPS2Subimage(u8* src, u8* dst, u32 numBytesToDecompress)
 	u32 backReferenceOffset = 0;
 	u32 currentBackReferenceByte = 0;
 	u32 encodingTypeBitField = 0;
+	u32 nLiterals = 0;
+	u32 nBackReferences = 0;
+	u32 backReferenceBytes = 0;
 	u32 i = 0;
 	while (numBytesToDecompress != 0)
 	{
@@ -361,6 +704,7 @@ void DecompressPS2Subimage(u8* src, u8* dst, u32 numBytesToDecompress)
 			++src;
 			++dst;
 			--numBytesToDecompress;
+			++nLiterals;
 		}
 		else
 		{
@@ -376,289 +720,852 @@ void DecompressPS2Subimage(u8* src, u8* dst, u32 numBytesToDecompress)
 				++dst;
 			}
 			numBytesToDecompress -= backReferenceLength;
+			++nBackReferences;
+			backReferenceBytes += backReferenceLength;
 		}
 	}
+	if (stats)
+	{
+		stats->nLiterals = nLiterals;
+		stats->nBackReferences = nBackReferences;
+		stats->backReferenceBytes = backReferenceBytes;
+	}
 }
 
 /* On PSP, the pixels in an image aren't given in linear order, but instead are
- * grouped into 16 x 8 tiles. */
+ * grouped into 16 x 8 tiles. A partial row of tiles at the end is untiled as if the
+ * rest of the row were zeros, so nothing past the end of the image is read. */
 Memory TiledToLinear(Memory tiledImage)
 {
-	u32 currentRowInTile = 0;
-	u32 currentTileInRow = 0;
-	u8* src = NULL;
-	u8* dst = NULL;
+	u8 tiledRow[TILE_ROW_SIZE];
+	u8 linearRow[TILE_ROW_SIZE];
 	Memory ret = { 0 };
 
 	u32 i = 0;
 
-	ret.data = malloc(tiledImage.size);
+	ret.data = TrackedMalloc(tiledImage.size, MEMORY_STAGE_UNTILE);
 	if (!ret.data)
 	{
 		return ret;
 	}
 	ret.size = tiledImage.size;
 
-	src = tiledImage.data;
-	dst = ret.data;
-	for (i = 0; i < tiledImage.size / TILE_WIDTH; ++i)
-	{
-		memcpy(dst, src, TILE_WIDTH);
-		++currentTileInRow;
-		src += TILE_SIZE;
-		dst += TILE_WIDTH;
-		if (currentTileInRow == TILES_PER_ROW)
-		{
-			src -= TILE_ROW_SIZE;
-			src += TILE_WIDTH;
-			currentTileInRow = 0;
-			++currentRowInTile;
-			if (currentRowInTile == TILE_HEIGHT)
-			{
-				src -= TILE_SIZE;
-				src += TILE_ROW_SIZE;
-				currentRowInTile = 0;
-			}
-		}
+	for (i = 0; i + TILE_ROW_SIZE <= tiledImage.size; i += TILE_ROW_SIZE)
+	{
+		UntileTileRow(&tiledImage.data[i], &ret.data[i]);
+	}
+	if (i < tiledImage.size)
+	{
+		memset(tiledRow, 0, sizeof(tiledRow));
+		memcpy(tiledRow, &tiledImage.data[i], tiledImage.size - i);
+		UntileTileRow(tiledRow, linearRow);
+		memcpy(&ret.data[i], linearRow, tiledImage.size - i);
 	}
 	return ret;
 }
 
-/* On PS2, the palette is not given in order for 256 color images, and instead
- * are grouped into 32-color groups where colors 8-15 and 16-24
- * are swapped. Additionally alpha ranges from 0x0 to 0x80 for all images, so
-* it needs to be converted to range from 0x0 + 0xFF */
-void CorrectPS2Palette(Palette palette)
+/* Untiles one row of 16 x 8 tiles, TILE_ROW_SIZE bytes. Every bound is a constant,
+ * so the compiler can unroll and vectorise the copies. */
+static void UntileTileRow(const u8* tiledRow, u8* linearRow)
 {
-	const u32 colorGroupSize = 32;
-	const u32 colorGroupNumBytes = 32 * 4;
-	u32* data = NULL;
+	u32 tile = 0;
+	u32 row = 0;
+
+	for (row = 0; row < TILE_HEIGHT; ++row)
+	{
+		for (tile = 0; tile < TILES_PER_ROW; ++tile)
+		{
+			memcpy(&linearRow[row * PSP_IMAGE_DEFAULT_WIDTH + tile * TILE_WIDTH], &tiledRow[tile * TILE_SIZE + row * TILE_WIDTH], TILE_WIDTH);
+		}
+	}
+}
+
+/* Defines a converter for one layout and bit depth. Linear indices go straight to the
+ * palette expansion kernel. PSP indices still in tiles are untiled a row of tiles at a
+ * time into a buffer small enough to stay in cache and expanded from there, so there is
+ * no separate untiled copy of the image. nBytes must be a multiple of TILE_ROW_SIZE when tiled. */
+#define DEFINE_RGBA_CONVERTER(name, isTiled, expand, pixelsPerByte) \
+static void name(const u8* indices, u32 nBytes, const u32* palette, u32* rgba) \
+{ \
+	u8 linearRow[TILE_ROW_SIZE]; \
+	u32 i = 0; \
+\
+	if (!(isTiled)) \
+	{ \
+		expand(indices, nBytes, palette, rgba); \
+		return; \
+	} \
+	for (i = 0; i < nBytes; i += TILE_ROW_SIZE) \
+	{ \
+		UntileTileRow(&indices[i], linearRow); \
+		expand(linearRow, TILE_ROW_SIZE, palette, &rgba[i * (pixelsPerByte)]); \
+	} \
+}
+
+DEFINE_RGBA_CONVERTER(ConvertLinearIndices4ToRGBA, FALSE, ExpandPaletteIndices4, 2)
+DEFINE_RGBA_CONVERTER(ConvertLinearIndices8ToRGBA, FALSE, ExpandPaletteIndices8, 1)
+DEFINE_RGBA_CONVERTER(ConvertTiledIndices4ToRGBA, TRUE, ExpandPaletteIndices4, 2)
+DEFINE_RGBA_CONVERTER(ConvertTiledIndices8ToRGBA, TRUE, ExpandPaletteIndices8, 1)
+
+/* Picks the converter for an image once, so nothing is decided per pixel. */
+static RGBAConverter GetRGBAConverter(bool32 isTiled, u32 bitsPerPixel)
+{
+	if (isTiled)
+	{
+		return bitsPerPixel == 4 ? ConvertTiledIndices4ToRGBA : ConvertTiledIndices8ToRGBA;
+	}
+	return bitsPerPixel == 4 ? ConvertLinearIndices4ToRGBA : ConvertLinearIndices8ToRGBA;
+}
+
+/* The reverse of TiledToLinear, for putting edited PSP images back. Pixels of a partial
+ * row of tiles that would land past the end of the image are dropped. */
+Memory LinearToTiled(Memory linearImage)
+{
+	u8 linearRow[TILE_ROW_SIZE];
+	u8 tiledRow[TILE_ROW_SIZE];
+	Memory ret = { 0 };
+
 	u32 i = 0;
-	u32 temp[32] = { 0 };
 
-	data = (u32*)palette.data;
-	for (i = 0; i < palette.nColors / colorGroupSize; ++i)
+	ret.data = malloc(linearImage.size);
+	if (!ret.data)
 	{
-		memcpy(temp, &data[i * 32 + 16], 32);
-		memcpy(&data[i * 32 + 16], &data[i * 32 + 8], 32);
-		memcpy(&data[i * 32 + 8], temp, 32);
+		return ret;
+	}
+	ret.size = linearImage.size;
+
+	for (i = 0; i + TILE_ROW_SIZE <= linearImage.size; i += TILE_ROW_SIZE)
+	{
+		TileLinearRow(&linearImage.data[i], &ret.data[i]);
 	}
-	for (i = 0; i < palette.nColors; ++i)
+	if (i < linearImage.size)
 	{
-		if (data[i] & 0x80000000)
+		memset(linearRow, 0, sizeof(linearRow));
+		memcpy(linearRow, &linearImage.data[i], linearImage.size - i);
+		TileLinearRow(linearRow, tiledRow);
+		memcpy(&ret.data[i], tiledRow, linearImage.size - i);
+	}
+	return ret;
+}
+
+/* The reverse of UntileTileRow */
+static void TileLinearRow(const u8* linearRow, u8* tiledRow)
+{
+	u32 tile = 0;
+	u32 row = 0;
+
+	for (row = 0; row < TILE_HEIGHT; ++row)
+	{
+		for (tile = 0; tile < TILES_PER_ROW; ++tile)
 		{
-			data[i] |= 0xFF000000;
+			memcpy(&tiledRow[tile * TILE_SIZE + row * TILE_WIDTH], &linearRow[row * PSP_IMAGE_DEFAULT_WIDTH + tile * TILE_WIDTH], TILE_WIDTH);
 		}
-		else
+	}
+}
+
+static void PNGWriteToMemory(png_structp pngWritePtr, png_bytep data, png_size_t length)
+{
+	PNGOutputBuffer* buffer = NULL;
+	u8* newData = NULL;
+	u32 newCapacity = 0;
+
+	buffer = png_get_io_ptr(pngWritePtr);
+	if (buffer->memory.size + length > buffer->capacity)
+	{
+		newCapacity = buffer->capacity ? buffer->capacity * 2 : 64 * 1024;
+		while (newCapacity < buffer->memory.size + length)
+		{
+			newCapacity *= 2;
+		}
+		newData = TrackedRealloc(buffer->memory.data, newCapacity, MEMORY_STAGE_ENCODE);
+		if (!newData)
 		{
-			data[i] += data[i] & 0xFF000000;
+			png_error(pngWritePtr, "Out of memory");
 		}
+		buffer->memory.data = newData;
+		buffer->capacity = newCapacity;
 	}
+	memcpy(&buffer->memory.data[buffer->memory.size], data, length);
+	buffer->memory.size += (u32)length;
 }
 
-bool32 WriteToPNG(Memory decompressedImage, Palette palette, u32 width, u32 height, const char* outputPath)
+static void PNGFlushMemory(png_structp pngWritePtr)
 {
-	FILE* outputFile = NULL;
-	png_structp pngWritePtr = NULL;
-	png_infop pngInfoPtr = NULL;
-	u8** rowPointers = NULL;
+	/* Nothing to flush, it's all in memory */
+	(void)pngWritePtr;
+}
 
-	u32* paletteData = NULL;
-	u32* finalImageData = NULL;
-	u32 i = 0;
+/* Encodes the image as an RGBA PNG in memory using the given profile.
+ * On success, encodedImage->data must be freed by the caller with TrackedFree. */
+bool32 EncodePNG(Memory decompressedImage, Palette palette, u32 width, u32 height, PNGEncodeProfile profile, Memory* encodedImage)
+{
+	DecodedImage decodedImage = { 0 };
 
-	paletteData = (u32*)palette.data;
+	decodedImage.pixels = decompressedImage;
+	decodedImage.palette = palette;
+	decodedImage.width = width;
+	decodedImage.height = height;
+	decodedImage.bitsPerPixel = palette.nColors != 256 ? 4 : 8;
+	return EncodeDecodedImagePNG(decodedImage, profile, encodedImage);
+}
 
-	/* setup output file, memory, and libpng */
-	outputFile = fopen(outputPath, "wb");
-	if (!outputFile)
+/* Like EncodePNG, but also takes PSP pixels that are still in tiles.
+ * On success, encodedImage->data must be freed by the caller with TrackedFree. */
+bool32 EncodeDecodedImagePNG(DecodedImage decodedImage, PNGEncodeProfile profile, Memory* encodedImage)
+{
+	RGBAConverter convert = NULL;
+	u32* finalImageData = NULL;
+	bool32 success = FALSE;
+
+	/* setup memory */
+	finalImageData = TrackedMalloc(decodedImage.pixels.size * (decodedImage.bitsPerPixel == 4 ? 8 : 4), MEMORY_STAGE_EXPAND);
+	if (!finalImageData)
 	{
 		return FALSE;
 	}
-	if (palette.nColors != 256)
+
+	/* Prepare image data for writing as PNG */
+	convert = GetRGBAConverter(decodedImage.isTiled, decodedImage.bitsPerPixel);
+	convert(decodedImage.pixels.data, decodedImage.pixels.size, (const u32*)decodedImage.palette.data, finalImageData);
+	success = EncodeRGBAImagePNG(finalImageData, decodedImage.width, decodedImage.height, profile, encodedImage);
+	TrackedFree(finalImageData);
+	return success;
+}
+
+/* Encodes width * height RGBA u32s as a PNG with the given profile.
+ * On success, encodedImage->data must be freed by the caller with TrackedFree. */
+bool32 EncodeRGBAImagePNG(const u32* rgba, u32 width, u32 height, PNGEncodeProfile profile, Memory* encodedImage)
+{
+	const PNGEncodeParameters* attempts = NULL;
+	u32 nAttempts = 0;
+	Memory attempt = { 0 };
+	Memory smallest = { 0 };
+	u8** rowPointers = NULL;
+
+	u32 i = 0;
+
+	switch (profile)
 	{
-		finalImageData = malloc(decompressedImage.size * 8);
+	case PNG_ENCODE_PROFILE_FAST:
+		attempts = fastParameters;
+		nAttempts = NUM_ELEMENTS(fastParameters);
+		break;
+	case PNG_ENCODE_PROFILE_MAXIMUM:
+		attempts = maximumParameters;
+		nAttempts = NUM_ELEMENTS(maximumParameters);
+		break;
+	default:
+		attempts = defaultParameters;
+		nAttempts = NUM_ELEMENTS(defaultParameters);
+		break;
 	}
-	else
+
+	rowPointers = malloc(sizeof(u8*) * height);
+	if (!rowPointers)
+	{
+		return FALSE;
+	}
+	for (i = 0; i < height; ++i)
 	{
-		finalImageData = malloc(decompressedImage.size * 4);
+		rowPointers[i] = (u8*)(&rgba[width * i]);
 	}
-	if (!finalImageData)
+
+	/* Encode once per set of parameters in the profile and keep the smallest result */
+	for (i = 0; i < nAttempts; ++i)
 	{
-		fclose(outputFile);
-		return FALSE;
+		if (!EncodeRGBAPNG(rowPointers, width, height, &attempts[i], &attempt))
+		{
+			continue;
+		}
+		if (!smallest.data || attempt.size < smallest.size)
+		{
+			TrackedFree(smallest.data);
+			smallest = attempt;
+		}
+		else
+		{
+			TrackedFree(attempt.data);
+		}
 	}
-	rowPointers = malloc(sizeof(u8*) * height);
-	if (!rowPointers)
+
+	/* Cleanup */
+	free(rowPointers);
+	if (!smallest.data)
 	{
-		fclose(outputFile);
-		free(finalImageData);
 		return FALSE;
 	}
+	*encodedImage = smallest;
+	return TRUE;
+}
+
+static bool32 EncodeRGBAPNG(u8** rowPointers, u32 width, u32 height, const PNGEncodeParameters* parameters, Memory* encodedImage)
+{
+	PNGOutputBuffer outputBuffer = { 0 };
+	png_structp pngWritePtr = NULL;
+	png_infop pngInfoPtr = NULL;
+
+	/* setup libpng */
 	pngWritePtr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (!pngWritePtr)
 	{
-		fclose(outputFile);
-		free(finalImageData);
-		free(rowPointers);
 		return FALSE;
 	}
 	pngInfoPtr = png_create_info_struct(pngWritePtr);
 	if (!pngInfoPtr)
 	{
-		fclose(outputFile);
-		free(finalImageData);
-		free(rowPointers);
 		png_destroy_write_struct(&pngWritePtr, NULL);
 		return FALSE;
 	}
 	if (setjmp(png_jmpbuf(pngWritePtr)))
 	{
-		fclose(outputFile);
-		free(finalImageData);
-		free(rowPointers);
+		TrackedFree(outputBuffer.memory.data);
 		png_destroy_write_struct(&pngWritePtr, &pngInfoPtr);
 		return FALSE;
 	}
-	png_init_io(pngWritePtr, outputFile);
+	png_set_write_fn(pngWritePtr, &outputBuffer, PNGWriteToMemory, PNGFlushMemory);
+	if (parameters->compressionLevel != PNG_ENCODE_LIBPNG_DEFAULT)
+	{
+		png_set_compression_level(pngWritePtr, parameters->compressionLevel);
+		png_set_compression_mem_level(pngWritePtr, MAX_MEM_LEVEL);
+	}
+	if (parameters->filters != PNG_ENCODE_LIBPNG_DEFAULT)
+	{
+		png_set_filter(pngWritePtr, PNG_FILTER_TYPE_BASE, parameters->filters);
+	}
+	if (parameters->strategy != PNG_ENCODE_LIBPNG_DEFAULT)
+	{
+		png_set_compression_strategy(pngWritePtr, parameters->strategy);
+	}
 	png_set_IHDR(pngWritePtr, pngInfoPtr, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 	png_write_info(pngWritePtr, pngInfoPtr);
+	png_write_image(pngWritePtr, rowPointers);
+	png_write_end(pngWritePtr, NULL);
+
+	png_destroy_write_struct(&pngWritePtr, &pngInfoPtr);
+	*encodedImage = outputBuffer.memory;
+	return TRUE;
+}
 
-	/* Prepare image data for writing as PNG and then write to the PNG */
-	if (palette.nColors != 256)
+const char* GetPNGEncodeProfileName(PNGEncodeProfile profile)
+{
+	switch (profile)
 	{
-		for (i = 0; i < decompressedImage.size; ++i)
-		{
-			finalImageData[i * 2] = paletteData[decompressedImage.data[i] & 0xF];
-			finalImageData[i * 2 + 1] = paletteData[(decompressedImage.data[i] & 0xF0) >> 4];
-		}
+	case PNG_ENCODE_PROFILE_FAST:
+		return "fast";
+	case PNG_ENCODE_PROFILE_MAXIMUM:
+		return "maximum";
+	default:
+		return "default";
 	}
-	else if (palette.nColors == 0)
+}
+
+bool32 WriteToPNG(Memory decompressedImage, Palette palette, u32 width, u32 height, const char* outputPath)
+{
+	Memory encodedImage = { 0 };
+	bool32 success = FALSE;
+
+	if (!EncodePNG(decompressedImage, palette, width, height, PNG_ENCODE_PROFILE_DEFAULT, &encodedImage))
 	{
-		for (i = 0; i < decompressedImage.size; ++i)
-		{
-			finalImageData[i] = decompressedImage.data[i];
-		}
+		return FALSE;
+	}
+	success = WriteMemoryToFile(encodedImage, outputPath);
+	TrackedFree(encodedImage.data);
+	return success;
+}
+
+/* Writes a decoded image out in the format chosen by output, either to its own file or into the sink. */
+bool32 WriteDecodedImage(DecodedImage decodedImage, const char* outputPath, OutputSettings output)
+{
+	Memory encodedImage = { 0 };
+	bool32 success = FALSE;
+
+	/* Raw images need no encoding, and thumbnails are mostly encoding */
+	if (output.format == OUTPUT_FORMAT_RAW)
+	{
+		BeginTraceEvent(TRACE_STAGE_WRITE, outputPath, TRACE_NO_INDEX);
+		success = WriteRawImage(decodedImage, outputPath, output);
+		EndTraceEvent(TRACE_STAGE_WRITE);
+		return success;
+	}
+	if (output.format == OUTPUT_FORMAT_THUMBNAIL)
+	{
+		BeginTraceEvent(TRACE_STAGE_ENCODE, outputPath, TRACE_NO_INDEX);
+		success = WriteThumbnail(decodedImage, outputPath, output);
+		EndTraceEvent(TRACE_STAGE_ENCODE);
+		return success;
+	}
+
+	BeginTraceEvent(TRACE_STAGE_ENCODE, outputPath, TRACE_NO_INDEX);
+	success = EncodeDecodedImagePNG(decodedImage, output.encodeProfile, &encodedImage);
+	EndTraceEvent(TRACE_STAGE_ENCODE);
+	if (!success)
+	{
+		return FALSE;
+	}
+	BeginTraceEvent(TRACE_STAGE_WRITE, outputPath, TRACE_NO_INDEX);
+	if (output.sink)
+	{
+		success = WriteToOutputSink(output.sink, outputPath, encodedImage);
 	}
 	else
 	{
-		for (i = 0; i < decompressedImage.size; ++i)
+		success = WriteMemoryToFile(encodedImage, outputPath);
+	}
+	EndTraceEvent(TRACE_STAGE_WRITE);
+	TrackedFree(encodedImage.data);
+	return success;
+}
+
+
+/* Decompresses and untiles an image's palette indices. On success, the returned memory must be freed by the caller with TrackedFree. */
+Memory DecodeImagePixels(u8* header, Platform platform, ImageCodecStats* stats)
+{
+	Memory decompressedImage = { 0 };
+	Memory untiledImage = { 0 };
+
+	decompressedImage = DecompressImageSubfiles(header, platform, 0, LittleEndianRead32(header), stats);
+	if (!decompressedImage.data || platform != PLATFORM_PSP)
+	{
+		return decompressedImage;
+	}
+	BeginTraceEvent(TRACE_STAGE_UNTILE, NULL, TRACE_NO_INDEX);
+	untiledImage = TiledToLinear(decompressedImage);
+	EndTraceEvent(TRACE_STAGE_UNTILE);
+	TrackedFree(decompressedImage.data);
+	return untiledImage;
+}
+
+/* Fills in decodedImage for already decoded pixels, working out the palette and dimensions.
+ * decodedImage->pixels is set to pixels, so whoever owns pixels still has to free them. */
+bool32 InitDecodedImage(Memory image, ImageInfo imageInfo, u32 imageIndex, Platform platform, u32 customWidth, Memory pixels, DecodedImage* decodedImage)
+{
+	Palette palette = { 0 };
+	u32 width = 0;
+	u32 height = 0;
+
+	palette = imageInfo.palettes[imageIndex];
+	if (platform == PLATFORM_PS2)
+	{
+		BeginTraceEvent(TRACE_STAGE_PALETTE, NULL, imageIndex);
+		palette = GetCorrectedPS2Palette(imageInfo.palettes[imageIndex]);
+		EndTraceEvent(TRACE_STAGE_PALETTE);
+		if (!palette.data)
 		{
-			finalImageData[i] = paletteData[decompressedImage.data[i]];
+			return FALSE;
 		}
 	}
-	for (i = 0; i < height; ++i)
+	width = GetImageWidth(image, imageInfo, platform, customWidth);
+	if (width == 0)
 	{
-		rowPointers[i] = (u8*)(&finalImageData[width * i]);
+		printf("Image %u has a MAP width of 0 and no custom width\n", imageIndex);
+		return FALSE;
+	}
+	if (palette.nColors == 16)
+	{
+		height = (pixels.size / width) * 2;
+	}
+	else
+	{
+		height = pixels.size / width;
 	}
-	png_write_image(pngWritePtr, rowPointers);
-	png_write_end(pngWritePtr, NULL);
 
-	/* Cleanup */
-	fclose(outputFile);
-	free(finalImageData);
-	free(rowPointers);
-	png_destroy_write_struct(&pngWritePtr, &pngInfoPtr);
+	decodedImage->pixels = pixels;
+	decodedImage->palette = palette;
+	decodedImage->sourcePalette = imageInfo.palettes[imageIndex];
+	decodedImage->platform = platform;
+	decodedImage->width = width;
+	decodedImage->height = height;
+	decodedImage->bitsPerPixel = palette.nColors == 16 ? 4 : 8;
+	decodedImage->isTiled = FALSE;
 	return TRUE;
 }
 
-bool32 ConvertRGOImageToPNG(Memory image, ImageInfo imageInfo, u8* header, u32 imageIndex, const char* imageOutputPath, u32 customWidth)
+/* The width an image is decoded at: customWidth if it isn't 0, otherwise the PS2 MAP data width
+ * or the platform's default width. Can be 0 if the MAP data says so. */
+u32 GetImageWidth(Memory image, ImageInfo imageInfo, Platform platform, u32 customWidth)
+{
+	MAPData mapData = { 0 };
+
+	if (customWidth)
+	{
+		return customWidth;
+	}
+	if (platform == PLATFORM_PSP)
+	{
+		return PSP_IMAGE_DEFAULT_WIDTH;
+	}
+	if (FindMAPData(image, imageInfo, &mapData))
+	{
+		return mapData.width; /* PSP ignores this aspect of the MAP data */
+	}
+	return PS2_IMAGE_DEFAULT_WIDTH;
+}
+
+/* Decompresses and untiles an image and works out its dimensions. On success,
+ * decodedImage->pixels must be freed by the caller with TrackedFree. */
+bool32 DecodeRGOImage(Memory image, ImageInfo imageInfo, u8* header, u32 imageIndex, u32 customWidth, DecodedImage* decodedImage)
 {
-	Palette palette = { 0 };
 	Platform platform = 0;
+	Memory pixels = { 0 };
+
+	platform = GetImagePlatform(header);
+	pixels = DecodeImagePixels(header, platform, NULL);
+	if (!pixels.data)
+	{
+		return FALSE;
+	}
+	if (!InitDecodedImage(image, imageInfo, imageIndex, platform, customWidth, pixels, decodedImage))
+	{
+		TrackedFree(pixels.data);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Decodes only the part of an image inside region. Only the subfiles covering the rows of the
+ * region are decompressed, and on PSP only the tile rows covering it are untiled.
+ * On success, decodedImage holds just the region and decodedImage->pixels must be freed by the caller with TrackedFree. */
+bool32 DecodeRGOImageRegion(Memory image, ImageInfo imageInfo, u8* header, u32 imageIndex, u32 customWidth, ImageRegion region, DecodedImage* decodedImage)
+{
+	DecodedImage fullImage = { 0 };
+	Platform platform = 0;
+	Memory fullPixels = { 0 }; /* Only the size is known before decoding */
 	Memory decompressedImage = { 0 };
-	Memory untiledImage = { 0 };
-	u32 width = 0;
-	u32 height = 0;
+	Memory tiledRows = { 0 };
+	Memory linearRows = { 0 };
+	u32 nSubfiles = 0;
+	u32 rowSize = 0;
+	u32 regionStart = 0;
+	u32 regionEnd = 0;
+	u32 subfileStart = 0;
+	u32 subfileSize = 0;
+	u32 decompressedStart = 0;
+	u32 linearStart = 0;
+	u32 firstSubfile = 0;
+	u32 lastSubfile = 0;
+	bool32 foundFirstSubfile = FALSE;
+	bool32 success = FALSE;
+	u32 i = 0;
 
-	palette = imageInfo.palettes[imageIndex];
+	nSubfiles = LittleEndianRead32(header);
+	if (nSubfiles == 0)
+	{
+		return FALSE;
+	}
+
+	/* Work out the dimensions of the full image without decoding any of it */
 	platform = GetImagePlatform(header);
-	decompressedImage = DecompressImage(header, platform);
-	if (!decompressedImage.data)
+	fullPixels.size = GetDecompressedImageSize(header);
+	if (!InitDecodedImage(image, imageInfo, imageIndex, platform, customWidth, fullPixels, &fullImage))
 	{
 		return FALSE;
 	}
-	if (platform == PLATFORM_PS2)
+	if (region.width == 0 || region.height == 0 || region.x + region.width > fullImage.width || region.y + region.height > fullImage.height)
+	{
+		printf("Region %u,%u %ux%u is outside of the %ux%u image\n", region.x, region.y, region.width, region.height, fullImage.width, fullImage.height);
+		return FALSE;
+	}
+
+	/* Find the bytes of the image holding the rows of the region. On PSP, the rows are spread over
+	 * whole tile rows, so the range has to cover all of those. */
+	rowSize = fullImage.bitsPerPixel == 4 ? fullImage.width / 2 : fullImage.width;
+	regionStart = region.y * rowSize;
+	regionEnd = (region.y + region.height) * rowSize;
+	if (platform == PLATFORM_PSP)
 	{
-		CorrectPS2Palette(palette);
-		if (imageInfo.hasMAPData)
+		regionStart = regionStart / TILE_ROW_SIZE * TILE_ROW_SIZE;
+		regionEnd = (regionEnd + TILE_ROW_SIZE - 1) / TILE_ROW_SIZE * TILE_ROW_SIZE;
+		if (regionEnd > fullPixels.size)
 		{
-			width = LittleEndianRead16(&image.data[0x41C]); /* PSP ignores this aspect of the MAP data */
+			regionEnd = fullPixels.size;
 		}
-		else
+	}
+
+	/* Find the subfiles that decompress to those bytes */
+	for (i = 0; i < nSubfiles; ++i)
+	{
+		subfileSize = LittleEndianRead32(&header[LittleEndianRead32(&header[(i + 1) * 4])]);
+		if (!foundFirstSubfile && regionStart < subfileStart + subfileSize)
+		{
+			firstSubfile = i;
+			decompressedStart = subfileStart;
+			foundFirstSubfile = TRUE;
+		}
+		if (foundFirstSubfile)
 		{
-			width = PS2_IMAGE_DEFAULT_WIDTH;
+			lastSubfile = i;
+			if (regionEnd <= subfileStart + subfileSize)
+			{
+				break;
+			}
 		}
+		subfileStart += subfileSize;
+	}
+	if (!foundFirstSubfile)
+	{
+		return FALSE;
+	}
+
+	decompressedImage = DecompressImageSubfiles(header, platform, firstSubfile, lastSubfile - firstSubfile + 1, NULL);
+	if (!decompressedImage.data)
+	{
+		return FALSE;
 	}
-	else if (platform == PLATFORM_PSP)
+	if (platform == PLATFORM_PSP)
 	{
-		untiledImage = TiledToLinear(decompressedImage);
-		if (!untiledImage.data)
+		tiledRows.data = &decompressedImage.data[regionStart - decompressedStart];
+		tiledRows.size = regionEnd - regionStart;
+		linearRows = TiledToLinear(tiledRows);
+		TrackedFree(decompressedImage.data);
+		if (!linearRows.data)
 		{
-			free(decompressedImage.data);
 			return FALSE;
 		}
-		free(decompressedImage.data);
-		decompressedImage = untiledImage;
-
-		width = PSP_IMAGE_DEFAULT_WIDTH;
+		linearStart = regionStart;
 	}
-	if (customWidth)
+	else
 	{
-		width = customWidth;
+		linearRows = decompressedImage;
+		linearStart = decompressedStart;
 	}
-	if (palette.nColors == 16)
+
+	/* Crop the region out of the decoded rows */
+	fullImage.pixels.data = &linearRows.data[region.y * rowSize - linearStart];
+	fullImage.pixels.size = region.height * rowSize;
+	fullImage.height = region.height;
+	region.y = 0;
+	success = CropDecodedImage(fullImage, region, decodedImage);
+	TrackedFree(linearRows.data);
+	return success;
+}
+
+/* Copies region out of a decoded image. The cropped image has the same palette.
+ * On success, croppedImage->pixels must be freed by the caller with TrackedFree. */
+bool32 CropDecodedImage(DecodedImage decodedImage, ImageRegion region, DecodedImage* croppedImage)
+{
+	Memory pixels = { 0 };
+	u32 rowSize = 0;
+	u32 pixelIndex = 0;
+	u32 srcPixel = 0;
+	u8* srcRow = NULL;
+	u32 x = 0;
+	u32 y = 0;
+
+	if (region.width == 0 || region.height == 0 || region.x + region.width > decodedImage.width || region.y + region.height > decodedImage.height)
+	{
+		return FALSE;
+	}
+
+	if (decodedImage.bitsPerPixel == 4)
 	{
-		height = (decompressedImage.size / width) * 2;
+		/* Pixels are packed two to a byte with no padding between rows, just like a full image */
+		pixels.size = (region.width * region.height + 1) / 2;
+		rowSize = decodedImage.width / 2;
 	}
 	else
 	{
-		height = decompressedImage.size / width;
+		pixels.size = region.width * region.height;
+		rowSize = decodedImage.width;
 	}
-	if (!WriteToPNG(decompressedImage, palette, width, height, imageOutputPath))
+	pixels.data = TrackedMalloc(pixels.size, MEMORY_STAGE_DECOMPRESS);
+	if (!pixels.data)
 	{
-		free(decompressedImage.data);
 		return FALSE;
 	}
+	memset(pixels.data, 0, pixels.size);
 
-	free(decompressedImage.data);
+	for (y = 0; y < region.height; ++y)
+	{
+		srcRow = &decodedImage.pixels.data[(region.y + y) * rowSize];
+		if (decodedImage.bitsPerPixel == 4)
+		{
+			for (x = 0; x < region.width; ++x)
+			{
+				srcPixel = (srcRow[(region.x + x) / 2] >> (((region.x + x) & 1) * 4)) & 0xF;
+				pixels.data[pixelIndex / 2] |= srcPixel << ((pixelIndex & 1) * 4);
+				++pixelIndex;
+			}
+		}
+		else
+		{
+			memcpy(&pixels.data[y * region.width], &srcRow[region.x], region.width);
+		}
+	}
+
+	*croppedImage = decodedImage;
+	croppedImage->pixels = pixels;
+	croppedImage->width = region.width;
+	croppedImage->height = region.height;
 	return TRUE;
 }
 
-void ConvertRGOImageToPNGAll(const char* inputPath, const char* outputPath, u32* customWidths)
+/* The number of bytes in an image's header and compressed subfiles, not counting the checksum or padding. */
+u32 GetImageDataSize(const u8* header)
+{
+	u32 nSubfiles = 0;
+	nSubfiles = LittleEndianRead32(header);
+	return LittleEndianRead32(&header[(nSubfiles + 1) * 4]);
+}
+
+ExtractSettings InitExtractSettings(void)
+{
+	ExtractSettings ret = { 0 };
+	ret.writer = NULL;
+	ret.output.sink = NULL;
+	ret.output.encodeProfile = PNG_ENCODE_PROFILE_DEFAULT;
+	ret.output.format = OUTPUT_FORMAT_PNG;
+	ret.output.uncorrectedRawPalette = FALSE;
+	ret.output.thumbnailSize = THUMBNAIL_DEFAULT_SIZE;
+	ret.decodeSharedImagesOnce = TRUE;
+	ret.detectWidths = FALSE;
+	ret.dedup = NULL;
+	ret.codecStats = NULL;
+	ret.memoryBudget = NULL;
+	return ret;
+}
+
+/* Writes out a decoded image, handing it off to the writer threads if there are any.
+ * Takes ownership of decodedImage.pixels and of reservedBytes in the memory budget. */
+static bool32 ExtractDecodedImage(DecodedImage decodedImage, const char* imageOutputPath, const ExtractSettings* settings, u64 reservedBytes)
+{
+	bool32 success = FALSE;
+
+	if (settings->writer)
+	{
+		/* The writer takes ownership of the pixels and the reservation, even on failure */
+		return SubmitImageWrite(settings->writer, decodedImage, imageOutputPath, settings->output, settings->memoryBudget, reservedBytes);
+	}
+	success = WriteDecodedImage(decodedImage, imageOutputPath, settings->output);
+	TrackedFree(decodedImage.pixels.data);
+	ReleaseMemory(settings->memoryBudget, reservedBytes);
+	return success;
+}
+
+/* Tiled pixels can only go to the PNG encoder, so they have to be untiled if anything else is going to look at them.
+ * The encoder untiles whole rows of tiles only, so an image ending in a partial row is untiled up front as well. */
+static bool32 CanKeepPixelsTiled(const u8* header, Platform platform, const ExtractSettings* settings)
+{
+	return platform == PLATFORM_PSP && GetDecompressedImageSize(header) % TILE_ROW_SIZE == 0 &&
+		settings->output.format == OUTPUT_FORMAT_PNG && !settings->detectWidths && !settings->dedup;
+}
+
+/* PSP pixels that are only going to be encoded as a PNG are left in tiles, so that
+ * EncodeDecodedImagePNG can untile them as it goes instead of making an untiled copy. */
+static Memory DecodeExtractedPixels(u8* header, Platform platform, bool32 keepTiled, ImageCodecStats* stats)
+{
+	if (keepTiled)
+	{
+		return DecompressImageSubfiles(header, platform, 0, LittleEndianRead32(header), stats);
+	}
+	return DecodeImagePixels(header, platform, stats);
+}
+
+/* Images after the first in a file get _N added before the extension. outputPathMultipleFiles
+ * already holds outputPath up to appendLocation. */
+static const char* GetImageOutputPath(const char* outputPath, char* outputPathMultipleFiles, u32 appendLocation, u32 imageIndex)
+{
+	if (imageIndex == 0)
+	{
+		return outputPath;
+	}
+	sprintf(&outputPathMultipleFiles[appendLocation], "_%u", imageIndex);
+	strcat(outputPathMultipleFiles, &outputPath[appendLocation]);
+	return outputPathMultipleFiles;
+}
+
+/* Palette swapped images often have exactly the same compressed data. For every image, finds
+ * the first image with identical data, so that data only needs to be decoded once. */
+static void FindImagesWithSharedData(u8** headers, u32 nImages, u32* sharedWith)
+{
+	u32 dataSizes[MAX_IMAGES_PER_FILE] = { 0 };
+	u32 checksums[MAX_IMAGES_PER_FILE] = { 0 };
+	u32 i = 0;
+	u32 j = 0;
+
+	for (i = 0; i < nImages; ++i)
+	{
+		dataSizes[i] = GetImageDataSize(headers[i]);
+		checksums[i] = crc32(0, headers[i], dataSizes[i]);
+		sharedWith[i] = i;
+		for (j = 0; j < i; ++j)
+		{
+			if (sharedWith[j] == j && dataSizes[j] == dataSizes[i] && checksums[j] == checksums[i] &&
+				memcmp(headers[j], headers[i], dataSizes[i]) == 0)
+			{
+				sharedWith[i] = j;
+				break;
+			}
+		}
+	}
+}
+
+/* Returns the number of images in the file, or 0 if it couldn't be extracted at all */
+u32 ConvertRGOImageToPNGAll(const char* inputPath, const char* outputPath, u32* customWidths, const ExtractSettings* settings)
 {
+	ExtractSettings defaultSettings = { 0 };
 	Memory image = { 0 };
 	ImageInfo imageInfo = { 0 };
-	u8* header = NULL;
+	u8* headers[MAX_IMAGES_PER_FILE] = { 0 };
+	u32 sharedWith[MAX_IMAGES_PER_FILE] = { 0 };
+	u32 nUsersLeft[MAX_IMAGES_PER_FILE] = { 0 };
+	u32 decodedBy[MAX_IMAGES_PER_FILE] = { 0 };
+	u32 firstDecodedInGroup[MAX_IMAGES_PER_FILE] = { 0 };
+	bool32 isDuplicate[MAX_IMAGES_PER_FILE] = { 0 };
+	ImageDataKey dataKeys[MAX_IMAGES_PER_FILE] = { { 0 } };
+	Memory sharedPixels[MAX_IMAGES_PER_FILE] = { { 0 } };
+	u64 sharedPixelsReservedBytes[MAX_IMAGES_PER_FILE] = { 0 };
+	u64 totalSharedPixelsReservedBytes = 0;
+	u64 reservedBytes = 0;
+	Memory pixels = { 0 };
+	DecodedImage decodedImage = { 0 };
+	ImageCodecStats codecStats = { 0 };
+	Platform platform = 0;
+	u32 source = 0;
 	u32 i = 0;
 	char* outputPathMultipleFiles = NULL;
+	const char* imageOutputPath = NULL;
 	u32 appendLocation = 0;
 	char* appendPtr = NULL;
 	u32 imageWidth = 0;
+	u32 detectedWidth = 0;
+	bool32 keepTiled = FALSE;
+
+	if (!settings)
+	{
+		defaultSettings = InitExtractSettings();
+		settings = &defaultSettings;
+	}
 
+	BeginTraceEvent(TRACE_STAGE_FILE, inputPath, TRACE_NO_INDEX);
+	BeginTraceEvent(TRACE_STAGE_LOAD, NULL, TRACE_NO_INDEX);
+	SetTrackedImage(inputPath);
 	image = LoadFile(inputPath);
+	TrackAllocation(image.data, image.size, MEMORY_STAGE_LOAD);
+	EndTraceEvent(TRACE_STAGE_LOAD);
 	if (!image.data)
 	{
 		LOAD_FILE_FAIL_MESSAGE(inputPath);
-		return;
-	}
-	imageInfo = GetImageInfo(image);
-	header = GetImageHeader(image, imageInfo, 0);
-	if (customWidths)
-	{
-		imageWidth = customWidths[0];
+		EndTraceEvent(TRACE_STAGE_FILE);
+		return 0;
 	}
-	if (!ConvertRGOImageToPNG(image, imageInfo, header, 0, outputPath, imageWidth))
+	BeginTraceEvent(TRACE_STAGE_INFO, NULL, TRACE_NO_INDEX);
+	if (!ValidateContainer(image, &imageInfo))
 	{
-		printf("Failed to extract image 0 in %s\n", inputPath);
+		printf("Skipping corrupt file %s\n", inputPath);
+		TrackedFree(image.data);
+		EndTraceEvent(TRACE_STAGE_INFO);
+		EndTraceEvent(TRACE_STAGE_FILE);
+		return 0;
 	}
 	if (imageInfo.nImages > 1)
 	{
 		outputPathMultipleFiles = malloc(strlen(outputPath) + 256); /* Just something reasonably big enough */
 		if (!outputPathMultipleFiles)
 		{
-			free(image.data);
-			return;
+			TrackedFree(image.data);
+			EndTraceEvent(TRACE_STAGE_INFO);
+			EndTraceEvent(TRACE_STAGE_FILE);
+			return 0;
 		}
 		appendPtr = strrchr(outputPath, '.');
 		if (!appendPtr)
@@ -671,20 +1578,150 @@ void ConvertRGOImageToPNGAll(const char* inputPath, const char* outputPath, u32*
 		}
 		memcpy(outputPathMultipleFiles, outputPath, appendLocation);
 	}
+
+	headers[0] = GetImageHeader(image, imageInfo, 0);
+	sharedWith[0] = 0;
 	for (i = 1; i < imageInfo.nImages; ++i)
 	{
-		sprintf(&outputPathMultipleFiles[appendLocation], "_%u", i);
-		strcat(outputPathMultipleFiles, &outputPath[appendLocation]);
-		header = GetNextImageHeader(header);
+		headers[i] = GetNextImageHeader(headers[i - 1]);
+		sharedWith[i] = i;
+	}
+	if (settings->decodeSharedImagesOnce)
+	{
+		FindImagesWithSharedData(headers, imageInfo.nImages, sharedWith);
+	}
+	EndTraceEvent(TRACE_STAGE_INFO);
+
+	/* Images already extracted from other files are skipped before they're even decoded */
+	if (settings->dedup)
+	{
+		for (i = 0; i < imageInfo.nImages; ++i)
+		{
+			dataKeys[i] = GetImageDataKey(headers[i], imageInfo.palettes[i],
+				GetImageWidth(image, imageInfo, GetImagePlatform(headers[i]), customWidths ? customWidths[i] : 0));
+			isDuplicate[i] = FindDuplicateImageData(settings->dedup, &dataKeys[i],
+				GetImageOutputPath(outputPath, outputPathMultipleFiles, appendLocation, i));
+		}
+	}
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		firstDecodedInGroup[i] = MAX_IMAGES_PER_FILE;
+	}
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		if (isDuplicate[i])
+		{
+			continue;
+		}
+		if (firstDecodedInGroup[sharedWith[i]] == MAX_IMAGES_PER_FILE)
+		{
+			firstDecodedInGroup[sharedWith[i]] = i;
+		}
+		decodedBy[i] = firstDecodedInGroup[sharedWith[i]];
+		++nUsersLeft[decodedBy[i]];
+	}
+
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		if (isDuplicate[i])
+		{
+			continue;
+		}
+		imageOutputPath = GetImageOutputPath(outputPath, outputPathMultipleFiles, appendLocation, i);
 		if (customWidths)
 		{
 			imageWidth = customWidths[i];
 		}
-		if (!ConvertRGOImageToPNG(image, imageInfo, header, i, outputPathMultipleFiles, imageWidth))
+
+		/* Only the first image of each group with identical data gets decoded. The
+		 * last image in the group takes the pixels, the rest get their own copy. */
+		source = decodedBy[i];
+		platform = GetImagePlatform(headers[i]);
+		keepTiled = CanKeepPixelsTiled(headers[i], platform, settings);
+		SetTrackedImage(imageOutputPath);
+
+		/* The first image of a group also holds on to the decoded pixels for the rest of the
+		 * group, so that's reserved along with it until the last image in the group takes them */
+		if (settings->memoryBudget)
+		{
+			reservedBytes = EstimateImagePeakMemory(headers[i], platform, imageInfo.palettes[i], settings->output);
+			if (source == i && nUsersLeft[i] > 1)
+			{
+				sharedPixelsReservedBytes[i] = GetDecompressedImageSize(headers[i]);
+			}
+			ReserveMemory(settings->memoryBudget, reservedBytes + (source == i ? sharedPixelsReservedBytes[i] : 0), totalSharedPixelsReservedBytes);
+			if (source == i)
+			{
+				totalSharedPixelsReservedBytes += sharedPixelsReservedBytes[i];
+			}
+		}
+		if (source == i && settings->codecStats && InitImageCodecStats(headers[i], platform, &codecStats))
+		{
+			sharedPixels[i] = DecodeExtractedPixels(headers[i], platform, keepTiled, &codecStats);
+			codecStats.nPaletteColors = imageInfo.palettes[i].nColors;
+			if (i + 1 < imageInfo.nImages)
+			{
+				codecStats.nPaddingKilobytes = GetImagePaddingKilobytes(headers[i]);
+			}
+			AddImageCodecStats(settings->codecStats, inputPath, i, &codecStats);
+		}
+		else if (source == i)
+		{
+			sharedPixels[i] = DecodeExtractedPixels(headers[i], platform, keepTiled, NULL);
+		}
+		--nUsersLeft[source];
+		pixels = sharedPixels[source];
+		if (pixels.data && nUsersLeft[source] > 0)
+		{
+			pixels.data = TrackedMalloc(sharedPixels[source].size, platform == PLATFORM_PSP && !keepTiled ? MEMORY_STAGE_UNTILE : MEMORY_STAGE_DECOMPRESS);
+			if (pixels.data)
+			{
+				memcpy(pixels.data, sharedPixels[source].data, pixels.size);
+			}
+		}
+		else
+		{
+			sharedPixels[source].data = NULL;
+		}
+		if (nUsersLeft[source] == 0 && sharedPixelsReservedBytes[source])
+		{
+			ReleaseMemory(settings->memoryBudget, sharedPixelsReservedBytes[source]);
+			totalSharedPixelsReservedBytes -= sharedPixelsReservedBytes[source];
+			sharedPixelsReservedBytes[source] = 0;
+		}
+
+		if (!pixels.data || !InitDecodedImage(image, imageInfo, i, platform, imageWidth, pixels, &decodedImage))
+		{
+			TrackedFree(pixels.data);
+			ReleaseMemory(settings->memoryBudget, reservedBytes);
+			printf("Failed to extract image %u in %s\n", i, inputPath);
+			continue;
+		}
+		decodedImage.isTiled = keepTiled;
+
+		/* The PS2 MAP data width is always right, so only guess when there's nothing else to go on */
+		if (settings->detectWidths && !imageWidth && !(platform == PLATFORM_PS2 && imageInfo.hasMAPData))
+		{
+			detectedWidth = DetectImageWidth(decodedImage);
+			if (detectedWidth != decodedImage.width)
+			{
+				InitDecodedImage(image, imageInfo, i, platform, detectedWidth, pixels, &decodedImage);
+			}
+		}
+		if (settings->dedup && FindDuplicateDecodedImage(settings->dedup, &dataKeys[i], decodedImage, imageOutputPath))
+		{
+			TrackedFree(decodedImage.pixels.data);
+			ReleaseMemory(settings->memoryBudget, reservedBytes);
+			continue;
+		}
+		if (!ExtractDecodedImage(decodedImage, imageOutputPath, settings, reservedBytes))
 		{
 			printf("Failed to extract image %u in %s\n", i, inputPath);
 		}
 	}
-	free(image.data);
+	TrackedFree(image.data);
 	free(outputPathMultipleFiles);
+	SetTrackedImage(NULL);
+	EndTraceEvent(TRACE_STAGE_FILE);
+	return imageInfo.nImages;
 }
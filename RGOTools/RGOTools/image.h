@@ -22,6 +22,8 @@
 
 #include "util.h"
 
+#define MAX_IMAGES_PER_FILE 32 /* No file has more than 32 images */
+
 typedef struct
 {
 	u32 nColors;
@@ -33,19 +35,95 @@ typedef struct
 	u32 nImages;
 	bool32 hasMAPData;
 	u8* firstHeader;
-	Palette palettes[32]; /* No file has more than 32 images */
+	Palette palettes[MAX_IMAGES_PER_FILE];
 } ImageInfo;
 
+/* An image that has been decompressed and, unless isTiled, untiled, ready to be written out. */
+typedef struct
+{
+	Memory pixels; /* Palette indices in linear order unless isTiled, owned by whoever decoded the image */
+	Palette palette; /* Ready to use. For PS2 images, this is the corrected palette from the palette cache. */
+	Palette sourcePalette; /* The palette as it is in the file */
+	Platform platform;
+	u32 width;
+	u32 height;
+	u32 bitsPerPixel; /* 4 for 16 color images, where the left pixel of each pair is in the low nibble, otherwise 8 */
+	bool32 isTiled; /* PSP pixels left in 16 x 8 tiles because they're only going to be encoded as a PNG, which untiles as it goes */
+} DecodedImage;
+
+/* A rectangle of pixels within an image. */
+typedef struct
+{
+	u32 x;
+	u32 y;
+	u32 width;
+	u32 height;
+} ImageRegion;
+
+typedef enum
+{
+	PNG_ENCODE_PROFILE_DEFAULT, /* libpng's default compression level and filter heuristics */
+	PNG_ENCODE_PROFILE_FAST,    /* Compression level 1 and no filtering. For quick previews. */
+	PNG_ENCODE_PROFILE_MAXIMUM  /* Compression level 9, trying every filter and strategy and keeping the smallest. For archiving. */
+} PNGEncodeProfile;
+
+typedef enum
+{
+	OUTPUT_FORMAT_PNG,
+	OUTPUT_FORMAT_RAW, /* Palette indices and palette as they are in memory. See raw.h. */
+	OUTPUT_FORMAT_THUMBNAIL /* A small PNG preview. See thumbnail.h. */
+} OutputFormat;
+
+/* How decoded images are written out. */
+typedef struct
+{
+	struct OutputSink* sink; /* If NULL, every image is written to its own file */
+	OutputFormat format;
+	PNGEncodeProfile encodeProfile;
+	bool32 uncorrectedRawPalette; /* Write PS2 raw palettes as they are in the file instead of corrected */
+	u32 thumbnailSize; /* The longest side of a thumbnail in pixels */
+} OutputSettings;
+
+/* Controls how ConvertRGOImageToPNGAll produces its output. Get the defaults from InitExtractSettings. */
+typedef struct
+{
+	struct ImageWriter* writer; /* If not NULL, images are encoded and written on the writer's threads, as output below says */
+	struct DedupIndex* dedup; /* If not NULL, images that would come out the same as an earlier one are skipped. See dedup.h. */
+	struct CodecStatsCollector* codecStats; /* If not NULL, counters on how each decoded image was compressed are added to it. See stats.h. */
+	struct MemoryBudget* memoryBudget; /* If not NULL, images wait to be decoded until their estimated memory fits in it. See budget.h. */
+	OutputSettings output;
+	bool32 decodeSharedImagesOnce; /* Images with identical compressed data are decoded once and rendered with each palette */
+	bool32 detectWidths; /* Guess the width of images that have no custom width and no PS2 MAP width. Off by default. See width.h. */
+} ExtractSettings;
+
+struct ImageCodecStats; /* See stats.h */
+
 ImageInfo GetImageInfo(Memory imageData);
+bool32 ValidateContainer(Memory imageData, ImageInfo* imageInfo);
 u8* GetImageHeader(Memory imageData, ImageInfo imageInfo, u32 index);
 u8* GetNextImageHeader(u8* currentHeader);
+u32 GetImagePaddingKilobytes(const u8* header);
 Platform GetImagePlatform(const u8* header);
+u32 GetDecompressedImageSize(const u8* header);
 Memory DecompressImage(u8* header, Platform platform);
+Memory DecompressImageSubfiles(u8* header, Platform platform, u32 firstSubfile, u32 nSubfilesToDecompress, struct ImageCodecStats* stats);
+bool32 EncodePNG(Memory decompressedImage, Palette palette, u32 width, u32 height, PNGEncodeProfile profile, Memory* encodedImage);
+bool32 EncodeDecodedImagePNG(DecodedImage decodedImage, PNGEncodeProfile profile, Memory* encodedImage);
+bool32 EncodeRGBAImagePNG(const u32* rgba, u32 width, u32 height, PNGEncodeProfile profile, Memory* encodedImage);
+const char* GetPNGEncodeProfileName(PNGEncodeProfile profile);
 bool32 WriteToPNG(Memory decompressedImage, Palette palette, u32 width, u32 height, const char* outputPath);
+bool32 WriteDecodedImage(DecodedImage decodedImage, const char* outputPath, OutputSettings output);
 Memory TiledToLinear(Memory tiledImage);
-void CorrectPS2Palette(Palette palette);
-bool32 ConvertRGOImageToPNG(Memory image, ImageInfo imageInfo, u8* header, u32 imageIndex, const char* imageOutputPath, u32 customWidth);
-void ConvertRGOImageToPNGAll(const char* inputPath, const char* outputPath, u32* customWidths);
+Memory LinearToTiled(Memory linearImage);
+Memory DecodeImagePixels(u8* header, Platform platform, struct ImageCodecStats* stats);
+u32 GetImageWidth(Memory image, ImageInfo imageInfo, Platform platform, u32 customWidth);
+bool32 InitDecodedImage(Memory image, ImageInfo imageInfo, u32 imageIndex, Platform platform, u32 customWidth, Memory pixels, DecodedImage* decodedImage);
+u32 GetImageDataSize(const u8* header);
+bool32 DecodeRGOImage(Memory image, ImageInfo imageInfo, u8* header, u32 imageIndex, u32 customWidth, DecodedImage* decodedImage);
+bool32 DecodeRGOImageRegion(Memory image, ImageInfo imageInfo, u8* header, u32 imageIndex, u32 customWidth, ImageRegion region, DecodedImage* decodedImage);
+bool32 CropDecodedImage(DecodedImage decodedImage, ImageRegion region, DecodedImage* croppedImage);
+ExtractSettings InitExtractSettings(void);
+u32 ConvertRGOImageToPNGAll(const char* inputPath, const char* outputPath, u32* customWidths, const ExtractSettings* settings);
 void DecompressPS2Subimage(u8* src, u8* dst, u32 numBytesToDecompress);
 
 #endif
@@ -0,0 +1,258 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  import.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "OutsideCode/libpng/png.h"
+#include "util.h"
+#include "image.h"
+#include "palette.h"
+#include "repack.h"
+#include "import.h"
+#include "alloc.h"
+
+static u32 FindNearestColor(u32 color, const u32* palette, u32 nColors);
+static bool32 MapColorsToIndices(const u32* rgba, DecodedImage original, Memory* pixels, ImportResult* result);
+
+/* Loads any PNG as width * height RGBA u32s in the same byte order EncodePNG writes them.
+ * On success, *rgba must be freed by the caller. */
+bool32 LoadPNG(const char* path, u32** rgba, u32* width, u32* height)
+{
+	png_image image = { 0 };
+	u32* ret = NULL;
+
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_file(&image, path))
+	{
+		printf("Could not read PNG %s: %s\n", path, image.message);
+		return FALSE;
+	}
+	image.format = PNG_FORMAT_RGBA;
+	ret = malloc(PNG_IMAGE_SIZE(image));
+	if (!ret)
+	{
+		png_image_free(&image);
+		return FALSE;
+	}
+	if (!png_image_finish_read(&image, NULL, ret, 0, NULL))
+	{
+		printf("Could not read PNG %s: %s\n", path, image.message);
+		free(ret);
+		return FALSE;
+	}
+	*rgba = ret;
+	*width = image.width;
+	*height = image.height;
+	return TRUE;
+}
+
+static u32 FindNearestColor(u32 color, const u32* palette, u32 nColors)
+{
+	u32 nearest = 0;
+	u32 nearestDistance = 0xFFFFFFFF;
+	u32 distance = 0;
+	int difference = 0;
+	u32 i = 0;
+	u32 channel = 0;
+
+	for (i = 0; i < nColors; ++i)
+	{
+		distance = 0;
+		for (channel = 0; channel < 32; channel += 8)
+		{
+			difference = (int)((color >> channel) & 0xFF) - (int)((palette[i] >> channel) & 0xFF);
+			distance += (u32)(difference * difference);
+		}
+		if (distance < nearestDistance)
+		{
+			nearest = i;
+			nearestDistance = distance;
+		}
+	}
+	return nearest;
+}
+
+/* Turns RGBA pixels the size of original back into palette indices laid out like original's.
+ * On success, pixels->data must be freed by the caller. */
+static bool32 MapColorsToIndices(const u32* rgba, DecodedImage original, Memory* pixels, ImportResult* result)
+{
+	Memory ret = { 0 };
+	u32* originalColors = NULL;
+	u32 nPixels = 0;
+	u32 originalIndex = 0;
+	u32 index = 0;
+	u32 i = 0;
+
+	nPixels = original.width * original.height;
+	originalColors = malloc(original.pixels.size * (original.bitsPerPixel == 4 ? 8 : 4));
+	ret.data = malloc(original.pixels.size);
+	if (!originalColors || !ret.data)
+	{
+		free(originalColors);
+		free(ret.data);
+		return FALSE;
+	}
+	ret.size = original.pixels.size;
+
+	/* Anything after the last full row isn't in the PNG, so it stays as it was */
+	memcpy(ret.data, original.pixels.data, original.pixels.size);
+	ExpandPaletteIndices(original.pixels.data, original.pixels.size, original.palette, originalColors);
+
+	for (i = 0; i < nPixels; ++i)
+	{
+		if (original.bitsPerPixel == 4)
+		{
+			originalIndex = (original.pixels.data[i / 2] >> ((i % 2) * 4)) & 0xF;
+		}
+		else
+		{
+			originalIndex = original.pixels.data[i];
+		}
+		if (rgba[i] == originalColors[i])
+		{
+			continue;
+		}
+
+		for (index = 0; index < original.palette.nColors; ++index)
+		{
+			if (((const u32*)original.palette.data)[index] == rgba[i])
+			{
+				break;
+			}
+		}
+		if (index == original.palette.nColors)
+		{
+			index = FindNearestColor(rgba[i], (const u32*)original.palette.data, original.palette.nColors);
+			++result->nApproximatedPixels;
+		}
+		if (index == originalIndex)
+		{
+			continue;
+		}
+		++result->nChangedPixels;
+		if (original.bitsPerPixel == 4)
+		{
+			ret.data[i / 2] = (u8)((ret.data[i / 2] & ~(0xF << ((i % 2) * 4))) | (index << ((i % 2) * 4)));
+		}
+		else
+		{
+			ret.data[i] = (u8)index;
+		}
+	}
+
+	free(originalColors);
+	*pixels = ret;
+	return TRUE;
+}
+
+/* Replaces an image in a container with a PNG of the same size, as written by ConvertRGOImageToPNGAll.
+ * The container is only written to if some pixel actually changed. */
+bool32 ImportPNGImage(const char* containerPath, u32 imageIndex, u32 customWidth, const char* pngPath, ImportResult* result)
+{
+	Memory container = { 0 };
+	ImportResult ret = { 0 };
+	bool32 success = FALSE;
+
+	container = LoadFile(containerPath);
+	if (!container.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(containerPath);
+		return FALSE;
+	}
+	success = ImportPNGImageInMemory(&container, containerPath, imageIndex, customWidth, pngPath, &ret) &&
+		WriteRepackedRange(containerPath, container, ret.repack);
+	free(container.data);
+	if (success)
+	{
+		*result = ret;
+	}
+	return success;
+}
+
+/* Like ImportPNGImage, but on a container that's already loaded, so that several images can be imported
+ * into it before it's written back once. containerPath is only used in messages. If the images after
+ * this one have to move, container->data is reallocated. result->repack gives the bytes that changed. */
+bool32 ImportPNGImageInMemory(Memory* container, const char* containerPath, u32 imageIndex, u32 customWidth, const char* pngPath, ImportResult* result)
+{
+	ImportResult ret = { 0 };
+	ImageInfo imageInfo = { 0 };
+	DecodedImage original = { 0 };
+	Memory pixels = { 0 };
+	Memory newBlock = { 0 };
+	u8* header = NULL;
+	u32* rgba = NULL;
+	u32 width = 0;
+	u32 height = 0;
+	bool32 success = FALSE;
+
+	if (!LoadPNG(pngPath, &rgba, &width, &height))
+	{
+		return FALSE;
+	}
+	if (!ValidateContainer(*container, &imageInfo))
+	{
+		printf("%s is corrupt\n", containerPath);
+		goto cleanup;
+	}
+	if (imageIndex >= imageInfo.nImages)
+	{
+		printf("%s has no image %u\n", containerPath, imageIndex);
+		goto cleanup;
+	}
+	header = GetImageHeader(*container, imageInfo, imageIndex);
+	if (!DecodeRGOImage(*container, imageInfo, header, imageIndex, customWidth, &original))
+	{
+		printf("Could not decode image %u of %s\n", imageIndex, containerPath);
+		goto cleanup;
+	}
+	if (width != original.width || height != original.height)
+	{
+		printf("%s is %ux%u, but image %u of %s is %ux%u\n", pngPath, width, height, imageIndex, containerPath, original.width, original.height);
+		goto cleanup;
+	}
+	if (!MapColorsToIndices(rgba, original, &pixels, &ret))
+	{
+		goto cleanup;
+	}
+	if (memcmp(pixels.data, original.pixels.data, pixels.size) == 0)
+	{
+		/* Saved without changes, or only changed to colors that round to the same indices */
+		success = TRUE;
+		goto cleanup;
+	}
+
+	newBlock = EncodeReplacementImage(header, original.platform, pixels);
+	if (!newBlock.data)
+	{
+		goto cleanup;
+	}
+	success = RepackImage(container, imageIndex, newBlock, &ret.repack);
+
+cleanup:
+	free(newBlock.data);
+	free(pixels.data);
+	TrackedFree(original.pixels.data);
+	free(rgba);
+	if (success)
+	{
+		*result = ret;
+	}
+	return success;
+}
@@ -0,0 +1,42 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  import.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include "util.h"
+#include "image.h"
+#include "repack.h"
+
+/* Puts an edited PNG back into the container it was extracted from. Each pixel becomes the palette
+ * index with the same color, preferring the index the pixel had before so that unedited pixels keep
+ * their exact index even where a palette repeats a color. Colors that aren't in the palette become
+ * the nearest one. The image keeps its palette, so a PNG can only change which colors go where. */
+typedef struct
+{
+	u32 nChangedPixels;      /* Pixels whose palette index changed. 0 if the PNG was saved without any real change. */
+	u32 nApproximatedPixels; /* Pixels whose color isn't in the palette */
+	RepackResult repack;     /* Not filled in if no pixels changed, as the container is left alone */
+} ImportResult;
+
+bool32 LoadPNG(const char* path, u32** rgba, u32* width, u32* height);
+bool32 ImportPNGImage(const char* containerPath, u32 imageIndex, u32 customWidth, const char* pngPath, ImportResult* result);
+bool32 ImportPNGImageInMemory(Memory* container, const char* containerPath, u32 imageIndex, u32 customWidth, const char* pngPath, ImportResult* result);
+
+#endif
@@ -0,0 +1,506 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  lzss.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "image.h"
+#include "thread.h"
+#include "lzss.h"
+
+#define LZSS_WINDOW_SIZE 4096
+#define LZSS_MAX_MATCH 18
+#define LZSS_MIN_MATCH 3
+#define LZSS_NIL LZSS_WINDOW_SIZE /* Marks an empty link in the tree */
+#define LZSS_TREE_ROOTS (LZSS_WINDOW_SIZE + 1) /* One tree per first byte, rooted after the window positions */
+
+/* The window, with the first LZSS_MAX_MATCH - 1 bytes repeated after its end so that strings can be
+ * compared without wrapping, and a binary tree of the strings starting at each window position. */
+typedef struct
+{
+	u8 window[LZSS_WINDOW_SIZE + LZSS_MAX_MATCH - 1];
+	u32 left[LZSS_WINDOW_SIZE + 1];
+	u32 right[LZSS_TREE_ROOTS + 256];
+	u32 parent[LZSS_WINDOW_SIZE + 1];
+	u32 matchPosition;
+	u32 matchLength;
+} LZSSEncoder;
+
+typedef struct
+{
+	Mutex mutex;
+	FilePathList filePathList;
+	FILE* report;
+	PS2RecompressionStats stats;
+} RecompressionVerifier;
+
+static void InsertString(LZSSEncoder* encoder, u32 position);
+static void DeleteString(LZSSEncoder* encoder, u32 position);
+static void VerifierThread(void* arg);
+static void VerifyFile(RecompressionVerifier* verifier, const char* path);
+static bool32 VerifySubfile(u8* header, u32 subfileIndex, u32* firstDifference, u32* storedSize, u32* recompressedSize);
+
+/* Adds the string at position to the tree, and finds the longest match for it among the strings already there.
+ * Ties go to whichever string is met first on the way down, which is what makes the output match the original. */
+static void InsertString(LZSSEncoder* encoder, u32 position)
+{
+	const u8* key = NULL;
+	u32 node = 0;
+	int cmp = 1;
+	u32 i = 0;
+
+	key = &encoder->window[position];
+	node = LZSS_TREE_ROOTS + key[0];
+	encoder->right[position] = LZSS_NIL;
+	encoder->left[position] = LZSS_NIL;
+	encoder->matchLength = 0;
+	while (1)
+	{
+		if (cmp >= 0)
+		{
+			if (encoder->right[node] == LZSS_NIL)
+			{
+				encoder->right[node] = position;
+				encoder->parent[position] = node;
+				return;
+			}
+			node = encoder->right[node];
+		}
+		else
+		{
+			if (encoder->left[node] == LZSS_NIL)
+			{
+				encoder->left[node] = position;
+				encoder->parent[position] = node;
+				return;
+			}
+			node = encoder->left[node];
+		}
+		for (i = 1; i < LZSS_MAX_MATCH; ++i)
+		{
+			cmp = key[i] - encoder->window[node + i];
+			if (cmp != 0)
+			{
+				break;
+			}
+		}
+		if (i > encoder->matchLength)
+		{
+			encoder->matchPosition = node;
+			encoder->matchLength = i;
+			if (i >= LZSS_MAX_MATCH)
+			{
+				break;
+			}
+		}
+	}
+
+	/* An identical string is already in the tree. The new one takes its place. */
+	encoder->parent[position] = encoder->parent[node];
+	encoder->left[position] = encoder->left[node];
+	encoder->right[position] = encoder->right[node];
+	encoder->parent[encoder->left[node]] = position;
+	encoder->parent[encoder->right[node]] = position;
+	if (encoder->right[encoder->parent[node]] == node)
+	{
+		encoder->right[encoder->parent[node]] = position;
+	}
+	else
+	{
+		encoder->left[encoder->parent[node]] = position;
+	}
+	encoder->parent[node] = LZSS_NIL;
+}
+
+static void DeleteString(LZSSEncoder* encoder, u32 position)
+{
+	u32 replacement = 0;
+
+	if (encoder->parent[position] == LZSS_NIL)
+	{
+		return;
+	}
+	if (encoder->right[position] == LZSS_NIL)
+	{
+		replacement = encoder->left[position];
+	}
+	else if (encoder->left[position] == LZSS_NIL)
+	{
+		replacement = encoder->right[position];
+	}
+	else
+	{
+		/* Replace it with the greatest string smaller than it */
+		replacement = encoder->left[position];
+		if (encoder->right[replacement] != LZSS_NIL)
+		{
+			while (encoder->right[replacement] != LZSS_NIL)
+			{
+				replacement = encoder->right[replacement];
+			}
+			encoder->right[encoder->parent[replacement]] = encoder->left[replacement];
+			encoder->parent[encoder->left[replacement]] = encoder->parent[replacement];
+			encoder->left[replacement] = encoder->left[position];
+			encoder->parent[encoder->left[position]] = replacement;
+		}
+		encoder->right[replacement] = encoder->right[position];
+		encoder->parent[encoder->right[position]] = replacement;
+	}
+	encoder->parent[replacement] = encoder->parent[position];
+	if (encoder->right[encoder->parent[position]] == position)
+	{
+		encoder->right[encoder->parent[position]] = replacement;
+	}
+	else
+	{
+		encoder->left[encoder->parent[position]] = replacement;
+	}
+	encoder->parent[position] = LZSS_NIL;
+}
+
+/* Compresses a subfile so that DecompressPS2Subimage gives back src.
+ * On success, compressed->data must be freed by the caller. */
+bool32 CompressPS2Subimage(const u8* src, u32 srcSize, Memory* compressed)
+{
+	LZSSEncoder* encoder = NULL;
+	Memory ret = { 0 };
+	u8 group[1 + 8 * 2] = { 0 };
+	u32 groupSize = 1;
+	u8 flagBit = 1;
+	u32 srcPos = 0;
+	u32 lookaheadSize = 0;
+	u32 oldestPos = 0;
+	u32 currentPos = LZSS_WINDOW_SIZE - LZSS_MAX_MATCH;
+	u32 lastMatchLength = 0;
+	u32 i = 0;
+
+	/* At worst every byte is a literal, with a flag byte for every 8 */
+	ret.data = malloc(srcSize + (srcSize + 7) / 8 + 1);
+	encoder = calloc(1, sizeof(LZSSEncoder));
+	if (!ret.data || !encoder)
+	{
+		free(ret.data);
+		free(encoder);
+		return FALSE;
+	}
+
+	for (i = LZSS_TREE_ROOTS; i < LZSS_TREE_ROOTS + 256; ++i)
+	{
+		encoder->right[i] = LZSS_NIL;
+	}
+	for (i = 0; i < LZSS_WINDOW_SIZE; ++i)
+	{
+		encoder->parent[i] = LZSS_NIL;
+	}
+	for (lookaheadSize = 0; lookaheadSize < LZSS_MAX_MATCH && srcPos < srcSize; ++lookaheadSize)
+	{
+		encoder->window[currentPos + lookaheadSize] = src[srcPos++];
+	}
+	if (lookaheadSize == 0)
+	{
+		free(encoder);
+		*compressed = ret;
+		return TRUE;
+	}
+
+	/* The zeros before the start are matchable too, same as for the decompressor */
+	for (i = 1; i <= LZSS_MAX_MATCH; ++i)
+	{
+		InsertString(encoder, currentPos - i);
+	}
+	InsertString(encoder, currentPos);
+
+	do
+	{
+		if (encoder->matchLength > lookaheadSize)
+		{
+			encoder->matchLength = lookaheadSize;
+		}
+		if (encoder->matchLength < LZSS_MIN_MATCH)
+		{
+			encoder->matchLength = 1;
+			group[0] |= flagBit;
+			group[groupSize++] = encoder->window[currentPos];
+		}
+		else
+		{
+			group[groupSize++] = (u8)encoder->matchPosition;
+			group[groupSize++] = (u8)(((encoder->matchPosition >> 4) & 0xF0) | (encoder->matchLength - LZSS_MIN_MATCH));
+		}
+		flagBit <<= 1;
+		if (flagBit == 0)
+		{
+			memcpy(&ret.data[ret.size], group, groupSize);
+			ret.size += groupSize;
+			group[0] = 0;
+			groupSize = 1;
+			flagBit = 1;
+		}
+
+		/* Slide the window along by however much was just encoded */
+		lastMatchLength = encoder->matchLength;
+		for (i = 0; i < lastMatchLength && srcPos < srcSize; ++i)
+		{
+			DeleteString(encoder, oldestPos);
+			encoder->window[oldestPos] = src[srcPos];
+			if (oldestPos < LZSS_MAX_MATCH - 1)
+			{
+				encoder->window[oldestPos + LZSS_WINDOW_SIZE] = src[srcPos];
+			}
+			++srcPos;
+			oldestPos = (oldestPos + 1) & (LZSS_WINDOW_SIZE - 1);
+			currentPos = (currentPos + 1) & (LZSS_WINDOW_SIZE - 1);
+			InsertString(encoder, currentPos);
+		}
+		for (; i < lastMatchLength; ++i)
+		{
+			/* Out of input, so the lookahead just shrinks */
+			DeleteString(encoder, oldestPos);
+			oldestPos = (oldestPos + 1) & (LZSS_WINDOW_SIZE - 1);
+			currentPos = (currentPos + 1) & (LZSS_WINDOW_SIZE - 1);
+			--lookaheadSize;
+			if (lookaheadSize != 0)
+			{
+				InsertString(encoder, currentPos);
+			}
+		}
+	} while (lookaheadSize > 0);
+
+	if (groupSize > 1)
+	{
+		memcpy(&ret.data[ret.size], group, groupSize);
+		ret.size += groupSize;
+	}
+	free(encoder);
+	*compressed = ret;
+	return TRUE;
+}
+
+/* Decompresses one subfile and compresses it again. Returns whether the result is the same as what's stored,
+ * which may be followed by zero padding. Otherwise firstDifference is the offset of the first byte that differs. */
+static bool32 VerifySubfile(u8* header, u32 subfileIndex, u32* firstDifference, u32* storedSize, u32* recompressedSize)
+{
+	Memory decompressed = { 0 };
+	Memory recompressed = { 0 };
+	u8* stored = NULL;
+	u32 subfileOffset = 0;
+	u32 i = 0;
+
+	subfileOffset = LittleEndianRead32(&header[(subfileIndex + 1) * 4]);
+	stored = &header[subfileOffset + 4];
+	*storedSize = LittleEndianRead32(&header[(subfileIndex + 2) * 4]) - subfileOffset - 4;
+	decompressed.size = LittleEndianRead32(&header[subfileOffset]);
+	decompressed.data = malloc(decompressed.size);
+	if (!decompressed.data)
+	{
+		*firstDifference = 0;
+		*recompressedSize = 0;
+		return FALSE;
+	}
+	DecompressPS2Subimage(stored, decompressed.data, decompressed.size);
+	if (!CompressPS2Subimage(decompressed.data, decompressed.size, &recompressed))
+	{
+		free(decompressed.data);
+		*firstDifference = 0;
+		*recompressedSize = 0;
+		return FALSE;
+	}
+	*recompressedSize = recompressed.size;
+
+	for (i = 0; i < *storedSize; ++i)
+	{
+		if (stored[i] != (i < recompressed.size ? recompressed.data[i] : 0))
+		{
+			break;
+		}
+	}
+	*firstDifference = i;
+	free(recompressed.data);
+	free(decompressed.data);
+	return i == *storedSize && recompressed.size <= *storedSize;
+}
+
+static void VerifyFile(RecompressionVerifier* verifier, const char* path)
+{
+	PS2RecompressionStats stats = { 0 };
+	Memory image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	u8* header = NULL;
+	u32 nSubfiles = 0;
+	u32 firstDifference = 0;
+	u32 storedSize = 0;
+	u32 recompressedSize = 0;
+	bool32 imageMatches = TRUE;
+	u32 i = 0;
+	u32 j = 0;
+
+	image = LoadFile(path);
+	if (!image.data)
+	{
+		LockMutex(&verifier->mutex);
+		fprintf(verifier->report, "%s: could not be loaded\n", path);
+		++verifier->stats.nFiles;
+		++verifier->stats.nFailedFiles;
+		UnlockMutex(&verifier->mutex);
+		return;
+	}
+
+	if (!ValidateContainer(image, &imageInfo))
+	{
+		free(image.data);
+		LockMutex(&verifier->mutex);
+		fprintf(verifier->report, "%s: is corrupt\n", path);
+		++verifier->stats.nFiles;
+		++verifier->stats.nFailedFiles;
+		UnlockMutex(&verifier->mutex);
+		return;
+	}
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		header = i == 0 ? imageInfo.firstHeader : GetNextImageHeader(header);
+		nSubfiles = LittleEndianRead32(header);
+		if (nSubfiles == 0 || GetImagePlatform(header) != PLATFORM_PS2)
+		{
+			continue;
+		}
+		++stats.nImages;
+		imageMatches = TRUE;
+		for (j = 0; j < nSubfiles; ++j)
+		{
+			++stats.nSubfiles;
+			if (VerifySubfile(header, j, &firstDifference, &storedSize, &recompressedSize))
+			{
+				continue;
+			}
+			++stats.nMismatchedSubfiles;
+			imageMatches = FALSE;
+			LockMutex(&verifier->mutex);
+			fprintf(verifier->report, "%s image %u subfile %u: differs at byte %u. Stored %u bytes, recompressed %u bytes\n",
+				path, i, j, firstDifference, storedSize, recompressedSize);
+			UnlockMutex(&verifier->mutex);
+		}
+		if (!imageMatches)
+		{
+			++stats.nMismatchedImages;
+		}
+	}
+	free(image.data);
+
+	LockMutex(&verifier->mutex);
+	++verifier->stats.nFiles;
+	verifier->stats.nImages += stats.nImages;
+	verifier->stats.nSubfiles += stats.nSubfiles;
+	verifier->stats.nMismatchedSubfiles += stats.nMismatchedSubfiles;
+	verifier->stats.nMismatchedImages += stats.nMismatchedImages;
+	UnlockMutex(&verifier->mutex);
+}
+
+static void VerifierThread(void* arg)
+{
+	RecompressionVerifier* verifier = arg;
+	char path[1024] = { 0 };
+	bool32 hasPath = FALSE;
+
+	while (1)
+	{
+		LockMutex(&verifier->mutex);
+		hasPath = GetNextFilePath(&verifier->filePathList);
+		if (hasPath)
+		{
+			strncpy(path, (const char*)verifier->filePathList.currentPath, sizeof(path) - 1);
+		}
+		UnlockMutex(&verifier->mutex);
+		if (!hasPath)
+		{
+			return;
+		}
+		VerifyFile(verifier, path);
+	}
+}
+
+/* Decompresses and recompresses every PS2 subfile of every file in the list on nThreads threads, writing a line
+ * to the report for each subfile that doesn't come out the same as it was. PSP images are skipped. */
+PS2RecompressionStats VerifyPS2Recompression(const char* fileListPath, u32 nThreads, const char* reportPath)
+{
+	RecompressionVerifier verifier = { 0 };
+	Memory fileList = { 0 };
+	Thread* threads = NULL;
+	u32 nStarted = 0;
+	u32 i = 0;
+
+	if (nThreads == 0)
+	{
+		nThreads = 1;
+	}
+	fileList = LoadFile(fileListPath);
+	if (!fileList.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(fileListPath);
+		return verifier.stats;
+	}
+	verifier.report = fopen(reportPath, "wb");
+	if (!verifier.report)
+	{
+		FOPEN_FAIL_MESSAGE(reportPath);
+		free(fileList.data);
+		return verifier.stats;
+	}
+	threads = calloc(nThreads, sizeof(Thread));
+	if (!threads)
+	{
+		fclose(verifier.report);
+		free(fileList.data);
+		return verifier.stats;
+	}
+	verifier.filePathList = InitFilePathList(fileList);
+	InitMutex(&verifier.mutex);
+
+	for (i = 0; i < nThreads; ++i)
+	{
+		if (!StartThread(&threads[nStarted], VerifierThread, &verifier))
+		{
+			break;
+		}
+		++nStarted;
+	}
+	if (nStarted == 0)
+	{
+		/* Do it all on this thread instead */
+		VerifierThread(&verifier);
+	}
+	for (i = 0; i < nStarted; ++i)
+	{
+		JoinThread(threads[i]);
+	}
+
+	fprintf(verifier.report, "%u of %u images and %u of %u subfiles did not recompress to the same bytes\n",
+		verifier.stats.nMismatchedImages, verifier.stats.nImages, verifier.stats.nMismatchedSubfiles, verifier.stats.nSubfiles);
+	DestroyMutex(&verifier.mutex);
+	fclose(verifier.report);
+	free(threads);
+	free(fileList.data);
+	return verifier.stats;
+}
+
+void PrintPS2RecompressionStats(PS2RecompressionStats stats)
+{
+	printf("Files: %u (%u failed). PS2 images recompressed differently: %u of %u. Subfiles: %u of %u\n",
+		stats.nFiles, stats.nFailedFiles, stats.nMismatchedImages, stats.nImages, stats.nMismatchedSubfiles, stats.nSubfiles);
+}
@@ -0,0 +1,44 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  lzss.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef LZSS_H
+#define LZSS_H
+
+#include "util.h"
+
+/* The PS2 version's subfiles are compressed with LZSS as read by DecompressPS2Subimage: a 4 KB window
+ * filled with zeros and starting at 0xFEE, matches of 3 to 18 bytes, and a flag byte before every 8
+ * literals or matches. CompressPS2Subimage picks its matches with the same binary tree match finder as
+ * Haruhiko Okumura's LZSS.C, which the window layout points to as the original tool, so that data the game
+ * shipped with recompresses to the same bytes. VerifyPS2Recompression checks that over a whole file list. */
+typedef struct
+{
+	u32 nFiles;
+	u32 nImages;
+	u32 nSubfiles;
+	u32 nMismatchedSubfiles;
+	u32 nMismatchedImages;
+	u32 nFailedFiles; /* Couldn't be loaded or decompressed */
+} PS2RecompressionStats;
+
+bool32 CompressPS2Subimage(const u8* src, u32 srcSize, Memory* compressed);
+PS2RecompressionStats VerifyPS2Recompression(const char* fileListPath, u32 nThreads, const char* reportPath);
+void PrintPS2RecompressionStats(PS2RecompressionStats stats);
+
+#endif
@@ -17,10 +17,106 @@
  *  You should have received a copy of the GNU General Public License
  *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "thread.h"
+#include "server.h"
+#include "regress.h"
+#include "shard.h"
 #include "test.h"
 
-int main(void)
+static int Serve(int argc, char** argv);
+static int Regress(int argc, char** argv);
+static int Shard(int argc, char** argv);
+
+int main(int argc, char** argv)
 {
+	if (argc > 1 && strcmp(argv[1], "--serve") == 0)
+	{
+		return Serve(argc - 2, &argv[2]);
+	}
+	if (argc > 1 && strcmp(argv[1], "--watch") == 0)
+	{
+		/* --watch [debounce in milliseconds] */
+		WatchExtractedImages(argc > 2 ? strtoul(argv[2], NULL, 10) : WATCH_EXTRACTED_IMAGES_DEFAULT_DEBOUNCE_MILLISECONDS);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--regress") == 0)
+	{
+		return Regress(argc - 2, &argv[2]);
+	}
+	if (argc > 1 && (strcmp(argv[1], "--shard") == 0 || strcmp(argv[1], "--merge-shards") == 0))
+	{
+		return Shard(argc - 1, &argv[1]);
+	}
 	TestExtractAllImages();
 	return 0;
 }
+
+/* --serve [socket path] [cache budget in megabytes] */
+static int Serve(int argc, char** argv)
+{
+	ImageServer* server = NULL;
+	const char* socketPath = IMAGE_SERVER_DEFAULT_SOCKET;
+	u64 cacheBudget = IMAGE_SERVER_DEFAULT_CACHE_BUDGET;
+
+	if (argc > 0)
+	{
+		socketPath = argv[0];
+	}
+	if (argc > 1)
+	{
+		cacheBudget = strtoull(argv[1], NULL, 10) * 1024 * 1024;
+	}
+	server = CreateImageServer(socketPath, cacheBudget, GetNumProcessors());
+	if (!server)
+	{
+		return 1;
+	}
+	printf("Serving images on %s\n", socketPath);
+	RunImageServer(server);
+	PrintImageServerStats(DestroyImageServer(server));
+	return 0;
+}
+
+/* --regress [update | allowed slowdown in percent] */
+static int Regress(int argc, char** argv)
+{
+	double slowdownThreshold = REGRESSION_DEFAULT_SLOWDOWN_THRESHOLD;
+
+	if (argc > 0 && strcmp(argv[0], "update") == 0)
+	{
+		return RunRegressionSuite(TRUE, slowdownThreshold) ? 0 : 1;
+	}
+	if (argc > 0)
+	{
+		slowdownThreshold = strtod(argv[0], NULL) / 100.0;
+	}
+	return RunRegressionSuite(FALSE, slowdownThreshold) ? 0 : 1;
+}
+
+/* --shard k/N, or --merge-shards N once all N shards are done */
+static int Shard(int argc, char** argv)
+{
+	u32 shard = 0;
+	u32 nShards = 0;
+
+	if (strcmp(argv[0], "--merge-shards") == 0)
+	{
+		nShards = argc > 1 ? strtoul(argv[1], NULL, 10) : 0;
+		if (nShards == 0)
+		{
+			printf("Usage: --merge-shards N\n");
+			return 1;
+		}
+		return MergeExtractedShards(nShards) ? 0 : 1;
+	}
+	if (argc < 2 || !ParseShardSpec(argv[1], &shard, &nShards))
+	{
+		printf("Usage: --shard k/N, where 1 <= k <= N\n");
+		return 1;
+	}
+	return ExtractShard(shard, nShards) ? 0 : 1;
+}
@@ -0,0 +1,224 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  map.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "image.h"
+#include "thread.h"
+#include "map.h"
+#include "alloc.h"
+
+struct SpriteSheets
+{
+	Mutex mutex;
+	Memory image;
+	ImageInfo imageInfo;
+	u8* headers[MAX_IMAGES_PER_FILE];
+	DecodedImage decoded[MAX_IMAGES_PER_FILE];
+	u32 nDecodes;
+};
+
+static u32 GetPixel(const u8* pixels, u32 bitsPerPixel, u32 pixelIndex);
+static void SetPixel(u8* pixels, u32 bitsPerPixel, u32 pixelIndex, u32 value);
+
+/* Finds the MAP data block of a container and reads the sheet width from it. FALSE if it has none. */
+bool32 FindMAPData(Memory image, ImageInfo imageInfo, MAPData* mapData)
+{
+	MAPData ret = { 0 };
+
+	if (!imageInfo.hasMAPData || image.size < MAP_DATA_OFFSET + MAP_DATA_WIDTH_OFFSET + 2)
+	{
+		return FALSE;
+	}
+	ret.block.data = &image.data[MAP_DATA_OFFSET];
+	ret.block.size = (u32)(imageInfo.firstHeader - ret.block.data);
+	ret.width = LittleEndianRead16(&ret.block.data[MAP_DATA_WIDTH_OFFSET]);
+	*mapData = ret;
+	return TRUE;
+}
+
+/* Draws every piece of the composition from the sheet in one go. Index 0 is transparent, so
+ * it leaves whatever is underneath. On success, sprite->pixels must be freed by the caller with TrackedFree. */
+bool32 RenderSpriteComposition(DecodedImage sheet, const SpriteComposition* composition, DecodedImage* sprite)
+{
+	const SpritePiece* piece = NULL;
+	Memory pixels = { 0 };
+	u32 value = 0;
+	u32 x = 0;
+	u32 y = 0;
+	u32 i = 0;
+
+	if (composition->width == 0 || composition->height == 0)
+	{
+		return FALSE;
+	}
+	for (i = 0; i < composition->nPieces; ++i)
+	{
+		piece = &composition->pieces[i];
+		if (piece->sheetX + piece->width > sheet.width || piece->sheetY + piece->height > sheet.height ||
+			piece->spriteX + piece->width > composition->width || piece->spriteY + piece->height > composition->height)
+		{
+			printf("Sprite piece %u doesn't fit in the sheet or the sprite\n", i);
+			return FALSE;
+		}
+	}
+
+	pixels.size = sheet.bitsPerPixel == 4 ? (composition->width * composition->height + 1) / 2 : composition->width * composition->height;
+	pixels.data = TrackedMalloc(pixels.size, MEMORY_STAGE_DECOMPRESS);
+	if (!pixels.data)
+	{
+		return FALSE;
+	}
+	memset(pixels.data, 0, pixels.size);
+	for (i = 0; i < composition->nPieces; ++i)
+	{
+		piece = &composition->pieces[i];
+		for (y = 0; y < piece->height; ++y)
+		{
+			for (x = 0; x < piece->width; ++x)
+			{
+				value = GetPixel(sheet.pixels.data, sheet.bitsPerPixel, (piece->sheetY + y) * sheet.width + piece->sheetX + x);
+				if (value != 0)
+				{
+					SetPixel(pixels.data, sheet.bitsPerPixel, (piece->spriteY + y) * composition->width + piece->spriteX + x, value);
+				}
+			}
+		}
+	}
+
+	*sprite = sheet;
+	sprite->pixels = pixels;
+	sprite->width = composition->width;
+	sprite->height = composition->height;
+	return TRUE;
+}
+
+static u32 GetPixel(const u8* pixels, u32 bitsPerPixel, u32 pixelIndex)
+{
+	if (bitsPerPixel == 4)
+	{
+		return (pixels[pixelIndex / 2] >> ((pixelIndex & 1) * 4)) & 0xF;
+	}
+	return pixels[pixelIndex];
+}
+
+static void SetPixel(u8* pixels, u32 bitsPerPixel, u32 pixelIndex, u32 value)
+{
+	if (bitsPerPixel == 4)
+	{
+		pixels[pixelIndex / 2] &= 0xF0 >> ((pixelIndex & 1) * 4);
+		pixels[pixelIndex / 2] |= value << ((pixelIndex & 1) * 4);
+		return;
+	}
+	pixels[pixelIndex] = (u8)value;
+}
+
+SpriteSheets* OpenSpriteSheets(const char* path)
+{
+	SpriteSheets* sheets = NULL;
+	u32 i = 0;
+
+	sheets = calloc(1, sizeof(SpriteSheets));
+	if (!sheets)
+	{
+		return NULL;
+	}
+	sheets->image = LoadFile(path);
+	if (!sheets->image.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(path);
+		free(sheets);
+		return NULL;
+	}
+	if (!ValidateContainer(sheets->image, &sheets->imageInfo))
+	{
+		printf("Skipping corrupt file %s\n", path);
+		free(sheets->image.data);
+		free(sheets);
+		return NULL;
+	}
+	sheets->headers[0] = GetImageHeader(sheets->image, sheets->imageInfo, 0);
+	for (i = 1; i < sheets->imageInfo.nImages; ++i)
+	{
+		sheets->headers[i] = GetNextImageHeader(sheets->headers[i - 1]);
+	}
+	InitMutex(&sheets->mutex);
+	return sheets;
+}
+
+/* Gets a decoded image from the container, decoding it if this is the first time it's been asked for.
+ * The pixels stay owned by sheets and are valid until CloseSpriteSheets. */
+bool32 GetSpriteSheet(SpriteSheets* sheets, u32 imageIndex, DecodedImage* sheet)
+{
+	bool32 success = TRUE;
+
+	if (imageIndex >= sheets->imageInfo.nImages)
+	{
+		return FALSE;
+	}
+	LockMutex(&sheets->mutex);
+	if (!sheets->decoded[imageIndex].pixels.data)
+	{
+		success = DecodeRGOImage(sheets->image, sheets->imageInfo, sheets->headers[imageIndex], imageIndex, 0, &sheets->decoded[imageIndex]);
+		++sheets->nDecodes;
+	}
+	*sheet = sheets->decoded[imageIndex];
+	UnlockMutex(&sheets->mutex);
+	return success;
+}
+
+bool32 RenderSprite(SpriteSheets* sheets, u32 imageIndex, const SpriteComposition* composition, DecodedImage* sprite)
+{
+	DecodedImage sheet = { 0 };
+
+	if (!GetSpriteSheet(sheets, imageIndex, &sheet))
+	{
+		return FALSE;
+	}
+	return RenderSpriteComposition(sheet, composition, sprite);
+}
+
+u32 GetNumSpriteSheetDecodes(SpriteSheets* sheets)
+{
+	u32 ret = 0;
+
+	LockMutex(&sheets->mutex);
+	ret = sheets->nDecodes;
+	UnlockMutex(&sheets->mutex);
+	return ret;
+}
+
+void CloseSpriteSheets(SpriteSheets* sheets)
+{
+	u32 i = 0;
+
+	if (!sheets)
+	{
+		return;
+	}
+	for (i = 0; i < sheets->imageInfo.nImages; ++i)
+	{
+		TrackedFree(sheets->decoded[i].pixels.data);
+	}
+	DestroyMutex(&sheets->mutex);
+	free(sheets->image.data);
+	free(sheets);
+}
@@ -0,0 +1,74 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  map.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef MAP_H
+#define MAP_H
+
+#include "util.h"
+#include "image.h"
+
+/* MAP data takes the place of the second palette in files that have it, starting with "MAP"
+ * and running up to the first image header. Only the sheet width at MAP_DATA_WIDTH_OFFSET
+ * is understood so far. The rest of the block, which presumably says how sprites are cut out
+ * of the sheet, hasn't been worked out, so it's only handed back as raw bytes and nothing here
+ * builds sprites from it. SpriteComposition describes a sprite for the renderer below, and it's
+ * up to the caller to fill one in. */
+#define MAP_DATA_OFFSET 0x400
+#define MAP_DATA_WIDTH_OFFSET 0x1C
+
+typedef struct
+{
+	Memory block; /* Points into the loaded file */
+	u32 width;    /* PSP ignores this */
+} MAPData;
+
+/* One rectangle of a sheet placed into a composed sprite */
+typedef struct
+{
+	u32 sheetX;
+	u32 sheetY;
+	u32 width;
+	u32 height;
+	u32 spriteX;
+	u32 spriteY;
+} SpritePiece;
+
+/* A sprite built out of pieces of a sheet. Later pieces are drawn over earlier ones. */
+typedef struct
+{
+	u32 width;
+	u32 height;
+	u32 nPieces;
+	const SpritePiece* pieces;
+} SpriteComposition;
+
+/* A container whose images are decoded the first time they're needed and then kept,
+ * so any number of sprites can be composed from them without decoding again. */
+typedef struct SpriteSheets SpriteSheets;
+
+bool32 FindMAPData(Memory image, ImageInfo imageInfo, MAPData* mapData);
+bool32 RenderSpriteComposition(DecodedImage sheet, const SpriteComposition* composition, DecodedImage* sprite);
+
+SpriteSheets* OpenSpriteSheets(const char* path);
+bool32 GetSpriteSheet(SpriteSheets* sheets, u32 imageIndex, DecodedImage* sheet);
+bool32 RenderSprite(SpriteSheets* sheets, u32 imageIndex, const SpriteComposition* composition, DecodedImage* sprite);
+u32 GetNumSpriteSheetDecodes(SpriteSheets* sheets);
+void CloseSpriteSheets(SpriteSheets* sheets);
+
+#endif
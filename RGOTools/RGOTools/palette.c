@@ -0,0 +1,409 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  palette.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "OutsideCode/zlib/zlib.h"
+#include "util.h"
+#include "image.h"
+#include "thread.h"
+#include "palette.h"
+
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
+
+#define PALETTE_CACHE_NUM_BUCKETS 1024
+
+
+/* Corrected palettes are looked up by their contents, not where they are in memory, so the same
+ * palette is only ever corrected once no matter which file or buffer it was loaded from. */
+typedef struct CachedPalette
+{
+	struct CachedPalette* next;
+	u32 nColors;
+	u32 source[256];
+	u32 corrected[256];
+} CachedPalette;
+
+typedef struct
+{
+	Mutex mutex;
+	CachedPalette* buckets[PALETTE_CACHE_NUM_BUCKETS];
+} PaletteCache;
+
+static void ExpandPaletteIndices4Scalar(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+static void ExpandPaletteIndices8Scalar(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+static void CorrectPS2PaletteColorsScalar(const u32* source, u32 nColors, u32* corrected);
+static void ChoosePaletteKernels(void);
+static u32 GetSwizzledPS2PaletteIndex(u32 index, u32 nColors);
+static void InitPaletteCache(void);
+#ifdef ARCH_X86
+static void CorrectPS2PaletteColorsSSE2(const u32* source, u32 nColors, u32* corrected);
+static void ExpandPaletteIndices4SSSE3(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+static void ExpandPaletteIndices8AVX2(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+#endif
+
+static const PaletteKernels scalarKernels = { "Scalar", ExpandPaletteIndices4Scalar, ExpandPaletteIndices8Scalar, CorrectPS2PaletteColorsScalar };
+#ifdef ARCH_X86
+static const PaletteKernels sse2Kernels = { "SSE2", NULL, NULL, CorrectPS2PaletteColorsSSE2 };
+static const PaletteKernels ssse3Kernels = { "SSSE3", ExpandPaletteIndices4SSSE3, NULL, NULL };
+static const PaletteKernels avx2Kernels = { "AVX2", NULL, ExpandPaletteIndices8AVX2, NULL };
+#endif
+
+/* Chosen once, by the first call to any kernel, before any of them are used */
+static ExpandFunction expandPaletteIndices4 = ExpandPaletteIndices4Scalar;
+static ExpandFunction expandPaletteIndices8 = ExpandPaletteIndices8Scalar;
+static CorrectFunction correctPS2PaletteColors = CorrectPS2PaletteColorsScalar;
+static OnceFlag paletteKernelsChosen = ONCE_FLAG_STATIC_INIT;
+
+static PaletteCache paletteCache = { 0 };
+static OnceFlag paletteCacheInitialized = ONCE_FLAG_STATIC_INIT;
+
+/* Expands indices into RGBA colors. 16 color palettes get two pixels out of every byte,
+ * so rgba needs room for nBytes * 2 colors. Otherwise it needs room for nBytes colors. */
+void ExpandPaletteIndices(const u8* indices, u32 nBytes, Palette palette, u32* rgba)
+{
+	RunOnce(&paletteKernelsChosen, ChoosePaletteKernels);
+	if (palette.nColors != 256)
+	{
+		expandPaletteIndices4(indices, nBytes, (const u32*)palette.data, rgba);
+	}
+	else
+	{
+		expandPaletteIndices8(indices, nBytes, (const u32*)palette.data, rgba);
+	}
+}
+
+/* The left pixel of each pair is in the low nibble */
+void ExpandPaletteIndices4(const u8* indices, u32 nBytes, const u32* palette, u32* rgba)
+{
+	RunOnce(&paletteKernelsChosen, ChoosePaletteKernels);
+	expandPaletteIndices4(indices, nBytes, palette, rgba);
+}
+
+void ExpandPaletteIndices8(const u8* indices, u32 nBytes, const u32* palette, u32* rgba)
+{
+	RunOnce(&paletteKernelsChosen, ChoosePaletteKernels);
+	expandPaletteIndices8(indices, nBytes, palette, rgba);
+}
+
+/* Lists every kernel set the CPU can run, scalar first and then in order of the instructions they need, so that
+ * the SIMD kernels can be checked against the scalar ones. kernels needs room for PALETTE_MAX_KERNEL_SETS.
+ * Returns how many were written. */
+u32 GetPaletteKernels(PaletteKernels* kernels)
+{
+	CPUFeatures features = { 0 };
+	u32 nKernels = 0;
+
+	features = GetCPUFeatures();
+	kernels[nKernels++] = scalarKernels;
+#ifdef ARCH_X86
+	if (features.hasSSE2)
+	{
+		kernels[nKernels++] = sse2Kernels;
+	}
+	if (features.hasSSSE3)
+	{
+		kernels[nKernels++] = ssse3Kernels;
+	}
+	if (features.hasAVX2)
+	{
+		kernels[nKernels++] = avx2Kernels;
+	}
+#else
+	(void)features;
+#endif
+	return nKernels;
+}
+
+/* Threads may call the kernels for the first time at the same time, so they're chosen under RunOnce */
+static void ChoosePaletteKernels(void)
+{
+	PaletteKernels kernels[PALETTE_MAX_KERNEL_SETS] = { { 0 } };
+	u32 nKernels = 0;
+	u32 i = 0;
+
+	/* Later sets need newer instructions, so the last one with a version of a kernel is the fastest */
+	nKernels = GetPaletteKernels(kernels);
+	for (i = 0; i < nKernels; ++i)
+	{
+		if (kernels[i].expand4)
+		{
+			expandPaletteIndices4 = kernels[i].expand4;
+		}
+		if (kernels[i].expand8)
+		{
+			expandPaletteIndices8 = kernels[i].expand8;
+		}
+		if (kernels[i].correctPS2)
+		{
+			correctPS2PaletteColors = kernels[i].correctPS2;
+		}
+	}
+}
+
+/* On PS2, the palette is not given in order for 256 color images, and instead
+ * is grouped into 32-color groups where colors 8-15 and 16-23 are swapped.
+ * Additionally alpha ranges from 0x0 to 0x80, so it needs to be converted to range
+ * from 0x0 to 0xFF. This writes the corrected colors to corrected and leaves source alone. */
+void CorrectPS2PaletteColors(const u32* source, u32 nColors, u32* corrected)
+{
+	RunOnce(&paletteKernelsChosen, ChoosePaletteKernels);
+	correctPS2PaletteColors(source, nColors, corrected);
+}
+
+/* Returns the corrected version of a PS2 palette, only correcting it if this palette
+ * hasn't been seen before. The source palette is never modified. The returned palette's
+ * colors belong to the cache and stay valid until ClearPaletteCache is called. */
+Palette GetCorrectedPS2Palette(Palette source)
+{
+	Palette ret = { 0 };
+	CachedPalette* entry = NULL;
+	u32 bucket = 0;
+
+	RunOnce(&paletteCacheInitialized, InitPaletteCache);
+
+	bucket = crc32(source.nColors, source.data, source.nColors * 4) % PALETTE_CACHE_NUM_BUCKETS;
+	ret.nColors = source.nColors;
+
+	LockMutex(&paletteCache.mutex);
+	for (entry = paletteCache.buckets[bucket]; entry; entry = entry->next)
+	{
+		if (entry->nColors == source.nColors && memcmp(entry->source, source.data, source.nColors * 4) == 0)
+		{
+			ret.data = (u8*)entry->corrected;
+			UnlockMutex(&paletteCache.mutex);
+			return ret;
+		}
+	}
+
+	entry = malloc(sizeof(CachedPalette));
+	if (!entry)
+	{
+		UnlockMutex(&paletteCache.mutex);
+		return ret;
+	}
+	entry->nColors = source.nColors;
+	memcpy(entry->source, source.data, source.nColors * 4);
+	CorrectPS2PaletteColors(entry->source, entry->nColors, entry->corrected);
+	entry->next = paletteCache.buckets[bucket];
+	paletteCache.buckets[bucket] = entry;
+	UnlockMutex(&paletteCache.mutex);
+
+	ret.data = (u8*)entry->corrected;
+	return ret;
+}
+
+/* Frees every corrected palette. Nothing returned by GetCorrectedPS2Palette may be in use. */
+void ClearPaletteCache(void)
+{
+	CachedPalette* entry = NULL;
+	CachedPalette* next = NULL;
+	u32 i = 0;
+
+	RunOnce(&paletteCacheInitialized, InitPaletteCache);
+
+	LockMutex(&paletteCache.mutex);
+	for (i = 0; i < PALETTE_CACHE_NUM_BUCKETS; ++i)
+	{
+		for (entry = paletteCache.buckets[i]; entry; entry = next)
+		{
+			next = entry->next;
+			free(entry);
+		}
+		paletteCache.buckets[i] = NULL;
+	}
+	UnlockMutex(&paletteCache.mutex);
+}
+
+static void InitPaletteCache(void)
+{
+	InitMutex(&paletteCache.mutex);
+}
+
+/* Where the color that belongs at index comes from in the PS2's ordering. Groups of
+ * 4 colors always come from the same place, so the SIMD version can move 4 at a time. */
+static u32 GetSwizzledPS2PaletteIndex(u32 index, u32 nColors)
+{
+	const u32 colorGroupSize = 32;
+	u32 indexInGroup = 0;
+
+	if (index >= nColors / colorGroupSize * colorGroupSize)
+	{
+		/* Not part of a full color group, so 16 color palettes are left as they are */
+		return index;
+	}
+	indexInGroup = index % colorGroupSize;
+	if (indexInGroup >= 8 && indexInGroup < 16)
+	{
+		return index + 8;
+	}
+	if (indexInGroup >= 16 && indexInGroup < 24)
+	{
+		return index - 8;
+	}
+	return index;
+}
+
+static void CorrectPS2PaletteColorsScalar(const u32* source, u32 nColors, u32* corrected)
+{
+	u32 color = 0;
+	u32 i = 0;
+
+	for (i = 0; i < nColors; ++i)
+	{
+		color = source[GetSwizzledPS2PaletteIndex(i, nColors)];
+		if (color & 0x80000000)
+		{
+			color |= 0xFF000000;
+		}
+		else
+		{
+			color += color & 0xFF000000;
+		}
+		corrected[i] = color;
+	}
+}
+
+static void ExpandPaletteIndices4Scalar(const u8* indices, u32 nBytes, const u32* palette, u32* rgba)
+{
+	u32 i = 0;
+
+	for (i = 0; i < nBytes; ++i)
+	{
+		rgba[i * 2] = palette[indices[i] & 0xF];
+		rgba[i * 2 + 1] = palette[(indices[i] & 0xF0) >> 4];
+	}
+}
+
+static void ExpandPaletteIndices8Scalar(const u8* indices, u32 nBytes, const u32* palette, u32* rgba)
+{
+	u32 i = 0;
+
+	for (i = 0; i < nBytes; ++i)
+	{
+		rgba[i] = palette[indices[i]];
+	}
+}
+
+#ifdef ARCH_X86
+/* Doubling alpha with a saturating add gives exactly 0xFF for anything 0x80 or over,
+ * so the alpha correction needs no comparisons. */
+TARGET_SSE2 static void CorrectPS2PaletteColorsSSE2(const u32* source, u32 nColors, u32* corrected)
+{
+	__m128i alphaMask = { 0 };
+	__m128i colors = { 0 };
+	u32 i = 0;
+
+	alphaMask = _mm_set1_epi32((int)0xFF000000);
+	for (i = 0; i + 4 <= nColors; i += 4)
+	{
+		colors = _mm_loadu_si128((const __m128i*)&source[GetSwizzledPS2PaletteIndex(i, nColors)]);
+		colors = _mm_adds_epu8(colors, _mm_and_si128(colors, alphaMask));
+		_mm_storeu_si128((__m128i*)&corrected[i], colors);
+	}
+	for (; i < nColors; ++i)
+	{
+		CorrectPS2PaletteColorsScalar(&source[i], 1, &corrected[i]);
+	}
+}
+
+/* With only 16 colors, each byte of every color fits in one register, so pshufb
+ * can look up 16 pixels at a time. The four looked up bytes of each pixel then
+ * just need to be interleaved back into RGBA order. */
+TARGET_SSSE3 static void ExpandPaletteIndices4SSSE3(const u8* indices, u32 nBytes, const u32* palette, u32* rgba)
+{
+	const u8* paletteBytes = NULL;
+	u8 planes[4][16] = { { 0 } };
+	__m128i plane0 = { 0 };
+	__m128i plane1 = { 0 };
+	__m128i plane2 = { 0 };
+	__m128i plane3 = { 0 };
+	__m128i lowNibbleMask = { 0 };
+	__m128i packed = { 0 };
+	__m128i lowNibbles = { 0 };
+	__m128i highNibbles = { 0 };
+	__m128i pixelIndices[2] = { { 0 } };
+	__m128i byte0 = { 0 };
+	__m128i byte1 = { 0 };
+	__m128i byte2 = { 0 };
+	__m128i byte3 = { 0 };
+	__m128i bytes01 = { 0 };
+	__m128i bytes23 = { 0 };
+	u32 i = 0;
+	u32 j = 0;
+
+	/* Split the palette into one register per byte of a color */
+	paletteBytes = (const u8*)palette;
+	for (i = 0; i < 16; ++i)
+	{
+		for (j = 0; j < 4; ++j)
+		{
+			planes[j][i] = paletteBytes[i * 4 + j];
+		}
+	}
+	plane0 = _mm_loadu_si128((const __m128i*)planes[0]);
+	plane1 = _mm_loadu_si128((const __m128i*)planes[1]);
+	plane2 = _mm_loadu_si128((const __m128i*)planes[2]);
+	plane3 = _mm_loadu_si128((const __m128i*)planes[3]);
+	lowNibbleMask = _mm_set1_epi8(0xF);
+
+	for (i = 0; i + 16 <= nBytes; i += 16)
+	{
+		packed = _mm_loadu_si128((const __m128i*)&indices[i]);
+		lowNibbles = _mm_and_si128(packed, lowNibbleMask);
+		highNibbles = _mm_and_si128(_mm_srli_epi16(packed, 4), lowNibbleMask);
+		pixelIndices[0] = _mm_unpacklo_epi8(lowNibbles, highNibbles);
+		pixelIndices[1] = _mm_unpackhi_epi8(lowNibbles, highNibbles);
+
+		for (j = 0; j < 2; ++j)
+		{
+			byte0 = _mm_shuffle_epi8(plane0, pixelIndices[j]);
+			byte1 = _mm_shuffle_epi8(plane1, pixelIndices[j]);
+			byte2 = _mm_shuffle_epi8(plane2, pixelIndices[j]);
+			byte3 = _mm_shuffle_epi8(plane3, pixelIndices[j]);
+
+			bytes01 = _mm_unpacklo_epi8(byte0, byte1);
+			bytes23 = _mm_unpacklo_epi8(byte2, byte3);
+			_mm_storeu_si128((__m128i*)&rgba[i * 2 + j * 16], _mm_unpacklo_epi16(bytes01, bytes23));
+			_mm_storeu_si128((__m128i*)&rgba[i * 2 + j * 16 + 4], _mm_unpackhi_epi16(bytes01, bytes23));
+			bytes01 = _mm_unpackhi_epi8(byte0, byte1);
+			bytes23 = _mm_unpackhi_epi8(byte2, byte3);
+			_mm_storeu_si128((__m128i*)&rgba[i * 2 + j * 16 + 8], _mm_unpacklo_epi16(bytes01, bytes23));
+			_mm_storeu_si128((__m128i*)&rgba[i * 2 + j * 16 + 12], _mm_unpackhi_epi16(bytes01, bytes23));
+		}
+	}
+	ExpandPaletteIndices4Scalar(&indices[i], nBytes - i, palette, &rgba[i * 2]);
+}
+
+/* 256 colors don't fit in a register, so gather 8 colors at a time instead */
+TARGET_AVX2 static void ExpandPaletteIndices8AVX2(const u8* indices, u32 nBytes, const u32* palette, u32* rgba)
+{
+	__m256i pixelIndices = { 0 };
+	u32 i = 0;
+
+	for (i = 0; i + 8 <= nBytes; i += 8)
+	{
+		pixelIndices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&indices[i]));
+		_mm256_storeu_si256((__m256i*)&rgba[i], _mm256_i32gather_epi32((const int*)palette, pixelIndices, 4));
+	}
+	ExpandPaletteIndices8Scalar(&indices[i], nBytes - i, palette, &rgba[i]);
+}
+#endif
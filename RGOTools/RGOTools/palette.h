@@ -0,0 +1,52 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  palette.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include "util.h"
+#include "image.h"
+
+/* Palette kernels. Each has a scalar version and SIMD versions, and the
+ * fastest one the CPU supports is picked the first time any of them is called. */
+
+typedef void (*ExpandFunction)(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+typedef void (*CorrectFunction)(const u32* source, u32 nColors, u32* corrected);
+
+#define PALETTE_MAX_KERNEL_SETS 4
+
+/* The kernels written for one instruction set. Those it has no version of are NULL. */
+typedef struct
+{
+	const char* name;
+	ExpandFunction expand4;
+	ExpandFunction expand8;
+	CorrectFunction correctPS2;
+} PaletteKernels;
+
+void ExpandPaletteIndices(const u8* indices, u32 nBytes, Palette palette, u32* rgba);
+void ExpandPaletteIndices4(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+void ExpandPaletteIndices8(const u8* indices, u32 nBytes, const u32* palette, u32* rgba);
+void CorrectPS2PaletteColors(const u32* source, u32 nColors, u32* corrected);
+u32 GetPaletteKernels(PaletteKernels* kernels);
+
+Palette GetCorrectedPS2Palette(Palette source);
+void ClearPaletteCache(void);
+
+#endif
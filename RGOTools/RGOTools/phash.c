@@ -0,0 +1,397 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  phash.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "image.h"
+#include "palette.h"
+#include "thread.h"
+#include "phash.h"
+#include "alloc.h"
+
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
+
+#define PERCEPTUAL_HASH_COLUMNS 9
+#define PERCEPTUAL_HASH_ROWS 8
+#define PERCEPTUAL_INDEX_NUM_BUCKETS (1 << PERCEPTUAL_INDEX_BAND_BITS)
+
+typedef u32 (*SumFunction)(const u32* values, u32 nValues);
+
+typedef struct
+{
+	u64 hash;
+	char* path;
+	u32 imageIndex;
+	Platform platform;
+	u32 nextInBand[PERCEPTUAL_INDEX_NUM_BANDS]; /* One more than the index of the next entry in the same bucket, 0 for none */
+} PerceptualEntry;
+
+struct PerceptualIndex
+{
+	Mutex mutex;
+	PerceptualEntry* entries;
+	u32 nEntries;
+	u32 entriesCapacity;
+	u32 buckets[PERCEPTUAL_INDEX_NUM_BANDS][PERCEPTUAL_INDEX_NUM_BUCKETS]; /* One more than the index of the first entry, 0 for none */
+};
+
+static u32 GetBand(u64 hash, u32 band);
+static u32 SumScalar(const u32* values, u32 nValues);
+static void ChooseSum(void);
+#ifdef ARCH_X86
+static u32 SumSSE2(const u32* values, u32 nValues);
+#endif
+
+static SumFunction sum = SumScalar;
+static OnceFlag sumChosen = ONCE_FLAG_STATIC_INIT;
+
+/* Returns FALSE if the image is too small to hash or memory runs out. Every 64-bit value is a valid hash,
+ * so there's no value left over to mean failure. */
+bool32 GetPerceptualHash(DecodedImage decodedImage, u64* hash)
+{
+	Palette brightnessPalette = { 0 };
+	u32 brightness[256] = { 0 };
+	u64 bins[PERCEPTUAL_HASH_ROWS][PERCEPTUAL_HASH_COLUMNS] = { { 0 } };
+	u32 columnStarts[PERCEPTUAL_HASH_COLUMNS + 1] = { 0 };
+	u32* row = NULL;
+	const u8* color = NULL;
+	u32 rowSize = 0;
+	u32 binRow = 0;
+	u64 ret = 0;
+	u32 x = 0;
+	u32 y = 0;
+	u32 i = 0;
+
+	if (decodedImage.width < PERCEPTUAL_HASH_COLUMNS || decodedImage.height < PERCEPTUAL_HASH_ROWS)
+	{
+		return FALSE;
+	}
+	row = malloc(decodedImage.width * sizeof(u32));
+	if (!row)
+	{
+		return FALSE;
+	}
+
+	/* Swapping every color for its brightness lets the palette kernels produce brightness directly.
+	 * Transparent pixels count as black, so sprites on a transparent background hash like they look. */
+	for (i = 0; i < decodedImage.palette.nColors; ++i)
+	{
+		color = &decodedImage.palette.data[i * 4];
+		brightness[i] = ((color[0] * 77 + color[1] * 150 + color[2] * 29) >> 8) * color[3] / 255;
+	}
+	brightnessPalette.nColors = decodedImage.palette.nColors;
+	brightnessPalette.data = (u8*)brightness;
+
+	for (i = 0; i <= PERCEPTUAL_HASH_COLUMNS; ++i)
+	{
+		columnStarts[i] = (u32)((u64)i * decodedImage.width / PERCEPTUAL_HASH_COLUMNS);
+	}
+	rowSize = decodedImage.bitsPerPixel == 4 ? decodedImage.width / 2 : decodedImage.width;
+	RunOnce(&sumChosen, ChooseSum);
+	for (y = 0; y < decodedImage.height; ++y)
+	{
+		ExpandPaletteIndices(&decodedImage.pixels.data[y * rowSize], rowSize, brightnessPalette, row);
+		binRow = (u32)((u64)y * PERCEPTUAL_HASH_ROWS / decodedImage.height);
+		for (x = 0; x < PERCEPTUAL_HASH_COLUMNS; ++x)
+		{
+			bins[binRow][x] += sum(&row[columnStarts[x]], columnStarts[x + 1] - columnStarts[x]);
+		}
+	}
+	free(row);
+
+	/* Every bin in a row covers the same number of pixels, give or take a column, so sums compare like averages */
+	for (y = 0; y < PERCEPTUAL_HASH_ROWS; ++y)
+	{
+		for (x = 0; x < PERCEPTUAL_HASH_COLUMNS - 1; ++x)
+		{
+			ret <<= 1;
+			ret |= bins[y][x] * (columnStarts[x + 2] - columnStarts[x + 1]) > bins[y][x + 1] * (columnStarts[x + 1] - columnStarts[x]);
+		}
+	}
+	*hash = ret;
+	return TRUE;
+}
+
+u32 GetPerceptualHashDistance(u64 a, u64 b)
+{
+	u64 bits = 0;
+	u32 ret = 0;
+
+	bits = a ^ b;
+	for (ret = 0; bits; ++ret)
+	{
+		bits &= bits - 1;
+	}
+	return ret;
+}
+
+PerceptualIndex* CreatePerceptualIndex(void)
+{
+	PerceptualIndex* index = NULL;
+
+	index = calloc(1, sizeof(PerceptualIndex));
+	if (!index)
+	{
+		return NULL;
+	}
+	InitMutex(&index->mutex);
+	return index;
+}
+
+bool32 AddToPerceptualIndex(PerceptualIndex* index, u64 hash, const char* path, u32 imageIndex, Platform platform)
+{
+	PerceptualEntry* entries = NULL;
+	PerceptualEntry* entry = NULL;
+	u32 newCapacity = 0;
+	u32 band = 0;
+
+	LockMutex(&index->mutex);
+	if (index->nEntries == index->entriesCapacity)
+	{
+		newCapacity = index->entriesCapacity ? index->entriesCapacity * 2 : 1024;
+		entries = realloc(index->entries, newCapacity * sizeof(PerceptualEntry));
+		if (!entries)
+		{
+			UnlockMutex(&index->mutex);
+			return FALSE;
+		}
+		index->entries = entries;
+		index->entriesCapacity = newCapacity;
+	}
+	entry = &index->entries[index->nEntries];
+	entry->path = malloc(strlen(path) + 1);
+	if (!entry->path)
+	{
+		UnlockMutex(&index->mutex);
+		return FALSE;
+	}
+	strcpy(entry->path, path);
+	entry->hash = hash;
+	entry->imageIndex = imageIndex;
+	entry->platform = platform;
+	for (band = 0; band < PERCEPTUAL_INDEX_NUM_BANDS; ++band)
+	{
+		entry->nextInBand[band] = index->buckets[band][GetBand(hash, band)];
+		index->buckets[band][GetBand(hash, band)] = index->nEntries + 1;
+	}
+	++index->nEntries;
+	UnlockMutex(&index->mutex);
+	return TRUE;
+}
+
+/* Decodes every image in the file and adds it to the index. Returns how many were added, which leaves out
+ * any image that couldn't be decoded or hashed. */
+u32 AddFileToPerceptualIndex(PerceptualIndex* index, const char* path, const u32* customWidths)
+{
+	Memory image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	DecodedImage decodedImage = { 0 };
+	u8* header = NULL;
+	u64 hash = 0;
+	u32 nAdded = 0;
+	u32 i = 0;
+
+	image = LoadFile(path);
+	if (!image.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(path);
+		return 0;
+	}
+	if (!ValidateContainer(image, &imageInfo))
+	{
+		printf("Skipping corrupt file %s\n", path);
+		free(image.data);
+		return 0;
+	}
+	header = GetImageHeader(image, imageInfo, 0);
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		if (i > 0)
+		{
+			header = GetNextImageHeader(header);
+		}
+		if (!DecodeRGOImage(image, imageInfo, header, i, customWidths ? customWidths[i] : 0, &decodedImage))
+		{
+			continue;
+		}
+		if (GetPerceptualHash(decodedImage, &hash))
+		{
+			nAdded += AddToPerceptualIndex(index, hash, path, i, decodedImage.platform);
+		}
+		TrackedFree(decodedImage.pixels.data);
+	}
+	free(image.data);
+	return nAdded;
+}
+
+u32 GetPerceptualIndexSize(PerceptualIndex* index)
+{
+	u32 ret = 0;
+
+	LockMutex(&index->mutex);
+	ret = index->nEntries;
+	UnlockMutex(&index->mutex);
+	return ret;
+}
+
+bool32 GetPerceptualIndexEntry(PerceptualIndex* index, u32 entryIndex, u64* hash, PerceptualMatch* entry)
+{
+	LockMutex(&index->mutex);
+	if (entryIndex >= index->nEntries)
+	{
+		UnlockMutex(&index->mutex);
+		return FALSE;
+	}
+	*hash = index->entries[entryIndex].hash;
+	entry->path = index->entries[entryIndex].path;
+	entry->imageIndex = index->entries[entryIndex].imageIndex;
+	entry->platform = index->entries[entryIndex].platform;
+	entry->distance = 0;
+	UnlockMutex(&index->mutex);
+	return TRUE;
+}
+
+/* Finds the closest images on the given platform that are at most maxDistance bits from hash, closest first.
+ * Only images sharing a band with hash are looked at, so matches further than PERCEPTUAL_INDEX_NUM_BANDS - 1
+ * bits away may be missed. Returns the number of matches written. */
+u32 FindPerceptualMatches(PerceptualIndex* index, u64 hash, Platform platform, u32 maxDistance, PerceptualMatch* matches, u32 maxMatches)
+{
+	PerceptualEntry* entry = NULL;
+	PerceptualMatch match = { 0 };
+	u32 nMatches = 0;
+	u32 entryIndex = 0;
+	u32 band = 0;
+	u32 earlierBand = 0;
+	bool32 alreadySeen = FALSE;
+	u32 i = 0;
+
+	LockMutex(&index->mutex);
+	for (band = 0; band < PERCEPTUAL_INDEX_NUM_BANDS; ++band)
+	{
+		for (entryIndex = index->buckets[band][GetBand(hash, band)]; entryIndex; entryIndex = entry->nextInBand[band])
+		{
+			entry = &index->entries[entryIndex - 1];
+
+			/* An entry that shares an earlier band was already looked at */
+			alreadySeen = FALSE;
+			for (earlierBand = 0; earlierBand < band; ++earlierBand)
+			{
+				alreadySeen |= GetBand(entry->hash, earlierBand) == GetBand(hash, earlierBand);
+			}
+			if (alreadySeen || entry->platform != platform)
+			{
+				continue;
+			}
+			match.distance = GetPerceptualHashDistance(hash, entry->hash);
+			if (match.distance > maxDistance)
+			{
+				continue;
+			}
+			match.path = entry->path;
+			match.imageIndex = entry->imageIndex;
+			match.platform = entry->platform;
+
+			/* Insertion sort, dropping the furthest match when full */
+			for (i = nMatches; i > 0 && matches[i - 1].distance > match.distance; --i)
+			{
+				if (i < maxMatches)
+				{
+					matches[i] = matches[i - 1];
+				}
+			}
+			if (i < maxMatches)
+			{
+				matches[i] = match;
+				if (nMatches < maxMatches)
+				{
+					++nMatches;
+				}
+			}
+		}
+	}
+	UnlockMutex(&index->mutex);
+	return nMatches;
+}
+
+void DestroyPerceptualIndex(PerceptualIndex* index)
+{
+	u32 i = 0;
+
+	if (!index)
+	{
+		return;
+	}
+	for (i = 0; i < index->nEntries; ++i)
+	{
+		free(index->entries[i].path);
+	}
+	free(index->entries);
+	DestroyMutex(&index->mutex);
+	free(index);
+}
+
+static u32 GetBand(u64 hash, u32 band)
+{
+	return (u32)(hash >> (band * PERCEPTUAL_INDEX_BAND_BITS)) & (PERCEPTUAL_INDEX_NUM_BUCKETS - 1);
+}
+
+/* Several threads may hash their first image at the same time, so the kernel is chosen under RunOnce */
+static void ChooseSum(void)
+{
+#ifdef ARCH_X86
+	if (GetCPUFeatures().hasSSE2)
+	{
+		sum = SumSSE2;
+	}
+#endif
+}
+
+static u32 SumScalar(const u32* values, u32 nValues)
+{
+	u32 ret = 0;
+	u32 i = 0;
+
+	for (i = 0; i < nValues; ++i)
+	{
+		ret += values[i];
+	}
+	return ret;
+}
+
+#ifdef ARCH_X86
+/* Brightness values are at most 255 and rows are at most a few thousand pixels, so 32-bit lanes can't overflow */
+TARGET_SSE2 static u32 SumSSE2(const u32* values, u32 nValues)
+{
+	__m128i sums = { 0 };
+	u32 i = 0;
+
+	sums = _mm_setzero_si128();
+	for (i = 0; i + 4 <= nValues; i += 4)
+	{
+		sums = _mm_add_epi32(sums, _mm_loadu_si128((const __m128i*)&values[i]));
+	}
+	sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 8));
+	sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 4));
+	return (u32)_mm_cvtsi128_si32(sums) + SumScalar(&values[i], nValues - i);
+}
+#endif
@@ -0,0 +1,58 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  phash.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef PHASH_H
+#define PHASH_H
+
+#include "util.h"
+#include "image.h"
+
+/* Perceptual hashes tell whether two images look alike, even at different sizes or from different platforms.
+ * The hash is a 64-bit difference hash: the image is shrunk to 9x8 brightness values, and each bit says
+ * whether one value is brighter than the one to its right. Similar images differ in only a few bits.
+ *
+ * The index splits each hash into PERCEPTUAL_INDEX_NUM_BANDS bands and buckets images by each band,
+ * so any image within PERCEPTUAL_INDEX_NUM_BANDS - 1 bits of a query shares a bucket with it.
+ * Images smaller than 9x8 can't be hashed, and are left out of the index. */
+#define PERCEPTUAL_INDEX_NUM_BANDS 4
+#define PERCEPTUAL_INDEX_BAND_BITS 16
+#define PERCEPTUAL_HASH_DEFAULT_MAX_DISTANCE (PERCEPTUAL_INDEX_NUM_BANDS - 1)
+
+typedef struct PerceptualIndex PerceptualIndex;
+
+typedef struct
+{
+	const char* path; /* Owned by the index */
+	u32 imageIndex;
+	Platform platform;
+	u32 distance; /* The number of bits that differ from the query */
+} PerceptualMatch;
+
+bool32 GetPerceptualHash(DecodedImage decodedImage, u64* hash);
+u32 GetPerceptualHashDistance(u64 a, u64 b);
+
+PerceptualIndex* CreatePerceptualIndex(void);
+bool32 AddToPerceptualIndex(PerceptualIndex* index, u64 hash, const char* path, u32 imageIndex, Platform platform);
+u32 AddFileToPerceptualIndex(PerceptualIndex* index, const char* path, const u32* customWidths);
+u32 GetPerceptualIndexSize(PerceptualIndex* index);
+bool32 GetPerceptualIndexEntry(PerceptualIndex* index, u32 entryIndex, u64* hash, PerceptualMatch* entry);
+u32 FindPerceptualMatches(PerceptualIndex* index, u64 hash, Platform platform, u32 maxDistance, PerceptualMatch* matches, u32 maxMatches);
+void DestroyPerceptualIndex(PerceptualIndex* index);
+
+#endif
@@ -0,0 +1,164 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  raw.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "image.h"
+#include "sink.h"
+#include "raw.h"
+
+/* Writes the image and palette files next to each other, named after outputPath with
+ * its extension replaced. Goes into the sink instead if the output settings have one. */
+bool32 WriteRawImage(DecodedImage decodedImage, const char* outputPath, OutputSettings output)
+{
+	Memory imageFile = { 0 };
+	Memory paletteFile = { 0 };
+	char* path = NULL;
+	bool32 success = FALSE;
+
+	path = malloc(strlen(outputPath) + sizeof(RAW_IMAGE_EXTENSION) + sizeof(RAW_PALETTE_EXTENSION));
+	imageFile.size = RAW_IMAGE_HEADER_SIZE + decodedImage.pixels.size;
+	imageFile.data = malloc(imageFile.size);
+	if (!path || !imageFile.data)
+	{
+		free(path);
+		free(imageFile.data);
+		return FALSE;
+	}
+	memcpy(&imageFile.data[0], RAW_IMAGE_SIGNATURE, 4);
+	LittleEndianWrite32(&imageFile.data[4], decodedImage.width);
+	LittleEndianWrite32(&imageFile.data[8], decodedImage.height);
+	LittleEndianWrite32(&imageFile.data[12], decodedImage.bitsPerPixel);
+	memcpy(&imageFile.data[RAW_IMAGE_HEADER_SIZE], decodedImage.pixels.data, decodedImage.pixels.size);
+
+	if (output.uncorrectedRawPalette)
+	{
+		paletteFile.data = decodedImage.sourcePalette.data;
+		paletteFile.size = decodedImage.sourcePalette.nColors * 4;
+	}
+	else
+	{
+		paletteFile.data = decodedImage.palette.data;
+		paletteFile.size = decodedImage.palette.nColors * 4;
+	}
+
+	ReplaceExtension(outputPath, RAW_IMAGE_EXTENSION, path);
+	if (output.sink)
+	{
+		success = WriteToOutputSink(output.sink, path, imageFile);
+	}
+	else
+	{
+		success = WriteMemoryToFile(imageFile, path);
+	}
+	if (success)
+	{
+		ReplaceExtension(outputPath, RAW_PALETTE_EXTENSION, path);
+		if (output.sink)
+		{
+			success = WriteToOutputSink(output.sink, path, paletteFile);
+		}
+		else
+		{
+			success = WriteMemoryToFile(paletteFile, path);
+		}
+	}
+
+	free(path);
+	free(imageFile.data);
+	return success;
+}
+
+/* Loads a raw image and its palette. There's nothing to decode, the pixels and palette are used in place. */
+bool32 LoadRawImage(const char* imagePath, const char* palettePath, RawImage* rawImage)
+{
+	RawImage ret = { 0 };
+	u32 bytesPerRow = 0;
+
+	ret.imageFile = LoadFile(imagePath);
+	if (!ret.imageFile.data)
+	{
+		return FALSE;
+	}
+	ret.paletteFile = LoadFile(palettePath);
+	if (!ret.paletteFile.data)
+	{
+		free(ret.imageFile.data);
+		return FALSE;
+	}
+	if (ret.imageFile.size < RAW_IMAGE_HEADER_SIZE || memcmp(ret.imageFile.data, RAW_IMAGE_SIGNATURE, 4) != 0)
+	{
+		printf("%s is not a raw image\n", imagePath);
+		FreeRawImage(&ret);
+		return FALSE;
+	}
+
+	ret.image.width = LittleEndianRead32(&ret.imageFile.data[4]);
+	ret.image.height = LittleEndianRead32(&ret.imageFile.data[8]);
+	ret.image.bitsPerPixel = LittleEndianRead32(&ret.imageFile.data[12]);
+	ret.image.pixels.data = &ret.imageFile.data[RAW_IMAGE_HEADER_SIZE];
+	ret.image.pixels.size = ret.imageFile.size - RAW_IMAGE_HEADER_SIZE;
+	ret.image.palette.data = ret.paletteFile.data;
+	ret.image.palette.nColors = ret.paletteFile.size / 4;
+
+	/* Make sure the header agrees with the amount of data so nothing reads past the end */
+	bytesPerRow = ret.image.width * ret.image.bitsPerPixel / 8;
+	if ((ret.image.bitsPerPixel != 4 && ret.image.bitsPerPixel != 8) ||
+		(u64)bytesPerRow * ret.image.height > ret.image.pixels.size ||
+		ret.image.palette.nColors < (1u << ret.image.bitsPerPixel))
+	{
+		printf("Raw image %s does not match its header or palette\n", imagePath);
+		FreeRawImage(&ret);
+		return FALSE;
+	}
+
+	*rawImage = ret;
+	return TRUE;
+}
+
+void FreeRawImage(RawImage* rawImage)
+{
+	free(rawImage->imageFile.data);
+	free(rawImage->paletteFile.data);
+	rawImage->imageFile.data = NULL;
+	rawImage->paletteFile.data = NULL;
+}
+
+/* Copies path into outputPath with everything from the last '.' in the file name replaced by extension */
+void ReplaceExtension(const char* path, const char* extension, char* outputPath)
+{
+	const char* dot = NULL;
+	const char* slash = NULL;
+	size_t length = 0;
+
+	dot = strrchr(path, '.');
+	slash = strrchr(path, '/');
+	if (!dot || (slash && dot < slash))
+	{
+		length = strlen(path);
+	}
+	else
+	{
+		length = dot - path;
+	}
+	memcpy(outputPath, path, length);
+	strcpy(&outputPath[length], extension);
+}
@@ -0,0 +1,52 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  raw.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef RAW_H
+#define RAW_H
+
+#include "util.h"
+#include "image.h"
+
+/* The raw format skips PNG compression entirely, for quickly editing and reimporting images.
+ * An image is written as two files:
+ *
+ * <name>.rgoi: A RAW_IMAGE_HEADER_SIZE byte header followed immediately by the decoded
+ *              palette indices, exactly as DecodeRGOImage leaves them. The header is
+ *              "RGOI" followed by the width, height, and bits per pixel as little endian u32s.
+ * <name>.pal:  The palette as nColors little endian RGBA u32s. */
+#define RAW_IMAGE_EXTENSION ".rgoi"
+#define RAW_PALETTE_EXTENSION ".pal"
+#define RAW_IMAGE_SIGNATURE "RGOI"
+#define RAW_IMAGE_HEADER_SIZE 16
+
+/* A raw image loaded back in. image points into the loaded files, so it
+ * stays valid until FreeRawImage is called. */
+typedef struct
+{
+	Memory imageFile;
+	Memory paletteFile;
+	DecodedImage image;
+} RawImage;
+
+bool32 WriteRawImage(DecodedImage decodedImage, const char* outputPath, OutputSettings output);
+bool32 LoadRawImage(const char* imagePath, const char* palettePath, RawImage* rawImage);
+void FreeRawImage(RawImage* rawImage);
+void ReplaceExtension(const char* path, const char* extension, char* outputPath);
+
+#endif
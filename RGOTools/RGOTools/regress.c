@@ -0,0 +1,355 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  regress.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "OutsideCode/zlib/zlib.h"
+#include "util.h"
+#include "image.h"
+#include "regress.h"
+#include "alloc.h"
+
+#define REGRESSION_MANIFEST_MAX_LINE 2048
+
+/* Everything that has to come out the same. A failed image is all zeroes, so it
+ * only matches an image that also failed when the manifest was written. */
+typedef struct
+{
+	char* inputPath;
+	u32 imageIndex;
+	u32 width;
+	u32 height;
+	u32 pixelsCrc;
+	u32 outputCrc;
+	u32 outputSize;
+	bool32 compared;
+} RegressionImage;
+
+struct RegressionRun
+{
+	RegressionImage* images;
+	u32 nImages;
+	u32 imagesCapacity;
+	double stageSeconds[NUM_REGRESSION_STAGES];
+};
+
+static const char* regressionStageNames[NUM_REGRESSION_STAGES] =
+{
+	"load",
+	"decode",
+	"palette",
+	"encode"
+};
+
+static RegressionImage* AddRegressionImage(RegressionRun* run, const char* inputPath, u32 imageIndex);
+static void HashRegressionImage(Memory image, ImageInfo imageInfo, u8* header, u32 imageIndex, u32 customWidth, RegressionRun* run, RegressionImage* result);
+static RegressionImage* FindRegressionImage(RegressionRun* run, const char* inputPath, u32 imageIndex, u32* searchStart);
+static bool32 RegressionImagesMatch(const RegressionImage* a, const RegressionImage* b);
+
+RegressionRun* CreateRegressionRun(void)
+{
+	return calloc(1, sizeof(RegressionRun));
+}
+
+/* Decodes, hashes and encodes every image in the file. customWidths may be NULL if none of them have one. */
+bool32 AddRegressionFile(RegressionRun* run, const char* inputPath, const u32* customWidths)
+{
+	Memory image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	u8* headers[MAX_IMAGES_PER_FILE] = { 0 };
+	RegressionImage* result = NULL;
+	double startTime = 0.0;
+	u32 i = 0;
+
+	startTime = GetTimeInSeconds();
+	image = LoadFile(inputPath);
+	if (!image.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(inputPath);
+		return FALSE;
+	}
+	if (!ValidateContainer(image, &imageInfo))
+	{
+		printf("Skipping corrupt file %s\n", inputPath);
+		free(image.data);
+		return FALSE;
+	}
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		headers[i] = i == 0 ? GetImageHeader(image, imageInfo, 0) : GetNextImageHeader(headers[i - 1]);
+	}
+	run->stageSeconds[REGRESSION_STAGE_LOAD] += GetTimeInSeconds() - startTime;
+
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		result = AddRegressionImage(run, inputPath, i);
+		if (!result)
+		{
+			free(image.data);
+			return FALSE;
+		}
+		HashRegressionImage(image, imageInfo, headers[i], i, customWidths ? customWidths[i] : 0, run, result);
+	}
+	free(image.data);
+	return TRUE;
+}
+
+static RegressionImage* AddRegressionImage(RegressionRun* run, const char* inputPath, u32 imageIndex)
+{
+	RegressionImage* images = NULL;
+	RegressionImage* ret = NULL;
+	u32 newCapacity = 0;
+
+	if (run->nImages == run->imagesCapacity)
+	{
+		newCapacity = run->imagesCapacity ? run->imagesCapacity * 2 : 1024;
+		images = realloc(run->images, sizeof(RegressionImage) * newCapacity);
+		if (!images)
+		{
+			return NULL;
+		}
+		run->images = images;
+		run->imagesCapacity = newCapacity;
+	}
+	ret = &run->images[run->nImages];
+	memset(ret, 0, sizeof(RegressionImage));
+	ret->inputPath = malloc(strlen(inputPath) + 1);
+	if (!ret->inputPath)
+	{
+		return NULL;
+	}
+	strcpy(ret->inputPath, inputPath);
+	ret->imageIndex = imageIndex;
+	++run->nImages;
+	return ret;
+}
+
+/* Goes through the same steps as extraction, timing each of them. Anything that fails leaves the rest of result zeroed. */
+static void HashRegressionImage(Memory image, ImageInfo imageInfo, u8* header, u32 imageIndex, u32 customWidth, RegressionRun* run, RegressionImage* result)
+{
+	DecodedImage decodedImage = { 0 };
+	Memory pixels = { 0 };
+	Memory encodedImage = { 0 };
+	Platform platform = 0;
+	double startTime = 0.0;
+	bool32 success = FALSE;
+
+	platform = GetImagePlatform(header);
+	startTime = GetTimeInSeconds();
+	pixels = DecodeImagePixels(header, platform, NULL);
+	run->stageSeconds[REGRESSION_STAGE_DECODE] += GetTimeInSeconds() - startTime;
+	if (!pixels.data)
+	{
+		return;
+	}
+
+	startTime = GetTimeInSeconds();
+	success = InitDecodedImage(image, imageInfo, imageIndex, platform, customWidth, pixels, &decodedImage);
+	run->stageSeconds[REGRESSION_STAGE_PALETTE] += GetTimeInSeconds() - startTime;
+	if (!success)
+	{
+		TrackedFree(pixels.data);
+		return;
+	}
+	result->width = decodedImage.width;
+	result->height = decodedImage.height;
+	result->pixelsCrc = crc32(crc32(0, NULL, 0), pixels.data, pixels.size);
+
+	startTime = GetTimeInSeconds();
+	success = EncodePNG(decodedImage.pixels, decodedImage.palette, decodedImage.width, decodedImage.height, PNG_ENCODE_PROFILE_DEFAULT, &encodedImage);
+	run->stageSeconds[REGRESSION_STAGE_ENCODE] += GetTimeInSeconds() - startTime;
+	if (success)
+	{
+		result->outputCrc = crc32(crc32(0, NULL, 0), encodedImage.data, encodedImage.size);
+		result->outputSize = encodedImage.size;
+		TrackedFree(encodedImage.data);
+	}
+	TrackedFree(pixels.data);
+}
+
+/* One line per stage with its total time, then one line per image with its
+ * index, dimensions, pixel and output hashes, output size and file path. */
+bool32 WriteRegressionManifest(RegressionRun* run, const char* manifestPath)
+{
+	FILE* manifestFile = NULL;
+	const RegressionImage* image = NULL;
+	u32 i = 0;
+
+	manifestFile = fopen(manifestPath, "wb");
+	if (!manifestFile)
+	{
+		FOPEN_FAIL_MESSAGE(manifestPath);
+		return FALSE;
+	}
+	for (i = 0; i < NUM_REGRESSION_STAGES; ++i)
+	{
+		fprintf(manifestFile, "stage %s %.6f\n", regressionStageNames[i], run->stageSeconds[i]);
+	}
+	for (i = 0; i < run->nImages; ++i)
+	{
+		image = &run->images[i];
+		fprintf(manifestFile, "image %u %u %u %08x %08x %u %s\n", image->imageIndex, image->width, image->height,
+			image->pixelsCrc, image->outputCrc, image->outputSize, image->inputPath);
+	}
+	fclose(manifestFile);
+	return TRUE;
+}
+
+/* Checks this run against a manifest written by an earlier one, printing every image that differs.
+ * Returns TRUE only if every image matches and no stage got slower by more than slowdownThreshold,
+ * which is a fraction of the manifest's time for that stage. */
+bool32 CompareRegressionManifest(RegressionRun* run, const char* manifestPath, double slowdownThreshold, RegressionResults* results)
+{
+	FILE* manifestFile = NULL;
+	char line[REGRESSION_MANIFEST_MAX_LINE] = { 0 };
+	char stageName[32] = { 0 };
+	RegressionImage expected = { 0 };
+	RegressionImage* actual = NULL;
+	double stageSeconds = 0.0;
+	u32 searchStart = 0;
+	int pathStart = 0;
+	u32 i = 0;
+
+	memset(results, 0, sizeof(RegressionResults));
+	results->nImages = run->nImages;
+	memcpy(results->stageSeconds, run->stageSeconds, sizeof(results->stageSeconds));
+	manifestFile = fopen(manifestPath, "rb");
+	if (!manifestFile)
+	{
+		FOPEN_FAIL_MESSAGE(manifestPath);
+		return FALSE;
+	}
+	for (i = 0; i < run->nImages; ++i)
+	{
+		run->images[i].compared = FALSE;
+	}
+
+	while (fgets(line, sizeof(line), manifestFile))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (sscanf(line, "stage %31s %lf", stageName, &stageSeconds) == 2)
+		{
+			for (i = 0; i < NUM_REGRESSION_STAGES; ++i)
+			{
+				if (strcmp(stageName, regressionStageNames[i]) == 0)
+				{
+					results->baselineStageSeconds[i] = stageSeconds;
+				}
+			}
+			continue;
+		}
+		pathStart = 0;
+		if (sscanf(line, "image %u %u %u %x %x %u %n", &expected.imageIndex, &expected.width, &expected.height,
+			&expected.pixelsCrc, &expected.outputCrc, &expected.outputSize, &pathStart) < 6 || pathStart == 0)
+		{
+			continue;
+		}
+		expected.inputPath = &line[pathStart];
+		actual = FindRegressionImage(run, expected.inputPath, expected.imageIndex, &searchStart);
+		if (!actual)
+		{
+			printf("Missing: image %u of %s\n", expected.imageIndex, expected.inputPath);
+			++results->nMissing;
+			continue;
+		}
+		actual->compared = TRUE;
+		if (!RegressionImagesMatch(actual, &expected))
+		{
+			printf("Mismatch: image %u of %s is %ux%u pixels %08x output %08x (%u bytes), expected %ux%u pixels %08x output %08x (%u bytes)\n",
+				actual->imageIndex, actual->inputPath, actual->width, actual->height, actual->pixelsCrc, actual->outputCrc, actual->outputSize,
+				expected.width, expected.height, expected.pixelsCrc, expected.outputCrc, expected.outputSize);
+			++results->nMismatched;
+		}
+	}
+	fclose(manifestFile);
+
+	for (i = 0; i < run->nImages; ++i)
+	{
+		if (!run->images[i].compared)
+		{
+			printf("New: image %u of %s\n", run->images[i].imageIndex, run->images[i].inputPath);
+			++results->nNew;
+		}
+	}
+	for (i = 0; i < NUM_REGRESSION_STAGES; ++i)
+	{
+		if (results->stageSeconds[i] > results->baselineStageSeconds[i] * (1.0 + slowdownThreshold) &&
+			results->stageSeconds[i] - results->baselineStageSeconds[i] > REGRESSION_MIN_SLOWDOWN_SECONDS)
+		{
+			printf("Slower: %s took %.3fs, %.3fs in the manifest\n", regressionStageNames[i], results->stageSeconds[i], results->baselineStageSeconds[i]);
+			++results->nSlowerStages;
+		}
+	}
+	return results->nMismatched == 0 && results->nMissing == 0 && results->nNew == 0 && results->nSlowerStages == 0;
+}
+
+/* The manifest is normally in the same order as the run, so the search starts just after the last image found */
+static RegressionImage* FindRegressionImage(RegressionRun* run, const char* inputPath, u32 imageIndex, u32* searchStart)
+{
+	RegressionImage* image = NULL;
+	u32 i = 0;
+	u32 j = 0;
+
+	for (i = 0; i < run->nImages; ++i)
+	{
+		j = (*searchStart + i) % run->nImages;
+		image = &run->images[j];
+		if (image->imageIndex == imageIndex && !image->compared && strcmp(image->inputPath, inputPath) == 0)
+		{
+			*searchStart = j + 1;
+			return image;
+		}
+	}
+	return NULL;
+}
+
+static bool32 RegressionImagesMatch(const RegressionImage* a, const RegressionImage* b)
+{
+	return a->width == b->width && a->height == b->height && a->pixelsCrc == b->pixelsCrc &&
+		a->outputCrc == b->outputCrc && a->outputSize == b->outputSize;
+}
+
+void PrintRegressionResults(RegressionResults results)
+{
+	u32 i = 0;
+
+	printf("Images: %u. Mismatched: %u. Missing: %u. New: %u. Slower stages: %u\n",
+		results.nImages, results.nMismatched, results.nMissing, results.nNew, results.nSlowerStages);
+	for (i = 0; i < NUM_REGRESSION_STAGES; ++i)
+	{
+		printf("  %-8s %.3fs (manifest %.3fs)\n", regressionStageNames[i], results.stageSeconds[i], results.baselineStageSeconds[i]);
+	}
+}
+
+void DestroyRegressionRun(RegressionRun* run)
+{
+	u32 i = 0;
+
+	if (!run)
+	{
+		return;
+	}
+	for (i = 0; i < run->nImages; ++i)
+	{
+		free(run->images[i].inputPath);
+	}
+	free(run->images);
+	free(run);
+}
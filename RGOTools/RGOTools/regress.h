@@ -0,0 +1,62 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  regress.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef REGRESS_H
+#define REGRESS_H
+
+#include "util.h"
+
+/* Decodes and encodes every image given to it, hashing the palette indices and the PNG that
+ * comes out and timing each stage, so a run can be saved as a manifest and later runs checked
+ * against it for both bit-exactness and speed. */
+typedef struct RegressionRun RegressionRun;
+
+/* A stage only counts as slower if it's slower by both the threshold and this many seconds,
+ * so that timer noise on small test sets doesn't fail the run */
+#define REGRESSION_MIN_SLOWDOWN_SECONDS 0.05
+#define REGRESSION_DEFAULT_SLOWDOWN_THRESHOLD 0.10
+
+typedef enum
+{
+	REGRESSION_STAGE_LOAD,    /* Loading the file and finding the image headers */
+	REGRESSION_STAGE_DECODE,  /* Decompressing and untiling */
+	REGRESSION_STAGE_PALETTE, /* Working out the palette and dimensions */
+	REGRESSION_STAGE_ENCODE,  /* Encoding the PNG */
+	NUM_REGRESSION_STAGES
+} RegressionStage;
+
+typedef struct
+{
+	u32 nImages;
+	u32 nMismatched; /* Pixels, dimensions or output differ from the manifest */
+	u32 nMissing;    /* In the manifest but not in this run */
+	u32 nNew;        /* In this run but not in the manifest */
+	u32 nSlowerStages;
+	double stageSeconds[NUM_REGRESSION_STAGES];
+	double baselineStageSeconds[NUM_REGRESSION_STAGES];
+} RegressionResults;
+
+RegressionRun* CreateRegressionRun(void);
+bool32 AddRegressionFile(RegressionRun* run, const char* inputPath, const u32* customWidths);
+bool32 WriteRegressionManifest(RegressionRun* run, const char* manifestPath);
+bool32 CompareRegressionManifest(RegressionRun* run, const char* manifestPath, double slowdownThreshold, RegressionResults* results);
+void PrintRegressionResults(RegressionResults results);
+void DestroyRegressionRun(RegressionRun* run);
+
+#endif
@@ -0,0 +1,450 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  repack.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "OutsideCode/zlib/zlib.h"
+#include "util.h"
+#include "image.h"
+#include "lzss.h"
+#include "repack.h"
+
+#define MAX_SUBFILE_ALIGNMENT 16
+#define PSP_SUBFILE_DATA_OFFSET 16 /* The decompressed size, then 12 bytes of padding */
+#define PS2_SUBFILE_DATA_OFFSET 4
+#define IMAGE_ALIGNMENT 1024
+
+static u32 RoundUp(u32 value, u32 alignment);
+static bool32 CompressPSPSubfile(const u8* src, u32 srcSize, Memory* compressed);
+static u32 GetSubfileAlignment(const u8* header);
+static u32 GetImageSpaceUsed(u32 dataSize);
+static bool32 GetImageExtent(Memory container, u32 imageIndex, u32* start, u32* end);
+
+static u32 RoundUp(u32 value, u32 alignment)
+{
+	if (value % alignment != 0)
+	{
+		value = (value / alignment + 1) * alignment;
+	}
+	return value;
+}
+
+static bool32 CompressPSPSubfile(const u8* src, u32 srcSize, Memory* compressed)
+{
+	z_stream zStream = { 0 };
+	Memory ret = { 0 };
+
+	if (deflateInit2(&zStream, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		return FALSE;
+	}
+	ret.data = malloc(deflateBound(&zStream, srcSize));
+	if (!ret.data)
+	{
+		deflateEnd(&zStream);
+		return FALSE;
+	}
+	zStream.next_in = (u8*)src;
+	zStream.avail_in = srcSize;
+	zStream.next_out = ret.data;
+	zStream.avail_out = deflateBound(&zStream, srcSize);
+	if (deflate(&zStream, Z_FINISH) != Z_STREAM_END)
+	{
+		deflateEnd(&zStream);
+		free(ret.data);
+		return FALSE;
+	}
+	ret.size = (u32)zStream.total_out;
+	deflateEnd(&zStream);
+	*compressed = ret;
+	return TRUE;
+}
+
+/* PSP subfiles are always 16-byte aligned. PS2 subfiles are packed however the original tool packed them, so
+ * the alignment is worked out from the offsets, which lays an unchanged image out the same way again. */
+static u32 GetSubfileAlignment(const u8* header)
+{
+	u32 alignment = MAX_SUBFILE_ALIGNMENT;
+	u32 nSubfiles = 0;
+	u32 i = 0;
+
+	nSubfiles = LittleEndianRead32(header);
+	for (i = 0; i <= nSubfiles; ++i)
+	{
+		while (LittleEndianRead32(&header[(i + 1) * 4]) % alignment != 0)
+		{
+			alignment /= 2;
+		}
+	}
+	return alignment;
+}
+
+/* Compresses linear palette indices into the header and subfiles of an image, laid out like
+ * originalHeader: the same header size and, if the pixels are the same size as before, the same
+ * split into subfiles. The checksum and padding are left to RepackImage. PSP pixels are tiled here.
+ * On success, the returned data must be freed by the caller. */
+Memory EncodeReplacementImage(const u8* originalHeader, Platform platform, Memory pixels)
+{
+	Memory ret = { 0 };
+	Memory source = { 0 };
+	Memory* compressedSubfiles = NULL;
+	u32* subfileSizes = NULL;
+	u32 nOriginalSubfiles = 0;
+	u32 nSubfiles = 0;
+	u32 headerSize = 0;
+	u32 subfileOffset = 0;
+	u32 subfileSize = 0;
+	u32 dataOffset = 0;
+	u32 pixelsOffset = 0;
+	u32 alignment = 0;
+	bool32 keepOriginalSplit = FALSE;
+	bool32 success = TRUE;
+
+	u32 i = 0;
+
+	nOriginalSubfiles = LittleEndianRead32(originalHeader);
+	if (nOriginalSubfiles == 0 || pixels.size == 0)
+	{
+		printf("Image has no subfiles to replace\n");
+		return ret;
+	}
+	headerSize = LittleEndianRead32(&originalHeader[4]);
+	dataOffset = platform == PLATFORM_PSP ? PSP_SUBFILE_DATA_OFFSET : PS2_SUBFILE_DATA_OFFSET;
+	alignment = platform == PLATFORM_PSP ? MAX_SUBFILE_ALIGNMENT : GetSubfileAlignment(originalHeader);
+
+	if (platform == PLATFORM_PSP)
+	{
+		source = LinearToTiled(pixels);
+		if (!source.data)
+		{
+			return ret;
+		}
+	}
+	else
+	{
+		source = pixels;
+	}
+
+	/* Keep the original split if possible, otherwise split into pieces the size of the original first subfile */
+	keepOriginalSplit = source.size == GetDecompressedImageSize(originalHeader);
+	if (keepOriginalSplit)
+	{
+		nSubfiles = nOriginalSubfiles;
+	}
+	else
+	{
+		subfileSize = LittleEndianRead32(&originalHeader[headerSize]);
+		nSubfiles = (source.size + subfileSize - 1) / subfileSize;
+	}
+	if (headerSize < (nSubfiles + 2) * 4)
+	{
+		headerSize = RoundUp((nSubfiles + 2) * 4, alignment);
+	}
+	subfileSizes = calloc(nSubfiles, sizeof(*subfileSizes));
+	compressedSubfiles = calloc(nSubfiles, sizeof(*compressedSubfiles));
+	if (!subfileSizes || !compressedSubfiles)
+	{
+		success = FALSE;
+		goto cleanup;
+	}
+	for (i = 0; i < nSubfiles; ++i)
+	{
+		if (keepOriginalSplit)
+		{
+			subfileOffset = LittleEndianRead32(&originalHeader[(i + 1) * 4]);
+			subfileSizes[i] = LittleEndianRead32(&originalHeader[subfileOffset]);
+		}
+		else
+		{
+			subfileSizes[i] = source.size - pixelsOffset < subfileSize ? source.size - pixelsOffset : subfileSize;
+		}
+		if (platform == PLATFORM_PSP)
+		{
+			success = CompressPSPSubfile(&source.data[pixelsOffset], subfileSizes[i], &compressedSubfiles[i]);
+		}
+		else
+		{
+			success = CompressPS2Subimage(&source.data[pixelsOffset], subfileSizes[i], &compressedSubfiles[i]);
+		}
+		if (!success)
+		{
+			goto cleanup;
+		}
+		pixelsOffset += subfileSizes[i];
+		ret.size += RoundUp(dataOffset + compressedSubfiles[i].size, alignment);
+	}
+
+	ret.size += headerSize;
+	ret.data = calloc(ret.size, 1);
+	if (!ret.data)
+	{
+		success = FALSE;
+		goto cleanup;
+	}
+	LittleEndianWrite32(ret.data, nSubfiles);
+	subfileOffset = headerSize;
+	for (i = 0; i < nSubfiles; ++i)
+	{
+		LittleEndianWrite32(&ret.data[(i + 1) * 4], subfileOffset);
+		LittleEndianWrite32(&ret.data[subfileOffset], subfileSizes[i]);
+		memcpy(&ret.data[subfileOffset + dataOffset], compressedSubfiles[i].data, compressedSubfiles[i].size);
+		subfileOffset += RoundUp(dataOffset + compressedSubfiles[i].size, alignment);
+	}
+	LittleEndianWrite32(&ret.data[(nSubfiles + 1) * 4], subfileOffset);
+
+cleanup:
+	if (compressedSubfiles)
+	{
+		for (i = 0; i < nSubfiles; ++i)
+		{
+			free(compressedSubfiles[i].data);
+		}
+		free(compressedSubfiles);
+	}
+	free(subfileSizes);
+	if (source.data != pixels.data)
+	{
+		free(source.data);
+	}
+	if (!success)
+	{
+		printf("Failed to encode replacement image\n");
+		free(ret.data);
+		ret.data = NULL;
+		ret.size = 0;
+	}
+	return ret;
+}
+
+/* The image data, its checksum and the padding up to the next kilobyte */
+static u32 GetImageSpaceUsed(u32 dataSize)
+{
+	return RoundUp(dataSize + (dataSize % 16) + CHECKSUM_LENGTH, IMAGE_ALIGNMENT);
+}
+
+/* Where an image starts, and where the image after it starts (or the end of the file for the last one),
+ * which is all the space the image can use without moving anything else. */
+static bool32 GetImageExtent(Memory container, u32 imageIndex, u32* start, u32* end)
+{
+	ImageInfo imageInfo = { 0 };
+	u8* header = NULL;
+
+	if (!ValidateContainer(container, &imageInfo))
+	{
+		return FALSE;
+	}
+	if (imageIndex >= imageInfo.nImages)
+	{
+		printf("Image %u is out of range, the container has %u images\n", imageIndex, imageInfo.nImages);
+		return FALSE;
+	}
+	header = GetImageHeader(container, imageInfo, imageIndex);
+	*start = (u32)(header - container.data);
+	if (imageIndex + 1 < imageInfo.nImages)
+	{
+		*end = (u32)(GetNextImageHeader(header) - container.data);
+	}
+	else
+	{
+		*end = container.size;
+	}
+	return *start + GetImageSpaceUsed(GetImageDataSize(header)) <= *end;
+}
+
+/* Replaces an image with newBlock, a header and subfiles as made by EncodeReplacementImage.
+ * The original checksum is kept, as how it's calculated isn't known and a nonzero checksum is
+ * what marks the end of an image. If the container has to grow, container->data is reallocated.
+ * result gives the range of bytes that changed, so that only those have to be written back.
+ * An empty image header (like PSP image 2530's) is only told apart from padding by the checksum
+ * right before it, so an image followed by one keeps all of its space, with its data size
+ * stretched up to the checksum at the very end. For the same reason, an image followed by padding
+ * must not have its checksum end right on a kilobyte, so its data size is stretched past it. */
+bool32 RepackImage(Memory* container, u32 imageIndex, Memory newBlock, RepackResult* result)
+{
+	RepackResult ret = { 0 };
+	u8 checksum[CHECKSUM_LENGTH] = { 0 };
+	u8* newExtent = NULL;
+	u8* newData = NULL;
+	u32 start = 0;
+	u32 end = 0;
+	u32 oldDataSize = 0;
+	u32 newDataSize = 0;
+	u32 newExtentSize = 0;
+	u32 lastChanged = 0;
+	bool32 nextHeaderEmpty = FALSE;
+
+	if (newBlock.size < 8 || GetImageDataSize(newBlock.data) != newBlock.size)
+	{
+		printf("Replacement image data is malformed\n");
+		return FALSE;
+	}
+	if (!GetImageExtent(*container, imageIndex, &start, &end))
+	{
+		printf("Could not find the space used by image %u\n", imageIndex);
+		return FALSE;
+	}
+	oldDataSize = GetImageDataSize(&container->data[start]);
+	memcpy(checksum, &container->data[start + oldDataSize + (oldDataSize % 16)], CHECKSUM_LENGTH);
+	nextHeaderEmpty = end < container->size && LittleEndianRead32(&container->data[end]) == 0;
+
+	/* Lay the image out exactly as it will be in the container */
+	newDataSize = newBlock.size;
+	newExtentSize = end - start;
+	if (GetImageSpaceUsed(newDataSize) > newExtentSize)
+	{
+		ret.shiftAmount = RoundUp(GetImageSpaceUsed(newDataSize) - newExtentSize, IMAGE_ALIGNMENT);
+		newExtentSize += ret.shiftAmount;
+	}
+	newExtent = calloc(newExtentSize, 1);
+	if (!newExtent)
+	{
+		return FALSE;
+	}
+	memcpy(newExtent, newBlock.data, newDataSize);
+	if (nextHeaderEmpty)
+	{
+		/* The extent is whole kilobytes, so this is 16-byte aligned and the checksum ends right at the next header */
+		newDataSize = newExtentSize - CHECKSUM_LENGTH;
+		LittleEndianWrite32(&newExtent[(LittleEndianRead32(newBlock.data) + 1) * 4], newDataSize);
+	}
+	else if ((newDataSize + (newDataSize % 16) + CHECKSUM_LENGTH) % IMAGE_ALIGNMENT == 0 &&
+		GetImageSpaceUsed(newDataSize) < newExtentSize)
+	{
+		/* Otherwise the zeroed padding after the checksum would be read as an empty image header */
+		newDataSize += (newDataSize % 16) + 16;
+		LittleEndianWrite32(&newExtent[(LittleEndianRead32(newBlock.data) + 1) * 4], newDataSize);
+	}
+	memcpy(&newExtent[newDataSize + (newDataSize % 16)], checksum, CHECKSUM_LENGTH);
+
+	if (ret.shiftAmount == 0)
+	{
+		/* It fits. Only the bytes that actually differ need to be written. */
+		for (ret.changedOffset = 0; ret.changedOffset < newExtentSize; ++ret.changedOffset)
+		{
+			if (newExtent[ret.changedOffset] != container->data[start + ret.changedOffset])
+			{
+				break;
+			}
+		}
+		for (lastChanged = newExtentSize; lastChanged > ret.changedOffset; --lastChanged)
+		{
+			if (newExtent[lastChanged - 1] != container->data[start + lastChanged - 1])
+			{
+				break;
+			}
+		}
+		memcpy(&container->data[start], newExtent, newExtentSize);
+		ret.changedSize = lastChanged - ret.changedOffset;
+		ret.changedOffset += start;
+	}
+	else
+	{
+		/* It doesn't fit. Everything after it has to move. */
+		newData = realloc(container->data, container->size + ret.shiftAmount);
+		if (!newData)
+		{
+			free(newExtent);
+			return FALSE;
+		}
+		container->data = newData;
+		memmove(&container->data[end + ret.shiftAmount], &container->data[end], container->size - end);
+		container->size += ret.shiftAmount;
+		memcpy(&container->data[start], newExtent, newExtentSize);
+		ret.changedOffset = start;
+		ret.changedSize = container->size - start;
+	}
+
+	free(newExtent);
+	*result = ret;
+	return TRUE;
+}
+
+/* Like RepackImage, but on a file. Only the bytes that changed are written. */
+bool32 RepackImageInFile(const char* path, u32 imageIndex, Memory newBlock, RepackResult* result)
+{
+	Memory container = { 0 };
+	bool32 success = FALSE;
+
+	container = LoadFile(path);
+	if (!container.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(path);
+		return FALSE;
+	}
+	if (!RepackImage(&container, imageIndex, newBlock, result))
+	{
+		free(container.data);
+		return FALSE;
+	}
+	success = WriteRepackedRange(path, container, *result);
+	free(container.data);
+	return success;
+}
+
+/* Widens combined to also cover the bytes changed by a later repack of the same container, so that
+ * several repacks can be written back at once. Moving images only ever rewrites everything from the
+ * moved image to the end of the file, which covers wherever earlier changes after it ended up. */
+void AddRepackResult(RepackResult* combined, RepackResult result)
+{
+	u32 combinedEnd = 0;
+	u32 resultEnd = 0;
+
+	if (result.changedSize == 0)
+	{
+		return;
+	}
+	if (combined->changedSize == 0)
+	{
+		combined->changedOffset = result.changedOffset;
+		combined->changedSize = result.changedSize;
+		combined->shiftAmount += result.shiftAmount;
+		return;
+	}
+	combinedEnd = combined->changedOffset + combined->changedSize;
+	resultEnd = result.changedOffset + result.changedSize;
+	combined->changedOffset = result.changedOffset < combined->changedOffset ? result.changedOffset : combined->changedOffset;
+	combined->changedSize = (resultEnd > combinedEnd ? resultEnd : combinedEnd) - combined->changedOffset;
+	combined->shiftAmount += result.shiftAmount;
+}
+
+/* Writes the range of a repacked container given by changes back to the file it was loaded from. */
+bool32 WriteRepackedRange(const char* path, Memory container, RepackResult changes)
+{
+	FILE* file = NULL;
+	bool32 success = FALSE;
+
+	if (changes.changedSize == 0)
+	{
+		return TRUE;
+	}
+	file = fopen(path, "r+b");
+	if (!file)
+	{
+		FOPEN_FAIL_MESSAGE(path);
+		return FALSE;
+	}
+	success = fseek(file, (long)changes.changedOffset, SEEK_SET) == 0 &&
+		fwrite(&container.data[changes.changedOffset], 1, changes.changedSize, file) == changes.changedSize;
+	if (fclose(file) != 0)
+	{
+		success = FALSE;
+	}
+	return success;
+}
@@ -0,0 +1,43 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  repack.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef REPACK_H
+#define REPACK_H
+
+#include "util.h"
+#include "image.h"
+
+/* Every image in a container takes up a whole number of kilobytes: its header and subfiles, a
+ * 16-byte checksum, then zero padding, sometimes with extra kilobytes of it. A replacement image
+ * is put into that space whenever it fits, so that nothing after it moves. Only when it doesn't are
+ * the images after it moved back, by as few kilobytes as it takes. */
+typedef struct
+{
+	u32 changedOffset; /* Offset in the container of the first byte that changed */
+	u32 changedSize;   /* Number of bytes from changedOffset that need writing, 0 if nothing changed */
+	u32 shiftAmount;   /* How far the images after this one moved, 0 if the replacement fit in place */
+} RepackResult;
+
+Memory EncodeReplacementImage(const u8* originalHeader, Platform platform, Memory pixels);
+bool32 RepackImage(Memory* container, u32 imageIndex, Memory newBlock, RepackResult* result);
+bool32 RepackImageInFile(const char* path, u32 imageIndex, Memory newBlock, RepackResult* result);
+void AddRepackResult(RepackResult* combined, RepackResult result);
+bool32 WriteRepackedRange(const char* path, Memory container, RepackResult changes);
+
+#endif
@@ -0,0 +1,869 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  server.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "OutsideCode/zlib/zlib.h"
+#include "util.h"
+#include "image.h"
+#include "palette.h"
+#include "thread.h"
+#include "socket.h"
+#include "server.h"
+#include "alloc.h"
+
+#define CACHE_NUM_BUCKETS 1024
+#define CACHE_KIND_CONTAINER SERVER_IMAGE_NUM_FORMATS /* A loaded file rather than an image */
+#define SERVER_MAX_PENDING_CONNECTIONS 64
+#define MAX_REQUEST_LENGTH 2048
+#define MAX_REPLY_HEADER_LENGTH 128
+#define SERVER_POLL_MILLISECONDS 20 /* How often a thread on an idle connection checks whether other connections are waiting */
+
+static const char* const formatNames[SERVER_IMAGE_NUM_FORMATS] = { "indices", "rgba", "png" };
+
+typedef struct CacheEntry
+{
+	struct CacheEntry* newer;
+	struct CacheEntry* older;
+	struct CacheEntry* nextInBucket;
+	char* path;
+	u32 imageIndex;
+	u32 customWidth;
+	u32 kind;     /* A ServerImageFormat, or CACHE_KIND_CONTAINER */
+	u32 hash;
+	u32 nUsers;   /* An entry that's in use is only freed once the last user releases it */
+	bool32 evicted;
+	u64 cost;
+	FileStamp stamp; /* The file as it was when this entry was made from it */
+	ServerImage image; /* For containers, only data is used */
+} CacheEntry;
+
+typedef struct
+{
+	Socket socket;
+	double lastActive; /* When it last sent anything */
+} Connection;
+
+struct ImageServer
+{
+	Mutex mutex; /* Guards everything below */
+	Condition connectionsPending;
+	Condition connectionsTaken;
+	Socket listener;
+	char* socketPath;
+	Connection pending[SERVER_MAX_PENDING_CONNECTIONS];
+	u32 pendingStart;
+	u32 nPending;
+	Socket* active; /* The connection each thread is serving, so they can be woken up to stop */
+	bool32 stopping;
+
+	Thread* threads;
+	u32 nThreads;
+	u32 nextThreadIndex;
+
+	CacheEntry* buckets[CACHE_NUM_BUCKETS];
+	CacheEntry* newest;
+	CacheEntry* oldest;
+	u64 cacheBudget;
+
+	ImageServerStats stats;
+};
+
+static void ServerThread(void* arg);
+static bool32 ServeConnection(ImageServer* server, Connection* connection);
+static bool32 HandleRequest(ImageServer* server, Socket connection, char* request);
+static bool32 SendError(Socket connection, const char* message);
+static u32 HashCacheKey(const char* path, u32 imageIndex, u32 customWidth, u32 kind);
+static CacheEntry* AcquireCacheEntry(ImageServer* server, const char* path, u32 imageIndex, u32 customWidth, u32 kind, FileStamp stamp);
+static CacheEntry* InsertCacheEntry(ImageServer* server, const char* path, u32 imageIndex, u32 customWidth, u32 kind, FileStamp stamp, ServerImage image);
+static void ReleaseCacheEntry(ImageServer* server, CacheEntry* entry);
+static void DropStaleCacheEntries(ImageServer* server, const char* path, FileStamp stamp);
+static void UnlinkCacheEntry(ImageServer* server, CacheEntry* entry);
+static void FreeCacheEntry(CacheEntry* entry);
+static CacheEntry* GetCacheEntry(ImageServer* server, const char* path, u32 imageIndex, u32 customWidth, u32 kind, FileStamp stamp, const char** error);
+static bool32 DecodeServerImage(ImageServer* server, const char* path, u32 imageIndex, u32 customWidth, FileStamp stamp, ServerImage* image, const char** error);
+static bool32 RenderServerImage(ServerImage indices, ServerImageFormat format, ServerImage* image);
+
+/* Starts listening and starts nThreads threads to serve connections. Nothing is accepted until RunImageServer. */
+ImageServer* CreateImageServer(const char* socketPath, u64 cacheBudget, u32 nThreads)
+{
+	ImageServer* server = NULL;
+	u32 i = 0;
+
+	if (nThreads == 0)
+	{
+		nThreads = 1;
+	}
+	server = calloc(1, sizeof(ImageServer));
+	if (!server)
+	{
+		return NULL;
+	}
+	server->socketPath = malloc(strlen(socketPath) + 1);
+	server->threads = calloc(nThreads, sizeof(Thread));
+	server->active = calloc(nThreads, sizeof(Socket));
+	if (!server->socketPath || !server->threads || !server->active)
+	{
+		free(server->socketPath);
+		free(server->threads);
+		free(server->active);
+		free(server);
+		return NULL;
+	}
+	strcpy(server->socketPath, socketPath);
+	if (!ListenLocalSocket(socketPath, &server->listener))
+	{
+		free(server->socketPath);
+		free(server->threads);
+		free(server->active);
+		free(server);
+		return NULL;
+	}
+	server->cacheBudget = cacheBudget;
+	for (i = 0; i < nThreads; ++i)
+	{
+		server->active[i] = INVALID_SOCKET_VALUE;
+	}
+	InitMutex(&server->mutex);
+	InitCondition(&server->connectionsPending);
+	InitCondition(&server->connectionsTaken);
+
+	for (i = 0; i < nThreads; ++i)
+	{
+		if (!StartThread(&server->threads[i], ServerThread, server))
+		{
+			break;
+		}
+		++server->nThreads;
+	}
+	if (server->nThreads == 0)
+	{
+		DestroyImageServer(server);
+		return NULL;
+	}
+	return server;
+}
+
+/* Accepts connections and hands them to the server's threads until a client asks the server to quit. */
+void RunImageServer(ImageServer* server)
+{
+	Socket connection = INVALID_SOCKET_VALUE;
+
+	while (AcceptConnection(server->listener, &connection))
+	{
+		LockMutex(&server->mutex);
+		while (server->nPending == SERVER_MAX_PENDING_CONNECTIONS && !server->stopping)
+		{
+			WaitCondition(&server->connectionsTaken, &server->mutex);
+		}
+		if (server->stopping)
+		{
+			UnlockMutex(&server->mutex);
+			CloseSocket(connection);
+			return;
+		}
+		server->pending[(server->pendingStart + server->nPending) % SERVER_MAX_PENDING_CONNECTIONS].socket = connection;
+		server->pending[(server->pendingStart + server->nPending) % SERVER_MAX_PENDING_CONNECTIONS].lastActive = GetTimeInSeconds();
+		++server->nPending;
+		SignalCondition(&server->connectionsPending);
+		UnlockMutex(&server->mutex);
+	}
+}
+
+/* Stops the server, closing any connections still open, and frees everything in the cache. */
+ImageServerStats DestroyImageServer(ImageServer* server)
+{
+	ImageServerStats stats = { 0 };
+	CacheEntry* entry = NULL;
+	CacheEntry* older = NULL;
+	u32 i = 0;
+
+	LockMutex(&server->mutex);
+	server->stopping = TRUE;
+	for (i = 0; i < server->nThreads; ++i)
+	{
+		if (server->active[i] != INVALID_SOCKET_VALUE)
+		{
+			ShutdownSocket(server->active[i]);
+		}
+	}
+	BroadcastCondition(&server->connectionsPending);
+	BroadcastCondition(&server->connectionsTaken);
+	UnlockMutex(&server->mutex);
+	for (i = 0; i < server->nThreads; ++i)
+	{
+		JoinThread(server->threads[i]);
+	}
+	for (i = 0; i < server->nPending; ++i)
+	{
+		CloseSocket(server->pending[(server->pendingStart + i) % SERVER_MAX_PENDING_CONNECTIONS].socket);
+	}
+	CloseSocket(server->listener);
+	remove(server->socketPath);
+
+	for (entry = server->newest; entry; entry = older)
+	{
+		older = entry->older;
+		FreeCacheEntry(entry);
+	}
+	stats = server->stats;
+	DestroyCondition(&server->connectionsTaken);
+	DestroyCondition(&server->connectionsPending);
+	DestroyMutex(&server->mutex);
+	free(server->socketPath);
+	free(server->threads);
+	free(server->active);
+	free(server);
+	return stats;
+}
+
+void PrintImageServerStats(ImageServerStats stats)
+{
+	printf("Requests: %u (%u from cache). Files loaded: %u. Images decoded: %u. Cache entries evicted: %u, dropped for changed files: %u. Cache peaked at %llu bytes\n",
+		stats.nRequests, stats.nCacheHits, stats.nFileLoads, stats.nDecodes, stats.nEvictions, stats.nStaleEntries, stats.peakCacheBytes);
+}
+
+static void ServerThread(void* arg)
+{
+	ImageServer* server = arg;
+	Connection connection = { 0 };
+	u32 threadIndex = 0;
+	bool32 requeue = FALSE;
+
+	LockMutex(&server->mutex);
+	threadIndex = server->nextThreadIndex++;
+	UnlockMutex(&server->mutex);
+
+	while (1)
+	{
+		LockMutex(&server->mutex);
+		while (server->nPending == 0 && !server->stopping)
+		{
+			WaitCondition(&server->connectionsPending, &server->mutex);
+		}
+		if (server->stopping)
+		{
+			UnlockMutex(&server->mutex);
+			return;
+		}
+		connection = server->pending[server->pendingStart];
+		server->pendingStart = (server->pendingStart + 1) % SERVER_MAX_PENDING_CONNECTIONS;
+		--server->nPending;
+		server->active[threadIndex] = connection.socket;
+		SignalCondition(&server->connectionsTaken);
+		UnlockMutex(&server->mutex);
+
+		requeue = ServeConnection(server, &connection);
+
+		LockMutex(&server->mutex);
+		server->active[threadIndex] = INVALID_SOCKET_VALUE;
+		if (requeue && !server->stopping && server->nPending < SERVER_MAX_PENDING_CONNECTIONS)
+		{
+			server->pending[(server->pendingStart + server->nPending) % SERVER_MAX_PENDING_CONNECTIONS] = connection;
+			++server->nPending;
+			SignalCondition(&server->connectionsPending);
+		}
+		else
+		{
+			requeue = FALSE;
+		}
+		UnlockMutex(&server->mutex);
+		if (!requeue)
+		{
+			CloseSocket(connection.socket);
+		}
+	}
+}
+
+/* Reads requests a line at a time until the client hangs up, goes idle for too long or asks the server to quit.
+ * Returns TRUE if the connection is between requests and should go back in the queue so that other connections
+ * get a turn, or FALSE if it should be closed. */
+static bool32 ServeConnection(ImageServer* server, Connection* connection)
+{
+	char request[MAX_REQUEST_LENGTH] = { 0 };
+	char* lineEnd = NULL;
+	u32 nBuffered = 0;
+	u32 nReceived = 0;
+	u32 lineLength = 0;
+	bool32 othersWaiting = FALSE;
+
+	while (1)
+	{
+		lineEnd = memchr(request, '\n', nBuffered);
+		if (!lineEnd)
+		{
+			if (nBuffered == sizeof(request))
+			{
+				SendError(connection->socket, "Request too long");
+				return FALSE;
+			}
+			switch (WaitForData(connection->socket, SERVER_POLL_MILLISECONDS))
+			{
+			case 1:
+				break;
+			case 0:
+				if (GetTimeInSeconds() - connection->lastActive > IMAGE_SERVER_IDLE_TIMEOUT_MILLISECONDS / 1000.0)
+				{
+					return FALSE;
+				}
+				if (nBuffered == 0)
+				{
+					LockMutex(&server->mutex);
+					othersWaiting = server->nPending > 0;
+					UnlockMutex(&server->mutex);
+					if (othersWaiting)
+					{
+						return TRUE;
+					}
+				}
+				continue;
+			default:
+				return FALSE;
+			}
+			nReceived = ReceiveSome(connection->socket, &request[nBuffered], sizeof(request) - nBuffered);
+			if (nReceived == 0)
+			{
+				return FALSE;
+			}
+			nBuffered += nReceived;
+			connection->lastActive = GetTimeInSeconds();
+			continue;
+		}
+
+		*lineEnd = '\0';
+		if (lineEnd > request && lineEnd[-1] == '\r')
+		{
+			lineEnd[-1] = '\0';
+		}
+		lineLength = (u32)(lineEnd - request) + 1;
+		if (!HandleRequest(server, connection->socket, request))
+		{
+			return FALSE;
+		}
+		memmove(request, &request[lineLength], nBuffered - lineLength);
+		nBuffered -= lineLength;
+		connection->lastActive = GetTimeInSeconds();
+	}
+}
+
+/* Returns FALSE if the connection should be closed */
+static bool32 HandleRequest(ImageServer* server, Socket connection, char* request)
+{
+	char formatName[16] = { 0 };
+	char replyHeader[MAX_REPLY_HEADER_LENGTH] = { 0 };
+	const char* error = NULL;
+	const char* path = NULL;
+	CacheEntry* entry = NULL;
+	FileStamp stamp = { 0 };
+	Socket wakeConnection = INVALID_SOCKET_VALUE;
+	u32 imageIndex = 0;
+	u32 customWidth = 0;
+	int pathStart = 0;
+	u32 format = 0;
+	bool32 success = FALSE;
+
+	if (strcmp(request, "quit") == 0)
+	{
+		LockMutex(&server->mutex);
+		server->stopping = TRUE;
+		BroadcastCondition(&server->connectionsTaken);
+		UnlockMutex(&server->mutex);
+
+		/* RunImageServer is waiting for a connection, so give it one to find out it's time to stop */
+		if (ConnectLocalSocket(server->socketPath, &wakeConnection))
+		{
+			CloseSocket(wakeConnection);
+		}
+		return FALSE;
+	}
+
+	if (sscanf(request, "%15s %u %u %n", formatName, &imageIndex, &customWidth, &pathStart) != 3 || request[pathStart] == '\0')
+	{
+		return SendError(connection, "Expected a format, image index, custom width and path");
+	}
+	path = &request[pathStart];
+	for (format = 0; format < SERVER_IMAGE_NUM_FORMATS; ++format)
+	{
+		if (strcmp(formatName, formatNames[format]) == 0)
+		{
+			break;
+		}
+	}
+	if (format == SERVER_IMAGE_NUM_FORMATS)
+	{
+		return SendError(connection, "Unknown format");
+	}
+
+	LockMutex(&server->mutex);
+	++server->stats.nRequests;
+	UnlockMutex(&server->mutex);
+	if (!GetFileStamp(path, &stamp))
+	{
+		return SendError(connection, "Could not load file");
+	}
+
+	entry = AcquireCacheEntry(server, path, imageIndex, customWidth, format, stamp);
+	if (entry)
+	{
+		LockMutex(&server->mutex);
+		++server->stats.nCacheHits;
+		UnlockMutex(&server->mutex);
+	}
+	else
+	{
+		entry = GetCacheEntry(server, path, imageIndex, customWidth, format, stamp, &error);
+		if (!entry)
+		{
+			return SendError(connection, error);
+		}
+	}
+
+	sprintf(replyHeader, "OK %u %u %u %u %u\n", entry->image.width, entry->image.height, entry->image.bitsPerPixel,
+		entry->image.nColors, entry->image.data.size);
+	success = SendAll(connection, replyHeader, (u32)strlen(replyHeader)) &&
+		SendAll(connection, entry->image.data.data, entry->image.data.size);
+	ReleaseCacheEntry(server, entry);
+	return success;
+}
+
+static bool32 SendError(Socket connection, const char* message)
+{
+	char reply[MAX_REPLY_HEADER_LENGTH] = { 0 };
+
+	snprintf(reply, sizeof(reply), "ERROR %s\n", message);
+	return SendAll(connection, reply, (u32)strlen(reply));
+}
+
+static u32 HashCacheKey(const char* path, u32 imageIndex, u32 customWidth, u32 kind)
+{
+	u32 hash = 0;
+
+	hash = (u32)crc32(0, (const Bytef*)path, (uInt)strlen(path));
+	hash ^= (imageIndex * 0x9E3779B1u) ^ (customWidth * 0x85EBCA77u) ^ (kind * 0xC2B2AE3Du);
+	return hash;
+}
+
+/* Finds an entry and marks it as the most recently used. The caller must release it. If the entry was made
+ * from a different version of the file than stamp, it and everything else made from that file are dropped instead. */
+static CacheEntry* AcquireCacheEntry(ImageServer* server, const char* path, u32 imageIndex, u32 customWidth, u32 kind, FileStamp stamp)
+{
+	CacheEntry* entry = NULL;
+	u32 hash = 0;
+
+	hash = HashCacheKey(path, imageIndex, customWidth, kind);
+	LockMutex(&server->mutex);
+	for (entry = server->buckets[hash % CACHE_NUM_BUCKETS]; entry; entry = entry->nextInBucket)
+	{
+		if (entry->hash == hash && entry->imageIndex == imageIndex && entry->customWidth == customWidth &&
+			entry->kind == kind && strcmp(entry->path, path) == 0)
+		{
+			break;
+		}
+	}
+	if (entry && (entry->stamp.size != stamp.size || entry->stamp.modifiedTime != stamp.modifiedTime))
+	{
+		DropStaleCacheEntries(server, path, stamp);
+		entry = NULL;
+	}
+	if (entry)
+	{
+		++entry->nUsers;
+		if (entry != server->newest)
+		{
+			/* Move it to the front */
+			entry->newer->older = entry->older;
+			if (entry->older)
+			{
+				entry->older->newer = entry->newer;
+			}
+			else
+			{
+				server->oldest = entry->newer;
+			}
+			entry->newer = NULL;
+			entry->older = server->newest;
+			server->newest->newer = entry;
+			server->newest = entry;
+		}
+	}
+	UnlockMutex(&server->mutex);
+	return entry;
+}
+
+/* Adds image to the cache, taking ownership of its data, and evicts the least recently used entries until the
+ * cache is back within budget. If another thread got there first, its entry is used instead. The caller must
+ * release the returned entry. */
+static CacheEntry* InsertCacheEntry(ImageServer* server, const char* path, u32 imageIndex, u32 customWidth, u32 kind, FileStamp stamp, ServerImage image)
+{
+	CacheEntry* entry = NULL;
+	CacheEntry* existing = NULL;
+	CacheEntry* toFree = NULL;
+
+	entry = calloc(1, sizeof(CacheEntry));
+	if (entry)
+	{
+		entry->path = malloc(strlen(path) + 1);
+	}
+	if (!entry || !entry->path)
+	{
+		free(entry);
+		TrackedFree(image.data.data);
+		return NULL;
+	}
+	strcpy(entry->path, path);
+	entry->imageIndex = imageIndex;
+	entry->customWidth = customWidth;
+	entry->kind = kind;
+	entry->hash = HashCacheKey(path, imageIndex, customWidth, kind);
+	entry->stamp = stamp;
+	entry->image = image;
+	entry->cost = image.data.size + sizeof(CacheEntry) + strlen(path) + 1;
+	entry->nUsers = 1;
+
+	existing = AcquireCacheEntry(server, path, imageIndex, customWidth, kind, stamp);
+	if (existing)
+	{
+		FreeCacheEntry(entry);
+		return existing;
+	}
+
+	LockMutex(&server->mutex);
+	entry->nextInBucket = server->buckets[entry->hash % CACHE_NUM_BUCKETS];
+	server->buckets[entry->hash % CACHE_NUM_BUCKETS] = entry;
+	entry->older = server->newest;
+	if (server->newest)
+	{
+		server->newest->newer = entry;
+	}
+	else
+	{
+		server->oldest = entry;
+	}
+	server->newest = entry;
+	server->stats.cacheBytes += entry->cost;
+
+	/* Entries still in use are taken out of the cache all the same and freed when they're released */
+	while (server->stats.cacheBytes > server->cacheBudget && server->oldest)
+	{
+		toFree = server->oldest;
+		UnlinkCacheEntry(server, toFree);
+		++server->stats.nEvictions;
+		if (toFree->nUsers == 0)
+		{
+			FreeCacheEntry(toFree);
+		}
+	}
+	if (server->stats.cacheBytes > server->stats.peakCacheBytes)
+	{
+		server->stats.peakCacheBytes = server->stats.cacheBytes;
+	}
+	UnlockMutex(&server->mutex);
+	return entry;
+}
+
+static void ReleaseCacheEntry(ImageServer* server, CacheEntry* entry)
+{
+	bool32 shouldFree = FALSE;
+
+	LockMutex(&server->mutex);
+	--entry->nUsers;
+	shouldFree = entry->evicted && entry->nUsers == 0;
+	UnlockMutex(&server->mutex);
+	if (shouldFree)
+	{
+		FreeCacheEntry(entry);
+	}
+}
+
+/* Drops every entry made from a version of path other than stamp. The server's mutex must be held. */
+static void DropStaleCacheEntries(ImageServer* server, const char* path, FileStamp stamp)
+{
+	CacheEntry* entry = NULL;
+	CacheEntry* older = NULL;
+
+	for (entry = server->newest; entry; entry = older)
+	{
+		older = entry->older;
+		if ((entry->stamp.size != stamp.size || entry->stamp.modifiedTime != stamp.modifiedTime) && strcmp(entry->path, path) == 0)
+		{
+			UnlinkCacheEntry(server, entry);
+			++server->stats.nStaleEntries;
+			if (entry->nUsers == 0)
+			{
+				FreeCacheEntry(entry);
+			}
+		}
+	}
+}
+
+/* Takes an entry out of the LRU list and its bucket. The server's mutex must be held. */
+static void UnlinkCacheEntry(ImageServer* server, CacheEntry* entry)
+{
+	CacheEntry** link = NULL;
+
+	for (link = &server->buckets[entry->hash % CACHE_NUM_BUCKETS]; *link != entry; link = &(*link)->nextInBucket)
+	{
+	}
+	*link = entry->nextInBucket;
+	if (entry->newer)
+	{
+		entry->newer->older = entry->older;
+	}
+	else
+	{
+		server->newest = entry->older;
+	}
+	if (entry->older)
+	{
+		entry->older->newer = entry->newer;
+	}
+	else
+	{
+		server->oldest = entry->newer;
+	}
+	server->stats.cacheBytes -= entry->cost;
+	entry->evicted = TRUE;
+}
+
+static void FreeCacheEntry(CacheEntry* entry)
+{
+	TrackedFree(entry->image.data.data);
+	free(entry->path);
+	free(entry);
+}
+
+/* Gets an entry from the cache, making it and whatever it's made from if they aren't there yet.
+ * The caller must release the returned entry. On failure, error says why. */
+static CacheEntry* GetCacheEntry(ImageServer* server, const char* path, u32 imageIndex, u32 customWidth, u32 kind, FileStamp stamp, const char** error)
+{
+	CacheEntry* entry = NULL;
+	CacheEntry* source = NULL;
+	ServerImage image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	bool32 success = FALSE;
+
+	entry = AcquireCacheEntry(server, path, imageIndex, customWidth, kind, stamp);
+	if (entry)
+	{
+		return entry;
+	}
+
+	if (kind == CACHE_KIND_CONTAINER)
+	{
+		image.data = LoadFile(path);
+		if (!image.data.data)
+		{
+			*error = "Could not load file";
+			return NULL;
+		}
+		/* Validated once here, so every image decoded from the cached container can trust its offsets */
+		if (!ValidateContainer(image.data, &imageInfo))
+		{
+			free(image.data.data);
+			*error = "Corrupt file";
+			return NULL;
+		}
+		LockMutex(&server->mutex);
+		++server->stats.nFileLoads;
+		UnlockMutex(&server->mutex);
+		/* Containers don't depend on the image index or width, so they're all cached under the same key */
+		entry = InsertCacheEntry(server, path, 0, 0, kind, stamp, image);
+	}
+	else if (kind == SERVER_IMAGE_INDICES)
+	{
+		if (!DecodeServerImage(server, path, imageIndex, customWidth, stamp, &image, error))
+		{
+			return NULL;
+		}
+		entry = InsertCacheEntry(server, path, imageIndex, customWidth, kind, stamp, image);
+	}
+	else
+	{
+		source = GetCacheEntry(server, path, imageIndex, customWidth, SERVER_IMAGE_INDICES, stamp, error);
+		if (!source)
+		{
+			return NULL;
+		}
+		success = RenderServerImage(source->image, kind, &image);
+		ReleaseCacheEntry(server, source);
+		if (!success)
+		{
+			*error = "Could not convert image";
+			return NULL;
+		}
+		entry = InsertCacheEntry(server, path, imageIndex, customWidth, kind, stamp, image);
+	}
+	if (!entry)
+	{
+		*error = "Out of memory";
+	}
+	return entry;
+}
+
+/* Decodes an image into its palette indices followed by its palette */
+static bool32 DecodeServerImage(ImageServer* server, const char* path, u32 imageIndex, u32 customWidth, FileStamp stamp, ServerImage* image, const char** error)
+{
+	CacheEntry* container = NULL;
+	ImageInfo imageInfo = { 0 };
+	DecodedImage decodedImage = { 0 };
+	ServerImage ret = { 0 };
+	bool32 success = FALSE;
+
+	container = GetCacheEntry(server, path, 0, 0, CACHE_KIND_CONTAINER, stamp, error);
+	if (!container)
+	{
+		return FALSE;
+	}
+	imageInfo = GetImageInfo(container->image.data);
+	if (imageIndex >= imageInfo.nImages)
+	{
+		*error = "Image index out of range";
+		ReleaseCacheEntry(server, container);
+		return FALSE;
+	}
+	success = DecodeRGOImage(container->image.data, imageInfo, GetImageHeader(container->image.data, imageInfo, imageIndex),
+		imageIndex, customWidth, &decodedImage);
+	if (success)
+	{
+		ret.width = decodedImage.width;
+		ret.height = decodedImage.height;
+		ret.bitsPerPixel = decodedImage.bitsPerPixel;
+		ret.nColors = decodedImage.palette.nColors;
+		ret.data.size = decodedImage.pixels.size + ret.nColors * 4;
+		ret.data.data = malloc(ret.data.size);
+		success = ret.data.data != NULL;
+	}
+	if (success)
+	{
+		memcpy(ret.data.data, decodedImage.pixels.data, decodedImage.pixels.size);
+		memcpy(&ret.data.data[decodedImage.pixels.size], decodedImage.palette.data, ret.nColors * 4);
+		*image = ret;
+		LockMutex(&server->mutex);
+		++server->stats.nDecodes;
+		UnlockMutex(&server->mutex);
+	}
+	else
+	{
+		*error = "Could not decode image";
+	}
+	TrackedFree(decodedImage.pixels.data);
+	ReleaseCacheEntry(server, container);
+	return success;
+}
+
+static bool32 RenderServerImage(ServerImage indices, ServerImageFormat format, ServerImage* image)
+{
+	ServerImage ret = { 0 };
+	Memory pixels = { 0 };
+	Palette palette = { 0 };
+
+	ret = indices;
+	ret.data.data = NULL;
+	ret.data.size = 0;
+	pixels.data = indices.data.data;
+	pixels.size = indices.data.size - indices.nColors * 4;
+	palette.nColors = indices.nColors;
+	palette.data = &indices.data.data[pixels.size];
+
+	if (format == SERVER_IMAGE_RGBA)
+	{
+		ret.data.size = (indices.bitsPerPixel == 4 ? pixels.size * 2 : pixels.size) * 4;
+		ret.data.data = malloc(ret.data.size);
+		if (!ret.data.data)
+		{
+			return FALSE;
+		}
+		ExpandPaletteIndices(pixels.data, pixels.size, palette, (u32*)ret.data.data);
+	}
+	else
+	{
+		/* The server is for previews, so speed matters more than size */
+		if (!EncodePNG(pixels, palette, indices.width, indices.height, PNG_ENCODE_PROFILE_FAST, &ret.data))
+		{
+			return FALSE;
+		}
+	}
+	*image = ret;
+	return TRUE;
+}
+
+/* Asks the server at socketPath for an image. On success, image->data.data must be freed by the caller. */
+bool32 RequestServerImage(const char* socketPath, const char* path, u32 imageIndex, u32 customWidth, ServerImageFormat format, ServerImage* image)
+{
+	char request[MAX_REQUEST_LENGTH] = { 0 };
+	char replyHeader[MAX_REPLY_HEADER_LENGTH] = { 0 };
+	Socket connection = INVALID_SOCKET_VALUE;
+	ServerImage ret = { 0 };
+	u32 replyHeaderLength = 0;
+
+	if (snprintf(request, sizeof(request), "%s %u %u %s\n", formatNames[format], imageIndex, customWidth, path) >= (int)sizeof(request))
+	{
+		return FALSE;
+	}
+	if (!ConnectLocalSocket(socketPath, &connection))
+	{
+		printf("Could not connect to %s\n", socketPath);
+		return FALSE;
+	}
+	if (!SendAll(connection, request, (u32)strlen(request)))
+	{
+		CloseSocket(connection);
+		return FALSE;
+	}
+
+	/* The reply header is short, so read it a byte at a time rather than risk reading into the image */
+	while (replyHeaderLength < sizeof(replyHeader) - 1 && ReceiveAll(connection, &replyHeader[replyHeaderLength], 1))
+	{
+		if (replyHeader[replyHeaderLength++] == '\n')
+		{
+			break;
+		}
+	}
+	if (sscanf(replyHeader, "OK %u %u %u %u %u", &ret.width, &ret.height, &ret.bitsPerPixel, &ret.nColors, &ret.data.size) != 5)
+	{
+		printf("Server could not provide image %u of %s: %s", imageIndex, path, replyHeader);
+		CloseSocket(connection);
+		return FALSE;
+	}
+	ret.data.data = malloc(ret.data.size ? ret.data.size : 1);
+	if (!ret.data.data || !ReceiveAll(connection, ret.data.data, ret.data.size))
+	{
+		free(ret.data.data);
+		CloseSocket(connection);
+		return FALSE;
+	}
+	CloseSocket(connection);
+	*image = ret;
+	return TRUE;
+}
+
+bool32 StopImageServer(const char* socketPath)
+{
+	Socket connection = INVALID_SOCKET_VALUE;
+	bool32 success = FALSE;
+
+	if (!ConnectLocalSocket(socketPath, &connection))
+	{
+		return FALSE;
+	}
+	success = SendAll(connection, "quit\n", 5);
+	CloseSocket(connection);
+	return success;
+}
@@ -0,0 +1,81 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  server.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "util.h"
+#include "image.h"
+
+#define IMAGE_SERVER_DEFAULT_CACHE_BUDGET (256 * 1024 * 1024)
+#define IMAGE_SERVER_DEFAULT_SOCKET "rgotools.sock"
+#define IMAGE_SERVER_IDLE_TIMEOUT_MILLISECONDS 30000
+
+/* Serves images over a local socket so that tools that want many previews don't have to start a new
+ * process, load the file and decode it each time. Loaded files, decoded images and their RGBA and PNG
+ * forms are all kept in one least recently used cache, which drops the oldest entries once it's over budget.
+ *
+ * Each request is one line: the format ("indices", "rgba" or "png"), the image index, the custom width
+ * (0 for the default), then the path of the file, which may contain spaces. "quit" stops the server.
+ * The reply is either "ERROR <message>\n" or "OK <width> <height> <bitsPerPixel> <nColors> <size>\n"
+ * followed by size bytes: the palette indices then the palette, the RGBA pixels, or the PNG file.
+ * Any number of requests can be sent over one connection, until it has been idle for IMAGE_SERVER_IDLE_TIMEOUT_MILLISECONDS.
+ * A connection with nothing to read goes back in the queue when others are waiting, so idle ones don't hold up the rest.
+ * Every request checks the file's size and modification time, and everything cached from an older version is dropped. */
+typedef struct ImageServer ImageServer;
+
+typedef enum
+{
+	SERVER_IMAGE_INDICES,
+	SERVER_IMAGE_RGBA,
+	SERVER_IMAGE_PNG,
+	SERVER_IMAGE_NUM_FORMATS
+} ServerImageFormat;
+
+/* An image as the server sent it. data is laid out as described above. */
+typedef struct
+{
+	u32 width;
+	u32 height;
+	u32 bitsPerPixel;
+	u32 nColors;
+	Memory data;
+} ServerImage;
+
+typedef struct
+{
+	u32 nRequests;
+	u32 nCacheHits;   /* Requests answered without loading or decoding anything */
+	u32 nFileLoads;
+	u32 nDecodes;
+	u32 nEvictions;
+	u32 nStaleEntries; /* Entries dropped because their file changed */
+	u64 cacheBytes;
+	u64 peakCacheBytes;
+} ImageServerStats;
+
+ImageServer* CreateImageServer(const char* socketPath, u64 cacheBudget, u32 nThreads);
+void RunImageServer(ImageServer* server);
+ImageServerStats DestroyImageServer(ImageServer* server);
+void PrintImageServerStats(ImageServerStats stats);
+
+bool32 RequestServerImage(const char* socketPath, const char* path, u32 imageIndex, u32 customWidth, ServerImageFormat format, ServerImage* image);
+bool32 StopImageServer(const char* socketPath);
+
+#endif
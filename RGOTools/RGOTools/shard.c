@@ -0,0 +1,626 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  shard.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "sink.h"
+#include "shard.h"
+
+/* A file as one of the shards says it extracted it */
+typedef struct
+{
+	char* inputPath;
+	char* outputName;
+	u32 nImages;
+	u32 shard;
+} ShardClaim;
+
+/* An entry in one of the shards' archives */
+typedef struct
+{
+	char* name;
+	u64 offset;
+	u32 size;
+	u32 shard;
+	bool32 expected;
+} ShardImage;
+
+typedef struct
+{
+	ShardClaim* claims;
+	u32 nClaims;
+	u32 claimsCapacity;
+	ShardImage* images;
+	u32 nImages;
+	u32 imagesCapacity;
+} ShardMerge;
+
+/* A file waiting to be given to a shard, in the order PartitionShards hands them out */
+typedef struct
+{
+	const char* inputPath;
+	u64 cost;
+	u32 fileIndex;
+} ShardAssignment;
+
+static int CompareShardAssignments(const void* a, const void* b);
+static bool32 ReadShardManifest(const char* manifestPath, u32 shard, u32 nShards, ShardMerge* merge);
+static bool32 ReadShardArchiveIndex(const char* indexPath, u32 shard, ShardMerge* merge);
+static ShardClaim* AddShardClaim(ShardMerge* merge);
+static ShardImage* AddShardImage(ShardMerge* merge);
+static int CompareShardClaims(const void* a, const void* b);
+static int CompareShardImages(const void* a, const void* b);
+static int CompareStrings(const void* a, const void* b);
+static void CheckShardFiles(ShardMerge* merge, const char** inputPaths, u32 nInputPaths, ShardMergeResults* results);
+static void CheckShardImages(ShardMerge* merge, ShardMergeResults* results);
+static u32 FindShardImage(const ShardMerge* merge, const char* name);
+static void GetShardImageName(const char* outputName, u32 imageIndex, char* name);
+static void FreeShardMerge(ShardMerge* merge);
+
+/* Parses "k/N", where k counts from 1. On success, shard is k - 1. */
+bool32 ParseShardSpec(const char* spec, u32* shard, u32* nShards)
+{
+	u32 k = 0;
+	u32 n = 0;
+	int end = 0;
+
+	if (sscanf(spec, "%u/%u%n", &k, &n, &end) != 2 || spec[end] != '\0' || n == 0 || k == 0 || k > n)
+	{
+		return FALSE;
+	}
+	*shard = k - 1;
+	*nShards = n;
+	return TRUE;
+}
+
+/* Most of the time spent extracting a file goes on decompressing and encoding, which both grow
+ * with the file's size, so that's the estimate. Only the size is read, so every shard can
+ * estimate the whole batch without loading it. A file that can't be opened costs nothing. */
+u64 EstimateExtractionCost(const char* inputPath)
+{
+	FILE* file = NULL;
+	long size = 0;
+
+	file = fopen(inputPath, "rb");
+	if (!file)
+	{
+		return 0;
+	}
+	if (fseek(file, 0, SEEK_END) == 0)
+	{
+		size = ftell(file);
+	}
+	fclose(file);
+	return size > 0 ? (u64)size : 0;
+}
+
+/* Splits files between nShards shards so that their total costs come out as even as possible.
+ * The most expensive files are handed out first, each to the shard with the least cost so far.
+ * Ties go by path and then to the lowest shard, so every shard works out the same split on its
+ * own as long as it's given the same files. shardOfFile[i] is set to the shard, from 0, of files[i]. */
+void PartitionShards(const ShardFile* files, u32 nFiles, u32 nShards, u32* shardOfFile)
+{
+	ShardAssignment* assignments = NULL;
+	u64* shardCosts = NULL;
+	u32 cheapestShard = 0;
+	u32 i = 0;
+	u32 j = 0;
+
+	assignments = malloc(sizeof(ShardAssignment) * (nFiles ? nFiles : 1));
+	shardCosts = calloc(nShards, sizeof(u64));
+	if (!assignments || !shardCosts)
+	{
+		/* Still split the files the same way everywhere, just not by cost */
+		for (i = 0; i < nFiles; ++i)
+		{
+			shardOfFile[i] = i % nShards;
+		}
+		free(assignments);
+		free(shardCosts);
+		return;
+	}
+
+	for (i = 0; i < nFiles; ++i)
+	{
+		assignments[i].inputPath = files[i].inputPath;
+		assignments[i].cost = files[i].cost;
+		assignments[i].fileIndex = i;
+	}
+	qsort(assignments, nFiles, sizeof(ShardAssignment), CompareShardAssignments);
+
+	for (i = 0; i < nFiles; ++i)
+	{
+		cheapestShard = 0;
+		for (j = 1; j < nShards; ++j)
+		{
+			if (shardCosts[j] < shardCosts[cheapestShard])
+			{
+				cheapestShard = j;
+			}
+		}
+		shardCosts[cheapestShard] += assignments[i].cost;
+		shardOfFile[assignments[i].fileIndex] = cheapestShard;
+	}
+	free(assignments);
+	free(shardCosts);
+}
+
+/* Most expensive first, then by path. The file index only matters if the same path is listed twice. */
+static int CompareShardAssignments(const void* a, const void* b)
+{
+	const ShardAssignment* first = a;
+	const ShardAssignment* second = b;
+	int pathOrder = 0;
+
+	if (first->cost != second->cost)
+	{
+		return first->cost > second->cost ? -1 : 1;
+	}
+	pathOrder = strcmp(first->inputPath, second->inputPath);
+	if (pathOrder != 0)
+	{
+		return pathOrder;
+	}
+	return first->fileIndex < second->fileIndex ? -1 : (first->fileIndex > second->fileIndex);
+}
+
+/* The first line gives the shard, counting from 1, and the number of shards. The second gives the
+ * archive the shard wrote its images to, whose index is next to it. Then there is one line per file
+ * with the number of images in it, the name of its first image in the archive and its path. */
+bool32 WriteShardManifest(const char* manifestPath, u32 shard, u32 nShards, const char* archivePath, const ShardResult* results, u32 nResults)
+{
+	FILE* manifestFile = NULL;
+	u32 i = 0;
+
+	manifestFile = fopen(manifestPath, "wb");
+	if (!manifestFile)
+	{
+		FOPEN_FAIL_MESSAGE(manifestPath);
+		return FALSE;
+	}
+	fprintf(manifestFile, "shard %u %u\n", shard + 1, nShards);
+	fprintf(manifestFile, "archive %s\n", archivePath);
+	for (i = 0; i < nResults; ++i)
+	{
+		fprintf(manifestFile, "file %u %s %s\n", results[i].nImages, results[i].outputName, results[i].inputPath);
+	}
+	fclose(manifestFile);
+	return TRUE;
+}
+
+/* Combines the manifests of all nShards shards, manifestPaths[i] being shard i's, and checks that every
+ * file in inputPaths was extracted by exactly one shard and every image of it is in exactly one archive.
+ * Every problem found is printed. The merged manifest has one "<shard> <data offset> <size> <name>" line
+ * per image, sorted by name, and is written even if there were problems. Returns TRUE only if there were none. */
+bool32 MergeShardManifests(const char** manifestPaths, u32 nShards, const char** inputPaths, u32 nInputPaths, const char* mergedManifestPath, ShardMergeResults* results)
+{
+	ShardMerge merge = { 0 };
+	FILE* mergedManifestFile = NULL;
+	const ShardImage* image = NULL;
+	u32 i = 0;
+
+	memset(results, 0, sizeof(ShardMergeResults));
+	results->nShards = nShards;
+	results->nFiles = nInputPaths;
+	for (i = 0; i < nShards; ++i)
+	{
+		if (!ReadShardManifest(manifestPaths[i], i, nShards, &merge))
+		{
+			++results->nBadShards;
+		}
+	}
+	results->nImages = merge.nImages;
+
+	qsort(merge.claims, merge.nClaims, sizeof(ShardClaim), CompareShardClaims);
+	qsort(merge.images, merge.nImages, sizeof(ShardImage), CompareShardImages);
+	CheckShardFiles(&merge, inputPaths, nInputPaths, results);
+	CheckShardImages(&merge, results);
+
+	mergedManifestFile = fopen(mergedManifestPath, "wb");
+	if (!mergedManifestFile)
+	{
+		FOPEN_FAIL_MESSAGE(mergedManifestPath);
+		++results->nBadShards;
+	}
+	else
+	{
+		for (i = 0; i < merge.nImages; ++i)
+		{
+			image = &merge.images[i];
+			fprintf(mergedManifestFile, "%u %llu %u %s\n", image->shard + 1, image->offset, image->size, image->name);
+		}
+		fclose(mergedManifestFile);
+	}
+	FreeShardMerge(&merge);
+
+	return results->nBadShards == 0 && results->nMissingFiles == 0 && results->nDuplicateFiles == 0 && results->nUnknownFiles == 0 &&
+		results->nMissingImages == 0 && results->nDuplicateImages == 0 && results->nUnexpectedImages == 0;
+}
+
+static bool32 ReadShardManifest(const char* manifestPath, u32 shard, u32 nShards, ShardMerge* merge)
+{
+	FILE* manifestFile = NULL;
+	char line[SHARD_MANIFEST_MAX_LINE] = { 0 };
+	char outputName[SHARD_MANIFEST_MAX_LINE] = { 0 };
+	char indexPath[SHARD_MANIFEST_MAX_LINE + sizeof(OUTPUT_SINK_INDEX_EXTENSION)] = { 0 };
+	ShardClaim* claim = NULL;
+	u32 manifestShard = 0;
+	u32 manifestNShards = 0;
+	u32 nImages = 0;
+	int pathStart = 0;
+	bool32 success = TRUE;
+
+	manifestFile = fopen(manifestPath, "rb");
+	if (!manifestFile)
+	{
+		FOPEN_FAIL_MESSAGE(manifestPath);
+		return FALSE;
+	}
+	while (fgets(line, sizeof(line), manifestFile))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (sscanf(line, "shard %u %u", &manifestShard, &manifestNShards) == 2)
+		{
+			if (manifestShard != shard + 1 || manifestNShards != nShards)
+			{
+				printf("%s is for shard %u/%u, expected %u/%u\n", manifestPath, manifestShard, manifestNShards, shard + 1, nShards);
+				success = FALSE;
+			}
+			continue;
+		}
+		if (strncmp(line, "archive ", strlen("archive ")) == 0)
+		{
+			sprintf(indexPath, "%s%s", &line[strlen("archive ")], OUTPUT_SINK_INDEX_EXTENSION);
+			continue;
+		}
+		pathStart = 0;
+		if (sscanf(line, "file %u %s %n", &nImages, outputName, &pathStart) < 2 || pathStart == 0)
+		{
+			continue;
+		}
+		claim = AddShardClaim(merge);
+		if (!claim)
+		{
+			success = FALSE;
+			break;
+		}
+		claim->inputPath = CopyString(&line[pathStart]);
+		claim->outputName = CopyString(outputName);
+		claim->nImages = nImages;
+		claim->shard = shard;
+		if (!claim->inputPath || !claim->outputName)
+		{
+			success = FALSE;
+			break;
+		}
+	}
+	fclose(manifestFile);
+
+	if (manifestNShards == 0 || indexPath[0] == '\0')
+	{
+		printf("%s is not a shard manifest\n", manifestPath);
+		return FALSE;
+	}
+	return ReadShardArchiveIndex(indexPath, shard, merge) && success;
+}
+
+static bool32 ReadShardArchiveIndex(const char* indexPath, u32 shard, ShardMerge* merge)
+{
+	FILE* indexFile = NULL;
+	char line[SHARD_MANIFEST_MAX_LINE] = { 0 };
+	ShardImage* image = NULL;
+	u64 offset = 0;
+	u32 size = 0;
+	int nameStart = 0;
+	bool32 success = TRUE;
+
+	indexFile = fopen(indexPath, "rb");
+	if (!indexFile)
+	{
+		FOPEN_FAIL_MESSAGE(indexPath);
+		return FALSE;
+	}
+	while (fgets(line, sizeof(line), indexFile))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		nameStart = 0;
+		if (sscanf(line, "%llu %u %n", &offset, &size, &nameStart) < 2 || nameStart == 0)
+		{
+			continue;
+		}
+		image = AddShardImage(merge);
+		if (!image)
+		{
+			success = FALSE;
+			break;
+		}
+		image->name = CopyString(&line[nameStart]);
+		image->offset = offset;
+		image->size = size;
+		image->shard = shard;
+		if (!image->name)
+		{
+			success = FALSE;
+			break;
+		}
+	}
+	fclose(indexFile);
+	return success;
+}
+
+/* The new claim is zeroed, so it can be freed straight away if filling it in fails */
+static ShardClaim* AddShardClaim(ShardMerge* merge)
+{
+	ShardClaim* claims = NULL;
+	u32 newCapacity = 0;
+
+	if (merge->nClaims == merge->claimsCapacity)
+	{
+		newCapacity = merge->claimsCapacity ? merge->claimsCapacity * 2 : 1024;
+		claims = realloc(merge->claims, sizeof(ShardClaim) * newCapacity);
+		if (!claims)
+		{
+			return NULL;
+		}
+		merge->claims = claims;
+		merge->claimsCapacity = newCapacity;
+	}
+	memset(&merge->claims[merge->nClaims], 0, sizeof(ShardClaim));
+	return &merge->claims[merge->nClaims++];
+}
+
+static ShardImage* AddShardImage(ShardMerge* merge)
+{
+	ShardImage* images = NULL;
+	u32 newCapacity = 0;
+
+	if (merge->nImages == merge->imagesCapacity)
+	{
+		newCapacity = merge->imagesCapacity ? merge->imagesCapacity * 2 : 1024;
+		images = realloc(merge->images, sizeof(ShardImage) * newCapacity);
+		if (!images)
+		{
+			return NULL;
+		}
+		merge->images = images;
+		merge->imagesCapacity = newCapacity;
+	}
+	memset(&merge->images[merge->nImages], 0, sizeof(ShardImage));
+	return &merge->images[merge->nImages++];
+}
+
+/* Claims and images that failed to copy their strings are sorted to the end and otherwise ignored */
+static int CompareShardClaims(const void* a, const void* b)
+{
+	const ShardClaim* first = a;
+	const ShardClaim* second = b;
+
+	if (!first->inputPath || !second->inputPath)
+	{
+		return (first->inputPath == NULL) - (second->inputPath == NULL);
+	}
+	return strcmp(first->inputPath, second->inputPath);
+}
+
+static int CompareShardImages(const void* a, const void* b)
+{
+	const ShardImage* first = a;
+	const ShardImage* second = b;
+
+	if (!first->name || !second->name)
+	{
+		return (first->name == NULL) - (second->name == NULL);
+	}
+	return strcmp(first->name, second->name);
+}
+
+static int CompareStrings(const void* a, const void* b)
+{
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/* Walks the sorted paths of the batch and the sorted claims side by side */
+static void CheckShardFiles(ShardMerge* merge, const char** inputPaths, u32 nInputPaths, ShardMergeResults* results)
+{
+	const char** sortedPaths = NULL;
+	const ShardClaim* claim = NULL;
+	u32 nSameClaims = 0;
+	int order = 0;
+	u32 i = 0;
+	u32 j = 0;
+
+	sortedPaths = malloc(sizeof(const char*) * (nInputPaths ? nInputPaths : 1));
+	if (!sortedPaths)
+	{
+		++results->nBadShards;
+		return;
+	}
+	memcpy(sortedPaths, inputPaths, sizeof(const char*) * nInputPaths);
+	qsort(sortedPaths, nInputPaths, sizeof(const char*), CompareStrings);
+
+	while (i < nInputPaths || (j < merge->nClaims && merge->claims[j].inputPath))
+	{
+		/* A file listed twice in the batch is still only extracted once */
+		if (i > 0 && i < nInputPaths && strcmp(sortedPaths[i], sortedPaths[i - 1]) == 0)
+		{
+			++i;
+			continue;
+		}
+		claim = &merge->claims[j];
+		if (i == nInputPaths)
+		{
+			order = 1;
+		}
+		else if (j == merge->nClaims || !claim->inputPath)
+		{
+			order = -1;
+		}
+		else
+		{
+			order = strcmp(sortedPaths[i], claim->inputPath);
+		}
+
+		if (order < 0)
+		{
+			printf("Missing: %s was not extracted by any shard\n", sortedPaths[i]);
+			++results->nMissingFiles;
+			++i;
+		}
+		else if (order > 0)
+		{
+			printf("Unknown: %s was extracted by shard %u but is not in the batch\n", claim->inputPath, claim->shard + 1);
+			++results->nUnknownFiles;
+			++j;
+		}
+		else
+		{
+			for (nSameClaims = 1; j + nSameClaims < merge->nClaims && merge->claims[j + nSameClaims].inputPath &&
+				strcmp(merge->claims[j + nSameClaims].inputPath, claim->inputPath) == 0; ++nSameClaims);
+			if (nSameClaims > 1)
+			{
+				printf("Duplicate: %s was extracted by %u shards\n", claim->inputPath, nSameClaims);
+				++results->nDuplicateFiles;
+			}
+			j += nSameClaims;
+			++i;
+		}
+	}
+	free(sortedPaths);
+}
+
+/* Looks up every image each claimed file should have produced. Whatever is left
+ * over in the archives wasn't expected from anything. */
+static void CheckShardImages(ShardMerge* merge, ShardMergeResults* results)
+{
+	char name[SHARD_MANIFEST_MAX_LINE + 16] = { 0 };
+	const ShardClaim* claim = NULL;
+	u32 firstImage = 0;
+	u32 nSameImages = 0;
+	u32 i = 0;
+	u32 j = 0;
+
+	for (i = 0; i < merge->nClaims && merge->claims[i].inputPath; ++i)
+	{
+		claim = &merge->claims[i];
+		for (j = 0; j < claim->nImages; ++j)
+		{
+			GetShardImageName(claim->outputName, j, name);
+			firstImage = FindShardImage(merge, name);
+			if (firstImage == merge->nImages)
+			{
+				printf("Missing: image %u of %s (%s) is in no shard's archive\n", j, claim->inputPath, name);
+				++results->nMissingImages;
+				continue;
+			}
+			if (merge->images[firstImage].expected)
+			{
+				/* Already looked at for another claim on the same file */
+				continue;
+			}
+			for (nSameImages = 0; firstImage + nSameImages < merge->nImages && merge->images[firstImage + nSameImages].name &&
+				strcmp(merge->images[firstImage + nSameImages].name, name) == 0; ++nSameImages)
+			{
+				merge->images[firstImage + nSameImages].expected = TRUE;
+			}
+			if (nSameImages > 1)
+			{
+				printf("Duplicate: %s is in %u archive entries\n", name, nSameImages);
+				++results->nDuplicateImages;
+			}
+		}
+	}
+
+	for (i = 0; i < merge->nImages && merge->images[i].name; ++i)
+	{
+		if (!merge->images[i].expected)
+		{
+			printf("Unexpected: %s in shard %u's archive is not from any extracted file\n", merge->images[i].name, merge->images[i].shard + 1);
+			++results->nUnexpectedImages;
+		}
+	}
+}
+
+/* Returns the first image with the name, or merge->nImages if there isn't one */
+static u32 FindShardImage(const ShardMerge* merge, const char* name)
+{
+	u32 low = 0;
+	u32 high = merge->nImages;
+	u32 middle = 0;
+
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+		if (merge->images[middle].name && strcmp(merge->images[middle].name, name) < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if (low == merge->nImages || !merge->images[low].name || strcmp(merge->images[low].name, name) != 0)
+	{
+		return merge->nImages;
+	}
+	return low;
+}
+
+/* The same naming ConvertRGOImageToPNGAll uses for the images after the first in a file */
+static void GetShardImageName(const char* outputName, u32 imageIndex, char* name)
+{
+	const char* extension = NULL;
+	size_t baseLength = 0;
+
+	strcpy(name, outputName);
+	if (imageIndex == 0)
+	{
+		return;
+	}
+	extension = strrchr(outputName, '.');
+	baseLength = extension ? (size_t)(extension - outputName) : strlen(outputName);
+	sprintf(&name[baseLength], "_%u", imageIndex);
+	strcat(name, &outputName[baseLength]);
+}
+
+static void FreeShardMerge(ShardMerge* merge)
+{
+	u32 i = 0;
+
+	for (i = 0; i < merge->nClaims; ++i)
+	{
+		free(merge->claims[i].inputPath);
+		free(merge->claims[i].outputName);
+	}
+	for (i = 0; i < merge->nImages; ++i)
+	{
+		free(merge->images[i].name);
+	}
+	free(merge->claims);
+	free(merge->images);
+}
+
+void PrintShardMergeResults(ShardMergeResults results)
+{
+	printf("Shards: %u. Files: %u. Images: %u. Bad shards: %u\n", results.nShards, results.nFiles, results.nImages, results.nBadShards);
+	printf("Files missing: %u. Duplicated: %u. Unknown: %u\n", results.nMissingFiles, results.nDuplicateFiles, results.nUnknownFiles);
+	printf("Images missing: %u. Duplicated: %u. Unexpected: %u\n", results.nMissingImages, results.nDuplicateImages, results.nUnexpectedImages);
+}
@@ -0,0 +1,64 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  shard.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "util.h"
+
+#define SHARD_MANIFEST_MAX_LINE 2048
+
+/* A file in a batch and roughly how long it takes to extract, from EstimateExtractionCost. */
+typedef struct
+{
+	const char* inputPath;
+	u64 cost;
+} ShardFile;
+
+/* What one shard extracted, one entry per file it was given. outputName is the name of the first
+ * image of the file in the shard's archive. Image N after it has _N before the extension. */
+typedef struct
+{
+	const char* inputPath;
+	const char* outputName;
+	u32 nImages;
+} ShardResult;
+
+typedef struct
+{
+	u32 nShards;
+	u32 nFiles;
+	u32 nImages;
+	u32 nBadShards;         /* Manifest or archive index missing, or written for a different split */
+	u32 nMissingFiles;      /* In the batch but given to no shard */
+	u32 nDuplicateFiles;    /* Given to more than one shard */
+	u32 nUnknownFiles;      /* Extracted by a shard but not in the batch */
+	u32 nMissingImages;     /* Expected from an extracted file but in no archive */
+	u32 nDuplicateImages;   /* In more than one archive entry */
+	u32 nUnexpectedImages;  /* In an archive but not expected from any extracted file */
+} ShardMergeResults;
+
+bool32 ParseShardSpec(const char* spec, u32* shard, u32* nShards);
+u64 EstimateExtractionCost(const char* inputPath);
+void PartitionShards(const ShardFile* files, u32 nFiles, u32 nShards, u32* shardOfFile);
+bool32 WriteShardManifest(const char* manifestPath, u32 shard, u32 nShards, const char* archivePath, const ShardResult* results, u32 nResults);
+bool32 MergeShardManifests(const char** manifestPaths, u32 nShards, const char** inputPaths, u32 nInputPaths, const char* mergedManifestPath, ShardMergeResults* results);
+void PrintShardMergeResults(ShardMergeResults results);
+
+#endif
@@ -0,0 +1,246 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  sink.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "thread.h"
+#include "sink.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_LENGTH 100
+#define TAR_PREFIX_LENGTH 155
+#define INDEX_LINE_LENGTH (TAR_PREFIX_LENGTH + 1 + TAR_NAME_LENGTH + 64) /* The longest name, two numbers and spaces */
+
+struct OutputSink
+{
+	Mutex mutex;
+	FILE* archive;
+	char* archivePath;
+	char* indexPath;
+	char* basePath;   /* Stripped from the front of entry names */
+	char* index;      /* Kept in memory and written out when the sink is closed */
+	u64 indexSize;
+	u64 indexCapacity;
+	u64 archiveSize;
+	bool32 failed;
+};
+
+static bool32 WriteTarHeader(FILE* archive, const char* name, u32 size);
+static bool32 AppendToIndex(OutputSink* sink, const char* line);
+static void WriteTarOctal(char* field, u32 fieldLength, u64 value);
+
+OutputSink* OpenArchiveSink(const char* archivePath, const char* basePath)
+{
+	OutputSink* sink = NULL;
+	char* indexPath = NULL;
+
+	sink = calloc(1, sizeof(OutputSink));
+	indexPath = malloc(strlen(archivePath) + sizeof(OUTPUT_SINK_INDEX_EXTENSION));
+	if (!sink || !indexPath)
+	{
+		free(sink);
+		free(indexPath);
+		return NULL;
+	}
+	sprintf(indexPath, "%s%s", archivePath, OUTPUT_SINK_INDEX_EXTENSION);
+
+	sink->archivePath = CopyString(archivePath);
+	sink->indexPath = indexPath;
+	sink->basePath = CopyString(basePath);
+	sink->archive = fopen(archivePath, "wb");
+	if (!sink->archivePath || !sink->basePath || !sink->archive)
+	{
+		if (sink->archive)
+		{
+			fclose(sink->archive);
+		}
+		FOPEN_FAIL_MESSAGE(archivePath);
+		free(sink->archivePath);
+		free(sink->indexPath);
+		free(sink->basePath);
+		free(sink);
+		return NULL;
+	}
+	InitMutex(&sink->mutex);
+	return sink;
+}
+
+/* Appends a file to the archive. The entry is named after path, minus the sink's base path. */
+bool32 WriteToOutputSink(OutputSink* sink, const char* path, Memory data)
+{
+	const char* name = NULL;
+	const char padding[TAR_BLOCK_SIZE] = { 0 };
+	char indexLine[INDEX_LINE_LENGTH] = { 0 };
+	u32 paddingSize = 0;
+	bool32 success = FALSE;
+
+	name = path;
+	if (strncmp(path, sink->basePath, strlen(sink->basePath)) == 0)
+	{
+		name = &path[strlen(sink->basePath)];
+	}
+	paddingSize = (TAR_BLOCK_SIZE - data.size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+	LockMutex(&sink->mutex);
+	success = !sink->failed && WriteTarHeader(sink->archive, name, data.size);
+	if (success)
+	{
+		sink->archiveSize += TAR_BLOCK_SIZE;
+		snprintf(indexLine, sizeof(indexLine), "%llu %u %s\n", sink->archiveSize, data.size, name);
+		success = AppendToIndex(sink, indexLine) &&
+			fwrite(data.data, 1, data.size, sink->archive) == data.size &&
+			fwrite(padding, 1, paddingSize, sink->archive) == paddingSize;
+		sink->archiveSize += data.size + paddingSize;
+	}
+	if (!success)
+	{
+		/* Once a write fails, the offsets in the index can't be trusted anymore */
+		sink->failed = TRUE;
+	}
+	UnlockMutex(&sink->mutex);
+	return success;
+}
+
+/* Finishes the archive and writes the index. The index is only written if every write to the archive
+ * succeeded, so an index next to an archive can always be trusted. Returns FALSE if any write failed. */
+bool32 CloseOutputSink(OutputSink* sink)
+{
+	const char endOfArchive[TAR_BLOCK_SIZE * 2] = { 0 };
+	Memory index = { 0 };
+	bool32 success = FALSE;
+
+	success = !sink->failed;
+	if (fwrite(endOfArchive, 1, sizeof(endOfArchive), sink->archive) != sizeof(endOfArchive))
+	{
+		success = FALSE;
+	}
+	if (fclose(sink->archive) != 0)
+	{
+		success = FALSE;
+	}
+	if (success)
+	{
+		index.data = (u8*)sink->index;
+		index.size = (u32)sink->indexSize;
+		success = WriteMemoryToFile(index, sink->indexPath);
+	}
+	if (!success)
+	{
+		printf("Failed to write archive %s\n", sink->archivePath);
+	}
+
+	DestroyMutex(&sink->mutex);
+	free(sink->archivePath);
+	free(sink->indexPath);
+	free(sink->basePath);
+	free(sink->index);
+	free(sink);
+	return success;
+}
+
+/* The sink's mutex must be held */
+static bool32 AppendToIndex(OutputSink* sink, const char* line)
+{
+	char* newIndex = NULL;
+	u64 lineLength = 0;
+	u64 newCapacity = 0;
+
+	lineLength = strlen(line);
+	if (sink->indexSize + lineLength > sink->indexCapacity)
+	{
+		newCapacity = sink->indexCapacity ? sink->indexCapacity * 2 : 64 * 1024;
+		while (newCapacity < sink->indexSize + lineLength)
+		{
+			newCapacity *= 2;
+		}
+		newIndex = realloc(sink->index, (size_t)newCapacity);
+		if (!newIndex)
+		{
+			return FALSE;
+		}
+		sink->index = newIndex;
+		sink->indexCapacity = newCapacity;
+	}
+	memcpy(&sink->index[sink->indexSize], line, (size_t)lineLength);
+	sink->indexSize += lineLength;
+	return TRUE;
+}
+
+/* Writes a POSIX ustar header for a regular file. */
+static bool32 WriteTarHeader(FILE* archive, const char* name, u32 size)
+{
+	char header[TAR_BLOCK_SIZE] = { 0 };
+	size_t nameLength = 0;
+	const char* split = NULL;
+	u32 checksum = 0;
+	u32 i = 0;
+
+	/* Names longer than 100 characters have to be split at a slash into prefix and name */
+	nameLength = strlen(name);
+	if (nameLength <= TAR_NAME_LENGTH)
+	{
+		memcpy(&header[0], name, nameLength);
+	}
+	else
+	{
+		split = &name[nameLength - TAR_NAME_LENGTH - 1];
+		split = strchr(split, '/');
+		if (!split || split - name > TAR_PREFIX_LENGTH)
+		{
+			printf("Name is too long for a tar archive: %s\n", name);
+			return FALSE;
+		}
+		memcpy(&header[345], name, split - name);
+		memcpy(&header[0], split + 1, strlen(split + 1));
+	}
+
+	WriteTarOctal(&header[100], 8, 0644); /* mode */
+	WriteTarOctal(&header[108], 8, 0);    /* uid */
+	WriteTarOctal(&header[116], 8, 0);    /* gid */
+	WriteTarOctal(&header[124], 12, size);
+	WriteTarOctal(&header[136], 12, 0);   /* mtime. Left at zero so archives of the same images are identical. */
+	header[156] = '0';                    /* Regular file */
+	memcpy(&header[257], "ustar", 6);
+	memcpy(&header[263], "00", 2);
+
+	/* The checksum is calculated with the checksum field filled with spaces */
+	memset(&header[148], ' ', 8);
+	for (i = 0; i < TAR_BLOCK_SIZE; ++i)
+	{
+		checksum += (u8)header[i];
+	}
+	WriteTarOctal(&header[148], 7, checksum);
+
+	return fwrite(header, 1, TAR_BLOCK_SIZE, archive) == TAR_BLOCK_SIZE;
+}
+
+/* Fills a numeric tar field with zero-padded octal digits followed by a NUL */
+static void WriteTarOctal(char* field, u32 fieldLength, u64 value)
+{
+	u32 i = 0;
+
+	field[fieldLength - 1] = '\0';
+	for (i = fieldLength - 1; i > 0; --i)
+	{
+		field[i - 1] = '0' + (char)(value & 7);
+		value >>= 3;
+	}
+}
@@ -0,0 +1,37 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  sink.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include "util.h"
+
+#define OUTPUT_SINK_INDEX_EXTENSION ".idx"
+
+/* Collects many output files into a single uncompressed tar archive. Entries are
+ * appended sequentially, and when the sink is closed an index of where each entry's
+ * data starts is written next to the archive (the archive path + OUTPUT_SINK_INDEX_EXTENSION),
+ * one "<data offset> <size> <name>" line per entry. Safe to write to from multiple threads. */
+typedef struct OutputSink OutputSink;
+
+OutputSink* OpenArchiveSink(const char* archivePath, const char* basePath);
+bool32 WriteToOutputSink(OutputSink* sink, const char* path, Memory data);
+bool32 CloseOutputSink(OutputSink* sink);
+
+#endif
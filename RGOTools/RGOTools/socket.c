@@ -0,0 +1,235 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  socket.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <string.h>
+#include "util.h"
+#include "thread.h"
+#include "socket.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/* A peer that hangs up while a reply is being sent must make send fail, not raise SIGPIPE and end the process.
+ * Linux takes a flag on each send, macOS and BSD an option on each socket. Windows has no SIGPIPE. */
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+static bool32 InitLocalSocketAddress(const char* path, struct sockaddr_un* address);
+static void DisableSIGPIPE(Socket connection);
+
+#ifdef _WIN32
+static OnceFlag winsockInitialized = ONCE_FLAG_STATIC_INIT;
+
+static void InitWinsock(void)
+{
+	WSADATA wsaData = { 0 };
+
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+}
+#endif
+
+static bool32 InitLocalSocketAddress(const char* path, struct sockaddr_un* address)
+{
+	memset(address, 0, sizeof(*address));
+	if (strlen(path) >= sizeof(address->sun_path))
+	{
+		printf("Socket path %s is too long\n", path);
+		return FALSE;
+	}
+	address->sun_family = AF_UNIX;
+	strcpy(address->sun_path, path);
+	return TRUE;
+}
+
+static void DisableSIGPIPE(Socket connection)
+{
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+
+	setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+	(void)connection;
+#endif
+}
+
+/* Creates a socket at path, replacing whatever was left there by an earlier run, and starts listening on it. */
+bool32 ListenLocalSocket(const char* path, Socket* listener)
+{
+	struct sockaddr_un address = { 0 };
+	Socket ret = INVALID_SOCKET_VALUE;
+
+#ifdef _WIN32
+	RunOnce(&winsockInitialized, InitWinsock);
+#endif
+	if (!InitLocalSocketAddress(path, &address))
+	{
+		return FALSE;
+	}
+	ret = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ret == INVALID_SOCKET_VALUE)
+	{
+		return FALSE;
+	}
+	remove(path);
+	if (bind(ret, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(ret, SOMAXCONN) != 0)
+	{
+		printf("Could not listen on %s\n", path);
+		CloseSocket(ret);
+		return FALSE;
+	}
+	*listener = ret;
+	return TRUE;
+}
+
+bool32 ConnectLocalSocket(const char* path, Socket* connection)
+{
+	struct sockaddr_un address = { 0 };
+	Socket ret = INVALID_SOCKET_VALUE;
+
+#ifdef _WIN32
+	RunOnce(&winsockInitialized, InitWinsock);
+#endif
+	if (!InitLocalSocketAddress(path, &address))
+	{
+		return FALSE;
+	}
+	ret = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ret == INVALID_SOCKET_VALUE)
+	{
+		return FALSE;
+	}
+	if (connect(ret, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		CloseSocket(ret);
+		return FALSE;
+	}
+	DisableSIGPIPE(ret);
+	*connection = ret;
+	return TRUE;
+}
+
+bool32 AcceptConnection(Socket listener, Socket* connection)
+{
+	*connection = accept(listener, NULL, NULL);
+	if (*connection == INVALID_SOCKET_VALUE)
+	{
+		return FALSE;
+	}
+	DisableSIGPIPE(*connection);
+	return TRUE;
+}
+
+bool32 SendAll(Socket connection, const void* data, u32 size)
+{
+	const char* bytes = data;
+	int nSent = 0;
+
+	while (size > 0)
+	{
+		nSent = send(connection, bytes, size > 0x40000000 ? 0x40000000 : (int)size, SEND_FLAGS);
+		if (nSent <= 0) /* Includes EPIPE when the peer has hung up */
+		{
+			return FALSE;
+		}
+		bytes += nSent;
+		size -= (u32)nSent;
+	}
+	return TRUE;
+}
+
+bool32 ReceiveAll(Socket connection, void* data, u32 size)
+{
+	char* bytes = data;
+	u32 nReceived = 0;
+
+	while (size > 0)
+	{
+		nReceived = ReceiveSome(connection, bytes, size);
+		if (nReceived == 0)
+		{
+			return FALSE;
+		}
+		bytes += nReceived;
+		size -= nReceived;
+	}
+	return TRUE;
+}
+
+/* Returns however many bytes are available, waiting for at least one. 0 means the connection was closed. */
+u32 ReceiveSome(Socket connection, void* data, u32 size)
+{
+	int nReceived = 0;
+
+	nReceived = recv(connection, data, size > 0x40000000 ? 0x40000000 : (int)size, 0);
+	return nReceived > 0 ? (u32)nReceived : 0;
+}
+
+/* Returns 1 if there is data to receive or the connection was closed, 0 if nothing arrived before the timeout,
+ * and -1 on failure */
+int WaitForData(Socket connection, u32 timeoutMilliseconds)
+{
+#ifdef _WIN32
+	WSAPOLLFD pollFD = { 0 };
+#else
+	struct pollfd pollFD = { 0 };
+#endif
+	int nReady = 0;
+
+	pollFD.fd = connection;
+	pollFD.events = POLLIN;
+#ifdef _WIN32
+	nReady = WSAPoll(&pollFD, 1, (int)timeoutMilliseconds);
+#else
+	nReady = poll(&pollFD, 1, (int)timeoutMilliseconds);
+#endif
+	if (nReady < 0)
+	{
+		return -1;
+	}
+	return nReady > 0 ? 1 : 0;
+}
+
+/* Stops a connection in both directions, waking any thread waiting on it, without closing it yet */
+void ShutdownSocket(Socket connection)
+{
+#ifdef _WIN32
+	shutdown(connection, SD_BOTH);
+#else
+	shutdown(connection, SHUT_RDWR);
+#endif
+}
+
+void CloseSocket(Socket toClose)
+{
+#ifdef _WIN32
+	closesocket(toClose);
+#else
+	close(toClose);
+#endif
+}
@@ -0,0 +1,47 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  socket.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include "util.h"
+
+/* Local sockets are platform specific, so this is a thin wrapper over Winsock's
+ * AF_UNIX support on Windows and BSD sockets everywhere else. */
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+typedef SOCKET Socket;
+#define INVALID_SOCKET_VALUE INVALID_SOCKET
+#else
+typedef int Socket;
+#define INVALID_SOCKET_VALUE (-1)
+#endif
+
+bool32 ListenLocalSocket(const char* path, Socket* listener);
+bool32 ConnectLocalSocket(const char* path, Socket* connection);
+bool32 AcceptConnection(Socket listener, Socket* connection);
+bool32 SendAll(Socket connection, const void* data, u32 size);
+bool32 ReceiveAll(Socket connection, void* data, u32 size);
+u32 ReceiveSome(Socket connection, void* data, u32 size);
+int WaitForData(Socket connection, u32 timeoutMilliseconds);
+void ShutdownSocket(Socket connection);
+void CloseSocket(Socket toClose);
+
+#endif
@@ -0,0 +1,274 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  stats.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "thread.h"
+#include "stats.h"
+
+typedef struct
+{
+	char* inputPath;
+	u32 imageIndex;
+	ImageCodecStats stats;
+} CodecStatsRecord;
+
+struct CodecStatsCollector
+{
+	Mutex mutex;
+	CodecStatsRecord* records;
+	u32 nRecords;
+	u32 recordsCapacity;
+	CodecStatsTotals totals;
+};
+
+static void AddToTotals(CodecStatsTotals* totals, const ImageCodecStats* stats);
+static void SumSubfileStats(const ImageCodecStats* stats, SubfileStats* sum);
+static double GetRatio(u64 numerator, u64 denominator);
+
+/* Gets stats ready to be passed to DecodeImagePixels for the image at header */
+bool32 InitImageCodecStats(const u8* header, Platform platform, ImageCodecStats* stats)
+{
+	memset(stats, 0, sizeof(ImageCodecStats));
+	stats->platform = platform;
+	stats->nSubfiles = LittleEndianRead32(header);
+	if (stats->nSubfiles == 0)
+	{
+		return TRUE;
+	}
+	stats->subfiles = calloc(stats->nSubfiles, sizeof(SubfileStats));
+	if (!stats->subfiles)
+	{
+		stats->nSubfiles = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void FreeImageCodecStats(ImageCodecStats* stats)
+{
+	free(stats->subfiles);
+	stats->subfiles = NULL;
+	stats->nSubfiles = 0;
+}
+
+CodecStatsCollector* CreateCodecStatsCollector(void)
+{
+	CodecStatsCollector* collector = NULL;
+
+	collector = calloc(1, sizeof(CodecStatsCollector));
+	if (!collector)
+	{
+		return NULL;
+	}
+	InitMutex(&collector->mutex);
+	return collector;
+}
+
+/* The collector takes over stats->subfiles, so stats only needs to be initialized again to be reused.
+ * If there's no memory to keep the image's own record, it's still counted in the totals. */
+void AddImageCodecStats(CodecStatsCollector* collector, const char* inputPath, u32 imageIndex, ImageCodecStats* stats)
+{
+	CodecStatsRecord* records = NULL;
+	CodecStatsRecord* record = NULL;
+	u32 newCapacity = 0;
+
+	LockMutex(&collector->mutex);
+	AddToTotals(&collector->totals, stats);
+	if (collector->nRecords == collector->recordsCapacity)
+	{
+		newCapacity = collector->recordsCapacity ? collector->recordsCapacity * 2 : 256;
+		records = realloc(collector->records, sizeof(CodecStatsRecord) * newCapacity);
+		if (!records)
+		{
+			UnlockMutex(&collector->mutex);
+			FreeImageCodecStats(stats);
+			return;
+		}
+		collector->records = records;
+		collector->recordsCapacity = newCapacity;
+	}
+	record = &collector->records[collector->nRecords];
+	record->inputPath = CopyString(inputPath);
+	if (!record->inputPath)
+	{
+		UnlockMutex(&collector->mutex);
+		FreeImageCodecStats(stats);
+		return;
+	}
+	record->imageIndex = imageIndex;
+	record->stats = *stats;
+	++collector->nRecords;
+	UnlockMutex(&collector->mutex);
+
+	stats->subfiles = NULL;
+	stats->nSubfiles = 0;
+}
+
+static void AddToTotals(CodecStatsTotals* totals, const ImageCodecStats* stats)
+{
+	SubfileStats sum = { 0 };
+
+	SumSubfileStats(stats, &sum);
+	++totals->nImages;
+	totals->nSubfiles += stats->nSubfiles;
+	totals->compressedBytes += sum.compressedSize;
+	totals->decompressedBytes += sum.decompressedSize;
+	totals->nLiterals += sum.nLiterals;
+	totals->nBackReferences += sum.nBackReferences;
+	totals->backReferenceBytes += sum.backReferenceBytes;
+	totals->nInflateCalls += stats->nInflateCalls;
+	totals->nPaddingKilobytes += stats->nPaddingKilobytes;
+	if (stats->nPaletteColors == 16)
+	{
+		++totals->nImagesByPaletteSize[0];
+	}
+	else if (stats->nPaletteColors == 256)
+	{
+		++totals->nImagesByPaletteSize[1];
+	}
+	else
+	{
+		++totals->nImagesByPaletteSize[2];
+	}
+}
+
+/* Adds up every subfile of an image. None of the counts for a single image get anywhere near 4 GB. */
+static void SumSubfileStats(const ImageCodecStats* stats, SubfileStats* sum)
+{
+	u32 i = 0;
+
+	memset(sum, 0, sizeof(SubfileStats));
+	for (i = 0; i < stats->nSubfiles; ++i)
+	{
+		sum->compressedSize += stats->subfiles[i].compressedSize;
+		sum->decompressedSize += stats->subfiles[i].decompressedSize;
+		sum->nLiterals += stats->subfiles[i].nLiterals;
+		sum->nBackReferences += stats->subfiles[i].nBackReferences;
+		sum->backReferenceBytes += stats->subfiles[i].backReferenceBytes;
+	}
+}
+
+CodecStatsTotals GetCodecStatsTotals(CodecStatsCollector* collector)
+{
+	CodecStatsTotals ret = { 0 };
+
+	LockMutex(&collector->mutex);
+	ret = collector->totals;
+	UnlockMutex(&collector->mutex);
+	return ret;
+}
+
+/* Writes the totals, then every image in the order they were added with each of its subfiles.
+ * Sizes are in bytes, and compression ratios are decompressed size over compressed size,
+ * where the compressed size of a subfile includes its size field and padding. */
+bool32 WriteCodecStatsJSON(CodecStatsCollector* collector, const char* outputPath)
+{
+	FILE* outputFile = NULL;
+	const CodecStatsTotals* totals = NULL;
+	const CodecStatsRecord* record = NULL;
+	const SubfileStats* subfile = NULL;
+	SubfileStats sum = { 0 };
+	u32 i = 0;
+	u32 j = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return FALSE;
+	}
+	LockMutex(&collector->mutex);
+	totals = &collector->totals;
+	fprintf(outputFile, "{\n\t\"totals\": {\n");
+	fprintf(outputFile, "\t\t\"images\": %u,\n\t\t\"subfiles\": %u,\n", totals->nImages, totals->nSubfiles);
+	fprintf(outputFile, "\t\t\"compressedBytes\": %llu,\n\t\t\"decompressedBytes\": %llu,\n\t\t\"compressionRatio\": %.3f,\n",
+		totals->compressedBytes, totals->decompressedBytes, GetRatio(totals->decompressedBytes, totals->compressedBytes));
+	fprintf(outputFile, "\t\t\"literals\": %llu,\n\t\t\"backReferences\": %llu,\n\t\t\"averageMatchLength\": %.3f,\n",
+		totals->nLiterals, totals->nBackReferences, GetRatio(totals->backReferenceBytes, totals->nBackReferences));
+	fprintf(outputFile, "\t\t\"inflateCalls\": %llu,\n\t\t\"paddingKilobytes\": %llu,\n", totals->nInflateCalls, totals->nPaddingKilobytes);
+	fprintf(outputFile, "\t\t\"paletteSizes\": { \"16\": %u, \"256\": %u, \"other\": %u }\n\t},\n",
+		totals->nImagesByPaletteSize[0], totals->nImagesByPaletteSize[1], totals->nImagesByPaletteSize[2]);
+
+	fprintf(outputFile, "\t\"images\": [");
+	for (i = 0; i < collector->nRecords; ++i)
+	{
+		record = &collector->records[i];
+		SumSubfileStats(&record->stats, &sum);
+		fprintf(outputFile, "%s\n\t\t{\n\t\t\t\"file\": ", i == 0 ? "" : ",");
+		WriteJSONString(outputFile, record->inputPath);
+		fprintf(outputFile, ",\n\t\t\t\"image\": %u,\n\t\t\t\"platform\": \"%s\",\n", record->imageIndex,
+			record->stats.platform == PLATFORM_PS2 ? "PS2" : "PSP");
+		fprintf(outputFile, "\t\t\t\"paletteColors\": %u,\n\t\t\t\"paddingKilobytes\": %u,\n\t\t\t\"inflateCalls\": %u,\n",
+			record->stats.nPaletteColors, record->stats.nPaddingKilobytes, record->stats.nInflateCalls);
+		fprintf(outputFile, "\t\t\t\"compressedBytes\": %u,\n\t\t\t\"decompressedBytes\": %u,\n\t\t\t\"compressionRatio\": %.3f,\n",
+			sum.compressedSize, sum.decompressedSize, GetRatio(sum.decompressedSize, sum.compressedSize));
+		fprintf(outputFile, "\t\t\t\"literals\": %u,\n\t\t\t\"backReferences\": %u,\n\t\t\t\"averageMatchLength\": %.3f,\n",
+			sum.nLiterals, sum.nBackReferences, GetRatio(sum.backReferenceBytes, sum.nBackReferences));
+		fprintf(outputFile, "\t\t\t\"subfiles\": [");
+		for (j = 0; j < record->stats.nSubfiles; ++j)
+		{
+			subfile = &record->stats.subfiles[j];
+			fprintf(outputFile, "%s\n\t\t\t\t{ \"in\": %u, \"out\": %u, \"ratio\": %.3f, \"literals\": %u, \"backReferences\": %u, \"averageMatchLength\": %.3f }",
+				j == 0 ? "" : ",", subfile->compressedSize, subfile->decompressedSize, GetRatio(subfile->decompressedSize, subfile->compressedSize),
+				subfile->nLiterals, subfile->nBackReferences, GetRatio(subfile->backReferenceBytes, subfile->nBackReferences));
+		}
+		fprintf(outputFile, "%s]\n\t\t}", record->stats.nSubfiles == 0 ? "" : "\n\t\t\t");
+	}
+	fprintf(outputFile, "%s]\n}\n", collector->nRecords == 0 ? "" : "\n\t");
+	UnlockMutex(&collector->mutex);
+	fclose(outputFile);
+	return TRUE;
+}
+
+static double GetRatio(u64 numerator, u64 denominator)
+{
+	if (denominator == 0)
+	{
+		return 0.0;
+	}
+	return (double)numerator / (double)denominator;
+}
+
+void PrintCodecStatsTotals(CodecStatsTotals totals)
+{
+	printf("Images: %u. Subfiles: %u. Compression ratio: %.3f. Back-references: %llu, %.3f bytes on average. Padding: %llu KB\n",
+		totals.nImages, totals.nSubfiles, GetRatio(totals.decompressedBytes, totals.compressedBytes),
+		totals.nBackReferences, GetRatio(totals.backReferenceBytes, totals.nBackReferences), totals.nPaddingKilobytes);
+}
+
+void DestroyCodecStatsCollector(CodecStatsCollector* collector)
+{
+	u32 i = 0;
+
+	if (!collector)
+	{
+		return;
+	}
+	for (i = 0; i < collector->nRecords; ++i)
+	{
+		free(collector->records[i].inputPath);
+		free(collector->records[i].stats.subfiles);
+	}
+	free(collector->records);
+	DestroyMutex(&collector->mutex);
+	free(collector);
+}
@@ -0,0 +1,73 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  stats.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "util.h"
+
+/* Collects counters on how each decoded image was compressed, to help tell why some
+ * images are slower to decode than others. Each image's counters are filled in while it's
+ * decoded and then added to a collector, which can be shared between threads. */
+typedef struct CodecStatsCollector CodecStatsCollector;
+
+typedef struct
+{
+	u32 compressedSize;
+	u32 decompressedSize;
+	u32 nLiterals;          /* PS2 only */
+	u32 nBackReferences;    /* PS2 only */
+	u32 backReferenceBytes; /* PS2 only. The total length of all back-references. */
+} SubfileStats;
+
+typedef struct ImageCodecStats
+{
+	Platform platform;
+	u32 nSubfiles;
+	SubfileStats* subfiles; /* One per subfile. Subfiles that weren't decompressed are left zeroed. */
+	u32 nInflateCalls;
+	u32 nPaddingKilobytes; /* Kilobytes of padding skipped between this image and the next one. Zero for the last image in a file. */
+	u32 nPaletteColors;
+} ImageCodecStats;
+
+/* The sum of every image added to a collector */
+typedef struct
+{
+	u32 nImages;
+	u32 nSubfiles;
+	u64 compressedBytes;
+	u64 decompressedBytes;
+	u64 nLiterals;
+	u64 nBackReferences;
+	u64 backReferenceBytes;
+	u64 nInflateCalls;
+	u64 nPaddingKilobytes;
+	u32 nImagesByPaletteSize[3]; /* 16 colors, 256 colors, then anything else */
+} CodecStatsTotals;
+
+bool32 InitImageCodecStats(const u8* header, Platform platform, ImageCodecStats* stats);
+void FreeImageCodecStats(ImageCodecStats* stats);
+CodecStatsCollector* CreateCodecStatsCollector(void);
+void AddImageCodecStats(CodecStatsCollector* collector, const char* inputPath, u32 imageIndex, ImageCodecStats* stats);
+CodecStatsTotals GetCodecStatsTotals(CodecStatsCollector* collector);
+bool32 WriteCodecStatsJSON(CodecStatsCollector* collector, const char* outputPath);
+void PrintCodecStatsTotals(CodecStatsTotals totals);
+void DestroyCodecStatsCollector(CodecStatsCollector* collector);
+
+#endif
@@ -22,8 +22,56 @@
 #include <string.h>
 #include "util.h"
 #include "image.h"
+#include "palette.h"
+#include "thread.h"
+#include "writer.h"
+#include "sink.h"
+#include "raw.h"
+#include "width.h"
+#include "map.h"
+#include "dedup.h"
+#include "stats.h"
+#include "trace.h"
+#include "alloc.h"
+#include "budget.h"
+#include "regress.h"
+#include "shard.h"
+#include "phash.h"
+#include "repack.h"
+#include "lzss.h"
+#include "server.h"
+#include "import.h"
+#include "watch.h"
 #include "test.h"
 
+/* Where the images of one file in the file lists are extracted to */
+typedef struct
+{
+	char* inputPath;
+	char* outputPath; /* For the first image, as given by GenerateExtractAllImagesOutputPath */
+	u32 customWidths[MAX_IMAGES_PER_FILE];
+} ExtractedImageSource;
+
+/* What ExtractAllImagesWith sets up around the run */
+#define EXTRACT_ALL_TO_ARCHIVE 0x01
+#define EXTRACT_ALL_THUMBNAILS 0x02 /* Into their own archive */
+#define EXTRACT_ALL_DEDUPLICATED 0x04
+#define EXTRACT_ALL_CODEC_STATS 0x08
+#define EXTRACT_ALL_TRACED 0x10
+#define EXTRACT_ALL_MEMORY_TRACKED 0x20
+#define EXTRACT_ALL_MEMORY_BUDGETED 0x40
+
+static bool32 GetNextWidthListEntry(FilePathList* filePathList, u32* customWidths);
+static u32 DecodeValidatedContainer(Memory container, ImageInfo imageInfo);
+static void TestRepackImageEnlarged(Memory original, ImageInfo originalInfo, FILE* outputFile);
+static void RunImageServerThread(void* arg);
+static bool32 LoadExtractedImageSources(ExtractedImageSource** sources, u32* nSources);
+static void FreeExtractedImageSources(ExtractedImageSource* sources, u32 nSources);
+static bool32 FindExtractedImageSource(const ExtractedImageSource* sources, u32 nSources, const char* pngPath, u32* sourceIndex, u32* imageIndex);
+static void ImportChangedImages(const ExtractedImageSource* sources, u32 nSources, const ChangedFiles* changedFiles);
+static bool32 ExtractAllImagesWith(u32 options);
+static bool32 CheckTraceEventsPaired(const char* tracePath);
+
 void TestUtilLoadFile(const char* inputPath, const char* outputPath)
 {
 	FILE* outputFile = NULL;
@@ -220,7 +268,7 @@ void TestImageDecompressSingleImage(const char* inputPath, const char* outputPat
 
 	}
 	fwrite(decompressedImage.data, decompressedImage.size, 1, outputFile);
-	free(decompressedImage.data);
+	TrackedFree(decompressedImage.data);
 
 	for (i = 1; i < imageInfo.nImages; ++i)
 	{
@@ -233,110 +281,2115 @@ void TestImageDecompressSingleImage(const char* inputPath, const char* outputPat
 			return;
 		}
 		fwrite(decompressedImage.data, decompressedImage.size, 1, outputFile);
-		free(decompressedImage.data);
+		TrackedFree(decompressedImage.data);
 	}
 }
 
-void TestExtractAllImages(void)
+/* Encodes every image in the standard width list with each encode profile and
+ * logs how long each profile took and how big its output was. */
+void TestPNGEncodeProfiles(const char* outputPath)
 {
-	char outputPath[1024] = { 0 };
+	const PNGEncodeProfile profiles[3] = { PNG_ENCODE_PROFILE_FAST, PNG_ENCODE_PROFILE_DEFAULT, PNG_ENCODE_PROFILE_MAXIMUM };
+	double profileSeconds[3] = { 0 };
+	u64 profileBytes[3] = { 0 };
+	FILE* outputFile = NULL;
+
 	Memory filePathListMemory = { 0 };
 	FilePathList filePathList = { 0 };
-	u32 nImages = 0;
-	u32* imageWidths = NULL;
+	Memory image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	u8* header = NULL;
+	DecodedImage decodedImage = { 0 };
+	Memory encodedImage = { 0 };
+	u64 totalPixelBytes = 0;
+	double startTime = 0.0;
+
 	u32 i = 0;
+	u32 j = 0;
 
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
+	}
 	filePathListMemory = LoadFile(TEST_IMAGE_EXTRACT_ALL_IMAGES_STANDARD_WIDTH_FILE_LIST);
 	if (!filePathListMemory.data)
 	{
 		LOAD_FILE_FAIL_MESSAGE(TEST_IMAGE_EXTRACT_ALL_IMAGES_STANDARD_WIDTH_FILE_LIST);
+		fclose(outputFile);
 		return;
 	}
 	filePathList = InitFilePathList(filePathListMemory);
 
 	while (GetNextFilePath(&filePathList))
 	{
-		printf("%s\n", filePathList.currentPath);
-		GenerateExtractAllImagesOutputPath(filePathList.currentPath, outputPath);
-		ConvertRGOImageToPNGAll(filePathList.currentPath, outputPath, 0);
+		image = LoadFile((const char*)filePathList.currentPath);
+		if (!image.data)
+		{
+			LOAD_FILE_FAIL_MESSAGE(filePathList.currentPath);
+			continue;
+		}
+		if (!ValidateContainer(image, &imageInfo))
+		{
+			printf("Skipping corrupt file %s\n", filePathList.currentPath);
+			free(image.data);
+			continue;
+		}
+		header = GetImageHeader(image, imageInfo, 0);
+		for (i = 0; i < imageInfo.nImages; ++i)
+		{
+			if (i > 0)
+			{
+				header = GetNextImageHeader(header);
+			}
+			if (!DecodeRGOImage(image, imageInfo, header, i, 0, &decodedImage))
+			{
+				continue;
+			}
+			totalPixelBytes += decodedImage.pixels.size;
+			for (j = 0; j < NUM_ELEMENTS(profiles); ++j)
+			{
+				startTime = GetTimeInSeconds();
+				if (EncodePNG(decodedImage.pixels, decodedImage.palette, decodedImage.width, decodedImage.height, profiles[j], &encodedImage))
+				{
+					profileSeconds[j] += GetTimeInSeconds() - startTime;
+					profileBytes[j] += encodedImage.size;
+					TrackedFree(encodedImage.data);
+				}
+			}
+			TrackedFree(decodedImage.pixels.data);
+		}
+		free(image.data);
 	}
 	free(filePathListMemory.data);
 
-	filePathListMemory = LoadFile(TEST_IMAGE_EXTRACT_ALL_IMAGES_NONSTANDARD_WIDTH_FILE_LIST);
-	if (!filePathListMemory.data)
+	fprintf(outputFile, "Decoded pixel data: %llu bytes\n", totalPixelBytes);
+	for (i = 0; i < NUM_ELEMENTS(profiles); ++i)
 	{
-		LOAD_FILE_FAIL_MESSAGE(TEST_IMAGE_EXTRACT_ALL_IMAGES_NONSTANDARD_WIDTH_FILE_LIST);
+		fprintf(outputFile, "Profile %s: %.3fs, %llu bytes\n", GetPNGEncodeProfileName(profiles[i]), profileSeconds[i], profileBytes[i]);
+	}
+	fclose(outputFile);
+}
+
+/* Decodes the first image in the file, writes it in the raw format, loads it back in,
+ * and logs whether it came back exactly the same. */
+void TestRawImageRoundTrip(const char* inputPath, const char* outputPath)
+{
+	char rawOutputPath[1024] = { 0 };
+	char imagePath[1024] = { 0 };
+	char palettePath[1024] = { 0 };
+	FILE* outputFile = NULL;
+	Memory image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	u8* header = NULL;
+	DecodedImage decodedImage = { 0 };
+	RawImage rawImage = { 0 };
+	ExtractSettings settings = { 0 };
+	bool32 matches = FALSE;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
 		return;
 	}
-	filePathList = InitFilePathList(filePathListMemory);
-	filePathList.currentPath = filePathListMemory.data;
-	while (filePathList.memoryPos < filePathListMemory.size)
+	image = LoadFile(inputPath);
+	if (!image.data)
 	{
-		for (; filePathListMemory.data[filePathList.memoryPos] != ' '; ++filePathList.memoryPos);
-		filePathListMemory.data[filePathList.memoryPos] = '\0';
-		++filePathList.memoryPos;
+		LOAD_FILE_FAIL_MESSAGE(inputPath);
+		fclose(outputFile);
+		return;
+	}
+	imageInfo = GetImageInfo(image);
+	header = GetImageHeader(image, imageInfo, 0);
+	if (!DecodeRGOImage(image, imageInfo, header, 0, 0, &decodedImage))
+	{
+		fprintf(outputFile, "Failed to decode %s\n", inputPath);
+		free(image.data);
+		fclose(outputFile);
+		return;
+	}
 
-		sscanf(&filePathListMemory.data[filePathList.memoryPos], "%u", &nImages);
-		imageWidths = malloc(sizeof(u32) * nImages);
-		if (!imageWidths)
+	settings = InitExtractSettings();
+	settings.output.format = OUTPUT_FORMAT_RAW;
+	GenerateExtractAllImagesOutputPath(inputPath, rawOutputPath);
+	ReplaceExtension(rawOutputPath, RAW_IMAGE_EXTENSION, imagePath);
+	ReplaceExtension(rawOutputPath, RAW_PALETTE_EXTENSION, palettePath);
+	if (!WriteDecodedImage(decodedImage, rawOutputPath, settings.output) || !LoadRawImage(imagePath, palettePath, &rawImage))
+	{
+		fprintf(outputFile, "Failed to write and load %s\n", imagePath);
+	}
+	else
+	{
+		matches = rawImage.image.width == decodedImage.width &&
+			rawImage.image.height == decodedImage.height &&
+			rawImage.image.bitsPerPixel == decodedImage.bitsPerPixel &&
+			rawImage.image.pixels.size == decodedImage.pixels.size &&
+			rawImage.image.palette.nColors == decodedImage.palette.nColors &&
+			memcmp(rawImage.image.pixels.data, decodedImage.pixels.data, decodedImage.pixels.size) == 0 &&
+			memcmp(rawImage.image.palette.data, decodedImage.palette.data, decodedImage.palette.nColors * 4) == 0;
+		fprintf(outputFile, "%s: %ux%u, %u bits per pixel. Round trip %s\n", imagePath, rawImage.image.width, rawImage.image.height,
+			rawImage.image.bitsPerPixel, matches ? "matches" : "DOES NOT MATCH");
+		FreeRawImage(&rawImage);
+	}
+
+	TrackedFree(decodedImage.pixels.data);
+	free(image.data);
+	fclose(outputFile);
+}
+
+/* Decodes every image in the file twice and logs whether the loaded file was left
+ * untouched and whether both decodes gave the same palette. */
+void TestPS2PaletteCorrection(const char* inputPath, const char* outputPath)
+{
+	FILE* outputFile = NULL;
+	Memory image = { 0 };
+	Memory imageCopy = { 0 };
+	ImageInfo imageInfo = { 0 };
+	u8* header = NULL;
+	DecodedImage firstDecode = { 0 };
+	DecodedImage secondDecode = { 0 };
+	bool32 palettesMatch = FALSE;
+	u32 i = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
+	}
+	image = LoadFile(inputPath);
+	imageCopy = LoadFile(inputPath);
+	if (!image.data || !imageCopy.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(inputPath);
+		free(image.data);
+		free(imageCopy.data);
+		fclose(outputFile);
+		return;
+	}
+
+	imageInfo = GetImageInfo(image);
+	header = GetImageHeader(image, imageInfo, 0);
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		if (i > 0)
 		{
-			free(filePathListMemory.data);
-			return;
+			header = GetNextImageHeader(header);
 		}
-		for (; filePathListMemory.data[filePathList.memoryPos] != ' '; ++filePathList.memoryPos);
-		++filePathList.memoryPos;
+		if (!DecodeRGOImage(image, imageInfo, header, i, 0, &firstDecode))
+		{
+			fprintf(outputFile, "Image %u: failed to decode\n", i);
+			continue;
+		}
+		if (!DecodeRGOImage(image, imageInfo, header, i, 0, &secondDecode))
+		{
+			fprintf(outputFile, "Image %u: failed to decode a second time\n", i);
+			TrackedFree(firstDecode.pixels.data);
+			continue;
+		}
+		palettesMatch = firstDecode.palette.nColors == secondDecode.palette.nColors &&
+			memcmp(firstDecode.palette.data, secondDecode.palette.data, firstDecode.palette.nColors * 4) == 0;
+		fprintf(outputFile, "Image %u: palettes %s\n", i, palettesMatch ? "match" : "DO NOT MATCH");
+		TrackedFree(firstDecode.pixels.data);
+		TrackedFree(secondDecode.pixels.data);
+	}
+	fprintf(outputFile, "Loaded file %s\n", memcmp(image.data, imageCopy.data, image.size) == 0 ? "is unchanged" : "WAS MODIFIED");
 
-		for (i = 0; i < nImages; ++i)
+	free(image.data);
+	free(imageCopy.data);
+	fclose(outputFile);
+}
+
+/* Runs every palette kernel the CPU supports on random indices and palettes, at every length up to
+ * TEST_PALETTE_KERNELS_MAX_BYTES and from unaligned starts, and checks each against the scalar kernel.
+ * The output buffers are checked for writes past the end too. Returns FALSE if any kernel disagrees. */
+bool32 TestPaletteKernels(const char* outputPath)
+{
+	FILE* outputFile = NULL;
+	PaletteKernels kernels[PALETTE_MAX_KERNEL_SETS] = { { 0 } };
+	u8* indices = NULL;
+	u32* palette = NULL;
+	u32* expected = NULL;
+	u32* actual = NULL;
+	u32 nKernels = 0;
+	u32 nMismatches = 0;
+	u32 nFailedKernels = 0;
+	u32 nOutputColors = 0;
+	u32 nBytes = 0;
+	u32 offset = 0;
+	u32 random = 1;
+	u32 nColors = 0;
+	u32 bits = 0;
+	u32 i = 0;
+	u32 k = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return FALSE;
+	}
+	/* Outputs get one spare color at the end to catch overruns */
+	indices = malloc(TEST_PALETTE_KERNELS_MAX_BYTES + 4);
+	palette = malloc(256 * sizeof(u32));
+	expected = malloc((TEST_PALETTE_KERNELS_MAX_BYTES * 2 + 1) * sizeof(u32));
+	actual = malloc((TEST_PALETTE_KERNELS_MAX_BYTES * 2 + 1) * sizeof(u32));
+	if (!indices || !palette || !expected || !actual)
+	{
+		free(indices);
+		free(palette);
+		free(expected);
+		free(actual);
+		fclose(outputFile);
+		return FALSE;
+	}
+	for (i = 0; i < TEST_PALETTE_KERNELS_MAX_BYTES + 4; ++i)
+	{
+		random = random * 1103515245 + 12345;
+		indices[i] = (u8)(random >> 16);
+	}
+	for (i = 0; i < 256; ++i)
+	{
+		random = random * 1103515245 + 12345;
+		palette[i] = random ^ (random << 13);
+	}
+
+	nKernels = GetPaletteKernels(kernels);
+	for (k = 1; k < nKernels; ++k)
+	{
+		nMismatches = 0;
+		for (bits = 4; bits <= 8; bits += 4)
 		{
-			sscanf(&filePathListMemory.data[filePathList.memoryPos], "%u", &imageWidths[i]);
-			if (i < nImages - 1)
+			if ((bits == 4 && !kernels[k].expand4) || (bits == 8 && !kernels[k].expand8))
 			{
-				for (; filePathListMemory.data[filePathList.memoryPos] != ' '; ++filePathList.memoryPos);
-				++filePathList.memoryPos;
+				continue;
+			}
+			for (nBytes = 0; nBytes <= TEST_PALETTE_KERNELS_MAX_BYTES; ++nBytes)
+			{
+				offset = nBytes % 4;
+				nOutputColors = bits == 4 ? nBytes * 2 : nBytes;
+				memset(expected, 0xCD, (nOutputColors + 1) * sizeof(u32));
+				memset(actual, 0xCD, (nOutputColors + 1) * sizeof(u32));
+				if (bits == 4)
+				{
+					kernels[0].expand4(&indices[offset], nBytes, palette, expected);
+					kernels[k].expand4(&indices[offset], nBytes, palette, actual);
+				}
+				else
+				{
+					kernels[0].expand8(&indices[offset], nBytes, palette, expected);
+					kernels[k].expand8(&indices[offset], nBytes, palette, actual);
+				}
+				if (memcmp(expected, actual, (nOutputColors + 1) * sizeof(u32)) != 0)
+				{
+					fprintf(outputFile, "%s: %u-bit expansion of %u bytes DOES NOT MATCH\n", kernels[k].name, bits, nBytes);
+					++nMismatches;
+				}
+			}
+		}
+		if (kernels[k].correctPS2)
+		{
+			for (nColors = 16; nColors <= 256; nColors += 240)
+			{
+				memset(expected, 0xCD, (nColors + 1) * sizeof(u32));
+				memset(actual, 0xCD, (nColors + 1) * sizeof(u32));
+				kernels[0].correctPS2(palette, nColors, expected);
+				kernels[k].correctPS2(palette, nColors, actual);
+				if (memcmp(expected, actual, (nColors + 1) * sizeof(u32)) != 0)
+				{
+					fprintf(outputFile, "%s: PS2 correction of %u colors DOES NOT MATCH\n", kernels[k].name, nColors);
+					++nMismatches;
+				}
 			}
 		}
+		fprintf(outputFile, "%s: %s\n", kernels[k].name, nMismatches == 0 ? "matches scalar" : "FAILED");
+		nFailedKernels += nMismatches != 0;
+	}
 
-		printf("%s\n", filePathList.currentPath);
-		GenerateExtractAllImagesOutputPath(filePathList.currentPath, outputPath);
-		ConvertRGOImageToPNGAll(filePathList.currentPath, outputPath, imageWidths);
-		free(imageWidths);
+	free(indices);
+	free(palette);
+	free(expected);
+	free(actual);
+	fclose(outputFile);
+	return nFailedKernels == 0;
+}
 
-		for (; filePathListMemory.data[filePathList.memoryPos] != '\n'; ++filePathList.memoryPos);
-		++filePathList.memoryPos;
-		filePathList.currentPath = &filePathListMemory.data[filePathList.memoryPos];
+/* Encodes the same random indices as a PNG for each platform and bit depth, PSP indices straight from
+ * their tiles, and checks that each comes out byte for byte the same as untiling, expanding and
+ * encoding them the generic way. */
+bool32 TestRGBAConverters(const char* outputPath)
+{
+	static const Platform platforms[] = { PLATFORM_PS2, PLATFORM_PSP };
+	static const char* platformNames[] = { "PS2", "PSP" };
+	FILE* outputFile = NULL;
+	Memory indices = { 0 };
+	Memory linearIndices = { 0 };
+	Palette palette = { 0 };
+	u32* rgba = NULL;
+	DecodedImage decodedImage = { 0 };
+	Memory expected = { 0 };
+	Memory actual = { 0 };
+	u32 nMismatches = 0;
+	u32 random = 1;
+	u32 bits = 0;
+	u32 i = 0;
+	u32 p = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return FALSE;
 	}
-	free(filePathListMemory.data);
+	indices.size = TEST_RGBA_CONVERTERS_ROW_SIZE * TEST_RGBA_CONVERTERS_HEIGHT;
+	indices.data = malloc(indices.size);
+	palette.data = malloc(256 * sizeof(u32));
+	rgba = malloc(indices.size * 2 * sizeof(u32));
+	if (!indices.data || !palette.data || !rgba)
+	{
+		free(indices.data);
+		free(palette.data);
+		free(rgba);
+		fclose(outputFile);
+		return FALSE;
+	}
+	for (i = 0; i < indices.size; ++i)
+	{
+		random = random * 1103515245 + 12345;
+		indices.data[i] = (u8)(random >> 16);
+	}
+	for (i = 0; i < 256; ++i)
+	{
+		random = random * 1103515245 + 12345;
+		((u32*)palette.data)[i] = random ^ (random << 13);
+	}
+
+	for (p = 0; p < NUM_ELEMENTS(platforms); ++p)
+	{
+		/* On PSP the random indices are taken to be in tiles */
+		linearIndices = platforms[p] == PLATFORM_PSP ? TiledToLinear(indices) : indices;
+		if (!linearIndices.data)
+		{
+			fprintf(outputFile, "%s: Could not untile the indices\n", platformNames[p]);
+			++nMismatches;
+			continue;
+		}
+		for (bits = 4; bits <= 8; bits += 4)
+		{
+			palette.nColors = bits == 4 ? 16 : 256;
+			decodedImage.pixels = indices;
+			decodedImage.palette = palette;
+			decodedImage.sourcePalette = palette;
+			decodedImage.platform = platforms[p];
+			decodedImage.width = TEST_RGBA_CONVERTERS_ROW_SIZE * (bits == 4 ? 2 : 1);
+			decodedImage.height = TEST_RGBA_CONVERTERS_HEIGHT;
+			decodedImage.bitsPerPixel = bits;
+			decodedImage.isTiled = platforms[p] == PLATFORM_PSP;
+
+			ExpandPaletteIndices(linearIndices.data, linearIndices.size, palette, rgba);
+			if (!EncodeRGBAImagePNG(rgba, decodedImage.width, decodedImage.height, PNG_ENCODE_PROFILE_FAST, &expected) ||
+				!EncodeDecodedImagePNG(decodedImage, PNG_ENCODE_PROFILE_FAST, &actual))
+			{
+				fprintf(outputFile, "%s %u-bit: Could not encode\n", platformNames[p], bits);
+				++nMismatches;
+			}
+			else if (expected.size != actual.size || memcmp(expected.data, actual.data, expected.size) != 0)
+			{
+				fprintf(outputFile, "%s %u-bit: DOES NOT MATCH\n", platformNames[p], bits);
+				++nMismatches;
+			}
+			else
+			{
+				fprintf(outputFile, "%s %u-bit: Matches\n", platformNames[p], bits);
+			}
+			TrackedFree(expected.data);
+			TrackedFree(actual.data);
+			expected.data = NULL;
+			actual.data = NULL;
+		}
+		if (linearIndices.data != indices.data)
+		{
+			TrackedFree(linearIndices.data);
+		}
+	}
+
+	free(indices.data);
+	free(palette.data);
+	free(rgba);
+	fclose(outputFile);
+	return nMismatches == 0;
 }
 
-void GenerateExtractAllImagesOutputPath(const char* inputPath, char* outputPath)
+/* Decodes a few regions of the first image in the file both on their own and by cropping
+ * the full decode, and logs whether they match and how long each took. */
+void TestImageDecodeRegion(const char* inputPath, const char* outputPath)
 {
-	const char* fileNameStart = 0;
-	size_t fileNameLength = 0;
-	char* foundChr = NULL;
-	char filename[1024] = { 0 };
+	FILE* outputFile = NULL;
+	Memory image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	u8* header = NULL;
+	DecodedImage fullImage = { 0 };
+	DecodedImage croppedImage = { 0 };
+	DecodedImage regionImage = { 0 };
+	ImageRegion regions[4] = { { 0 } };
+	double startTime = 0;
+	double fullSeconds = 0;
+	double regionSeconds = 0;
+	bool32 matches = FALSE;
+	u32 i = 0;
 
-	foundChr = strchr(inputPath, '/');
-	if (!foundChr)
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
 	{
-		fileNameStart = inputPath;
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
 	}
-	else
+	image = LoadFile(inputPath);
+	if (!image.data)
 	{
-		fileNameStart = foundChr + 1;
+		LOAD_FILE_FAIL_MESSAGE(inputPath);
+		fclose(outputFile);
+		return;
 	}
-	foundChr = strrchr(inputPath, '.');
-	if (!foundChr)
+	imageInfo = GetImageInfo(image);
+	header = GetImageHeader(image, imageInfo, 0);
+	startTime = GetTimeInSeconds();
+	if (!DecodeRGOImage(image, imageInfo, header, 0, 0, &fullImage))
 	{
-		fileNameLength = strlen(fileNameStart);
+		fprintf(outputFile, "Failed to decode %s\n", inputPath);
+		free(image.data);
+		fclose(outputFile);
+		return;
 	}
-	else
+	fullSeconds = GetTimeInSeconds() - startTime;
+	fprintf(outputFile, "Full image: %ux%u in %.6fs\n", fullImage.width, fullImage.height, fullSeconds);
+
+	/* A corner, a sprite sized area in the middle, the last row and a single pixel at an odd position */
+	regions[0].width = fullImage.width / 4;
+	regions[0].height = fullImage.height / 4;
+	regions[1].x = fullImage.width / 3;
+	regions[1].y = fullImage.height / 2;
+	regions[1].width = fullImage.width / 8;
+	regions[1].height = fullImage.height / 8;
+	regions[2].y = fullImage.height - 1;
+	regions[2].width = fullImage.width;
+	regions[2].height = 1;
+	regions[3].x = fullImage.width / 2 + 1;
+	regions[3].y = fullImage.height / 2 + 1;
+	regions[3].width = 1;
+	regions[3].height = 1;
+	for (i = 0; i < NUM_ELEMENTS(regions); ++i)
 	{
-		fileNameLength = foundChr - fileNameStart;
+		startTime = GetTimeInSeconds();
+		if (!DecodeRGOImageRegion(image, imageInfo, header, 0, 0, regions[i], &regionImage))
+		{
+			fprintf(outputFile, "Region %u: failed to decode\n", i);
+			continue;
+		}
+		regionSeconds = GetTimeInSeconds() - startTime;
+		if (!CropDecodedImage(fullImage, regions[i], &croppedImage))
+		{
+			fprintf(outputFile, "Region %u: failed to crop\n", i);
+			TrackedFree(regionImage.pixels.data);
+			continue;
+		}
+		matches = regionImage.width == croppedImage.width &&
+			regionImage.height == croppedImage.height &&
+			regionImage.pixels.size == croppedImage.pixels.size &&
+			memcmp(regionImage.pixels.data, croppedImage.pixels.data, croppedImage.pixels.size) == 0;
+		fprintf(outputFile, "Region %u: %u,%u %ux%u in %.6fs. %s\n", i, regions[i].x, regions[i].y, regions[i].width, regions[i].height,
+			regionSeconds, matches ? "Matches" : "DOES NOT MATCH");
+		TrackedFree(regionImage.pixels.data);
+		TrackedFree(croppedImage.pixels.data);
 	}
-	memcpy(filename, fileNameStart, fileNameLength);
-	filename[fileNameLength] = '\0';
-	strcat(filename, ".png");
 
-	sprintf(outputPath, TEST_IMAGE_EXTRACTED_IMAGES_FOLDER);
-	strcat(outputPath, filename);
+	TrackedFree(fullImage.pixels.data);
+	free(image.data);
+	fclose(outputFile);
+}
+
+/* Replaces the first image of a container with itself, re-encoded, and checks that every image
+ * still decodes the same and that nothing outside the reported range changed. Then does it again
+ * with an image too big to fit. */
+void TestRepackImage(const char* inputPath, const char* outputPath)
+{
+	FILE* outputFile = NULL;
+	Memory original = { 0 };
+	Memory repacked = { 0 };
+	Memory newBlock = { 0 };
+	Memory originalPixels = { 0 };
+	Memory repackedPixels = { 0 };
+	ImageInfo originalInfo = { 0 };
+	ImageInfo repackedInfo = { 0 };
+	RepackResult result = { 0 };
+	Platform platform = PLATFORM_PS2;
+	u8* header = NULL;
+	u32 unchangedAfter = 0;
+	bool32 matches = FALSE;
+	u32 i = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
+	}
+	original = LoadFile(inputPath);
+	if (!original.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(inputPath);
+		fclose(outputFile);
+		return;
+	}
+	repacked.data = malloc(original.size);
+	if (!repacked.data)
+	{
+		free(original.data);
+		fclose(outputFile);
+		return;
+	}
+	memcpy(repacked.data, original.data, original.size);
+	repacked.size = original.size;
+
+	originalInfo = GetImageInfo(original);
+	header = GetImageHeader(original, originalInfo, 0);
+	platform = GetImagePlatform(header);
+	originalPixels = DecodeImagePixels(header, platform, NULL);
+	newBlock = EncodeReplacementImage(header, platform, originalPixels);
+	TrackedFree(originalPixels.data);
+	if (!newBlock.data || !RepackImage(&repacked, 0, newBlock, &result))
+	{
+		fprintf(outputFile, "Failed to repack %s\n", inputPath);
+		free(newBlock.data);
+		free(repacked.data);
+		free(original.data);
+		fclose(outputFile);
+		return;
+	}
+	fprintf(outputFile, "Image data was %u bytes, replacement is %u bytes\n", GetImageDataSize(header), newBlock.size);
+	fprintf(outputFile, "Changed %u bytes at 0x%X. Later images moved by %u bytes\n", result.changedSize, result.changedOffset, result.shiftAmount);
+	free(newBlock.data);
+
+	/* Everything before the changed range must be untouched, and so must everything after it, wherever it ended up */
+	unchangedAfter = original.size - (result.changedOffset + result.changedSize - result.shiftAmount);
+	matches = memcmp(original.data, repacked.data, result.changedOffset) == 0 &&
+		memcmp(&original.data[original.size - unchangedAfter], &repacked.data[repacked.size - unchangedAfter], unchangedAfter) == 0;
+	fprintf(outputFile, "Bytes outside the changed range: %s\n", matches ? "Unchanged" : "CHANGED");
+
+	repackedInfo = GetImageInfo(repacked);
+	for (i = 0; i < originalInfo.nImages; ++i)
+	{
+		originalPixels = DecodeImagePixels(GetImageHeader(original, originalInfo, i), platform, NULL);
+		repackedPixels = DecodeImagePixels(GetImageHeader(repacked, repackedInfo, i), platform, NULL);
+		matches = originalPixels.size == repackedPixels.size &&
+			memcmp(originalPixels.data, repackedPixels.data, originalPixels.size) == 0;
+		fprintf(outputFile, "Image %u: %s\n", i, matches ? "Matches" : "DOES NOT MATCH");
+		TrackedFree(originalPixels.data);
+		TrackedFree(repackedPixels.data);
+	}
+	TestRepackImageEnlarged(original, originalInfo, outputFile);
+
+	free(repacked.data);
+	free(original.data);
+	fclose(outputFile);
+}
+
+/* Replaces the first image with noise, which compresses far worse than any real image, so the images
+ * after it have to move. Every later image must still decode the same from where it ended up. */
+static void TestRepackImageEnlarged(Memory original, ImageInfo originalInfo, FILE* outputFile)
+{
+	Memory repacked = { 0 };
+	Memory noise = { 0 };
+	Memory newBlock = { 0 };
+	Memory originalPixels = { 0 };
+	Memory repackedPixels = { 0 };
+	ImageInfo repackedInfo = { 0 };
+	RepackResult result = { 0 };
+	Platform platform = PLATFORM_PS2;
+	u8* header = NULL;
+	u32 random = 1;
+	bool32 matches = FALSE;
+	u32 i = 0;
+
+	header = GetImageHeader(original, originalInfo, 0);
+	platform = GetImagePlatform(header);
+	noise.size = GetDecompressedImageSize(header);
+	noise.data = malloc(noise.size);
+	repacked.data = malloc(original.size);
+	if (!noise.data || !repacked.data)
+	{
+		goto cleanup;
+	}
+	for (i = 0; i < noise.size; ++i)
+	{
+		random = random * 1103515245 + 12345;
+		noise.data[i] = (u8)(random >> 16);
+	}
+	memcpy(repacked.data, original.data, original.size);
+	repacked.size = original.size;
+
+	newBlock = EncodeReplacementImage(header, platform, noise);
+	if (!newBlock.data || !RepackImage(&repacked, 0, newBlock, &result))
+	{
+		fprintf(outputFile, "Failed to repack the enlarged image\n");
+		goto cleanup;
+	}
+	fprintf(outputFile, "Enlarged replacement is %u bytes. Later images moved by %u bytes\n", newBlock.size, result.shiftAmount);
+	if (!ValidateContainer(repacked, &repackedInfo) || repackedInfo.nImages != originalInfo.nImages)
+	{
+		fprintf(outputFile, "Enlarged container DOES NOT VALIDATE\n");
+		goto cleanup;
+	}
+
+	repackedPixels = DecodeImagePixels(GetImageHeader(repacked, repackedInfo, 0), platform, NULL);
+	matches = repackedPixels.size == noise.size && memcmp(repackedPixels.data, noise.data, noise.size) == 0;
+	fprintf(outputFile, "Enlarged image 0: %s\n", matches ? "Matches" : "DOES NOT MATCH");
+	TrackedFree(repackedPixels.data);
+	for (i = 1; i < originalInfo.nImages; ++i)
+	{
+		originalPixels = DecodeImagePixels(GetImageHeader(original, originalInfo, i), platform, NULL);
+		repackedPixels = DecodeImagePixels(GetImageHeader(repacked, repackedInfo, i), platform, NULL);
+		matches = originalPixels.size == repackedPixels.size &&
+			memcmp(originalPixels.data, repackedPixels.data, originalPixels.size) == 0;
+		fprintf(outputFile, "After enlarging, image %u: %s\n", i, matches ? "Matches" : "DOES NOT MATCH");
+		TrackedFree(originalPixels.data);
+		TrackedFree(repackedPixels.data);
+	}
+
+cleanup:
+	free(newBlock.data);
+	free(noise.data);
+	free(repacked.data);
+}
+
+/* Checks that the container passes validation, then truncates it at every kilobyte and corrupts
+ * its bytes one at a time. Whatever still passes is decoded in full, which must not crash. */
+void TestValidateContainer(const char* inputPath, const char* outputPath)
+{
+	FILE* outputFile = NULL;
+	Memory original = { 0 };
+	Memory damaged = { 0 };
+	ImageInfo imageInfo = { 0 };
+	u32 nTried = 0;
+	u32 nAccepted = 0;
+	u32 nDecoded = 0;
+	double startTime = 0.0;
+	u32 i = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
+	}
+	original = LoadFile(inputPath);
+	damaged.data = malloc(original.size);
+	if (!original.data || !damaged.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(inputPath);
+		free(original.data);
+		free(damaged.data);
+		fclose(outputFile);
+		return;
+	}
+
+	startTime = GetTimeInSeconds();
+	if (!ValidateContainer(original, &imageInfo))
+	{
+		fprintf(outputFile, "%s: failed validation\n", inputPath);
+	}
+	else
+	{
+		fprintf(outputFile, "%s: valid, %u images, validated in %.3fms\n", inputPath, imageInfo.nImages, (GetTimeInSeconds() - startTime) * 1000.0);
+	}
+
+	/* Decoding reads straight from the buffer, so truncated copies are made at the exact size
+	 * and any read past the end is caught by tools like AddressSanitizer */
+	for (damaged.size = 0; damaged.size < original.size; damaged.size += 1024)
+	{
+		memcpy(damaged.data, original.data, damaged.size);
+		++nTried;
+		if (ValidateContainer(damaged, &imageInfo))
+		{
+			++nAccepted;
+			nDecoded += DecodeValidatedContainer(damaged, imageInfo);
+		}
+	}
+	fprintf(outputFile, "Truncated: %u accepted of %u, %u images decoded\n", nAccepted, nTried, nDecoded);
+
+	nTried = 0;
+	nAccepted = 0;
+	nDecoded = 0;
+	damaged.size = original.size;
+	memcpy(damaged.data, original.data, original.size);
+	for (i = 0; i < original.size; i += TEST_IMAGE_VALIDATE_CONTAINER_CORRUPTION_STEP)
+	{
+		damaged.data[i] ^= 0xFF;
+		++nTried;
+		if (ValidateContainer(damaged, &imageInfo))
+		{
+			++nAccepted;
+			nDecoded += DecodeValidatedContainer(damaged, imageInfo);
+		}
+		damaged.data[i] = original.data[i];
+	}
+	fprintf(outputFile, "Corrupted: %u accepted of %u, %u images decoded\n", nAccepted, nTried, nDecoded);
+
+	free(original.data);
+	free(damaged.data);
+	fclose(outputFile);
+}
+
+/* Returns the number of images that decoded */
+static u32 DecodeValidatedContainer(Memory container, ImageInfo imageInfo)
+{
+	DecodedImage decodedImage = { 0 };
+	u8* header = NULL;
+	u32 nDecoded = 0;
+	u32 i = 0;
+
+	header = imageInfo.firstHeader;
+	for (i = 0; i < imageInfo.nImages; ++i)
+	{
+		if (i > 0)
+		{
+			header = GetNextImageHeader(header);
+		}
+		if (DecodeRGOImage(container, imageInfo, header, i, 0, &decodedImage))
+		{
+			TrackedFree(decodedImage.pixels.data);
+			++nDecoded;
+		}
+	}
+	return nDecoded;
+}
+
+/* Recompresses every PS2 subfile and lists any that don't come out as the game has them. */
+void TestPS2Recompression(const char* outputPath)
+{
+	PrintPS2RecompressionStats(VerifyPS2Recompression(PS2_IMAGES_FILE_LIST, GetNumProcessors(), outputPath));
+}
+
+static void RunImageServerThread(void* arg)
+{
+	RunImageServer(arg);
+}
+
+/* Starts a server, asks it for one image in each format twice, once to fill the cache and once to hit it,
+ * and checks the palette indices against decoding the image directly. Then rewrites the file with a changed
+ * palette and checks that the server notices and stops serving what it had cached. */
+void TestImageServer(const char* inputPath, const char* outputPath)
+{
+	FILE* outputFile = NULL;
+	ImageServer* server = NULL;
+	ImageServerStats stats = { 0 };
+	Thread serverThread = { 0 };
+	Memory image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	DecodedImage decodedImage = { 0 };
+	DecodedImage rewrittenImage = { 0 };
+	ServerImage serverImage = { 0 };
+	double startTime = 0.0;
+	double coldSeconds = 0.0;
+	double warmSeconds = 0.0;
+	bool32 matches = FALSE;
+	u32 format = 0;
+	u32 i = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
+	}
+	image = LoadFile(inputPath);
+	if (!image.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(inputPath);
+		fclose(outputFile);
+		return;
+	}
+	imageInfo = GetImageInfo(image);
+	if (!WriteMemoryToFile(image, TEST_IMAGE_SERVER_COPY) ||
+		!DecodeRGOImage(image, imageInfo, GetImageHeader(image, imageInfo, 0), 0, 0, &decodedImage))
+	{
+		fprintf(outputFile, "Failed to decode %s\n", inputPath);
+		free(image.data);
+		fclose(outputFile);
+		return;
+	}
+	server = CreateImageServer(TEST_IMAGE_SERVER_SOCKET, IMAGE_SERVER_DEFAULT_CACHE_BUDGET, 2);
+	if (!server || !StartThread(&serverThread, RunImageServerThread, server))
+	{
+		fprintf(outputFile, "Failed to start the server\n");
+		if (server)
+		{
+			DestroyImageServer(server);
+		}
+		TrackedFree(decodedImage.pixels.data);
+		free(image.data);
+		fclose(outputFile);
+		return;
+	}
+
+	for (format = 0; format < SERVER_IMAGE_NUM_FORMATS; ++format)
+	{
+		startTime = GetTimeInSeconds();
+		if (!RequestServerImage(TEST_IMAGE_SERVER_SOCKET, TEST_IMAGE_SERVER_COPY, 0, 0, format, &serverImage))
+		{
+			fprintf(outputFile, "Format %u: request failed\n", format);
+			continue;
+		}
+		coldSeconds = GetTimeInSeconds() - startTime;
+		free(serverImage.data.data);
+
+		startTime = GetTimeInSeconds();
+		for (i = 0; i < TEST_IMAGE_SERVER_WARM_REQUESTS; ++i)
+		{
+			if (!RequestServerImage(TEST_IMAGE_SERVER_SOCKET, TEST_IMAGE_SERVER_COPY, 0, 0, format, &serverImage))
+			{
+				break;
+			}
+			if (i + 1 < TEST_IMAGE_SERVER_WARM_REQUESTS)
+			{
+				free(serverImage.data.data);
+			}
+		}
+		warmSeconds = (GetTimeInSeconds() - startTime) / TEST_IMAGE_SERVER_WARM_REQUESTS;
+		if (i < TEST_IMAGE_SERVER_WARM_REQUESTS)
+		{
+			fprintf(outputFile, "Format %u: warm request failed\n", format);
+			continue;
+		}
+
+		if (format == SERVER_IMAGE_INDICES)
+		{
+			matches = serverImage.data.size >= decodedImage.pixels.size &&
+				memcmp(serverImage.data.data, decodedImage.pixels.data, decodedImage.pixels.size) == 0;
+		}
+		else if (format == SERVER_IMAGE_RGBA)
+		{
+			matches = serverImage.data.size == serverImage.width * serverImage.height * 4;
+		}
+		else
+		{
+			matches = serverImage.data.size > 8 && memcmp(serverImage.data.data, "\x89PNG", 4) == 0;
+		}
+		fprintf(outputFile, "Format %u: %ux%u, %u bytes. Cold %.6fs, warm %.6fs. %s\n", format, serverImage.width, serverImage.height,
+			serverImage.data.size, coldSeconds, warmSeconds, matches ? "Matches" : "DOES NOT MATCH");
+		free(serverImage.data.data);
+	}
+
+	/* An image that isn't there should be refused, not crash the server */
+	if (RequestServerImage(TEST_IMAGE_SERVER_SOCKET, TEST_IMAGE_SERVER_COPY, imageInfo.nImages, 0, SERVER_IMAGE_INDICES, &serverImage))
+	{
+		fprintf(outputFile, "Out of range image was NOT REFUSED\n");
+		free(serverImage.data.data);
+	}
+
+	/* The palettes point into the loaded file, so change the first color there and write it back out */
+	imageInfo.palettes[0].data[0] ^= 0xFF;
+	if (!WriteMemoryToFile(image, TEST_IMAGE_SERVER_COPY) ||
+		!DecodeRGOImage(image, imageInfo, GetImageHeader(image, imageInfo, 0), 0, 0, &rewrittenImage))
+	{
+		fprintf(outputFile, "Failed to rewrite %s\n", TEST_IMAGE_SERVER_COPY);
+	}
+	else if (!RequestServerImage(TEST_IMAGE_SERVER_SOCKET, TEST_IMAGE_SERVER_COPY, 0, 0, SERVER_IMAGE_INDICES, &serverImage))
+	{
+		fprintf(outputFile, "Request after rewriting failed\n");
+	}
+	else
+	{
+		matches = serverImage.data.size == rewrittenImage.pixels.size + rewrittenImage.palette.nColors * 4 &&
+			memcmp(&serverImage.data.data[rewrittenImage.pixels.size], rewrittenImage.palette.data, rewrittenImage.palette.nColors * 4) == 0;
+		fprintf(outputFile, "After rewriting: %s\n", matches ? "Matches" : "STILL SERVES THE OLD FILE");
+		free(serverImage.data.data);
+	}
+	TrackedFree(rewrittenImage.pixels.data);
+
+	StopImageServer(TEST_IMAGE_SERVER_SOCKET);
+	JoinThread(serverThread);
+	stats = DestroyImageServer(server);
+	fprintf(outputFile, "Requests: %u, from cache: %u, files loaded: %u, decodes: %u, evictions: %u, dropped as stale: %u\n",
+		stats.nRequests, stats.nCacheHits, stats.nFileLoads, stats.nDecodes, stats.nEvictions, stats.nStaleEntries);
+	TrackedFree(decodedImage.pixels.data);
+	free(image.data);
+	fclose(outputFile);
+}
+
+/* Extracts the first image of a copy of a container as a PNG, recolors a block of it with another palette
+ * color, imports it back and checks that the container now decodes to the edited image. */
+void TestImportPNGImage(const char* inputPath, const char* outputPath)
+{
+	FILE* outputFile = NULL;
+	Memory container = { 0 };
+	ImageInfo imageInfo = { 0 };
+	DecodedImage original = { 0 };
+	DecodedImage imported = { 0 };
+	ImportResult result = { 0 };
+	u32* rgba = NULL;
+	u32 width = 0;
+	u32 height = 0;
+	u32 newColor = 0;
+	u32 index = 0;
+	u32 color = 0;
+	u32 nWrong = 0;
+	u32 x = 0;
+	u32 y = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
+	}
+	container = LoadFile(inputPath);
+	if (!container.data || !WriteMemoryToFile(container, TEST_IMAGE_IMPORT_PNG_CONTAINER))
+	{
+		fprintf(outputFile, "Failed to copy %s\n", inputPath);
+		free(container.data);
+		fclose(outputFile);
+		return;
+	}
+	imageInfo = GetImageInfo(container);
+	if (!DecodeRGOImage(container, imageInfo, GetImageHeader(container, imageInfo, 0), 0, 0, &original) ||
+		!WriteDecodedImage(original, TEST_IMAGE_IMPORT_PNG_IMAGE, InitExtractSettings().output) ||
+		!LoadPNG(TEST_IMAGE_IMPORT_PNG_IMAGE, &rgba, &width, &height))
+	{
+		fprintf(outputFile, "Failed to extract %s\n", inputPath);
+		TrackedFree(original.pixels.data);
+		free(container.data);
+		fclose(outputFile);
+		return;
+	}
+
+	/* Paint the top left quarter with the last palette color */
+	newColor = ((const u32*)original.palette.data)[original.palette.nColors - 1];
+	for (y = 0; y < height / 2; ++y)
+	{
+		for (x = 0; x < width / 2; ++x)
+		{
+			rgba[y * width + x] = newColor;
+		}
+	}
+	EncodeRGBAImagePNG(rgba, width, height, PNG_ENCODE_PROFILE_FAST, &container);
+	WriteMemoryToFile(container, TEST_IMAGE_IMPORT_PNG_IMAGE);
+	TrackedFree(container.data);
+	container.data = NULL;
+
+	if (!ImportPNGImage(TEST_IMAGE_IMPORT_PNG_CONTAINER, 0, 0, TEST_IMAGE_IMPORT_PNG_IMAGE, &result))
+	{
+		fprintf(outputFile, "Failed to import %s\n", TEST_IMAGE_IMPORT_PNG_IMAGE);
+	}
+	else
+	{
+		fprintf(outputFile, "%u pixels changed, %u not in the palette. Wrote %u bytes at 0x%X, moved later images by %u bytes\n",
+			result.nChangedPixels, result.nApproximatedPixels, result.repack.changedSize, result.repack.changedOffset, result.repack.shiftAmount);
+	}
+
+	container = LoadFile(TEST_IMAGE_IMPORT_PNG_CONTAINER);
+	imageInfo = GetImageInfo(container);
+	if (!container.data || !DecodeRGOImage(container, imageInfo, GetImageHeader(container, imageInfo, 0), 0, 0, &imported))
+	{
+		fprintf(outputFile, "Failed to decode the imported image\n");
+	}
+	else
+	{
+		/* Compare by color, as a palette may have the new color at more than one index */
+		for (y = 0; y < height; ++y)
+		{
+			for (x = 0; x < width; ++x)
+			{
+				index = imported.bitsPerPixel == 4 ? (imported.pixels.data[(y * width + x) / 2] >> ((x % 2) * 4)) & 0xF :
+					imported.pixels.data[y * width + x];
+				color = ((const u32*)imported.palette.data)[index];
+				if (color != rgba[y * width + x])
+				{
+					++nWrong;
+				}
+			}
+		}
+		fprintf(outputFile, "Imported image: %s\n", nWrong == 0 ? "Matches" : "DOES NOT MATCH");
+		TrackedFree(imported.pixels.data);
+	}
+
+	free(rgba);
+	TrackedFree(original.pixels.data);
+	free(container.data);
+	fclose(outputFile);
+}
+
+/* Gets the next entry of either width file list. Non-standard width entries are the path, the number
+ * of images, then each image's width, 0 meaning the default. Standard width entries are just the path,
+ * so every width is 0. */
+static bool32 GetNextWidthListEntry(FilePathList* filePathList, u32* customWidths)
+{
+	char* listEntry = NULL;
+	u32 nImages = 0;
+	u32 i = 0;
+
+	if (!GetNextFilePath(filePathList))
+	{
+		return FALSE;
+	}
+	memset(customWidths, 0, sizeof(u32) * MAX_IMAGES_PER_FILE);
+	listEntry = strchr((const char*)filePathList->currentPath, ' ');
+	if (listEntry)
+	{
+		*listEntry = '\0';
+		nImages = strtoul(listEntry + 1, &listEntry, 10);
+		for (i = 0; i < nImages && i < MAX_IMAGES_PER_FILE; ++i)
+		{
+			customWidths[i] = strtoul(listEntry, &listEntry, 10);
+		}
+	}
+	return TRUE;
+}
+
+/* Detects the width of every image in the standard and non-standard width file lists
+ * and logs whether it agrees with the width the lists give. Returns FALSE if any image
+ * couldn't be checked or disagrees. */
+bool32 TestDetectImageWidths(const char* outputPath)
+{
+	const char* fileLists[2] = { TEST_IMAGE_EXTRACT_ALL_IMAGES_STANDARD_WIDTH_FILE_LIST, TEST_IMAGE_EXTRACT_ALL_IMAGES_NONSTANDARD_WIDTH_FILE_LIST };
+	FILE* outputFile = NULL;
+	Memory filePathListMemory = { 0 };
+	FilePathList filePathList = { 0 };
+	Memory image = { 0 };
+	ImageInfo imageInfo = { 0 };
+	u8* header = NULL;
+	DecodedImage decodedImage = { 0 };
+	u32 customWidths[MAX_IMAGES_PER_FILE] = { 0 };
+	u32 listedWidth = 0;
+	u32 detectedWidth = 0;
+	u32 nImages = 0;
+	u32 nAgreed = 0;
+	u32 nFailed = 0;
+	double startTime = 0.0;
+	double detectSeconds = 0.0;
+	u32 i = 0;
+	u32 j = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return FALSE;
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(fileLists); ++i)
+	{
+		filePathListMemory = LoadFile(fileLists[i]);
+		if (!filePathListMemory.data)
+		{
+			LOAD_FILE_FAIL_MESSAGE(fileLists[i]);
+			++nFailed;
+			continue;
+		}
+		filePathList = InitFilePathList(filePathListMemory);
+		while (GetNextWidthListEntry(&filePathList, customWidths))
+		{
+			image = LoadFile((const char*)filePathList.currentPath);
+			if (!image.data)
+			{
+				LOAD_FILE_FAIL_MESSAGE(filePathList.currentPath);
+				++nFailed;
+				continue;
+			}
+			if (!ValidateContainer(image, &imageInfo))
+			{
+				fprintf(outputFile, "%s: corrupt, skipped\n", filePathList.currentPath);
+				++nFailed;
+				free(image.data);
+				continue;
+			}
+			header = GetImageHeader(image, imageInfo, 0);
+			for (j = 0; j < imageInfo.nImages; ++j)
+			{
+				if (j > 0)
+				{
+					header = GetNextImageHeader(header);
+				}
+				listedWidth = customWidths[j];
+				if (!DecodeRGOImage(image, imageInfo, header, j, 0, &decodedImage))
+				{
+					fprintf(outputFile, "%s %u: failed to decode\n", filePathList.currentPath, j);
+					++nFailed;
+					continue;
+				}
+				if (!listedWidth)
+				{
+					listedWidth = decodedImage.width;
+				}
+				startTime = GetTimeInSeconds();
+				detectedWidth = DetectImageWidth(decodedImage);
+				detectSeconds += GetTimeInSeconds() - startTime;
+				fprintf(outputFile, "%s %u: listed %u, detected %u%s\n", filePathList.currentPath, j, listedWidth, detectedWidth,
+					listedWidth == detectedWidth ? "" : " DIFFERS");
+				++nImages;
+				nAgreed += listedWidth == detectedWidth;
+				TrackedFree(decodedImage.pixels.data);
+			}
+			free(image.data);
+		}
+		free(filePathListMemory.data);
+	}
+	fprintf(outputFile, "%u of %u widths agree. Detection took %.3fs\n", nAgreed, nImages, detectSeconds);
+	fclose(outputFile);
+	return nFailed == 0 && nAgreed == nImages;
+}
+
+/* Composes a sprite out of the four quarters of the first image swapped around, many times over,
+ * and logs whether the sheet was only decoded once and whether the pieces ended up in the right place. */
+void TestSpriteComposition(const char* inputPath, const char* outputPath, const char* spriteOutputPath)
+{
+	FILE* outputFile = NULL;
+	SpriteSheets* sheets = NULL;
+	DecodedImage sheet = { 0 };
+	DecodedImage sprite = { 0 };
+	DecodedImage sheetPiece = { 0 };
+	DecodedImage spritePiece = { 0 };
+	SpritePiece pieces[4] = { { 0 } };
+	SpriteComposition composition = { 0 };
+	ImageRegion region = { 0 };
+	double startTime = 0.0;
+	double firstRenderSeconds = 0.0;
+	double laterRenderSeconds = 0.0;
+	bool32 piecesMatch = TRUE;
+	u32 i = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
+	}
+	sheets = OpenSpriteSheets(inputPath);
+	if (!sheets || !GetSpriteSheet(sheets, 0, &sheet))
+	{
+		fprintf(outputFile, "Failed to open %s\n", inputPath);
+		CloseSpriteSheets(sheets);
+		fclose(outputFile);
+		return;
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(pieces); ++i)
+	{
+		pieces[i].width = sheet.width / 2;
+		pieces[i].height = sheet.height / 2;
+		pieces[i].sheetX = (i % 2) * pieces[i].width;
+		pieces[i].sheetY = (i / 2) * pieces[i].height;
+		pieces[i].spriteX = pieces[i].width - pieces[i].sheetX;
+		pieces[i].spriteY = pieces[i].height - pieces[i].sheetY;
+	}
+	composition.width = sheet.width / 2 * 2;
+	composition.height = sheet.height / 2 * 2;
+	composition.nPieces = NUM_ELEMENTS(pieces);
+	composition.pieces = pieces;
+
+	startTime = GetTimeInSeconds();
+	if (!RenderSprite(sheets, 0, &composition, &sprite))
+	{
+		fprintf(outputFile, "Failed to render the sprite\n");
+		CloseSpriteSheets(sheets);
+		fclose(outputFile);
+		return;
+	}
+	firstRenderSeconds = GetTimeInSeconds() - startTime;
+	startTime = GetTimeInSeconds();
+	for (i = 0; i < 15; ++i)
+	{
+		if (RenderSprite(sheets, 0, &composition, &spritePiece))
+		{
+			TrackedFree(spritePiece.pixels.data);
+		}
+	}
+	laterRenderSeconds = GetTimeInSeconds() - startTime;
+
+	for (i = 0; i < NUM_ELEMENTS(pieces) && piecesMatch; ++i)
+	{
+		region.x = pieces[i].sheetX;
+		region.y = pieces[i].sheetY;
+		region.width = pieces[i].width;
+		region.height = pieces[i].height;
+		CropDecodedImage(sheet, region, &sheetPiece);
+		region.x = pieces[i].spriteX;
+		region.y = pieces[i].spriteY;
+		CropDecodedImage(sprite, region, &spritePiece);
+		piecesMatch = sheetPiece.pixels.size == spritePiece.pixels.size &&
+			memcmp(sheetPiece.pixels.data, spritePiece.pixels.data, sheetPiece.pixels.size) == 0;
+		TrackedFree(sheetPiece.pixels.data);
+		TrackedFree(spritePiece.pixels.data);
+	}
+
+	fprintf(outputFile, "Sheet decoded %u time(s)\n", GetNumSpriteSheetDecodes(sheets));
+	fprintf(outputFile, "First render: %.6fs. Later renders: %.6fs each\n", firstRenderSeconds, laterRenderSeconds / 15);
+	fprintf(outputFile, "Pieces %s\n", piecesMatch ? "match" : "DO NOT MATCH");
+	if (!WriteDecodedImage(sprite, spriteOutputPath, InitExtractSettings().output))
+	{
+		fprintf(outputFile, "Failed to write %s\n", spriteOutputPath);
+	}
+	TrackedFree(sprite.pixels.data);
+	CloseSpriteSheets(sheets);
+	fclose(outputFile);
+}
+
+/* Hashes every image in both width lists, then looks up the closest PS2 image to every PSP image
+ * and logs it along with how long hashing and matching took. */
+void TestPerceptualMatching(const char* outputPath)
+{
+	const char* fileLists[2] = { TEST_IMAGE_EXTRACT_ALL_IMAGES_STANDARD_WIDTH_FILE_LIST, TEST_IMAGE_EXTRACT_ALL_IMAGES_NONSTANDARD_WIDTH_FILE_LIST };
+	FILE* outputFile = NULL;
+	Memory filePathListMemory = { 0 };
+	FilePathList filePathList = { 0 };
+	PerceptualIndex* index = NULL;
+	PerceptualMatch entry = { 0 };
+	PerceptualMatch match = { 0 };
+	u32 customWidths[MAX_IMAGES_PER_FILE] = { 0 };
+	u64 hash = 0;
+	double startTime = 0.0;
+	double indexSeconds = 0.0;
+	double matchSeconds = 0.0;
+	u32 nQueries = 0;
+	u32 nMatched = 0;
+	u32 i = 0;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+		return;
+	}
+	index = CreatePerceptualIndex();
+	if (!index)
+	{
+		fclose(outputFile);
+		return;
+	}
+
+	startTime = GetTimeInSeconds();
+	for (i = 0; i < NUM_ELEMENTS(fileLists); ++i)
+	{
+		filePathListMemory = LoadFile(fileLists[i]);
+		if (!filePathListMemory.data)
+		{
+			LOAD_FILE_FAIL_MESSAGE(fileLists[i]);
+			continue;
+		}
+		filePathList = InitFilePathList(filePathListMemory);
+		while (GetNextWidthListEntry(&filePathList, customWidths))
+		{
+			AddFileToPerceptualIndex(index, (const char*)filePathList.currentPath, customWidths);
+		}
+		free(filePathListMemory.data);
+	}
+	indexSeconds = GetTimeInSeconds() - startTime;
+
+	startTime = GetTimeInSeconds();
+	for (i = 0; GetPerceptualIndexEntry(index, i, &hash, &entry); ++i)
+	{
+		if (entry.platform != PLATFORM_PSP)
+		{
+			continue;
+		}
+		++nQueries;
+		if (FindPerceptualMatches(index, hash, PLATFORM_PS2, PERCEPTUAL_HASH_DEFAULT_MAX_DISTANCE, &match, 1))
+		{
+			++nMatched;
+			fprintf(outputFile, "%s %u: %s %u, %u bits apart\n", entry.path, entry.imageIndex, match.path, match.imageIndex, match.distance);
+		}
+		else
+		{
+			fprintf(outputFile, "%s %u: no match\n", entry.path, entry.imageIndex);
+		}
+	}
+	matchSeconds = GetTimeInSeconds() - startTime;
+
+	fprintf(outputFile, "Hashed %u images in %.3fs. Matched %u of %u PSP images in %.3fs\n",
+		GetPerceptualIndexSize(index), indexSeconds, nMatched, nQueries, matchSeconds);
+	DestroyPerceptualIndex(index);
+	fclose(outputFile);
+}
+
+void TestExtractAllImages(void)
+{
+	ExtractAllImagesWith(0);
+}
+
+bool32 TestExtractAllImagesToArchive(void)
+{
+	return ExtractAllImagesWith(EXTRACT_ALL_TO_ARCHIVE);
+}
+
+/* Writes a thumbnail of every image into an archive next to the extracted images. */
+bool32 TestExtractAllThumbnails(void)
+{
+	return ExtractAllImagesWith(EXTRACT_ALL_THUMBNAILS);
+}
+
+/* Extracts every image, skipping any that would come out the same as one already extracted,
+ * and writes out which images were skipped in favour of which. */
+bool32 TestExtractAllImagesDeduplicated(void)
+{
+	return ExtractAllImagesWith(EXTRACT_ALL_DEDUPLICATED);
+}
+
+/* Extracts every image while collecting codec counters for each of them, and writes them out as JSON. */
+bool32 TestExtractAllImagesCodecStats(void)
+{
+	return ExtractAllImagesWith(EXTRACT_ALL_CODEC_STATS);
+}
+
+/* Extracts every image with tracing on, so the run can be looked at in chrome://tracing or Perfetto.
+ * Fails if a thread's begin and end events don't pair up. */
+bool32 TestExtractAllImagesTraced(void)
+{
+	return ExtractAllImagesWith(EXTRACT_ALL_TRACED);
+}
+
+/* Extracts every image while keeping count of the memory each stage and image uses,
+ * then prints the peaks and the images that needed the most. Fails if anything tracked is still live. */
+bool32 TestExtractAllImagesMemoryTracked(void)
+{
+	return ExtractAllImagesWith(EXTRACT_ALL_MEMORY_TRACKED);
+}
+
+/* Extracts every image on every core while keeping the estimated memory of the images
+ * in flight under TEST_IMAGE_MEMORY_BUDGET_BYTES. Fails if the budget was exceeded
+ * without being counted, or if anything is still reserved afterwards. */
+bool32 TestExtractAllImagesMemoryBudgeted(void)
+{
+	return ExtractAllImagesWith(EXTRACT_ALL_MEMORY_BUDGETED);
+}
+
+/* Runs ExtractAllImages over the file lists with what the options ask for set up around it,
+ * then writes out and checks what was collected. */
+static bool32 ExtractAllImagesWith(u32 options)
+{
+	ExtractSettings settings = { 0 };
+	const char* archivePath = NULL;
+	MemoryUsage memoryUsage = { 0 };
+	MemoryBudgetStats budgetStats = { 0 };
+	bool32 success = FALSE;
+
+	settings = InitExtractSettings();
+	if (options & EXTRACT_ALL_THUMBNAILS)
+	{
+		settings.output.format = OUTPUT_FORMAT_THUMBNAIL;
+		settings.output.encodeProfile = PNG_ENCODE_PROFILE_FAST;
+		archivePath = TEST_IMAGE_EXTRACTED_THUMBNAILS_ARCHIVE;
+	}
+	else if (options & EXTRACT_ALL_TO_ARCHIVE)
+	{
+		archivePath = TEST_IMAGE_EXTRACTED_IMAGES_ARCHIVE;
+	}
+	if (archivePath)
+	{
+		settings.output.sink = OpenArchiveSink(archivePath, TEST_IMAGE_EXTRACTED_IMAGES_FOLDER);
+		if (!settings.output.sink)
+		{
+			goto cleanup;
+		}
+	}
+	if (options & EXTRACT_ALL_DEDUPLICATED)
+	{
+		settings.dedup = CreateDedupIndex();
+		if (!settings.dedup)
+		{
+			goto cleanup;
+		}
+	}
+	if (options & EXTRACT_ALL_CODEC_STATS)
+	{
+		settings.codecStats = CreateCodecStatsCollector();
+		if (!settings.codecStats)
+		{
+			goto cleanup;
+		}
+	}
+	if (options & EXTRACT_ALL_MEMORY_BUDGETED)
+	{
+		settings.memoryBudget = CreateMemoryBudget(TEST_IMAGE_MEMORY_BUDGET_BYTES);
+		if (!settings.memoryBudget)
+		{
+			goto cleanup;
+		}
+	}
+	/* Started last so that nothing after them can fail before the run */
+	if ((options & EXTRACT_ALL_TRACED) && !StartTracing())
+	{
+		goto cleanup;
+	}
+	if ((options & EXTRACT_ALL_MEMORY_TRACKED) && !StartMemoryTracking())
+	{
+		if (options & EXTRACT_ALL_TRACED)
+		{
+			StopTracing(TEST_IMAGE_TRACE_OUTPUT);
+		}
+		goto cleanup;
+	}
+
+	ExtractAllImages(settings, GetNumProcessors());
+	success = TRUE;
+
+	if (options & EXTRACT_ALL_MEMORY_TRACKED)
+	{
+		memoryUsage = StopMemoryTracking(TEST_IMAGE_MEMORY_TRACKING_WORST_IMAGES);
+		if (memoryUsage.liveBytes != 0)
+		{
+			printf("%llu tracked bytes are still live after extraction\n", memoryUsage.liveBytes);
+			success = FALSE;
+		}
+	}
+	if (options & EXTRACT_ALL_TRACED)
+	{
+		if (!StopTracing(TEST_IMAGE_TRACE_OUTPUT) || !CheckTraceEventsPaired(TEST_IMAGE_TRACE_OUTPUT))
+		{
+			success = FALSE;
+		}
+	}
+	if (settings.dedup)
+	{
+		PrintDedupStats(GetDedupStats(settings.dedup));
+		if (!WriteDedupManifest(settings.dedup, TEST_IMAGE_DEDUP_MANIFEST_OUTPUT))
+		{
+			success = FALSE;
+		}
+	}
+	if (settings.codecStats)
+	{
+		PrintCodecStatsTotals(GetCodecStatsTotals(settings.codecStats));
+		if (!WriteCodecStatsJSON(settings.codecStats, TEST_IMAGE_CODEC_STATS_OUTPUT))
+		{
+			success = FALSE;
+		}
+	}
+	if (settings.memoryBudget)
+	{
+		budgetStats = DestroyMemoryBudget(settings.memoryBudget);
+		settings.memoryBudget = NULL;
+		PrintMemoryBudgetStats(budgetStats);
+		if (budgetStats.peakReservedBytes > budgetStats.budgetBytes && budgetStats.nOverBudget == 0)
+		{
+			printf("Reserved %llu bytes at peak, over the budget without it being counted\n", budgetStats.peakReservedBytes);
+			success = FALSE;
+		}
+		if (budgetStats.reservedBytes != 0)
+		{
+			printf("%llu bytes are still reserved after extraction\n", budgetStats.reservedBytes);
+			success = FALSE;
+		}
+	}
+
+cleanup:
+	if (settings.memoryBudget)
+	{
+		DestroyMemoryBudget(settings.memoryBudget);
+	}
+	if (settings.codecStats)
+	{
+		DestroyCodecStatsCollector(settings.codecStats);
+	}
+	if (settings.dedup)
+	{
+		DestroyDedupIndex(settings.dedup);
+	}
+	if (settings.output.sink && !CloseOutputSink(settings.output.sink))
+	{
+		success = FALSE;
+	}
+	return success;
+}
+
+/* Checks that every thread's begin and end events in a trace written by StopTracing nest properly,
+ * so that each end closes a stage that thread began and nothing is left open. */
+static bool32 CheckTraceEventsPaired(const char* tracePath)
+{
+	FILE* traceFile = NULL;
+	char line[TEST_IMAGE_TRACE_MAX_LINE] = { 0 };
+	const char* phase = NULL;
+	const char* threadId = NULL;
+	u32* openEvents = NULL;
+	u32* newOpenEvents = NULL;
+	u32 nThreads = 0;
+	u32 tid = 0;
+	u32 nUnpaired = 0;
+	u32 i = 0;
+	bool32 success = FALSE;
+
+	traceFile = fopen(tracePath, "rb");
+	if (!traceFile)
+	{
+		FOPEN_FAIL_MESSAGE(tracePath);
+		return FALSE;
+	}
+
+	/* StopTracing writes one event per line */
+	while (fgets(line, sizeof(line), traceFile))
+	{
+		phase = strstr(line, "\"ph\": \"");
+		threadId = strstr(line, "\"tid\": ");
+		if (!phase || !threadId || (phase[7] != 'B' && phase[7] != 'E'))
+		{
+			continue;
+		}
+		tid = strtoul(threadId + 7, NULL, 10);
+		if (tid >= nThreads)
+		{
+			newOpenEvents = realloc(openEvents, (tid + 1) * sizeof(u32));
+			if (!newOpenEvents)
+			{
+				goto cleanup;
+			}
+			openEvents = newOpenEvents;
+			memset(&openEvents[nThreads], 0, (tid + 1 - nThreads) * sizeof(u32));
+			nThreads = tid + 1;
+		}
+		if (phase[7] == 'B')
+		{
+			++openEvents[tid];
+		}
+		else if (openEvents[tid] > 0)
+		{
+			--openEvents[tid];
+		}
+		else
+		{
+			printf("Trace thread %u ends a stage it never began\n", tid);
+			++nUnpaired;
+		}
+	}
+	for (i = 0; i < nThreads; ++i)
+	{
+		if (openEvents[i] > 0)
+		{
+			printf("Trace thread %u leaves %u stages open\n", i, openEvents[i]);
+			nUnpaired += openEvents[i];
+		}
+	}
+	success = nUnpaired == 0;
+
+cleanup:
+	free(openEvents);
+	fclose(traceFile);
+	return success;
+}
+
+/* Decodes and encodes every image in the file lists and checks their hashes and the time each stage took
+ * against the regression manifest. If updateManifest is set, the manifest is rewritten from this run instead. */
+bool32 RunRegressionSuite(bool32 updateManifest, double slowdownThreshold)
+{
+	ExtractedImageSource* sources = NULL;
+	u32 nSources = 0;
+	RegressionRun* run = NULL;
+	RegressionResults results = { 0 };
+	bool32 passed = FALSE;
+	u32 i = 0;
+
+	if (!LoadExtractedImageSources(&sources, &nSources))
+	{
+		return FALSE;
+	}
+	run = CreateRegressionRun();
+	if (!run)
+	{
+		FreeExtractedImageSources(sources, nSources);
+		return FALSE;
+	}
+	for (i = 0; i < nSources; ++i)
+	{
+		AddRegressionFile(run, sources[i].inputPath, sources[i].customWidths);
+	}
+	FreeExtractedImageSources(sources, nSources);
+
+	if (updateManifest)
+	{
+		passed = WriteRegressionManifest(run, TEST_REGRESSION_MANIFEST);
+		if (passed)
+		{
+			printf("Wrote %s\n", TEST_REGRESSION_MANIFEST);
+		}
+	}
+	else
+	{
+		passed = CompareRegressionManifest(run, TEST_REGRESSION_MANIFEST, slowdownThreshold, &results);
+		PrintRegressionResults(results);
+		printf("%s\n", passed ? "Passed" : "Failed");
+	}
+	DestroyRegressionRun(run);
+	return passed;
+}
+
+/* Extracts this shard's share of the file lists, split by PartitionShards, into an archive of its
+ * own, and writes a manifest of what it extracted for MergeExtractedShards. shard counts from 0. */
+bool32 ExtractShard(u32 shard, u32 nShards)
+{
+	char archivePath[1024] = { 0 };
+	char manifestPath[1024] = { 0 };
+	ExtractedImageSource* sources = NULL;
+	u32 nSources = 0;
+	ShardFile* files = NULL;
+	u32* shardOfFile = NULL;
+	ShardResult* results = NULL;
+	u32 nResults = 0;
+	ExtractSettings settings = { 0 };
+	bool32 success = FALSE;
+	double startTime = 0.0;
+	u32 nImages = 0;
+	u32 i = 0;
+
+	if (!LoadExtractedImageSources(&sources, &nSources))
+	{
+		return FALSE;
+	}
+	files = malloc(sizeof(ShardFile) * (nSources ? nSources : 1));
+	shardOfFile = malloc(sizeof(u32) * (nSources ? nSources : 1));
+	results = malloc(sizeof(ShardResult) * (nSources ? nSources : 1));
+	if (!files || !shardOfFile || !results)
+	{
+		goto cleanup;
+	}
+	for (i = 0; i < nSources; ++i)
+	{
+		files[i].inputPath = sources[i].inputPath;
+		files[i].cost = EstimateExtractionCost(sources[i].inputPath);
+	}
+	PartitionShards(files, nSources, nShards, shardOfFile);
+
+	sprintf(archivePath, TEST_IMAGE_EXTRACTED_IMAGES_SHARD_ARCHIVE, shard + 1, nShards);
+	sprintf(manifestPath, TEST_IMAGE_EXTRACTED_IMAGES_SHARD_MANIFEST, shard + 1, nShards);
+	settings = InitExtractSettings();
+	settings.output.sink = OpenArchiveSink(archivePath, TEST_IMAGE_EXTRACTED_IMAGES_FOLDER);
+	if (!settings.output.sink)
+	{
+		goto cleanup;
+	}
+	settings.writer = CreateImageWriter(GetNumProcessors(), IMAGE_WRITER_DEFAULT_QUEUE_CAPACITY);
+	if (!settings.writer)
+	{
+		printf("Failed to start the image writer threads, writing on the main thread instead.\n");
+	}
+	startTime = GetTimeInSeconds();
+
+	for (i = 0; i < nSources; ++i)
+	{
+		if (shardOfFile[i] != shard)
+		{
+			continue;
+		}
+		printf("%s\n", sources[i].inputPath);
+
+		/* A file that can't be loaded or is corrupt is left out of the manifest, so the merge reports it missing */
+		nImages = ConvertRGOImageToPNGAll(sources[i].inputPath, sources[i].outputPath, sources[i].customWidths, &settings);
+		if (nImages == 0)
+		{
+			continue;
+		}
+		results[nResults].inputPath = sources[i].inputPath;
+		results[nResults].outputName = &sources[i].outputPath[strlen(TEST_IMAGE_EXTRACTED_IMAGES_FOLDER)];
+		results[nResults].nImages = nImages;
+		++nResults;
+	}
+
+	/* Everything has to be in the archive before the manifest says it is */
+	if (settings.writer)
+	{
+		PrintImageWriterStats(DestroyImageWriter(settings.writer));
+	}
+	success = CloseOutputSink(settings.output.sink);
+	success = WriteShardManifest(manifestPath, shard, nShards, archivePath, results, nResults) && success;
+	printf("Extracted shard %u/%u, %u of %u files, in %.3fs\n", shard + 1, nShards, nResults, nSources, GetTimeInSeconds() - startTime);
+
+cleanup:
+	free(files);
+	free(shardOfFile);
+	free(results);
+	FreeExtractedImageSources(sources, nSources);
+	return success;
+}
+
+/* Checks that the nShards shards from ExtractShard between them extracted every file in the
+ * file lists once, with every image, and writes the combined manifest. */
+bool32 MergeExtractedShards(u32 nShards)
+{
+	ExtractedImageSource* sources = NULL;
+	u32 nSources = 0;
+	char* manifestPathData = NULL;
+	const char** manifestPaths = NULL;
+	const char** inputPaths = NULL;
+	ShardMergeResults results = { 0 };
+	bool32 passed = FALSE;
+	u32 i = 0;
+
+	if (!LoadExtractedImageSources(&sources, &nSources))
+	{
+		return FALSE;
+	}
+	manifestPathData = malloc(1024 * nShards);
+	manifestPaths = malloc(sizeof(const char*) * nShards);
+	inputPaths = malloc(sizeof(const char*) * (nSources ? nSources : 1));
+	if (manifestPathData && manifestPaths && inputPaths)
+	{
+		for (i = 0; i < nShards; ++i)
+		{
+			sprintf(&manifestPathData[i * 1024], TEST_IMAGE_EXTRACTED_IMAGES_SHARD_MANIFEST, i + 1, nShards);
+			manifestPaths[i] = &manifestPathData[i * 1024];
+		}
+		for (i = 0; i < nSources; ++i)
+		{
+			inputPaths[i] = sources[i].inputPath;
+		}
+		passed = MergeShardManifests(manifestPaths, nShards, inputPaths, nSources, TEST_IMAGE_EXTRACTED_IMAGES_SHARDS_MANIFEST, &results);
+		PrintShardMergeResults(results);
+		printf("%s\n", passed ? "Passed" : "Failed");
+	}
+	free(manifestPathData);
+	free(manifestPaths);
+	free(inputPaths);
+	FreeExtractedImageSources(sources, nSources);
+	return passed;
+}
+
+/* Extracts every image in the standard and non-standard width file lists. Encoding and
+ * writing happens on nWriterThreads writer threads, or on this thread if it's zero. */
+void ExtractAllImages(ExtractSettings settings, u32 nWriterThreads)
+{
+	char outputPath[1024] = { 0 };
+	Memory filePathListMemory = { 0 };
+	FilePathList filePathList = { 0 };
+	u32 nImages = 0;
+	u32* imageWidths = NULL;
+	u32 i = 0;
+	double startTime = 0.0;
+
+	if (nWriterThreads)
+	{
+		settings.writer = CreateImageWriter(nWriterThreads, IMAGE_WRITER_DEFAULT_QUEUE_CAPACITY);
+		if (!settings.writer)
+		{
+			printf("Failed to start the image writer threads, writing on the main thread instead.\n");
+		}
+	}
+	startTime = GetTimeInSeconds();
+
+	filePathListMemory = LoadFile(TEST_IMAGE_EXTRACT_ALL_IMAGES_STANDARD_WIDTH_FILE_LIST);
+	if (!filePathListMemory.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(TEST_IMAGE_EXTRACT_ALL_IMAGES_STANDARD_WIDTH_FILE_LIST);
+		goto finish;
+	}
+	filePathList = InitFilePathList(filePathListMemory);
+
+	while (GetNextFilePath(&filePathList))
+	{
+		printf("%s\n", filePathList.currentPath);
+		GenerateExtractAllImagesOutputPath(filePathList.currentPath, outputPath);
+		ConvertRGOImageToPNGAll(filePathList.currentPath, outputPath, 0, &settings);
+	}
+	free(filePathListMemory.data);
+
+	filePathListMemory = LoadFile(TEST_IMAGE_EXTRACT_ALL_IMAGES_NONSTANDARD_WIDTH_FILE_LIST);
+	if (!filePathListMemory.data)
+	{
+		LOAD_FILE_FAIL_MESSAGE(TEST_IMAGE_EXTRACT_ALL_IMAGES_NONSTANDARD_WIDTH_FILE_LIST);
+		goto finish;
+	}
+	filePathList = InitFilePathList(filePathListMemory);
+	filePathList.currentPath = filePathListMemory.data;
+	while (filePathList.memoryPos < filePathListMemory.size)
+	{
+		for (; filePathListMemory.data[filePathList.memoryPos] != ' '; ++filePathList.memoryPos);
+		filePathListMemory.data[filePathList.memoryPos] = '\0';
+		++filePathList.memoryPos;
+
+		sscanf(&filePathListMemory.data[filePathList.memoryPos], "%u", &nImages);
+		imageWidths = malloc(sizeof(u32) * nImages);
+		if (!imageWidths)
+		{
+			free(filePathListMemory.data);
+			goto finish;
+		}
+		for (; filePathListMemory.data[filePathList.memoryPos] != ' '; ++filePathList.memoryPos);
+		++filePathList.memoryPos;
+
+		for (i = 0; i < nImages; ++i)
+		{
+			sscanf(&filePathListMemory.data[filePathList.memoryPos], "%u", &imageWidths[i]);
+			if (i < nImages - 1)
+			{
+				for (; filePathListMemory.data[filePathList.memoryPos] != ' '; ++filePathList.memoryPos);
+				++filePathList.memoryPos;
+			}
+		}
+
+		printf("%s\n", filePathList.currentPath);
+		GenerateExtractAllImagesOutputPath(filePathList.currentPath, outputPath);
+		ConvertRGOImageToPNGAll(filePathList.currentPath, outputPath, imageWidths, &settings);
+		free(imageWidths);
+
+		for (; filePathListMemory.data[filePathList.memoryPos] != '\n'; ++filePathList.memoryPos);
+		++filePathList.memoryPos;
+		filePathList.currentPath = &filePathListMemory.data[filePathList.memoryPos];
+	}
+	free(filePathListMemory.data);
+
+finish:
+	if (settings.writer)
+	{
+		PrintImageWriterStats(DestroyImageWriter(settings.writer));
+	}
+	printf("Extracted all images in %.3fs\n", GetTimeInSeconds() - startTime);
+}
+
+void GenerateExtractAllImagesOutputPath(const char* inputPath, char* outputPath)
+{
+	const char* fileNameStart = 0;
+	size_t fileNameLength = 0;
+	char* foundChr = NULL;
+	char filename[1024] = { 0 };
+
+	foundChr = strchr(inputPath, '/');
+	if (!foundChr)
+	{
+		fileNameStart = inputPath;
+	}
+	else
+	{
+		fileNameStart = foundChr + 1;
+	}
+	foundChr = strrchr(inputPath, '.');
+	if (!foundChr)
+	{
+		fileNameLength = strlen(fileNameStart);
+	}
+	else
+	{
+		fileNameLength = foundChr - fileNameStart;
+	}
+	memcpy(filename, fileNameStart, fileNameLength);
+	filename[fileNameLength] = '\0';
+	strcat(filename, ".png");
+
+	sprintf(outputPath, TEST_IMAGE_EXTRACTED_IMAGES_FOLDER);
+	strcat(outputPath, filename);
+}
+
+/* Loads where every image in the standard and non-standard width file lists gets extracted to.
+ * On success, the sources must be freed with FreeExtractedImageSources. */
+static bool32 LoadExtractedImageSources(ExtractedImageSource** sources, u32* nSources)
+{
+	const char* fileLists[2] = { TEST_IMAGE_EXTRACT_ALL_IMAGES_STANDARD_WIDTH_FILE_LIST, TEST_IMAGE_EXTRACT_ALL_IMAGES_NONSTANDARD_WIDTH_FILE_LIST };
+	char outputPath[1024] = { 0 };
+	Memory filePathListMemory = { 0 };
+	FilePathList filePathList = { 0 };
+	ExtractedImageSource* ret = NULL;
+	ExtractedImageSource* newSources = NULL;
+	u32 nRet = 0;
+	u32 capacity = 0;
+	u32 customWidths[MAX_IMAGES_PER_FILE] = { 0 };
+	u32 i = 0;
+
+	for (i = 0; i < NUM_ELEMENTS(fileLists); ++i)
+	{
+		filePathListMemory = LoadFile(fileLists[i]);
+		if (!filePathListMemory.data)
+		{
+			LOAD_FILE_FAIL_MESSAGE(fileLists[i]);
+			FreeExtractedImageSources(ret, nRet);
+			return FALSE;
+		}
+		filePathList = InitFilePathList(filePathListMemory);
+		while (GetNextWidthListEntry(&filePathList, customWidths))
+		{
+			if (nRet == capacity)
+			{
+				capacity = capacity ? capacity * 2 : 256;
+				newSources = realloc(ret, sizeof(ExtractedImageSource) * capacity);
+				if (!newSources)
+				{
+					break;
+				}
+				ret = newSources;
+			}
+			GenerateExtractAllImagesOutputPath((const char*)filePathList.currentPath, outputPath);
+			ret[nRet].inputPath = CopyString((const char*)filePathList.currentPath);
+			ret[nRet].outputPath = CopyString(outputPath);
+			if (!ret[nRet].inputPath || !ret[nRet].outputPath)
+			{
+				free(ret[nRet].inputPath);
+				free(ret[nRet].outputPath);
+				break;
+			}
+			memcpy(ret[nRet].customWidths, customWidths, sizeof(customWidths));
+			++nRet;
+		}
+		free(filePathListMemory.data);
+	}
+	*sources = ret;
+	*nSources = nRet;
+	return TRUE;
+}
+
+static void FreeExtractedImageSources(ExtractedImageSource* sources, u32 nSources)
+{
+	u32 i = 0;
+
+	for (i = 0; i < nSources; ++i)
+	{
+		free(sources[i].inputPath);
+		free(sources[i].outputPath);
+	}
+	free(sources);
+}
+
+/* Works out which image an extracted PNG is from. The first image of a file is written to the path from
+ * GenerateExtractAllImagesOutputPath, and image N after it to the same path with _N before the extension. */
+static bool32 FindExtractedImageSource(const ExtractedImageSource* sources, u32 nSources, const char* pngPath, u32* sourceIndex, u32* imageIndex)
+{
+	const char* suffix = NULL;
+	char* suffixEnd = NULL;
+	size_t baseLength = 0;
+	u32 suffixIndex = 0;
+	bool32 found = FALSE;
+	u32 i = 0;
+
+	for (i = 0; i < nSources; ++i)
+	{
+		baseLength = strlen(sources[i].outputPath) - strlen(".png");
+		if (strncmp(pngPath, sources[i].outputPath, baseLength) != 0)
+		{
+			continue;
+		}
+		suffix = &pngPath[baseLength];
+		if (strcmp(suffix, ".png") == 0)
+		{
+			/* Nothing can be a closer match than this */
+			*sourceIndex = i;
+			*imageIndex = 0;
+			return TRUE;
+		}
+		if (suffix[0] == '_' && suffix[1] >= '1' && suffix[1] <= '9')
+		{
+			suffixIndex = strtoul(&suffix[1], &suffixEnd, 10);
+			if (strcmp(suffixEnd, ".png") == 0 && suffixIndex < MAX_IMAGES_PER_FILE)
+			{
+				*sourceIndex = i;
+				*imageIndex = suffixIndex;
+				found = TRUE;
+			}
+		}
+	}
+	return found;
+}
+
+/* Imports a batch of changed PNGs, a container at a time. Each container is loaded once, every changed image
+ * from it is put into it in memory, and then the bytes that changed are written back in one go. */
+static void ImportChangedImages(const ExtractedImageSource* sources, u32 nSources, const ChangedFiles* changedFiles)
+{
+	Memory container = { 0 };
+	ImportResult result = { 0 };
+	RepackResult changes = { 0 };
+	u32 sourceIndices[FILE_WATCHER_MAX_BATCH] = { 0 };
+	u32 imageIndices[FILE_WATCHER_MAX_BATCH] = { 0 };
+	bool32 imported[FILE_WATCHER_MAX_BATCH] = { 0 };
+	const char* containerPath = NULL;
+	double startTime = 0.0;
+	u32 nImported = 0;
+	u32 i = 0;
+	u32 j = 0;
+
+	for (i = 0; i < changedFiles->nPaths; ++i)
+	{
+		if (!FindExtractedImageSource(sources, nSources, changedFiles->paths[i], &sourceIndices[i], &imageIndices[i]))
+		{
+			/* Not an extracted image, like an editor's temporary file */
+			imported[i] = TRUE;
+		}
+	}
+	for (i = 0; i < changedFiles->nPaths; ++i)
+	{
+		if (imported[i])
+		{
+			continue;
+		}
+		containerPath = sources[sourceIndices[i]].inputPath;
+		startTime = GetTimeInSeconds();
+		container = LoadFile(containerPath);
+		if (!container.data)
+		{
+			LOAD_FILE_FAIL_MESSAGE(containerPath);
+		}
+		memset(&changes, 0, sizeof(changes));
+		nImported = 0;
+		for (j = i; j < changedFiles->nPaths; ++j)
+		{
+			if (imported[j] || sourceIndices[j] != sourceIndices[i])
+			{
+				continue;
+			}
+			imported[j] = TRUE;
+			if (!container.data || !ImportPNGImageInMemory(&container, containerPath, imageIndices[j],
+				sources[sourceIndices[j]].customWidths[imageIndices[j]], changedFiles->paths[j], &result))
+			{
+				printf("Failed to import %s\n", changedFiles->paths[j]);
+			}
+			else if (result.nChangedPixels == 0)
+			{
+				printf("%s is unchanged\n", changedFiles->paths[j]);
+			}
+			else
+			{
+				printf("Imported %s into image %u of %s. %u pixels changed, %u not in the palette%s\n",
+					changedFiles->paths[j], imageIndices[j], containerPath, result.nChangedPixels, result.nApproximatedPixels,
+					result.repack.shiftAmount ? ", moving the images after it" : "");
+				AddRepackResult(&changes, result.repack);
+				++nImported;
+			}
+		}
+		if (nImported > 0)
+		{
+			if (WriteRepackedRange(containerPath, container, changes))
+			{
+				printf("Wrote %u imported images back to %s in %.3fs. %u bytes at 0x%X\n",
+					nImported, containerPath, GetTimeInSeconds() - startTime, changes.changedSize, changes.changedOffset);
+			}
+			else
+			{
+				printf("Failed to write the %u imported images back to %s\n", nImported, containerPath);
+			}
+		}
+		free(container.data);
+		container.data = NULL;
+	}
+}
+
+/* Watches the extracted images folder and puts every PNG that's saved back into the container it came from.
+ * Changes are collected until debounceMilliseconds pass without any, then imported together. */
+void WatchExtractedImages(u32 debounceMilliseconds)
+{
+	ExtractedImageSource* sources = NULL;
+	u32 nSources = 0;
+	FileWatcher* watcher = NULL;
+	ChangedFiles changedFiles = { 0 };
+
+	if (!LoadExtractedImageSources(&sources, &nSources))
+	{
+		return;
+	}
+	watcher = CreateFileWatcher(TEST_IMAGE_EXTRACTED_IMAGES_FOLDER);
+	if (!watcher)
+	{
+		FreeExtractedImageSources(sources, nSources);
+		return;
+	}
+	printf("Watching %s for changes to the images from %u files\n", TEST_IMAGE_EXTRACTED_IMAGES_FOLDER, nSources);
+	while (WaitForChangedFiles(watcher, FILE_WATCHER_WAIT_FOREVER, debounceMilliseconds, &changedFiles))
+	{
+		ImportChangedImages(sources, nSources, &changedFiles);
+		FreeChangedFiles(&changedFiles);
+	}
+	DestroyFileWatcher(watcher);
+	FreeExtractedImageSources(sources, nSources);
 }
@@ -20,6 +20,8 @@
 #ifndef TEST_H
 #define TEST_H
 
+#include "image.h"
+
 #define TEST_UTIL_LOAD_FILE_INPUT "TestFiles/MiscInput/LoadFileInput.txt"
 #define TEST_UTIL_LOAD_FILE_OUTPUT "TestFiles/Results/LoadFileOutput.log"
 #define TEST_UTIL_FILE_PATH_LIST_INPUT "TestFiles/PSPImages/filelist.txt"
@@ -35,16 +37,93 @@
 #define TEST_IMAGE_CONVERT_RGO_IMAGE_TO_PNG_PSP_OUTPUT "TestFiles/Results/RGOPSPToPNG.png"
 #define TEST_IMAGE_CONVERT_RGO_IMAGE_TO_PNG_PS2_OUTPUT "TestFiles/Results/RGOPS2ToPNG.png"
 #define TEST_IMAGE_EXTRACTED_IMAGES_FOLDER "TestFiles/Results/ExtractedImages/"
+#define TEST_IMAGE_EXTRACTED_IMAGES_ARCHIVE "TestFiles/Results/ExtractedImages.tar"
+#define TEST_IMAGE_DETECT_IMAGE_WIDTHS_OUTPUT "TestFiles/Results/DetectImageWidthsOutput.log"
+#define TEST_MAP_SPRITE_COMPOSITION_INPUT "TestFiles/PS2Images/BK/EG_000_A0.obj"
+#define TEST_MAP_SPRITE_COMPOSITION_OUTPUT "TestFiles/Results/SpriteCompositionOutput.log"
+#define TEST_MAP_SPRITE_COMPOSITION_SPRITE_OUTPUT "TestFiles/Results/SpriteComposition.png"
+#define TEST_IMAGE_PERCEPTUAL_MATCHING_OUTPUT "TestFiles/Results/PerceptualMatchingOutput.log"
+#define TEST_IMAGE_EXTRACTED_THUMBNAILS_ARCHIVE "TestFiles/Results/ExtractedThumbnails.tar"
+#define TEST_IMAGE_DEDUP_MANIFEST_OUTPUT "TestFiles/Results/ExtractedImagesDuplicates.txt"
+#define TEST_IMAGE_CODEC_STATS_OUTPUT "TestFiles/Results/ExtractedImagesCodecStats.json"
+#define TEST_IMAGE_TRACE_OUTPUT "TestFiles/Results/ExtractAllImagesTrace.json"
+#define TEST_IMAGE_TRACE_MAX_LINE 1024
+#define TEST_IMAGE_MEMORY_TRACKING_WORST_IMAGES 10
+#define TEST_IMAGE_MEMORY_BUDGET_BYTES (64 * 1024 * 1024)
+#define TEST_REGRESSION_MANIFEST "TestFiles/MiscInput/RegressionManifest.txt"
+#define TEST_IMAGE_EXTRACTED_IMAGES_SHARD_ARCHIVE "TestFiles/Results/ExtractedImagesShard%uof%u.tar" /* Shard number, number of shards */
+#define TEST_IMAGE_EXTRACTED_IMAGES_SHARD_MANIFEST "TestFiles/Results/ExtractedImagesShard%uof%u.txt"
+#define TEST_IMAGE_EXTRACTED_IMAGES_SHARDS_MANIFEST "TestFiles/Results/ExtractedImagesShards.txt"
 #define TEST_IMAGE_EXTRACT_ALL_IMAGES_STANDARD_WIDTH_FILE_LIST "TestFiles/MiscInput/ExtractAllImagesListStandardWidth.txt"
 #define TEST_IMAGE_EXTRACT_ALL_IMAGES_NONSTANDARD_WIDTH_FILE_LIST "TestFiles/MiscInput/ExtractAllImagesListNonStandardWidth.txt"
+#define TEST_IMAGE_PNG_ENCODE_PROFILES_OUTPUT "TestFiles/Results/PNGEncodeProfilesOutput.log"
+#define TEST_IMAGE_RAW_ROUND_TRIP_INPUT "TestFiles/PS2Images/BK/EG_000_A0.obj"
+#define TEST_IMAGE_RAW_ROUND_TRIP_OUTPUT "TestFiles/Results/RawImageRoundTripOutput.log"
+#define TEST_IMAGE_PS2_PALETTE_CORRECTION_INPUT "TestFiles/PS2Images/PT/pt_omake.obj"
+#define TEST_IMAGE_PS2_PALETTE_CORRECTION_OUTPUT "TestFiles/Results/PS2PaletteCorrectionOutput.log"
+#define TEST_PALETTE_KERNELS_OUTPUT "TestFiles/Results/PaletteKernelsOutput.log"
+#define TEST_PALETTE_KERNELS_MAX_BYTES 1100 /* Every length up to this is tried, so every tail length is covered */
+#define TEST_RGBA_CONVERTERS_OUTPUT "TestFiles/Results/RGBAConvertersOutput.log"
+#define TEST_RGBA_CONVERTERS_ROW_SIZE 512 /* Bytes in a row of a PSP image */
+#define TEST_RGBA_CONVERTERS_HEIGHT 24 /* Three rows of 16 x 8 tiles */
+#define TEST_IMAGE_DECODE_REGION_PSP_INPUT "TestFiles/PSPImages/BIN/824"
+#define TEST_IMAGE_DECODE_REGION_PSP_OUTPUT "TestFiles/Results/DecodeRegionPSPOutput.log"
+#define TEST_IMAGE_DECODE_REGION_PS2_INPUT "TestFiles/PS2Images/BK/BG_000_A0.obj"
+#define TEST_IMAGE_DECODE_REGION_PS2_OUTPUT "TestFiles/Results/DecodeRegionPS2Output.log"
+#define TEST_IMAGE_REPACK_PSP_INPUT "TestFiles/PSPImages/BIN/824"
+#define TEST_IMAGE_REPACK_PSP_OUTPUT "TestFiles/Results/RepackImagePSPOutput.log"
+#define TEST_IMAGE_REPACK_PS2_INPUT "TestFiles/PS2Images/BK/BG_000_A0.obj"
+#define TEST_IMAGE_REPACK_PS2_OUTPUT "TestFiles/Results/RepackImagePS2Output.log"
+#define TEST_IMAGE_VALIDATE_CONTAINER_PSP_INPUT "TestFiles/PSPImages/BIN/824"
+#define TEST_IMAGE_VALIDATE_CONTAINER_PSP_OUTPUT "TestFiles/Results/ValidateContainerPSPOutput.log"
+#define TEST_IMAGE_VALIDATE_CONTAINER_PS2_INPUT "TestFiles/PS2Images/BK/BG_000_A0.obj"
+#define TEST_IMAGE_VALIDATE_CONTAINER_PS2_OUTPUT "TestFiles/Results/ValidateContainerPS2Output.log"
+#define TEST_IMAGE_VALIDATE_CONTAINER_CORRUPTION_STEP 7 /* Every this many bytes is corrupted in turn */
+#define TEST_IMAGE_PS2_RECOMPRESSION_OUTPUT "TestFiles/Results/PS2RecompressionOutput.log"
+#define TEST_IMAGE_SERVER_INPUT "TestFiles/PSPImages/BIN/824"
+#define TEST_IMAGE_SERVER_OUTPUT "TestFiles/Results/ImageServerOutput.log"
+#define TEST_IMAGE_SERVER_SOCKET "TestFiles/Results/ImageServer.sock"
+#define TEST_IMAGE_SERVER_COPY "TestFiles/Results/ImageServerInput.bin" /* Served instead of the input so it can be rewritten */
+#define TEST_IMAGE_SERVER_WARM_REQUESTS 100
+#define TEST_IMAGE_IMPORT_PNG_INPUT "TestFiles/PS2Images/BK/BG_000_A0.obj"
+#define TEST_IMAGE_IMPORT_PNG_OUTPUT "TestFiles/Results/ImportPNGOutput.log"
+#define TEST_IMAGE_IMPORT_PNG_CONTAINER "TestFiles/Results/ImportPNGContainer.obj"
+#define TEST_IMAGE_IMPORT_PNG_IMAGE "TestFiles/Results/ImportPNGImage.png"
+#define WATCH_EXTRACTED_IMAGES_DEFAULT_DEBOUNCE_MILLISECONDS 250
 
 void TestUtilLoadFile(const char* inputPath, const char* outputPath);
 void TestUtilFilePathList(const char* inputPath, const char* outputPath);
 void TestImageGetImageInfo(const char* outputPath);
 void TestImageGetImageHeader(const char* outputPath);
 void TestImageDecompressSingleImage(const char* inputPath, const char* outputPath);
+void TestPNGEncodeProfiles(const char* outputPath);
+void TestRawImageRoundTrip(const char* inputPath, const char* outputPath);
+void TestPS2PaletteCorrection(const char* inputPath, const char* outputPath);
+bool32 TestPaletteKernels(const char* outputPath);
+bool32 TestRGBAConverters(const char* outputPath);
+void TestImageDecodeRegion(const char* inputPath, const char* outputPath);
+void TestRepackImage(const char* inputPath, const char* outputPath);
+void TestValidateContainer(const char* inputPath, const char* outputPath);
+void TestPS2Recompression(const char* outputPath);
+void TestImageServer(const char* inputPath, const char* outputPath);
+void TestImportPNGImage(const char* inputPath, const char* outputPath);
+bool32 TestDetectImageWidths(const char* outputPath);
+void TestSpriteComposition(const char* inputPath, const char* outputPath, const char* spriteOutputPath);
+void TestPerceptualMatching(const char* outputPath);
 void TestExtractAllImages(void);
+bool32 TestExtractAllImagesToArchive(void);
+bool32 TestExtractAllThumbnails(void);
+bool32 TestExtractAllImagesDeduplicated(void);
+bool32 TestExtractAllImagesCodecStats(void);
+bool32 TestExtractAllImagesTraced(void);
+bool32 TestExtractAllImagesMemoryTracked(void);
+bool32 TestExtractAllImagesMemoryBudgeted(void);
 
+void ExtractAllImages(ExtractSettings settings, u32 nWriterThreads);
 void GenerateExtractAllImagesOutputPath(const char* inputPath, char* outputPath);
+void WatchExtractedImages(u32 debounceMilliseconds);
+bool32 RunRegressionSuite(bool32 updateManifest, double slowdownThreshold);
+bool32 ExtractShard(u32 shard, u32 nShards);
+bool32 MergeExtractedShards(u32 nShards);
 
 #endif
@@ -0,0 +1,236 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  thread.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include "util.h"
+#include "thread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/* Both platforms want a differently shaped entry point, so threads are
+ * started through a trampoline that calls the real function. */
+typedef struct
+{
+	ThreadFunction function;
+	void* arg;
+} ThreadStart;
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadTrampoline(LPVOID param)
+#else
+static void* ThreadTrampoline(void* param)
+#endif
+{
+	ThreadStart start = { 0 };
+
+	start = *(ThreadStart*)param;
+	free(param);
+	start.function(start.arg);
+	return 0;
+}
+
+bool32 StartThread(Thread* thread, ThreadFunction function, void* arg)
+{
+	ThreadStart* start = NULL;
+
+	start = malloc(sizeof(ThreadStart));
+	if (!start)
+	{
+		return FALSE;
+	}
+	start->function = function;
+	start->arg = arg;
+
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, ThreadTrampoline, start, 0, NULL);
+	if (!*thread)
+	{
+		free(start);
+		return FALSE;
+	}
+#else
+	if (pthread_create(thread, NULL, ThreadTrampoline, start) != 0)
+	{
+		free(start);
+		return FALSE;
+	}
+#endif
+	return TRUE;
+}
+
+void JoinThread(Thread thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+u32 GetNumProcessors(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO systemInfo = { 0 };
+
+	GetSystemInfo(&systemInfo);
+	return systemInfo.dwNumberOfProcessors;
+#else
+	long nProcessors = 0;
+
+	nProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+	return nProcessors > 0 ? (u32)nProcessors : 1;
+#endif
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK OnceTrampoline(PINIT_ONCE flag, PVOID param, PVOID* context)
+{
+	(void)flag;
+	(void)context;
+	((OnceFunction)param)();
+	return TRUE;
+}
+#endif
+
+/* Calls function the first time this is called with flag, no matter how many threads
+ * get here at once. Every caller returns only after function has finished. */
+void RunOnce(OnceFlag* flag, OnceFunction function)
+{
+#ifdef _WIN32
+	InitOnceExecuteOnce(flag, OnceTrampoline, (PVOID)function, NULL);
+#else
+	pthread_once(flag, function);
+#endif
+}
+
+/* A value every thread has its own copy of, starting out as NULL. When a thread exits
+ * with a value that isn't NULL, onThreadExit is called with it on that thread. */
+bool32 CreateThreadLocal(ThreadLocal* key, ThreadExitFunction onThreadExit)
+{
+#ifdef _WIN32
+	/* Fiber local storage, unlike thread local storage, calls back when the thread exits */
+	*key = FlsAlloc(onThreadExit);
+	return *key != FLS_OUT_OF_INDEXES;
+#else
+	return pthread_key_create(key, onThreadExit) == 0;
+#endif
+}
+
+void* GetThreadLocal(ThreadLocal key)
+{
+#ifdef _WIN32
+	return FlsGetValue(key);
+#else
+	return pthread_getspecific(key);
+#endif
+}
+
+void SetThreadLocal(ThreadLocal key, void* value)
+{
+#ifdef _WIN32
+	FlsSetValue(key, value);
+#else
+	pthread_setspecific(key, value);
+#endif
+}
+
+void InitMutex(Mutex* mutex)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void DestroyMutex(Mutex* mutex)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(mutex);
+#else
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+void LockMutex(Mutex* mutex)
+{
+#ifdef _WIN32
+	EnterCriticalSection(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+void UnlockMutex(Mutex* mutex)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+void InitCondition(Condition* condition)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(condition);
+#else
+	pthread_cond_init(condition, NULL);
+#endif
+}
+
+void DestroyCondition(Condition* condition)
+{
+#ifdef _WIN32
+	/* Win32 condition variables don't need to be destroyed */
+	(void)condition;
+#else
+	pthread_cond_destroy(condition);
+#endif
+}
+
+void WaitCondition(Condition* condition, Mutex* mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(condition, mutex, INFINITE);
+#else
+	pthread_cond_wait(condition, mutex);
+#endif
+}
+
+void SignalCondition(Condition* condition)
+{
+#ifdef _WIN32
+	WakeConditionVariable(condition);
+#else
+	pthread_cond_signal(condition);
+#endif
+}
+
+void BroadcastCondition(Condition* condition)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(condition);
+#else
+	pthread_cond_broadcast(condition);
+#endif
+}
@@ -0,0 +1,72 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  thread.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "util.h"
+
+/* Threading is platform specific, so this is a thin wrapper over
+ * the Win32 API on Windows and pthreads everywhere else. */
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Condition;
+typedef INIT_ONCE OnceFlag;
+typedef DWORD ThreadLocal;
+#define ONCE_FLAG_STATIC_INIT INIT_ONCE_STATIC_INIT
+#define THREAD_EXIT_CALLBACK WINAPI
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+typedef pthread_once_t OnceFlag;
+typedef pthread_key_t ThreadLocal;
+#define ONCE_FLAG_STATIC_INIT PTHREAD_ONCE_INIT
+#define THREAD_EXIT_CALLBACK
+#endif
+
+typedef void (*ThreadFunction)(void* arg);
+typedef void (*OnceFunction)(void);
+typedef void (THREAD_EXIT_CALLBACK *ThreadExitFunction)(void* value);
+
+bool32 StartThread(Thread* thread, ThreadFunction function, void* arg);
+void JoinThread(Thread thread);
+u32 GetNumProcessors(void);
+void RunOnce(OnceFlag* flag, OnceFunction function);
+
+bool32 CreateThreadLocal(ThreadLocal* key, ThreadExitFunction onThreadExit);
+void* GetThreadLocal(ThreadLocal key);
+void SetThreadLocal(ThreadLocal key, void* value);
+
+void InitMutex(Mutex* mutex);
+void DestroyMutex(Mutex* mutex);
+void LockMutex(Mutex* mutex);
+void UnlockMutex(Mutex* mutex);
+
+void InitCondition(Condition* condition);
+void DestroyCondition(Condition* condition);
+void WaitCondition(Condition* condition, Mutex* mutex);
+void SignalCondition(Condition* condition);
+void BroadcastCondition(Condition* condition);
+
+#endif
@@ -0,0 +1,174 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  thumbnail.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "image.h"
+#include "palette.h"
+#include "sink.h"
+#include "thumbnail.h"
+#include "alloc.h"
+
+/* Box filters the image down so that neither side is bigger than maxSize. thumbnail gets
+ * thumbnailWidth * thumbnailHeight RGBA u32s, and on success must be freed by the caller. */
+bool32 MakeThumbnail(DecodedImage decodedImage, u32 maxSize, Memory* thumbnail, u32* thumbnailWidth, u32* thumbnailHeight)
+{
+	Memory ret = { 0 };
+	u32* sourceRow = NULL;
+	u32* columnStarts = NULL;
+	u64* sums = NULL;
+	u32* dst = NULL;
+	u32 rowSize = 0;
+	u32 width = 0;
+	u32 height = 0;
+	u32 firstRow = 0;
+	u32 endRow = 0;
+	u32 color = 0;
+	u32 alpha = 0;
+	u64 nPixels = 0;
+	u32 x = 0;
+	u32 y = 0;
+	u32 tx = 0;
+	u32 ty = 0;
+	u32 channel = 0;
+
+	if (decodedImage.width == 0 || decodedImage.height == 0 || maxSize == 0)
+	{
+		return FALSE;
+	}
+
+	/* Fit the longer side to maxSize, but don't scale up */
+	width = decodedImage.width;
+	height = decodedImage.height;
+	if (width > maxSize || height > maxSize)
+	{
+		if (width >= height)
+		{
+			height = (u32)((u64)height * maxSize / width);
+			width = maxSize;
+		}
+		else
+		{
+			width = (u32)((u64)width * maxSize / height);
+			height = maxSize;
+		}
+		width = width ? width : 1;
+		height = height ? height : 1;
+	}
+
+	rowSize = decodedImage.bitsPerPixel == 4 ? decodedImage.width / 2 : decodedImage.width;
+	ret.size = width * height * 4;
+	ret.data = malloc(ret.size);
+	sourceRow = malloc(decodedImage.width * sizeof(u32));
+	columnStarts = malloc((width + 1) * sizeof(u32));
+	sums = malloc(width * 4 * sizeof(u64));
+	if (!ret.data || !sourceRow || !columnStarts || !sums)
+	{
+		free(ret.data);
+		free(sourceRow);
+		free(columnStarts);
+		free(sums);
+		return FALSE;
+	}
+	for (tx = 0; tx <= width; ++tx)
+	{
+		columnStarts[tx] = (u32)((u64)tx * decodedImage.width / width);
+	}
+
+	dst = (u32*)ret.data;
+	for (ty = 0; ty < height; ++ty)
+	{
+		firstRow = (u32)((u64)ty * decodedImage.height / height);
+		endRow = (u32)((u64)(ty + 1) * decodedImage.height / height);
+		memset(sums, 0, width * 4 * sizeof(u64));
+		for (y = firstRow; y < endRow; ++y)
+		{
+			ExpandPaletteIndices(&decodedImage.pixels.data[y * rowSize], rowSize, decodedImage.palette, sourceRow);
+
+			/* Color is weighted by alpha so that transparent pixels don't darken the edges of sprites */
+			for (tx = 0; tx < width; ++tx)
+			{
+				for (x = columnStarts[tx]; x < columnStarts[tx + 1]; ++x)
+				{
+					color = sourceRow[x];
+					alpha = color >> 24;
+					sums[tx * 4] += (color & 0xFF) * alpha;
+					sums[tx * 4 + 1] += ((color >> 8) & 0xFF) * alpha;
+					sums[tx * 4 + 2] += ((color >> 16) & 0xFF) * alpha;
+					sums[tx * 4 + 3] += alpha;
+				}
+			}
+		}
+		for (tx = 0; tx < width; ++tx)
+		{
+			nPixels = (u64)(endRow - firstRow) * (columnStarts[tx + 1] - columnStarts[tx]);
+			color = 0;
+			if (sums[tx * 4 + 3] != 0)
+			{
+				for (channel = 0; channel < 3; ++channel)
+				{
+					color |= (u32)(sums[tx * 4 + channel] / sums[tx * 4 + 3]) << (channel * 8);
+				}
+				color |= (u32)(sums[tx * 4 + 3] / nPixels) << 24;
+			}
+			dst[ty * width + tx] = color;
+		}
+	}
+
+	free(sourceRow);
+	free(columnStarts);
+	free(sums);
+	*thumbnail = ret;
+	*thumbnailWidth = width;
+	*thumbnailHeight = height;
+	return TRUE;
+}
+
+/* Writes a PNG thumbnail no bigger than output.thumbnailSize to outputPath, or into the sink if there is one. */
+bool32 WriteThumbnail(DecodedImage decodedImage, const char* outputPath, OutputSettings output)
+{
+	Memory thumbnail = { 0 };
+	Memory encodedImage = { 0 };
+	u32 width = 0;
+	u32 height = 0;
+	bool32 success = FALSE;
+
+	if (!MakeThumbnail(decodedImage, output.thumbnailSize, &thumbnail, &width, &height))
+	{
+		return FALSE;
+	}
+	success = EncodeRGBAImagePNG((u32*)thumbnail.data, width, height, output.encodeProfile, &encodedImage);
+	free(thumbnail.data);
+	if (!success)
+	{
+		return FALSE;
+	}
+	if (output.sink)
+	{
+		success = WriteToOutputSink(output.sink, outputPath, encodedImage);
+	}
+	else
+	{
+		success = WriteMemoryToFile(encodedImage, outputPath);
+	}
+	TrackedFree(encodedImage.data);
+	return success;
+}
@@ -0,0 +1,34 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  thumbnail.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include "util.h"
+#include "image.h"
+
+/* Thumbnails are box filtered straight from the palette indices, one source row at a time,
+ * so no full size RGBA image is ever made. They keep the aspect ratio of the image and are
+ * never bigger than the image itself. */
+#define THUMBNAIL_DEFAULT_SIZE 128
+
+bool32 MakeThumbnail(DecodedImage decodedImage, u32 maxSize, Memory* thumbnail, u32* thumbnailWidth, u32* thumbnailHeight);
+bool32 WriteThumbnail(DecodedImage decodedImage, const char* outputPath, OutputSettings output);
+
+#endif
@@ -0,0 +1,368 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  trace.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "thread.h"
+#include "trace.h"
+
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_NO_PATH 0xFFFFFFFF
+
+typedef struct
+{
+	double time;
+	u32 pathIndex; /* Into the recording thread's paths */
+	u32 index;
+	u8 stage;
+	u8 isEnd;
+} TraceEvent;
+
+/* Events are kept in chunks that are never moved, so recording never has to copy what's already there */
+typedef struct TraceChunk
+{
+	struct TraceChunk* next;
+	u32 nEvents;
+	TraceEvent events[TRACE_CHUNK_EVENTS];
+} TraceChunk;
+
+/* Only ever touched by its own thread while tracing, and by StopTracing once it's done */
+typedef struct TraceBuffer
+{
+	struct TraceBuffer* next;
+	u32 threadId;
+	bool32 threadExited;
+	TraceChunk* firstChunk;
+	TraceChunk* lastChunk;
+	char** paths;
+	u32 nPaths;
+	u32 pathsCapacity;
+	u32 nDroppedEvents;
+} TraceBuffer;
+
+static const char* traceStageNames[NUM_TRACE_STAGES] =
+{
+	"file",
+	"load",
+	"info",
+	"decompress",
+	"untile",
+	"palette",
+	"encode",
+	"write"
+};
+
+static OnceFlag traceOnce = ONCE_FLAG_STATIC_INIT;
+static bool32 traceInitialized = FALSE;
+static ThreadLocal traceBufferKey;
+static Mutex traceMutex; /* Guards the list of buffers. Only taken when a thread records its first event or exits. */
+static TraceBuffer* traceBuffers = NULL;
+static u32 nTraceThreads = 0;
+static volatile bool32 tracing = FALSE;
+static double traceStartTime = 0.0;
+
+static void InitTracing(void);
+static void THREAD_EXIT_CALLBACK OnTraceThreadExit(void* value);
+static void RecordTraceEvent(TraceStage stage, const char* path, u32 index, bool32 isEnd);
+static TraceBuffer* GetThreadTraceBuffer(void);
+static u32 AddTracePath(TraceBuffer* buffer, const char* path);
+static void WriteTraceEvents(FILE* file, TraceBuffer* buffer, bool32* isFirstEvent);
+static void ResetTraceBuffer(TraceBuffer* buffer);
+
+static void InitTracing(void)
+{
+	InitMutex(&traceMutex);
+	traceInitialized = CreateThreadLocal(&traceBufferKey, OnTraceThreadExit);
+}
+
+/* Must be called before starting the threads that are to be traced */
+bool32 StartTracing(void)
+{
+	RunOnce(&traceOnce, InitTracing);
+	if (!traceInitialized || tracing)
+	{
+		return FALSE;
+	}
+	traceStartTime = GetTimeInSeconds();
+	tracing = TRUE;
+	return TRUE;
+}
+
+/* path is usually the file being worked on. If it's NULL, the event is shown
+ * without one, nested inside whichever event on the same thread began before it. */
+void BeginTraceEvent(TraceStage stage, const char* path, u32 index)
+{
+	if (tracing)
+	{
+		RecordTraceEvent(stage, path, index, FALSE);
+	}
+}
+
+void EndTraceEvent(TraceStage stage)
+{
+	if (tracing)
+	{
+		RecordTraceEvent(stage, NULL, TRACE_NO_INDEX, TRUE);
+	}
+}
+
+static void RecordTraceEvent(TraceStage stage, const char* path, u32 index, bool32 isEnd)
+{
+	TraceBuffer* buffer = NULL;
+	TraceChunk* chunk = NULL;
+	TraceEvent* event = NULL;
+
+	buffer = GetThreadTraceBuffer();
+	if (!buffer)
+	{
+		return;
+	}
+	chunk = buffer->lastChunk;
+	if (!chunk || chunk->nEvents == TRACE_CHUNK_EVENTS)
+	{
+		chunk = malloc(sizeof(TraceChunk));
+		if (!chunk)
+		{
+			++buffer->nDroppedEvents;
+			return;
+		}
+		chunk->next = NULL;
+		chunk->nEvents = 0;
+		if (buffer->lastChunk)
+		{
+			buffer->lastChunk->next = chunk;
+		}
+		else
+		{
+			buffer->firstChunk = chunk;
+		}
+		buffer->lastChunk = chunk;
+	}
+	event = &chunk->events[chunk->nEvents];
+	event->time = GetTimeInSeconds();
+	event->pathIndex = path ? AddTracePath(buffer, path) : TRACE_NO_PATH;
+	event->index = index;
+	event->stage = (u8)stage;
+	event->isEnd = (u8)isEnd;
+	++chunk->nEvents;
+}
+
+static TraceBuffer* GetThreadTraceBuffer(void)
+{
+	TraceBuffer* buffer = NULL;
+
+	buffer = GetThreadLocal(traceBufferKey);
+	if (buffer)
+	{
+		return buffer;
+	}
+	buffer = calloc(1, sizeof(TraceBuffer));
+	if (!buffer)
+	{
+		return NULL;
+	}
+	LockMutex(&traceMutex);
+	buffer->threadId = ++nTraceThreads;
+	buffer->next = traceBuffers;
+	traceBuffers = buffer;
+	UnlockMutex(&traceMutex);
+	SetThreadLocal(traceBufferKey, buffer);
+	return buffer;
+}
+
+/* A thread usually records several events in a row for the same file, so a path is only
+ * copied again when it's different from the last one. */
+static u32 AddTracePath(TraceBuffer* buffer, const char* path)
+{
+	char** paths = NULL;
+	char* pathCopy = NULL;
+	u32 newCapacity = 0;
+
+	if (buffer->nPaths > 0 && strcmp(buffer->paths[buffer->nPaths - 1], path) == 0)
+	{
+		return buffer->nPaths - 1;
+	}
+	if (buffer->nPaths == buffer->pathsCapacity)
+	{
+		newCapacity = buffer->pathsCapacity ? buffer->pathsCapacity * 2 : 64;
+		paths = realloc(buffer->paths, sizeof(char*) * newCapacity);
+		if (!paths)
+		{
+			return TRACE_NO_PATH;
+		}
+		buffer->paths = paths;
+		buffer->pathsCapacity = newCapacity;
+	}
+	pathCopy = malloc(strlen(path) + 1);
+	if (!pathCopy)
+	{
+		return TRACE_NO_PATH;
+	}
+	strcpy(pathCopy, path);
+	buffer->paths[buffer->nPaths] = pathCopy;
+	return buffer->nPaths++;
+}
+
+/* A buffer with events still has to be written out, so it's only marked here and freed by StopTracing */
+static void THREAD_EXIT_CALLBACK OnTraceThreadExit(void* value)
+{
+	TraceBuffer* buffer = NULL;
+	TraceBuffer** link = NULL;
+
+	buffer = value;
+	if (!buffer)
+	{
+		return;
+	}
+	LockMutex(&traceMutex);
+	if (buffer->firstChunk)
+	{
+		buffer->threadExited = TRUE;
+		UnlockMutex(&traceMutex);
+		return;
+	}
+	for (link = &traceBuffers; *link != buffer; link = &(*link)->next);
+	*link = buffer->next;
+	UnlockMutex(&traceMutex);
+	free(buffer);
+}
+
+/* Writes out every event recorded since StartTracing and clears them. Every traced thread
+ * must have finished its work, since their buffers are read without being locked. */
+bool32 StopTracing(const char* outputPath)
+{
+	FILE* outputFile = NULL;
+	TraceBuffer* buffer = NULL;
+	TraceBuffer** link = NULL;
+	bool32 isFirstEvent = TRUE;
+	u32 nDroppedEvents = 0;
+
+	if (!tracing)
+	{
+		return FALSE;
+	}
+	tracing = FALSE;
+
+	outputFile = fopen(outputPath, "wb");
+	if (!outputFile)
+	{
+		FOPEN_FAIL_MESSAGE(outputPath);
+	}
+	LockMutex(&traceMutex);
+	if (outputFile)
+	{
+		fprintf(outputFile, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+		for (buffer = traceBuffers; buffer; buffer = buffer->next)
+		{
+			WriteTraceEvents(outputFile, buffer, &isFirstEvent);
+			nDroppedEvents += buffer->nDroppedEvents;
+		}
+		fprintf(outputFile, "\n]}\n");
+		fclose(outputFile);
+	}
+
+	/* Threads that are still running keep their buffers for the next time tracing is started */
+	link = &traceBuffers;
+	while (*link)
+	{
+		buffer = *link;
+		ResetTraceBuffer(buffer);
+		if (buffer->threadExited)
+		{
+			*link = buffer->next;
+			free(buffer);
+		}
+		else
+		{
+			link = &buffer->next;
+		}
+	}
+	UnlockMutex(&traceMutex);
+
+	if (nDroppedEvents > 0)
+	{
+		printf("Ran out of memory for %u trace events\n", nDroppedEvents);
+	}
+	return outputFile != NULL;
+}
+
+static void WriteTraceEvents(FILE* file, TraceBuffer* buffer, bool32* isFirstEvent)
+{
+	TraceChunk* chunk = NULL;
+	TraceEvent* event = NULL;
+	u32 i = 0;
+
+	if (!buffer->firstChunk)
+	{
+		return;
+	}
+	fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"Thread %u\"}}",
+		*isFirstEvent ? "" : ",", buffer->threadId, buffer->threadId);
+	*isFirstEvent = FALSE;
+	for (chunk = buffer->firstChunk; chunk; chunk = chunk->next)
+	{
+		for (i = 0; i < chunk->nEvents; ++i)
+		{
+			event = &chunk->events[i];
+			fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u",
+				traceStageNames[event->stage], event->isEnd ? 'E' : 'B', (event->time - traceStartTime) * 1000000.0, buffer->threadId);
+			if (event->pathIndex != TRACE_NO_PATH || event->index != TRACE_NO_INDEX)
+			{
+				fprintf(file, ", \"args\": {");
+				if (event->pathIndex != TRACE_NO_PATH)
+				{
+					fprintf(file, "\"file\": ");
+					WriteJSONString(file, buffer->paths[event->pathIndex]);
+				}
+				if (event->index != TRACE_NO_INDEX)
+				{
+					fprintf(file, "%s\"index\": %u", event->pathIndex != TRACE_NO_PATH ? ", " : "", event->index);
+				}
+				fprintf(file, "}");
+			}
+			fprintf(file, "}");
+		}
+	}
+}
+
+static void ResetTraceBuffer(TraceBuffer* buffer)
+{
+	TraceChunk* chunk = NULL;
+	TraceChunk* next = NULL;
+	u32 i = 0;
+
+	for (chunk = buffer->firstChunk; chunk; chunk = next)
+	{
+		next = chunk->next;
+		free(chunk);
+	}
+	for (i = 0; i < buffer->nPaths; ++i)
+	{
+		free(buffer->paths[i]);
+	}
+	free(buffer->paths);
+	buffer->firstChunk = NULL;
+	buffer->lastChunk = NULL;
+	buffer->paths = NULL;
+	buffer->nPaths = 0;
+	buffer->pathsCapacity = 0;
+	buffer->nDroppedEvents = 0;
+}
@@ -0,0 +1,50 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  trace.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "util.h"
+
+/* Records when each stage of extraction begins and ends on each thread, and writes it out as
+ * Chrome trace event JSON that chrome://tracing and Perfetto can open. Every thread records into
+ * its own buffer without taking a lock, so tracing barely changes the timings it measures.
+ * While tracing is stopped, recording an event is a single check. */
+
+#define TRACE_NO_INDEX 0xFFFFFFFF
+
+typedef enum
+{
+	TRACE_STAGE_FILE,       /* Everything done with one input file */
+	TRACE_STAGE_LOAD,
+	TRACE_STAGE_INFO,       /* Finding the palettes and image headers */
+	TRACE_STAGE_DECOMPRESS, /* One subfile, given by the index */
+	TRACE_STAGE_UNTILE,
+	TRACE_STAGE_PALETTE,
+	TRACE_STAGE_ENCODE,
+	TRACE_STAGE_WRITE,
+	NUM_TRACE_STAGES
+} TraceStage;
+
+bool32 StartTracing(void);
+void BeginTraceEvent(TraceStage stage, const char* path, u32 index);
+void EndTraceEvent(TraceStage stage);
+bool32 StopTracing(const char* outputPath);
+
+#endif
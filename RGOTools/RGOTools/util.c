@@ -20,12 +20,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "util.h"
 
 /* Getting a list of files in a directory is platform specific :( */
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(ARCH_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
 #endif
 
 #define PSP_IMAGES_DIRECTORY "TestFiles/PSPImages/BIN/"
@@ -80,6 +89,79 @@ Memory LoadFile(const char* filePath)
 	return ret;
 }
 
+bool32 WriteMemoryToFile(Memory memory, const char* filePath)
+{
+	FILE* file = NULL;
+	bool32 success = FALSE;
+
+	file = fopen(filePath, "wb");
+	if (!file)
+	{
+		return FALSE;
+	}
+	success = fwrite(memory.data, 1, memory.size, file) == memory.size;
+	if (fclose(file) != 0)
+	{
+		success = FALSE;
+	}
+	return success;
+}
+
+bool32 GetFileStamp(const char* filePath, FileStamp* stamp)
+{
+	struct stat status = { 0 };
+
+	if (stat(filePath, &status) != 0)
+	{
+		return FALSE;
+	}
+	stamp->size = (u64)status.st_size;
+#if defined(__linux__)
+	stamp->modifiedTime = (u64)status.st_mtim.tv_sec * 1000000000 + (u64)status.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+	stamp->modifiedTime = (u64)status.st_mtimespec.tv_sec * 1000000000 + (u64)status.st_mtimespec.tv_nsec;
+#else
+	stamp->modifiedTime = (u64)status.st_mtime;
+#endif
+	return TRUE;
+}
+
+/* Returns a copy of string that the caller must free, or NULL if out of memory */
+char* CopyString(const char* string)
+{
+	char* ret = NULL;
+
+	ret = malloc(strlen(string) + 1);
+	if (ret)
+	{
+		strcpy(ret, string);
+	}
+	return ret;
+}
+
+/* Writes string in quotes, escaping quotes, backslashes (Windows paths are full of them) and control characters */
+void WriteJSONString(FILE* file, const char* string)
+{
+	fputc('"', file);
+	for (; *string; ++string)
+	{
+		if (*string == '"' || *string == '\\')
+		{
+			fputc('\\', file);
+			fputc(*string, file);
+		}
+		else if ((u8)*string < 0x20)
+		{
+			fprintf(file, "\\u%04x", (u8)*string);
+		}
+		else
+		{
+			fputc(*string, file);
+		}
+	}
+	fputc('"', file);
+}
+
 FilePathList InitFilePathList(Memory fileList)
 {
 	FilePathList ret = { 0 };
@@ -138,6 +220,59 @@ u32 LittleEndianRead16(const u8* data)
 	return data[0] + (data[1] << 8);
 }
 
+void LittleEndianWrite32(u8* data, u32 value)
+{
+	data[0] = value & 0xFF;
+	data[1] = (value >> 8) & 0xFF;
+	data[2] = (value >> 16) & 0xFF;
+	data[3] = (value >> 24) & 0xFF;
+}
+
+/* Monotonic time, only meaningful when comparing two results against each other. */
+double GetTimeInSeconds(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency = { 0 };
+	LARGE_INTEGER counter = { 0 };
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec now = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+#endif
+}
+
+CPUFeatures GetCPUFeatures(void)
+{
+	CPUFeatures ret = { 0 };
+#if defined(ARCH_X86) && defined(_MSC_VER)
+	int cpuInfo[4] = { 0 };
+	bool32 osSavesAVX = FALSE;
+
+	__cpuid(cpuInfo, 1);
+	ret.hasSSE2 = (cpuInfo[3] & (1 << 26)) != 0;
+	ret.hasSSSE3 = (cpuInfo[2] & (1 << 9)) != 0;
+
+	/* AVX registers are only usable if the OS saves them on context switches */
+	if ((cpuInfo[2] & (1 << 27)) && (cpuInfo[2] & (1 << 28)))
+	{
+		osSavesAVX = (_xgetbv(0) & 0x6) == 0x6;
+	}
+	__cpuidex(cpuInfo, 7, 0);
+	ret.hasAVX2 = osSavesAVX && (cpuInfo[1] & (1 << 5)) != 0;
+#elif defined(ARCH_X86)
+	__builtin_cpu_init();
+	ret.hasSSE2 = __builtin_cpu_supports("sse2");
+	ret.hasSSSE3 = __builtin_cpu_supports("ssse3");
+	ret.hasAVX2 = __builtin_cpu_supports("avx2");
+#endif
+	return ret;
+}
+
 void GeneratePSPImageFileList(void)
 {
 	const u32 excludedImages[] =
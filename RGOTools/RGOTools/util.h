@@ -20,6 +20,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdio.h>
+
 #define PSP_IMAGES_FILE_LIST "TestFiles/PSPImages/filelist.txt"
 #define PS2_IMAGES_FILE_LIST "TestFiles/PS2Images/filelist.txt"
 
@@ -32,6 +34,22 @@
 
 #define CHECKSUM_LENGTH 16
 
+/* SIMD code paths are only compiled for x86, and are chosen at runtime with GetCPUFeatures. */
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ARCH_X86
+#endif
+
+/* GCC and Clang need to be told which instructions a function may use. MSVC doesn't. */
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
 typedef enum
 {
 	PLATFORM_PS2,
@@ -40,6 +58,7 @@ typedef enum
 
 typedef unsigned char u8;
 typedef unsigned int u32;
+typedef unsigned long long u64;
 typedef unsigned int bool32;
 
 typedef struct
@@ -48,6 +67,20 @@ typedef struct
 	u8* data;
 } Memory;
 
+typedef struct
+{
+	bool32 hasSSE2;
+	bool32 hasSSSE3;
+	bool32 hasAVX2;
+} CPUFeatures;
+
+/* Enough to tell whether a file has been rewritten since it was last looked at */
+typedef struct
+{
+	u64 size;
+	u64 modifiedTime; /* In nanoseconds where the platform has them, otherwise seconds */
+} FileStamp;
+
 /* Used to process newline-separated lists of file paths */
 typedef struct
 {
@@ -57,10 +90,17 @@ typedef struct
 } FilePathList;
 
 Memory LoadFile(const char* filePath);
+bool32 WriteMemoryToFile(Memory memory, const char* filePath);
+bool32 GetFileStamp(const char* filePath, FileStamp* stamp);
+char* CopyString(const char* string);
+void WriteJSONString(FILE* file, const char* string);
 FilePathList InitFilePathList(Memory fileList);
 bool32 GetNextFilePath(FilePathList* pathList);
 u32 LittleEndianRead32(const u8* data);
 u32 LittleEndianRead16(const u8* data);
+void LittleEndianWrite32(u8* data, u32 value);
+double GetTimeInSeconds(void);
+CPUFeatures GetCPUFeatures(void);
 void GeneratePSPImageFileList(void);
 void GeneratePS2ImageFileList(void);
 
@@ -0,0 +1,404 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  watch.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "watch.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#define FILE_WATCHER_BUFFER_SIZE (64 * 1024)
+#elif defined(__linux__)
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#define FILE_WATCHER_BUFFER_SIZE (64 * 1024)
+#define FILE_WATCHER_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+#endif
+
+struct FileWatcher
+{
+	char* folder; /* Always ends with a slash */
+#ifdef _WIN32
+	HANDLE directory;
+	OVERLAPPED overlapped;
+	DWORD buffer[FILE_WATCHER_BUFFER_SIZE / sizeof(DWORD)]; /* ReadDirectoryChangesW needs it DWORD aligned */
+#elif defined(__linux__)
+	int inotify;
+	char** watchedFolders; /* Indexed by watch descriptor, each relative to folder */
+	u32 nWatchedFolders;
+	u8 buffer[FILE_WATCHER_BUFFER_SIZE];
+#endif
+};
+
+static void AddChangedFile(ChangedFiles* changedFiles, const char* folder, const char* relativeFolder, const char* name);
+static int ReadFileChanges(FileWatcher* watcher, u32 timeoutMilliseconds, ChangedFiles* changedFiles);
+#ifdef _WIN32
+static bool32 StartReadingChanges(FileWatcher* watcher);
+#elif defined(__linux__)
+static bool32 WatchFolder(FileWatcher* watcher, const char* relativeFolder);
+#endif
+
+/* Adds folder + relativeFolder + name to the batch unless it's already there. Paths always use forward slashes. */
+static void AddChangedFile(ChangedFiles* changedFiles, const char* folder, const char* relativeFolder, const char* name)
+{
+	char* path = NULL;
+	char* c = NULL;
+	u32 i = 0;
+
+	path = malloc(strlen(folder) + strlen(relativeFolder) + strlen(name) + 1);
+	if (!path)
+	{
+		return;
+	}
+	strcpy(path, folder);
+	strcat(path, relativeFolder);
+	strcat(path, name);
+	for (c = path; *c; ++c)
+	{
+		if (*c == '\\')
+		{
+			*c = '/';
+		}
+	}
+	for (i = 0; i < changedFiles->nPaths; ++i)
+	{
+		if (strcmp(changedFiles->paths[i], path) == 0)
+		{
+			free(path);
+			return;
+		}
+	}
+	if (changedFiles->nPaths == FILE_WATCHER_MAX_BATCH)
+	{
+		printf("Too many files changed at once, missed %s\n", path);
+		free(path);
+		return;
+	}
+	changedFiles->paths[changedFiles->nPaths++] = path;
+}
+
+FileWatcher* CreateFileWatcher(const char* folder)
+{
+	FileWatcher* watcher = NULL;
+	size_t folderLength = 0;
+
+	watcher = calloc(1, sizeof(FileWatcher));
+	if (!watcher)
+	{
+		return NULL;
+	}
+	folderLength = strlen(folder);
+	watcher->folder = malloc(folderLength + 2);
+	if (!watcher->folder)
+	{
+		free(watcher);
+		return NULL;
+	}
+	strcpy(watcher->folder, folder);
+	if (folderLength == 0 || (folder[folderLength - 1] != '/' && folder[folderLength - 1] != '\\'))
+	{
+		strcat(watcher->folder, "/");
+	}
+
+#ifdef _WIN32
+	watcher->directory = CreateFileA(folder, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	watcher->overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (watcher->directory == INVALID_HANDLE_VALUE || !watcher->overlapped.hEvent || !StartReadingChanges(watcher))
+	{
+		printf("Could not watch %s\n", folder);
+		DestroyFileWatcher(watcher);
+		return NULL;
+	}
+#elif defined(__linux__)
+	watcher->inotify = inotify_init();
+	if (watcher->inotify < 0 || !WatchFolder(watcher, ""))
+	{
+		printf("Could not watch %s\n", folder);
+		DestroyFileWatcher(watcher);
+		return NULL;
+	}
+#else
+	printf("Watching folders isn't supported on this platform\n");
+	free(watcher->folder);
+	free(watcher);
+	return NULL;
+#endif
+	return watcher;
+}
+
+#ifdef _WIN32
+static bool32 StartReadingChanges(FileWatcher* watcher)
+{
+	ResetEvent(watcher->overlapped.hEvent);
+	return ReadDirectoryChangesW(watcher->directory, watcher->buffer, sizeof(watcher->buffer), TRUE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &watcher->overlapped, NULL);
+}
+
+/* Returns 1 if there were changes, 0 if there were none before the timeout, and -1 on failure */
+static int ReadFileChanges(FileWatcher* watcher, u32 timeoutMilliseconds, ChangedFiles* changedFiles)
+{
+	FILE_NOTIFY_INFORMATION* notification = NULL;
+	char name[MAX_PATH * 4] = { 0 };
+	DWORD nBytes = 0;
+	int nameLength = 0;
+
+	switch (WaitForSingleObject(watcher->overlapped.hEvent, timeoutMilliseconds == FILE_WATCHER_WAIT_FOREVER ? INFINITE : timeoutMilliseconds))
+	{
+	case WAIT_OBJECT_0:
+		break;
+	case WAIT_TIMEOUT:
+		return 0;
+	default:
+		return -1;
+	}
+	if (!GetOverlappedResult(watcher->directory, &watcher->overlapped, &nBytes, FALSE))
+	{
+		return -1;
+	}
+	if (nBytes == 0)
+	{
+		printf("Too many files changed at once, some were missed\n");
+	}
+
+	notification = (FILE_NOTIFY_INFORMATION*)watcher->buffer;
+	while (nBytes != 0)
+	{
+		if (notification->Action == FILE_ACTION_ADDED || notification->Action == FILE_ACTION_MODIFIED ||
+			notification->Action == FILE_ACTION_RENAMED_NEW_NAME)
+		{
+			nameLength = WideCharToMultiByte(CP_UTF8, 0, notification->FileName, notification->FileNameLength / sizeof(WCHAR),
+				name, sizeof(name) - 1, NULL, NULL);
+			name[nameLength] = '\0';
+			AddChangedFile(changedFiles, watcher->folder, "", name);
+		}
+		if (notification->NextEntryOffset == 0)
+		{
+			break;
+		}
+		notification = (FILE_NOTIFY_INFORMATION*)((u8*)notification + notification->NextEntryOffset);
+	}
+	return StartReadingChanges(watcher) ? 1 : -1;
+}
+#elif defined(__linux__)
+/* inotify only watches one folder at a time, so every folder under the watched one needs its own watch */
+static bool32 WatchFolder(FileWatcher* watcher, const char* relativeFolder)
+{
+	char path[1024] = { 0 };
+	char childFolder[1024] = { 0 };
+	char** newWatchedFolders = NULL;
+	DIR* directory = NULL;
+	struct dirent* entry = NULL;
+	struct stat status = { 0 };
+	int watch = 0;
+
+	snprintf(path, sizeof(path), "%s%s", watcher->folder, relativeFolder);
+	watch = inotify_add_watch(watcher->inotify, path, FILE_WATCHER_EVENTS);
+	if (watch < 0)
+	{
+		return FALSE;
+	}
+	if ((u32)watch >= watcher->nWatchedFolders)
+	{
+		newWatchedFolders = realloc(watcher->watchedFolders, sizeof(char*) * (watch + 1));
+		if (!newWatchedFolders)
+		{
+			return FALSE;
+		}
+		memset(&newWatchedFolders[watcher->nWatchedFolders], 0, sizeof(char*) * (watch + 1 - watcher->nWatchedFolders));
+		watcher->watchedFolders = newWatchedFolders;
+		watcher->nWatchedFolders = watch + 1;
+	}
+	free(watcher->watchedFolders[watch]);
+	watcher->watchedFolders[watch] = malloc(strlen(relativeFolder) + 1);
+	if (!watcher->watchedFolders[watch])
+	{
+		return FALSE;
+	}
+	strcpy(watcher->watchedFolders[watch], relativeFolder);
+
+	directory = opendir(path);
+	if (!directory)
+	{
+		return FALSE;
+	}
+	while ((entry = readdir(directory)) != NULL)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+		{
+			continue;
+		}
+		snprintf(childFolder, sizeof(childFolder), "%s%s/", relativeFolder, entry->d_name);
+		snprintf(path, sizeof(path), "%s%s", watcher->folder, childFolder);
+		if (stat(path, &status) == 0 && S_ISDIR(status.st_mode))
+		{
+			WatchFolder(watcher, childFolder);
+		}
+	}
+	closedir(directory);
+	return TRUE;
+}
+
+/* Returns 1 if there were changes, 0 if there were none before the timeout, and -1 on failure */
+static int ReadFileChanges(FileWatcher* watcher, u32 timeoutMilliseconds, ChangedFiles* changedFiles)
+{
+	struct pollfd pollInfo = { 0 };
+	const struct inotify_event* event = NULL;
+	char childFolder[1024] = { 0 };
+	ssize_t nBytes = 0;
+	ssize_t offset = 0;
+	int nReady = 0;
+
+	pollInfo.fd = watcher->inotify;
+	pollInfo.events = POLLIN;
+	nReady = poll(&pollInfo, 1, timeoutMilliseconds == FILE_WATCHER_WAIT_FOREVER ? -1 : (int)timeoutMilliseconds);
+	if (nReady <= 0)
+	{
+		return nReady;
+	}
+	nBytes = read(watcher->inotify, watcher->buffer, sizeof(watcher->buffer));
+	if (nBytes <= 0)
+	{
+		return -1;
+	}
+
+	for (offset = 0; offset < nBytes; offset += sizeof(struct inotify_event) + event->len)
+	{
+		event = (const struct inotify_event*)&watcher->buffer[offset];
+		if (event->mask & IN_Q_OVERFLOW)
+		{
+			printf("Too many files changed at once, some were missed\n");
+		}
+		if (event->len == 0 || event->wd < 0 || (u32)event->wd >= watcher->nWatchedFolders || !watcher->watchedFolders[event->wd])
+		{
+			continue;
+		}
+		if (event->mask & IN_ISDIR)
+		{
+			/* A new folder needs watching too */
+			snprintf(childFolder, sizeof(childFolder), "%s%s/", watcher->watchedFolders[event->wd], event->name);
+			WatchFolder(watcher, childFolder);
+		}
+		else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+		{
+			AddChangedFile(changedFiles, watcher->folder, watcher->watchedFolders[event->wd], event->name);
+		}
+	}
+	return 1;
+}
+#else
+static int ReadFileChanges(FileWatcher* watcher, u32 timeoutMilliseconds, ChangedFiles* changedFiles)
+{
+	(void)watcher;
+	(void)timeoutMilliseconds;
+	(void)changedFiles;
+	return -1;
+}
+#endif
+
+/* Waits up to timeoutMilliseconds for a file to be written, then keeps collecting changes until
+ * debounceMilliseconds pass without any. Returns FALSE if nothing changed before the timeout.
+ * On success, changedFiles must be freed with FreeChangedFiles. */
+bool32 WaitForChangedFiles(FileWatcher* watcher, u32 timeoutMilliseconds, u32 debounceMilliseconds, ChangedFiles* changedFiles)
+{
+	double deadline = 0.0;
+	double remaining = 0.0;
+	int result = 0;
+
+	memset(changedFiles, 0, sizeof(*changedFiles));
+	deadline = GetTimeInSeconds() + timeoutMilliseconds / 1000.0;
+	while (changedFiles->nPaths == 0)
+	{
+		/* Some notifications, like new folders, don't count as changes, so keep waiting out the rest of the time */
+		if (timeoutMilliseconds == FILE_WATCHER_WAIT_FOREVER)
+		{
+			result = ReadFileChanges(watcher, FILE_WATCHER_WAIT_FOREVER, changedFiles);
+		}
+		else
+		{
+			remaining = deadline - GetTimeInSeconds();
+			if (remaining <= 0.0)
+			{
+				return FALSE;
+			}
+			result = ReadFileChanges(watcher, (u32)(remaining * 1000.0) + 1, changedFiles);
+		}
+		if (result < 0)
+		{
+			FreeChangedFiles(changedFiles);
+			return FALSE;
+		}
+	}
+	while (ReadFileChanges(watcher, debounceMilliseconds, changedFiles) > 0)
+	{
+	}
+	return TRUE;
+}
+
+void FreeChangedFiles(ChangedFiles* changedFiles)
+{
+	u32 i = 0;
+
+	for (i = 0; i < changedFiles->nPaths; ++i)
+	{
+		free(changedFiles->paths[i]);
+	}
+	changedFiles->nPaths = 0;
+}
+
+void DestroyFileWatcher(FileWatcher* watcher)
+{
+#if defined(__linux__)
+	u32 i = 0;
+#endif
+
+	if (!watcher)
+	{
+		return;
+	}
+#ifdef _WIN32
+	if (watcher->directory != INVALID_HANDLE_VALUE && watcher->directory)
+	{
+		CancelIo(watcher->directory);
+		CloseHandle(watcher->directory);
+	}
+	if (watcher->overlapped.hEvent)
+	{
+		CloseHandle(watcher->overlapped.hEvent);
+	}
+#elif defined(__linux__)
+	if (watcher->inotify >= 0)
+	{
+		close(watcher->inotify);
+	}
+	for (i = 0; i < watcher->nWatchedFolders; ++i)
+	{
+		free(watcher->watchedFolders[i]);
+	}
+	free(watcher->watchedFolders);
+#endif
+	free(watcher->folder);
+	free(watcher);
+}
@@ -0,0 +1,48 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  watch.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "util.h"
+
+#define FILE_WATCHER_MAX_BATCH 256
+#define FILE_WATCHER_WAIT_FOREVER 0xFFFFFFFF
+
+/* Watches a folder and everything under it for files being written. Change notifications are
+ * platform specific, so this is a thin wrapper over ReadDirectoryChangesW on Windows and inotify
+ * on Linux. Other platforms aren't supported.
+ *
+ * Saving a file usually produces a burst of notifications, and saving several at once a burst of
+ * bursts, so changes are collected until none have arrived for a while and then handed over as
+ * one batch with each path appearing once. */
+typedef struct FileWatcher FileWatcher;
+
+typedef struct
+{
+	u32 nPaths;
+	char* paths[FILE_WATCHER_MAX_BATCH]; /* Each is the watched folder followed by the path within it */
+} ChangedFiles;
+
+FileWatcher* CreateFileWatcher(const char* folder);
+bool32 WaitForChangedFiles(FileWatcher* watcher, u32 timeoutMilliseconds, u32 debounceMilliseconds, ChangedFiles* changedFiles);
+void FreeChangedFiles(ChangedFiles* changedFiles);
+void DestroyFileWatcher(FileWatcher* watcher);
+
+#endif
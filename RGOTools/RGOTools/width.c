@@ -0,0 +1,208 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  width.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include "util.h"
+#include "image.h"
+#include "thread.h"
+#include "width.h"
+
+#ifdef ARCH_X86
+#include <immintrin.h>
+#endif
+
+/* Only this many blocks of this many bytes are compared per offset, spread evenly over the image */
+#define WIDTH_DETECTION_SAMPLE_BLOCKS 16
+#define WIDTH_DETECTION_SAMPLE_BLOCK_SIZE 4096
+
+/* A detected width has to score at least this, and this many times better than the width the image would otherwise get */
+#define WIDTH_DETECTION_MIN_SCORE 0.01
+#define WIDTH_DETECTION_MARGIN 1.5
+
+/* A fraction of the best width that scores at least this proportion of the best score is picked instead,
+ * because every multiple of the real width also lines rows up with similar rows */
+#define WIDTH_DETECTION_HARMONIC_RATIO 0.9
+
+typedef u32 (*CountMatchingBytesFunction)(const u8* a, const u8* b, u32 nBytes);
+
+static double GetOffsetMatchScore(Memory pixels, u32 offset);
+static double GetWidthScore(Memory pixels, u32 bitsPerPixel, u32 width);
+static u32 CountMatchingBytesScalar(const u8* a, const u8* b, u32 nBytes);
+static void ChooseCountMatchingBytes(void);
+#ifdef ARCH_X86
+static u32 CountMatchingBytesSSE2(const u8* a, const u8* b, u32 nBytes);
+#endif
+
+static CountMatchingBytesFunction countMatchingBytes = CountMatchingBytesScalar;
+static OnceFlag countMatchingBytesChosen = ONCE_FLAG_STATIC_INIT;
+
+/* Guesses the width of an image from its decoded indices, without rendering anything. At the right
+ * width, each row lines up with the similar row below it, so comparing every byte with the byte one
+ * row later matches far more often than it does one byte either side of that. Returns
+ * decodedImage.width unless some other width is clearly better. */
+u32 DetectImageWidth(DecodedImage decodedImage)
+{
+	double score = 0.0;
+	double bestScore = 0.0;
+	double currentScore = 0.0;
+	u32 bestWidth = 0;
+	u32 width = 0;
+	u32 divisor = 0;
+
+	if (!decodedImage.pixels.data || (decodedImage.bitsPerPixel != 4 && decodedImage.bitsPerPixel != 8))
+	{
+		return decodedImage.width;
+	}
+
+	RunOnce(&countMatchingBytesChosen, ChooseCountMatchingBytes);
+	for (width = WIDTH_DETECTION_MIN_WIDTH; width <= WIDTH_DETECTION_MAX_WIDTH; width += WIDTH_DETECTION_WIDTH_STEP)
+	{
+		score = GetWidthScore(decodedImage.pixels, decodedImage.bitsPerPixel, width);
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestWidth = width;
+		}
+	}
+	if (!bestWidth)
+	{
+		return decodedImage.width;
+	}
+
+	for (divisor = bestWidth / WIDTH_DETECTION_MIN_WIDTH; divisor >= 2; --divisor)
+	{
+		if (bestWidth % (divisor * WIDTH_DETECTION_WIDTH_STEP) == 0 &&
+			GetWidthScore(decodedImage.pixels, decodedImage.bitsPerPixel, bestWidth / divisor) >= bestScore * WIDTH_DETECTION_HARMONIC_RATIO)
+		{
+			bestWidth /= divisor;
+			break;
+		}
+	}
+
+	currentScore = GetWidthScore(decodedImage.pixels, decodedImage.bitsPerPixel, decodedImage.width);
+	if (bestWidth != decodedImage.width && bestScore >= WIDTH_DETECTION_MIN_SCORE && bestScore > currentScore * WIDTH_DETECTION_MARGIN)
+	{
+		return bestWidth;
+	}
+	return decodedImage.width;
+}
+
+/* How much better rows line up at this width than at a byte either side of it. Large flat areas
+ * match at any offset, so only the difference says anything about the width. */
+static double GetWidthScore(Memory pixels, u32 bitsPerPixel, u32 width)
+{
+	u32 rowSize = 0;
+
+	rowSize = bitsPerPixel == 4 ? width / 2 : width;
+	if (rowSize < 2 || rowSize * 4 > pixels.size)
+	{
+		return 0.0;
+	}
+	return GetOffsetMatchScore(pixels, rowSize) -
+		(GetOffsetMatchScore(pixels, rowSize - 1) + GetOffsetMatchScore(pixels, rowSize + 1)) / 2;
+}
+
+/* The fraction of sampled bytes that equal the byte offset bytes later */
+static double GetOffsetMatchScore(Memory pixels, u32 offset)
+{
+	u32 nComparable = 0;
+	u32 blockSize = 0;
+	u32 nBlocks = 0;
+	u32 blockStart = 0;
+	u64 nMatches = 0;
+	u64 nCompared = 0;
+	u32 i = 0;
+
+	if (offset >= pixels.size)
+	{
+		return 0.0;
+	}
+	nComparable = pixels.size - offset;
+	if (nComparable <= WIDTH_DETECTION_SAMPLE_BLOCKS * WIDTH_DETECTION_SAMPLE_BLOCK_SIZE)
+	{
+		blockSize = nComparable;
+		nBlocks = 1;
+	}
+	else
+	{
+		blockSize = WIDTH_DETECTION_SAMPLE_BLOCK_SIZE;
+		nBlocks = WIDTH_DETECTION_SAMPLE_BLOCKS;
+	}
+	for (i = 0; i < nBlocks; ++i)
+	{
+		if (nBlocks > 1)
+		{
+			blockStart = (u32)((u64)i * (nComparable - blockSize) / (nBlocks - 1));
+		}
+		nMatches += countMatchingBytes(&pixels.data[blockStart], &pixels.data[blockStart + offset], blockSize);
+		nCompared += blockSize;
+	}
+	return (double)nMatches / (double)nCompared;
+}
+
+/* Extraction threads may detect widths at the same time, so the kernel is chosen under RunOnce */
+static void ChooseCountMatchingBytes(void)
+{
+#ifdef ARCH_X86
+	if (GetCPUFeatures().hasSSE2)
+	{
+		countMatchingBytes = CountMatchingBytesSSE2;
+	}
+#endif
+}
+
+static u32 CountMatchingBytesScalar(const u8* a, const u8* b, u32 nBytes)
+{
+	u32 ret = 0;
+	u32 i = 0;
+
+	for (i = 0; i < nBytes; ++i)
+	{
+		ret += a[i] == b[i];
+	}
+	return ret;
+}
+
+#ifdef ARCH_X86
+/* Each matching byte compares to 0xFF, so subtracting the comparison counts matches per lane.
+ * The lanes are summed with psadbw before any of them can overflow. */
+TARGET_SSE2 static u32 CountMatchingBytesSSE2(const u8* a, const u8* b, u32 nBytes)
+{
+	__m128i zero = { 0 };
+	__m128i laneCounts = { 0 };
+	__m128i totals = { 0 };
+	u32 ret = 0;
+	u32 i = 0;
+	u32 j = 0;
+
+	zero = _mm_setzero_si128();
+	totals = _mm_setzero_si128();
+	while (i + 16 <= nBytes)
+	{
+		laneCounts = _mm_setzero_si128();
+		for (j = 0; j < 255 && i + 16 <= nBytes; ++j, i += 16)
+		{
+			laneCounts = _mm_sub_epi8(laneCounts, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&a[i]), _mm_loadu_si128((const __m128i*)&b[i])));
+		}
+		totals = _mm_add_epi64(totals, _mm_sad_epu8(laneCounts, zero));
+	}
+	ret = (u32)_mm_cvtsi128_si32(totals) + (u32)_mm_cvtsi128_si32(_mm_srli_si128(totals, 8));
+	return ret + CountMatchingBytesScalar(&a[i], &b[i], nBytes - i);
+}
+#endif
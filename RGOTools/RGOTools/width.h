@@ -0,0 +1,37 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  width.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef WIDTH_H
+#define WIDTH_H
+
+#include "util.h"
+#include "image.h"
+
+/* Width detection is a fallback for images nobody has listed yet. The custom width lists stay the
+ * authority on widths, so extraction only detects widths when ExtractSettings.detectWidths is set,
+ * and TestDetectImageWidths fails if detection disagrees with any listed width. */
+
+/* Candidate widths for DetectImageWidth. Every known non-standard width is a multiple of 16. */
+#define WIDTH_DETECTION_MIN_WIDTH 16
+#define WIDTH_DETECTION_MAX_WIDTH 2048
+#define WIDTH_DETECTION_WIDTH_STEP 16
+
+u32 DetectImageWidth(DecodedImage decodedImage);
+
+#endif
@@ -0,0 +1,259 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  writer.c
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "image.h"
+#include "thread.h"
+#include "writer.h"
+#include "alloc.h"
+#include "budget.h"
+
+/* The palettes may point into the loaded file, which is freed as soon as the
+ * decoding thread moves on to the next file, so every job keeps its own copies. */
+typedef struct
+{
+	DecodedImage decodedImage;
+	u32 paletteData[256];
+	u32 sourcePaletteData[256];
+	char* outputPath;
+	OutputSettings output;
+	MemoryBudget* memoryBudget;
+	u64 reservedBytes;
+} WriteJob;
+
+/* A bounded queue between the decoding thread and the writer threads. When the queue
+ * is full, SubmitImageWrite blocks so that decoding can't run away from slow storage. */
+struct ImageWriter
+{
+	Mutex mutex;
+	Condition queueNotEmpty;
+	Condition queueNotFull;
+	WriteJob* queue;
+	u32 queueCapacity;
+	u32 queueStart;
+	u32 queueCount;
+	bool32 shuttingDown;
+
+	Thread* threads;
+	u32 nThreads;
+
+	ImageWriterStats stats;
+};
+
+static void WriterThread(void* arg);
+
+ImageWriter* CreateImageWriter(u32 nThreads, u32 queueCapacity)
+{
+	ImageWriter* writer = NULL;
+	u32 i = 0;
+
+	if (nThreads == 0)
+	{
+		nThreads = 1;
+	}
+	if (queueCapacity == 0)
+	{
+		queueCapacity = IMAGE_WRITER_DEFAULT_QUEUE_CAPACITY;
+	}
+
+	writer = calloc(1, sizeof(ImageWriter));
+	if (!writer)
+	{
+		return NULL;
+	}
+	writer->queue = calloc(queueCapacity, sizeof(WriteJob));
+	writer->threads = calloc(nThreads, sizeof(Thread));
+	if (!writer->queue || !writer->threads)
+	{
+		free(writer->queue);
+		free(writer->threads);
+		free(writer);
+		return NULL;
+	}
+	writer->queueCapacity = queueCapacity;
+	InitMutex(&writer->mutex);
+	InitCondition(&writer->queueNotEmpty);
+	InitCondition(&writer->queueNotFull);
+
+	for (i = 0; i < nThreads; ++i)
+	{
+		if (!StartThread(&writer->threads[i], WriterThread, writer))
+		{
+			break;
+		}
+		++writer->nThreads;
+	}
+	if (writer->nThreads == 0)
+	{
+		DestroyCondition(&writer->queueNotFull);
+		DestroyCondition(&writer->queueNotEmpty);
+		DestroyMutex(&writer->mutex);
+		free(writer->queue);
+		free(writer->threads);
+		free(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+/* Queues a decoded image to be written out as output says. The writer takes ownership of decodedImage.pixels
+ * and releases reservedBytes from memoryBudget once it's done, whether or not this succeeds.
+ * memoryBudget may be NULL. */
+bool32 SubmitImageWrite(ImageWriter* writer, DecodedImage decodedImage, const char* outputPath, OutputSettings output, MemoryBudget* memoryBudget, u64 reservedBytes)
+{
+	WriteJob* job = NULL;
+	char* outputPathCopy = NULL;
+	double waitStart = 0.0;
+
+	outputPathCopy = malloc(strlen(outputPath) + 1);
+	if (!outputPathCopy)
+	{
+		TrackedFree(decodedImage.pixels.data);
+		ReleaseMemory(memoryBudget, reservedBytes);
+		return FALSE;
+	}
+	strcpy(outputPathCopy, outputPath);
+
+	LockMutex(&writer->mutex);
+	if (writer->queueCount == writer->queueCapacity)
+	{
+		waitStart = GetTimeInSeconds();
+		while (writer->queueCount == writer->queueCapacity)
+		{
+			WaitCondition(&writer->queueNotFull, &writer->mutex);
+		}
+		writer->stats.decodeWaitSeconds += GetTimeInSeconds() - waitStart;
+	}
+
+	job = &writer->queue[(writer->queueStart + writer->queueCount) % writer->queueCapacity];
+	job->decodedImage = decodedImage;
+	memcpy(job->paletteData, decodedImage.palette.data, decodedImage.palette.nColors * 4);
+	memcpy(job->sourcePaletteData, decodedImage.sourcePalette.data, decodedImage.sourcePalette.nColors * 4);
+	job->decodedImage.palette.data = (u8*)job->paletteData;
+	job->decodedImage.sourcePalette.data = (u8*)job->sourcePaletteData;
+	job->outputPath = outputPathCopy;
+	job->output = output;
+	job->memoryBudget = memoryBudget;
+	job->reservedBytes = reservedBytes;
+
+	++writer->queueCount;
+	if (writer->queueCount > writer->stats.maxQueueDepth)
+	{
+		writer->stats.maxQueueDepth = writer->queueCount;
+	}
+	SignalCondition(&writer->queueNotEmpty);
+	UnlockMutex(&writer->mutex);
+	return TRUE;
+}
+
+static void WriterThread(void* arg)
+{
+	ImageWriter* writer = NULL;
+	WriteJob job = { 0 };
+	double waitStart = 0.0;
+	double busyStart = 0.0;
+	bool32 success = FALSE;
+
+	writer = arg;
+	while (1)
+	{
+		LockMutex(&writer->mutex);
+		waitStart = GetTimeInSeconds();
+		while (writer->queueCount == 0 && !writer->shuttingDown)
+		{
+			WaitCondition(&writer->queueNotEmpty, &writer->mutex);
+		}
+		writer->stats.writerWaitSeconds += GetTimeInSeconds() - waitStart;
+		if (writer->queueCount == 0)
+		{
+			/* Shutting down and there's nothing left to write */
+			UnlockMutex(&writer->mutex);
+			return;
+		}
+
+		job = writer->queue[writer->queueStart];
+		job.decodedImage.palette.data = (u8*)job.paletteData; /* Point at this copy, not the queue slot */
+		job.decodedImage.sourcePalette.data = (u8*)job.sourcePaletteData;
+		writer->queueStart = (writer->queueStart + 1) % writer->queueCapacity;
+		--writer->queueCount;
+		SignalCondition(&writer->queueNotFull);
+		UnlockMutex(&writer->mutex);
+
+		busyStart = GetTimeInSeconds();
+		SetTrackedImage(job.outputPath);
+		success = WriteDecodedImage(job.decodedImage, job.outputPath, job.output);
+		if (!success)
+		{
+			printf("Failed to write %s\n", job.outputPath);
+		}
+		TrackedFree(job.decodedImage.pixels.data);
+		SetTrackedImage(NULL);
+		free(job.outputPath);
+		ReleaseMemory(job.memoryBudget, job.reservedBytes);
+
+		LockMutex(&writer->mutex);
+		writer->stats.writerBusySeconds += GetTimeInSeconds() - busyStart;
+		if (success)
+		{
+			++writer->stats.nImagesWritten;
+		}
+		else
+		{
+			++writer->stats.nImagesFailed;
+		}
+		UnlockMutex(&writer->mutex);
+	}
+}
+
+/* Waits for every queued image to be written, then stops the writer threads. */
+ImageWriterStats DestroyImageWriter(ImageWriter* writer)
+{
+	ImageWriterStats ret = { 0 };
+	u32 i = 0;
+
+	LockMutex(&writer->mutex);
+	writer->shuttingDown = TRUE;
+	BroadcastCondition(&writer->queueNotEmpty);
+	UnlockMutex(&writer->mutex);
+
+	for (i = 0; i < writer->nThreads; ++i)
+	{
+		JoinThread(writer->threads[i]);
+	}
+	ret = writer->stats;
+
+	DestroyCondition(&writer->queueNotFull);
+	DestroyCondition(&writer->queueNotEmpty);
+	DestroyMutex(&writer->mutex);
+	free(writer->queue);
+	free(writer->threads);
+	free(writer);
+	return ret;
+}
+
+void PrintImageWriterStats(ImageWriterStats stats)
+{
+	printf("Images written: %u. Failed: %u. Max queue depth: %u\n", stats.nImagesWritten, stats.nImagesFailed, stats.maxQueueDepth);
+	printf("Decoder waiting on full queue: %.3fs\n", stats.decodeWaitSeconds);
+	printf("Writers waiting on empty queue: %.3fs\n", stats.writerWaitSeconds);
+	printf("Writers encoding and writing: %.3fs\n", stats.writerBusySeconds);
+}
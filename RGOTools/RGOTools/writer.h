@@ -0,0 +1,47 @@
+/*  RGO Patching Tools Version 1.0.0
+ *  writer.h
+ *  Copyright (C) 2022 TimepieceMaster
+ *
+ *  This file is part of the RGO Patching Tools.
+ *
+ *  The RGO Patching Tools is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The RGO Patching Tools is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with the RGO Patching Tools. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "util.h"
+#include "image.h"
+
+#define IMAGE_WRITER_DEFAULT_QUEUE_CAPACITY 16
+
+/* Where the time went in each stage of the pipeline. Wait times are summed
+ * over every thread in that stage, so they can exceed the wall clock time. */
+typedef struct
+{
+	u32 nImagesWritten;
+	u32 nImagesFailed;
+	u32 maxQueueDepth;
+	double decodeWaitSeconds;  /* Time the decoding thread spent blocked on a full queue */
+	double writerWaitSeconds;  /* Time the writer threads spent idle on an empty queue */
+	double writerBusySeconds;  /* Time the writer threads spent encoding and writing */
+} ImageWriterStats;
+
+typedef struct ImageWriter ImageWriter;
+
+ImageWriter* CreateImageWriter(u32 nThreads, u32 queueCapacity);
+bool32 SubmitImageWrite(ImageWriter* writer, DecodedImage decodedImage, const char* outputPath, OutputSettings output, struct MemoryBudget* memoryBudget, u64 reservedBytes);
+ImageWriterStats DestroyImageWriter(ImageWriter* writer);
+void PrintImageWriterStats(ImageWriterStats stats);
+
+#endif